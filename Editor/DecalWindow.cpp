@@ -40,7 +40,7 @@ void DecalWindow::Create(EditorComponent* editor)
 		NameComponent* name = wiScene::GetScene().names.GetComponent(entity);
 		if (name != nullptr)
 		{
-			*name = args.sValue;
+			name->SetName(args.sValue);
 
 			editor->RefreshSceneGraphView();
 		}
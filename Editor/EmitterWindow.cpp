@@ -25,7 +25,7 @@ void EmitterWindow::Create(EditorComponent* editor)
 		NameComponent* name = wiScene::GetScene().names.GetComponent(entity);
 		if (name != nullptr)
 		{
-			*name = args.sValue;
+			name->SetName(args.sValue);
 
 			editor->RefreshSceneGraphView();
 		}
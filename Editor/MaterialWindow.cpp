@@ -441,7 +441,7 @@ void MaterialWindow::Create(EditorComponent* editor)
 		NameComponent* name = wiScene::GetScene().names.GetComponent(entity);
 		if (name != nullptr)
 		{
-			*name = args.sValue;
+			name->SetName(args.sValue);
 
 			editor->RefreshSceneGraphView();
 		}
@@ -27,7 +27,7 @@ void NameWindow::Create(EditorComponent* editor)
 		{
 			name = &wiScene::GetScene().names.Create(entity);
 		}
-		name->name = args.sValue;
+		name->SetName(args.sValue);
 
 		editor->RefreshSceneGraphView();
 	});
@@ -96,7 +96,7 @@ void SoundWindow::Create(EditorComponent* editor)
 		{
 			name = &wiScene::GetScene().names.Create(entity);
 		}
-		*name = args.sValue;
+		name->SetName(args.sValue);
 
 		editor->RefreshSceneGraphView();
 	});
@@ -0,0 +1,231 @@
+// Steps a scene in headless mode (without graphics device) and prints the timings of the update systems
+//	Usage: SceneBenchmark <scene.wiscene> [-frames N] [-dt seconds] [-threads N]
+//	This is for measuring the simulation cost of a scene as a dedicated server would run it
+//	SceneBenchmark -jobsystem compares the job system scheduler with a single shared job queue at different thread counts instead
+
+#include "WickedEngine.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace wiScene;
+
+struct SystemTiming
+{
+	const char* name;
+	std::function<void(Scene&, wiJobSystem::context&)> run;
+	double total = 0;
+	double max = 0;
+};
+
+// Dispatch throughput and Dispatch() + Wait() latency of the job system with work stealing and with a single shared job queue (as it was before work stealing)
+//	The pool is initialized again for every configuration, with more threads than the hardware has if needed, to see how the scheduler behaves under contention
+static void JobSystemBenchmark()
+{
+	printf("Job system scheduler, 1000 rounds of Dispatch() + Wait() with 1024 jobs in groups of 8:\n");
+	printf("\t%-8s%-16s%16s%14s%14s%14s%24s\n", "threads", "queue", "groups/ms", "median ms", "p99 ms", "max ms", "nested groups/ms");
+	for (uint32_t threadCount : { 4u, 16u, 64u })
+	{
+		for (bool workStealing : { false, true })
+		{
+			wiJobSystem::ShutDown();
+			wiJobSystem::InitDesc desc;
+			desc.threadCount = threadCount;
+			desc.workStealing = workStealing;
+			wiJobSystem::Initialize(desc);
+
+			wiJobSystem::context ctx;
+			wiTimer timer;
+			std::atomic<uint32_t> counter{ 0 };
+
+			// One producer, the main thread:
+			const uint32_t roundCount = 1000;
+			const uint32_t jobCount = 1024;
+			const uint32_t groupSize = 8;
+			std::vector<double> latencies(roundCount);
+			timer.record();
+			for (uint32_t round = 0; round < roundCount; ++round)
+			{
+				wiTimer latency;
+				wiJobSystem::Dispatch(ctx, jobCount, groupSize, [&](wiJobArgs args) {
+					counter.fetch_add(1, std::memory_order_relaxed);
+				});
+				wiJobSystem::Wait(ctx);
+				latencies[round] = latency.elapsed();
+			}
+			const double time = timer.elapsed();
+			std::sort(latencies.begin(), latencies.end());
+
+			// Every worker is a producer too, the jobs dispatch more jobs into their own contexts:
+			const uint32_t outerCount = 256;
+			const uint32_t innerCount = 256;
+			timer.record();
+			for (uint32_t round = 0; round < 10; ++round)
+			{
+				wiJobSystem::Dispatch(ctx, outerCount, 1, [&](wiJobArgs args) {
+					wiJobSystem::context inner;
+					wiJobSystem::Dispatch(inner, innerCount, groupSize, [&](wiJobArgs args) {
+						counter.fetch_add(1, std::memory_order_relaxed);
+					});
+					wiJobSystem::Wait(inner);
+				});
+				wiJobSystem::Wait(ctx);
+			}
+			const double nestedTime = timer.elapsed();
+			const uint32_t nestedGroupCount = 10 * outerCount * (1 + wiJobSystem::DispatchGroupCount(innerCount, groupSize));
+
+			const uint32_t groupCount = roundCount * wiJobSystem::DispatchGroupCount(jobCount, groupSize);
+			printf("\t%-8u%-16s%16.0f%14.4f%14.4f%14.4f%24.0f\n", threadCount, workStealing ? "work stealing" : "shared",
+				groupCount / time, latencies[roundCount / 2], latencies[roundCount * 99 / 100], latencies.back(), nestedGroupCount / nestedTime);
+		}
+	}
+	wiJobSystem::ShutDown();
+}
+
+int main(int argc, char* argv[])
+{
+	std::string filename;
+	uint32_t frameCount = 600;
+	float dt = 1.0f / 60.0f;
+	wiJobSystem::InitDesc jobsystem_desc;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-jobsystem"))
+		{
+			JobSystemBenchmark();
+			return 0;
+		}
+		else if (!strcmp(argv[i], "-frames") && i + 1 < argc)
+		{
+			frameCount = (uint32_t)std::max(1, atoi(argv[++i]));
+		}
+		else if (!strcmp(argv[i], "-dt") && i + 1 < argc)
+		{
+			dt = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+		{
+			jobsystem_desc.maxThreadCount = (uint32_t)std::max(0, atoi(argv[++i]));
+		}
+		else
+		{
+			filename = argv[i];
+		}
+	}
+	if (filename.empty())
+	{
+		printf("Usage: SceneBenchmark <scene.wiscene> [-frames N] [-dt seconds] [-threads N]\n");
+		printf("       SceneBenchmark -jobsystem\n");
+		printf("\t-frames: number of updates to run (default: 600)\n");
+		printf("\t-dt: timestep of one update in seconds (default: 1/60)\n");
+		printf("\t-threads: upper limit of job system worker threads (default: one for every hardware thread except the main thread)\n");
+		printf("\t-jobsystem: compare the job system scheduler with a single shared job queue at 4, 16 and 64 worker threads\n");
+		return 1;
+	}
+
+	// Only the systems needed for the simulation are initialized, there is no graphics device:
+	//	Workers are not pinned to cores and go to sleep when idle, because a server could run other processes as well
+	jobsystem_desc.pinThreads = false;
+	jobsystem_desc.idlePolicy = wiJobSystem::IdlePolicy::Sleep;
+	wiJobSystem::Initialize(jobsystem_desc);
+	wiPhysicsEngine::Initialize();
+	wiAudio::Initialize();
+
+	Scene scene;
+	scene.SetHeadless(true);
+
+	wiTimer timer;
+	LoadModel(scene, filename);
+	const double loadTime = timer.elapsed();
+	if (scene.transforms.GetCount() == 0)
+	{
+		printf("Failed to load scene: %s\n", filename.c_str());
+		return 1;
+	}
+
+	printf("Scene: %s (loaded in %.2f ms)\n", filename.c_str(), loadTime);
+	printf("Job system: %u worker threads\n", wiJobSystem::GetThreadCount());
+	printf("Transforms: %zu, objects: %zu, meshes: %zu, armatures: %zu, animations: %zu, rigid bodies: %zu, soft bodies: %zu, springs: %zu, IK: %zu\n",
+		scene.transforms.GetCount(), scene.objects.GetCount(), scene.meshes.GetCount(), scene.armatures.GetCount(), scene.animations.GetCount(),
+		scene.rigidbodies.GetCount(), scene.softbodies.GetCount(), scene.springs.GetCount(), scene.inverse_kinematics.GetCount());
+
+	// All animations are played, otherwise a loaded scene would be mostly static:
+	for (size_t i = 0; i < scene.animations.GetCount(); ++i)
+	{
+		scene.animations[i].Play();
+		scene.animations[i].SetLooped();
+	}
+
+	// Whole update, with the systems running in parallel by their dependencies:
+	double updateTotal = 0;
+	double updateMax = 0;
+	for (uint32_t frame = 0; frame < frameCount; ++frame)
+	{
+		timer.record();
+		scene.Update(dt);
+		const double elapsed = timer.elapsed();
+		updateTotal += elapsed;
+		updateMax = std::max(updateMax, elapsed);
+	}
+	printf("\nScene::Update: %.3f ms/frame average, %.3f ms max (%u frames)\n", updateTotal / frameCount, updateMax, frameCount);
+
+	// The systems one after the other in dependency order, to see the cost of each:
+	std::vector<SystemTiming> systems = {
+		{ "PreviousFrameTransform", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunPreviousFrameTransformUpdateSystem(ctx); } },
+		{ "Animation", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunAnimationUpdateSystem(ctx); } },
+		{ "Transform", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunTransformUpdateSystem(ctx); } },
+		{ "Hierarchy", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunHierarchyUpdateSystem(ctx); } },
+		{ "Spring", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunSpringUpdateSystem(ctx); } },
+		{ "InverseKinematics", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunInverseKinematicsUpdateSystem(ctx); } },
+		{ "ChangedTransforms", [](Scene& scene, wiJobSystem::context& ctx) { scene.GatherChangedTransforms(ctx); } },
+		{ "Armature", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunArmatureUpdateSystem(ctx); } },
+		{ "Material", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunMaterialUpdateSystem(ctx); } },
+		{ "Mesh", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunMeshUpdateSystem(ctx); } },
+		{ "Impostor", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunImpostorUpdateSystem(ctx); } },
+		{ "Weather", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunWeatherUpdateSystem(ctx); } },
+		{ "Physics", [](Scene& scene, wiJobSystem::context& ctx) { wiPhysicsEngine::RunPhysicsUpdateSystem(ctx, scene, scene.dt); } },
+		{ "Object", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunObjectUpdateSystem(ctx); } },
+		{ "Camera", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunCameraUpdateSystem(ctx); } },
+		{ "Decal", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunDecalUpdateSystem(ctx); } },
+		{ "Probe", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunProbeUpdateSystem(ctx); } },
+		{ "Force", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunForceUpdateSystem(ctx); } },
+		{ "Light", [](Scene& scene, wiJobSystem::context& ctx) { scene.RunLightUpdateSystem(ctx); } },
+		{ "Bounds", [](Scene& scene, wiJobSystem::context& ctx) {
+			scene.bounds = wiJobSystem::ParallelReduce(ctx, (uint32_t)scene.aabb_objects.GetCount(), AABB(),
+				[&](uint32_t i) { return scene.aabb_objects[i]; },
+				[](const AABB& a, const AABB& b) { return AABB::Merge(a, b); }
+			);
+		} },
+	};
+	for (uint32_t frame = 0; frame < frameCount; ++frame)
+	{
+		scene.dt = dt;
+		for (SystemTiming& system : systems)
+		{
+			wiJobSystem::context ctx;
+			timer.record();
+			system.run(scene, ctx);
+			wiJobSystem::Wait(ctx);
+			const double elapsed = timer.elapsed();
+			system.total += elapsed;
+			system.max = std::max(system.max, elapsed);
+		}
+	}
+
+	printf("\nSystems run one after the other (ms/frame average, max):\n");
+	double sum = 0;
+	for (const SystemTiming& system : systems)
+	{
+		printf("\t%-24s%10.3f%10.3f\n", system.name, system.total / frameCount, system.max);
+		sum += system.total / frameCount;
+	}
+	printf("\t%-24s%10.3f\n", "Sum", sum);
+
+	return 0;
+}
@@ -5,10 +5,50 @@
 #include <sstream>
 #include <fstream>
 #include <thread>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
 
 using namespace wiECS;
 using namespace wiScene;
 
+extern std::atomic<uint32_t> number_of_allocs; // MainComponent heap allocation counter
+
+// Scene of a test case, it doesn't create GPU resources, so the tests can run on a background thread
+//	Every entity that has components in the scene, and the ones in the entities list, are destroyed when the test case ends
+struct TestScene
+{
+	Scene scene;
+	std::vector<Entity> entities;
+
+	TestScene()
+	{
+		scene.SetHeadless(true);
+	}
+	~TestScene()
+	{
+		for (uint32_t i = 0; i < scene.component_manager_count; ++i)
+		{
+			const ComponentManager_Interface& manager = *scene.component_managers[i];
+			for (size_t j = 0; j < manager.GetCount(); ++j)
+			{
+				DestroyEntity(manager.GetEntity(j));
+			}
+		}
+		for (Entity entity : entities)
+		{
+			DestroyEntity(entity);
+		}
+	}
+
+	// Entities that don't have components in the scene are created with this, so they are destroyed too:
+	Entity CreateEntity()
+	{
+		entities.push_back(wiECS::CreateEntity());
+		return entities.back();
+	}
+};
+
 void Tests::Initialize()
 {
     MainComponent::Initialize();
@@ -19,6 +59,7 @@ void Tests::Initialize()
 	infoDisplay.resolution = true;
 	infoDisplay.heap_allocation_counter = true;
 
+	renderer.main = this;
 	renderer.init(canvas);
 	renderer.Load();
 
@@ -95,6 +136,22 @@ void TestsRenderer::Load()
 	GetGUI().AddWidget(&volume);
 
 
+	// Compare the frame time with and without the pipelined update (profiler and fps info) on the rendered tests:
+	static wiCheckBox pipelinedUpdate;
+	pipelinedUpdate.Create("PipelinedUpdate");
+	pipelinedUpdate.SetText("Pipelined update: ");
+	pipelinedUpdate.SetSize(XMFLOAT2(20, 20));
+	pipelinedUpdate.SetPos(XMFLOAT2(140, 110));
+	pipelinedUpdate.SetCheck(main != nullptr && main->getPipelinedUpdate());
+	pipelinedUpdate.OnClick([=](wiEventArgs args) {
+		if (main != nullptr)
+		{
+			main->setPipelinedUpdate(args.bValue);
+		}
+	});
+	GetGUI().AddWidget(&pipelinedUpdate);
+
+
 	testSelector.Create("TestSelector");
 	testSelector.SetText("Demo: ");
 	testSelector.SetSize(XMFLOAT2(140, 20));
@@ -120,9 +177,19 @@ void TestsRenderer::Load()
 	testSelector.AddItem("Controller Test");
 	testSelector.AddItem("Inverse Kinematics");
 	testSelector.AddItem("65k Instances");
+	testSelector.AddItem("ECS Test");
+	testSelector.AddItem("Hierarchy Test");
+	testSelector.AddItem("Animation Test");
+	testSelector.AddItem("Scene Query Test");
+	testSelector.AddItem("Culling Test");
 	testSelector.SetMaxVisibleItemCount(10);
 	testSelector.OnSelect([=](wiEventArgs args) {
 
+		// The benchmark running in the background is finished first, so that it doesn't run together with the next test:
+		wiJobSystem::Wait(background_test_ctx);
+		background_test_pending = false;
+		wiPhysicsEngine::SetEnabled(true);
+
 		// Reset all state that tests might have modified:
 		wiEvent::SetVSync(true);
 		wiRenderer::SetToDrawGridHelper(false);
@@ -293,6 +360,22 @@ void TestsRenderer::Load()
 		}
 		break;
 
+		case 19:
+			RunBackgroundTest(RunECSTest);
+			break;
+		case 20:
+			RunBackgroundTest(RunHierarchyTest);
+			break;
+		case 21:
+			RunBackgroundTest(RunAnimationTest);
+			break;
+		case 22:
+			RunBackgroundTest(RunSceneQueryTest);
+			break;
+		case 23:
+			RunBackgroundTest(RunCullingTest);
+			break;
+
 		default:
 			assert(0);
 			break;
@@ -306,6 +389,13 @@ void TestsRenderer::Load()
 }
 void TestsRenderer::Update(float dt)
 {
+	if (background_test_pending && !wiJobSystem::IsBusy(background_test_ctx))
+	{
+		background_test_pending = false;
+		background_test_font.SetText(background_test_result);
+		wiPhysicsEngine::SetEnabled(true);
+	}
+
 	switch (testSelector.GetSelected())
 	{
     case 1:
@@ -460,6 +550,263 @@ void TestsRenderer::RunJobSystemTest()
 		ss << "wiJobSystem::Dispatch() took " << time << " milliseconds" << std::endl;
 	}
 
+	ss << std::endl;
+	ss << "3) Dispatch throughput and latency test:" << std::endl;
+
+	// Many small Dispatch() + Wait() rounds, similar to a frame that is split into many short parallel phases:
+	//	This measures the pool as it was initialized, the comparison with a single shared job queue at 4, 16 and 64 threads is in SceneBenchmark -jobsystem
+	{
+		const uint32_t roundCount = 1000;
+		const uint32_t jobCount = 1024;
+		const uint32_t groupSize = 8;
+		std::vector<double> latencies(roundCount);
+		std::atomic<uint32_t> counter{ 0 };
+		timer.record();
+		for (uint32_t round = 0; round < roundCount; ++round)
+		{
+			wiTimer latency;
+			wiJobSystem::Dispatch(ctx, jobCount, groupSize, [&](wiJobArgs args) {
+				counter.fetch_add(1, std::memory_order_relaxed);
+			});
+			wiJobSystem::Wait(ctx);
+			latencies[round] = latency.elapsed();
+		}
+		double time = timer.elapsed();
+		std::sort(latencies.begin(), latencies.end());
+		const uint32_t groupCount = roundCount * wiJobSystem::DispatchGroupCount(jobCount, groupSize);
+		ss << "Throughput: " << uint32_t(groupCount / time) << " groups per millisecond" << std::endl;
+		ss << "Latency: median " << latencies[roundCount / 2] << " ms, 99th percentile " << latencies[roundCount * 99 / 100] << " ms, max " << latencies.back() << " ms" << std::endl;
+	}
+
+	ss << std::endl;
+	ss << "4) Heap allocations of job submission:" << std::endl;
+
+	// The task is stored once per Dispatch() in a recycled block, jobs only refer to it.
+	//	A task wrapped in std::function with captures that don't fit into its small buffer still needs allocation, which is what every job submission did before:
+	{
+		const uint32_t roundCount = 100;
+		XMFLOAT4X4 capture = IDENTITYMATRIX; // bigger than the small buffer of std::function
+		std::atomic<uint32_t> counter{ 0 };
+
+		uint32_t allocs_before = number_of_allocs.load();
+		for (uint32_t round = 0; round < roundCount; ++round)
+		{
+			std::function<void(wiJobArgs)> task = [&counter, capture](wiJobArgs args) {
+				counter.fetch_add(uint32_t(capture._11), std::memory_order_relaxed);
+			};
+			wiJobSystem::Dispatch(ctx, 1024, 8, task);
+			wiJobSystem::Wait(ctx);
+		}
+		uint32_t allocs_function = number_of_allocs.load() - allocs_before;
+
+		allocs_before = number_of_allocs.load();
+		for (uint32_t round = 0; round < roundCount; ++round)
+		{
+			wiJobSystem::Dispatch(ctx, 1024, 8, [&counter, capture](wiJobArgs args) {
+				counter.fetch_add(uint32_t(capture._11), std::memory_order_relaxed);
+			});
+			wiJobSystem::Wait(ctx);
+		}
+		uint32_t allocs_lambda = number_of_allocs.load() - allocs_before;
+
+		ss << "Per Dispatch() with std::function task: " << float(allocs_function) / roundCount << ", with lambda task: " << float(allocs_lambda) / roundCount << std::endl;
+	}
+
+	// Heap allocations of a whole Scene::Update() per frame, this is part of what the info display shows with heap_allocation_counter.
+	//	When every job group copied its std::function, this scene made about 180 allocations per frame with 7 worker threads, 560 with 31
+	{
+		Scene scene;
+		for (uint32_t i = 0; i < 1000; ++i)
+		{
+			Entity parent = scene.Entity_CreateObject("parent");
+			scene.transforms.GetComponent(parent)->Translate(XMFLOAT3(float(i % 100), 0, float(i / 100)));
+			for (uint32_t j = 0; j < 4; ++j)
+			{
+				Entity child = scene.Entity_CreateObject("child");
+				scene.Component_Attach(child, parent);
+			}
+			if (i % 10 == 0)
+			{
+				scene.Entity_CreateLight("light", XMFLOAT3(float(i % 100), 2, float(i / 100)));
+				scene.Entity_CreateForce("force");
+			}
+		}
+		const float dt = 1.0f / 60.0f;
+		scene.Update(dt); // first updates create the GPU buffers and the update graph
+		scene.Update(dt);
+
+		const uint32_t frameCount = 100;
+		const uint32_t allocs_before = number_of_allocs.load();
+		for (uint32_t frame = 0; frame < frameCount; ++frame)
+		{
+			scene.transforms[frame].Translate(XMFLOAT3(0, 0.01f, 0));
+			scene.Update(dt);
+		}
+		const uint32_t allocs_update = number_of_allocs.load() - allocs_before;
+
+		ss << "Per frame of Scene::Update() (" << scene.objects.GetCount() << " objects, " << wiJobSystem::GetThreadCount() << " worker threads): " << float(allocs_update) / frameCount << std::endl;
+	}
+
+	ss << std::endl;
+	ss << "5) TaskGraph test:" << std::endl;
+
+	// Ordering test: random graph, every task checks that its dependencies finished completely, including the jobs that they left in their context:
+	{
+		const uint32_t taskCount = 256;
+		std::vector<std::vector<uint32_t>> dependencies(taskCount);
+		std::unique_ptr<std::atomic<uint32_t>[]> finished(new std::atomic<uint32_t>[taskCount]);
+		std::atomic<uint32_t> errors{ 0 };
+		wiJobSystem::TaskGraph graph;
+		for (uint32_t i = 0; i < taskCount; ++i)
+		{
+			for (uint32_t j = 0; i > 0 && j < uint32_t(rand() % 4); ++j)
+			{
+				dependencies[i].push_back(uint32_t(rand()) % i);
+			}
+			uint32_t task = graph.AddTask([&, i](wiJobSystem::context& ctx) {
+				for (uint32_t dependency : dependencies[i])
+				{
+					if (finished[dependency].load() != 1)
+					{
+						errors.fetch_add(1);
+					}
+				}
+				wiJobSystem::Dispatch(ctx, 64, 4, [&, i](wiJobArgs args) {
+					if (args.jobIndex == 63)
+					{
+						finished[i].fetch_add(1);
+					}
+				});
+			});
+			for (uint32_t dependency : dependencies[i])
+			{
+				graph.AddDependency(task, dependency);
+			}
+		}
+		for (uint32_t run = 0; run < 100; ++run)
+		{
+			for (uint32_t i = 0; i < taskCount; ++i)
+			{
+				finished[i].store(0);
+			}
+			graph.Run(ctx);
+			wiJobSystem::Wait(ctx);
+			for (uint32_t i = 0; i < taskCount; ++i)
+			{
+				if (finished[i].load() != 1)
+				{
+					errors.fetch_add(1);
+				}
+			}
+		}
+		ss << "Dependency order: " << (errors.load() == 0 ? "OK" : "FAILED") << std::endl;
+	}
+
+	// Scene update timing: the old barrier version with full Wait() between system groups against the dependency graph of Scene::Update()
+	{
+		Scene scene;
+		for (uint32_t i = 0; i < 10000; ++i)
+		{
+			Entity parent = scene.Entity_CreateObject("parent");
+			scene.transforms.GetComponent(parent)->Translate(XMFLOAT3(float(i % 100), 0, float(i / 100)));
+			for (uint32_t j = 0; j < 4; ++j)
+			{
+				Entity child = scene.Entity_CreateObject("child");
+				scene.Component_Attach(child, parent);
+			}
+			if (i % 10 == 0)
+			{
+				scene.Entity_CreateLight("light", XMFLOAT3(float(i % 100), 2, float(i / 100)));
+				scene.Entity_CreateForce("force");
+			}
+		}
+		const float dt = 1.0f / 60.0f;
+		scene.Update(dt); // first update creates the GPU buffers and the update graph
+
+		const uint32_t frameCount = 100;
+		timer.record();
+		for (uint32_t frame = 0; frame < frameCount; ++frame)
+		{
+			scene.RunPreviousFrameTransformUpdateSystem(ctx);
+			scene.RunAnimationUpdateSystem(ctx);
+			scene.RunTransformUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+			scene.RunHierarchyUpdateSystem(ctx);
+			scene.RunSpringUpdateSystem(ctx);
+			scene.RunInverseKinematicsUpdateSystem(ctx);
+			scene.RunArmatureUpdateSystem(ctx);
+			scene.RunMeshUpdateSystem(ctx);
+			scene.RunMaterialUpdateSystem(ctx);
+			scene.RunImpostorUpdateSystem(ctx);
+			scene.RunWeatherUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+			wiPhysicsEngine::RunPhysicsUpdateSystem(ctx, scene, dt);
+			scene.RunObjectUpdateSystem(ctx);
+			scene.RunCameraUpdateSystem(ctx);
+			scene.RunDecalUpdateSystem(ctx);
+			scene.RunProbeUpdateSystem(ctx);
+			scene.RunForceUpdateSystem(ctx);
+			scene.RunLightUpdateSystem(ctx);
+			scene.RunParticleUpdateSystem(ctx);
+			scene.RunSoundUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+		}
+		double time_barrier = timer.elapsed() / frameCount;
+
+		timer.record();
+		for (uint32_t frame = 0; frame < frameCount; ++frame)
+		{
+			scene.update_graph.Run(ctx);
+			wiJobSystem::Wait(ctx);
+		}
+		double time_graph = timer.elapsed() / frameCount;
+
+		ss << "Scene update systems (" << scene.objects.GetCount() << " objects): barriers took " << time_barrier << " ms, task graph took " << time_graph << " ms per frame" << std::endl;
+	}
+
+	ss << std::endl;
+	ss << "6) Priority test:" << std::endl;
+
+	// Latency of frame critical Dispatch() + Wait() rounds on an idle pool, then while background jobs keep the pool saturated:
+	{
+		wiJobSystem::context ctx_critical;
+		ctx_critical.priority = wiJobSystem::Priority::Critical;
+		wiJobSystem::context ctx_background;
+		ctx_background.priority = wiJobSystem::Priority::Background;
+
+		auto measure = [&](double& median, double& worst) {
+			const uint32_t roundCount = 200;
+			std::vector<double> latencies(roundCount);
+			for (uint32_t round = 0; round < roundCount; ++round)
+			{
+				wiTimer latency;
+				wiJobSystem::Dispatch(ctx_critical, 1024, 16, [](wiJobArgs args) {
+					wiHelper::Spin(0.001f);
+				});
+				wiJobSystem::Wait(ctx_critical);
+				latencies[round] = latency.elapsed();
+			}
+			std::sort(latencies.begin(), latencies.end());
+			median = latencies[roundCount / 2];
+			worst = latencies.back();
+		};
+
+		double idle_median, idle_worst;
+		measure(idle_median, idle_worst);
+
+		wiJobSystem::Dispatch(ctx_background, wiJobSystem::GetThreadCount() * 50, 1, [](wiJobArgs args) {
+			wiHelper::Spin(2);
+		});
+		double loaded_median, loaded_worst;
+		measure(loaded_median, loaded_worst);
+		const bool background_running = wiJobSystem::IsBusy(ctx_background);
+		wiJobSystem::Wait(ctx_background);
+
+		ss << "Critical jobs on idle pool: median " << idle_median << " ms, max " << idle_worst << " ms" << std::endl;
+		ss << "Critical jobs with saturated background: median " << loaded_median << " ms, max " << loaded_worst << " ms";
+		ss << (background_running ? "" : " (background finished early)") << std::endl;
+	}
+
 	static wiSpriteFont font;
 	font = wiSpriteFont(ss.str());
 	font.params.posX = GetLogicalWidth() / 2;
@@ -469,6 +816,1817 @@ void TestsRenderer::RunJobSystemTest()
 	font.params.size = 24;
 	this->AddFont(&font);
 }
+void TestsRenderer::RunBackgroundTest(std::string(*test)())
+{
+	// The results of these tests are longer, so they are displayed smaller, starting from the top, next to the GUI:
+	background_test_font = wiSpriteFont("Running test, please wait...");
+	background_test_font.params.posX = 220;
+	background_test_font.params.posY = 20;
+	background_test_font.params.h_align = WIFALIGN_LEFT;
+	background_test_font.params.v_align = WIFALIGN_TOP;
+	background_test_font.params.size = 16;
+	this->AddFont(&background_test_font);
+
+	// The physics world is global, the Scene::Update() of the test scenes would step it in parallel to the main scene,
+	//	and remove the rigid bodies that aren't in the test scene. It is disabled until the test is finished:
+	wiPhysicsEngine::SetEnabled(false);
+
+	background_test_ctx.priority = wiJobSystem::Priority::Background;
+	background_test_pending = true;
+	wiJobSystem::Execute(background_test_ctx, [this, test](wiJobArgs args) {
+		background_test_result = test();
+	});
+}
+std::string TestsRenderer::RunECSTest()
+{
+	wiTimer timer;
+
+	// This is created to be able to wait on the workload independently from other workload:
+	wiJobSystem::context ctx;
+
+	std::stringstream ss("");
+	ss << "ECS performance test:" << std::endl;
+	ss << "You can find out more in Tests.cpp, RunECSTest() function." << std::endl << std::endl;
+
+	ss << "1) Entity lookup test:" << std::endl;
+
+	// The ComponentManager lookup (paged sparse array) is compared against the std::unordered_map lookup that it replaced:
+	{
+		struct TestComponent
+		{
+			XMFLOAT4 value = XMFLOAT4(0, 0, 0, 0);
+		};
+		const uint32_t entityCount = 1000000;
+		TestScene test;
+		std::vector<Entity> entities(entityCount);
+		for (uint32_t i = 0; i < entityCount; ++i)
+		{
+			entities[i] = test.CreateEntity();
+		}
+		std::vector<Entity> shuffled = entities;
+		std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+
+		double time_create, time_lookup, time_remove;
+		double time_create_map, time_lookup_map, time_remove_map;
+		float checksum = 0;
+
+		{
+			ComponentManager<TestComponent> manager;
+
+			timer.record();
+			for (Entity entity : entities)
+			{
+				manager.Create(entity).value.x = 1;
+			}
+			time_create = timer.elapsed();
+
+			timer.record();
+			for (Entity entity : shuffled)
+			{
+				checksum += manager.GetComponent(entity)->value.x;
+			}
+			time_lookup = timer.elapsed();
+
+			timer.record();
+			for (Entity entity : shuffled)
+			{
+				manager.Remove(entity);
+			}
+			time_remove = timer.elapsed();
+		}
+
+		{
+			// Same operations as ComponentManager did with the hash map:
+			std::vector<TestComponent> components;
+			std::vector<Entity> component_entities;
+			std::unordered_map<Entity, size_t> lookup;
+
+			timer.record();
+			for (Entity entity : entities)
+			{
+				lookup[entity] = components.size();
+				components.emplace_back().value.x = 1;
+				component_entities.push_back(entity);
+			}
+			time_create_map = timer.elapsed();
+
+			timer.record();
+			for (Entity entity : shuffled)
+			{
+				checksum += components[lookup.find(entity)->second].value.x;
+			}
+			time_lookup_map = timer.elapsed();
+
+			timer.record();
+			for (Entity entity : shuffled)
+			{
+				auto it = lookup.find(entity);
+				const size_t index = it->second;
+				components[index] = components.back();
+				component_entities[index] = component_entities.back();
+				lookup[component_entities[index]] = index;
+				components.pop_back();
+				component_entities.pop_back();
+				lookup.erase(entity);
+			}
+			time_remove_map = timer.elapsed();
+		}
+
+		ss << entityCount << " entities, checksum: " << checksum << std::endl;
+		ss << "Create: " << time_create << " ms (unordered_map: " << time_create_map << " ms)" << std::endl;
+		ss << "Random order lookup: " << time_lookup << " ms (unordered_map: " << time_lookup_map << " ms)" << std::endl;
+		ss << "Random order remove: " << time_remove << " ms (unordered_map: " << time_remove_map << " ms)" << std::endl;
+	}
+
+	ss << std::endl << "2) Entity recycling test:" << std::endl;
+
+	// Entities are created and destroyed repeatedly, destroyed handles must become stale while the index range stays compact:
+	{
+		const uint32_t entityCount = 100000;
+		const uint32_t roundCount = 10;
+		std::vector<Entity> entities(entityCount);
+		uint32_t maxIndex = 0;
+		uint32_t staleAlive = 0;
+
+		timer.record();
+		for (uint32_t round = 0; round < roundCount; ++round)
+		{
+			for (uint32_t i = 0; i < entityCount; ++i)
+			{
+				entities[i] = CreateEntity();
+				maxIndex = std::max(maxIndex, GetEntityIndex(entities[i]));
+			}
+			for (uint32_t i = 0; i < entityCount; ++i)
+			{
+				DestroyEntity(entities[i]);
+			}
+			for (uint32_t i = 0; i < entityCount; ++i)
+			{
+				staleAlive += IsEntityAlive(entities[i]) ? 1 : 0;
+			}
+		}
+		double time_recycle = timer.elapsed();
+
+		ss << roundCount << " rounds of " << entityCount << " create + destroy: " << time_recycle << " ms" << std::endl;
+		ss << "Highest entity index: " << maxIndex << ", stale handles reported alive: " << staleAlive << std::endl;
+	}
+
+	// Entity references loaded from an archive are only kept if they are live entities of this process.
+	//	Others are remapped, so they can't collide with a live entity that has the same index in the lookup tables:
+	{
+		TestScene test;
+		Scene& scene = test.scene;
+		Entity live = scene.Entity_CreateObject("live");
+		Entity object = scene.Entity_CreateObject("object");
+		scene.Component_Attach(object, live);
+		const Entity foreign = MakeEntity(GetEntityIndex(live), GetEntityGeneration(live) + 1); // same index, different generation
+		scene.objects.GetComponent(object)->meshID = foreign;
+
+		wiArchive archive;
+		archive.SetReadModeAndResetPos(false);
+		scene.Entity_Serialize(archive, object);
+		archive.SetReadModeAndResetPos(true);
+		Entity loaded = scene.Entity_Serialize(archive);
+
+		const Entity meshID = scene.objects.GetComponent(loaded)->meshID;
+		bool remap_ok = meshID != foreign && GetEntityIndex(meshID) != GetEntityIndex(live) && IsEntityAlive(meshID);
+		remap_ok &= scene.hierarchy.GetComponent(loaded)->parentID == live;
+		ss << "Foreign entity references in archive: " << (remap_ok ? "remapped" : "[collided with a live entity!]") << std::endl;
+		test.entities.push_back(meshID); // the remapped reference doesn't have components
+	}
+
+	// A handle that was destroyed while it still had a component: when its index is reused, the stale component is removed instead of sharing the lookup slot:
+	{
+		ComponentManager<NameComponent> manager;
+		Entity stale = CreateEntity();
+		manager.Create(stale).name = "stale";
+		DestroyEntity(stale);
+		const Entity recycled = MakeEntity(GetEntityIndex(stale), GetEntityGeneration(stale) + 1); // same index, next generation
+		manager.Create(recycled).name = "recycled";
+		bool stale_ok = manager.GetCount() == 1 && manager.GetComponent(stale) == nullptr;
+		stale_ok &= manager.GetComponent(recycled) != nullptr && manager.GetComponent(recycled)->name == "recycled";
+		ss << "Recycled index with a stale component: " << (stale_ok ? "ok" : "FAILED") << std::endl;
+	}
+
+	ss << std::endl << "3) View test:" << std::endl;
+
+	// The previous frame transform update is simulated, which copies a matrix from one component to an other for every entity.
+	//	Per-entity GetComponent() is compared against a View, once including the gather and once with the cached gather:
+	{
+		struct Transform
+		{
+			XMFLOAT4X4 world = IDENTITYMATRIX;
+		};
+		struct PrevTransform
+		{
+			XMFLOAT4X4 world_prev = IDENTITYMATRIX;
+		};
+		const uint32_t entityCount = 1000000;
+		TestScene test;
+		std::vector<Entity> entities(entityCount);
+		ComponentManager<Transform> transforms;
+		ComponentManager<PrevTransform> prev_transforms;
+		for (uint32_t i = 0; i < entityCount; ++i)
+		{
+			entities[i] = test.CreateEntity();
+			transforms.Create(entities[i]);
+		}
+		// The two managers are filled in different order, like in a real scene after editing:
+		std::vector<Entity> shuffled = entities;
+		std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(7));
+		for (Entity entity : shuffled)
+		{
+			prev_transforms.Create(entity);
+		}
+
+		timer.record();
+		for (size_t i = 0; i < prev_transforms.GetCount(); ++i)
+		{
+			const Transform& transform = *transforms.GetComponent(prev_transforms.GetEntity(i));
+			prev_transforms[i].world_prev = transform.world;
+		}
+		double time_getcomponent = timer.elapsed();
+
+		View<PrevTransform, Transform> view(prev_transforms, transforms);
+
+		timer.record();
+		view.Refresh();
+		for (size_t i = 0; i < view.GetCount(); ++i)
+		{
+			auto [prev_transform, transform] = view[i];
+			prev_transform.world_prev = transform.world;
+		}
+		double time_view_first = timer.elapsed();
+
+		timer.record();
+		view.Refresh();
+		for (size_t i = 0; i < view.GetCount(); ++i)
+		{
+			auto [prev_transform, transform] = view[i];
+			prev_transform.world_prev = transform.world;
+		}
+		double time_view_cached = timer.elapsed();
+
+		ss << entityCount << " entities" << std::endl;
+		ss << "GetComponent() per entity: " << time_getcomponent << " ms" << std::endl;
+		ss << "View with gather: " << time_view_first << " ms, View cached: " << time_view_cached << " ms (speedup: " << time_getcomponent / std::max(0.001, time_view_cached) << "x)" << std::endl;
+	}
+
+	ss << std::endl << "4) Entity remove test:" << std::endl;
+
+	// Entities that only have a name and a transform are despawned.
+	//	Entity_Remove() only visits the component managers in the entity signature, 
+	//	this is compared against removing from every component manager like it was done before:
+	{
+		const uint32_t entityCount = 100000;
+		double time_all = 0;
+		double time_signature = 0;
+		for (int signature = 0; signature < 2; ++signature)
+		{
+			TestScene test;
+			Scene& scene = test.scene;
+			std::vector<Entity> entities(entityCount);
+			for (uint32_t i = 0; i < entityCount; ++i)
+			{
+				entities[i] = CreateEntity();
+				scene.names.Create(entities[i]) = "entity";
+				scene.transforms.Create(entities[i]);
+			}
+			std::shuffle(entities.begin(), entities.end(), std::mt19937(13));
+
+			timer.record();
+			for (Entity entity : entities)
+			{
+				if (signature)
+				{
+					scene.Entity_Remove(entity, true);
+				}
+				else
+				{
+					scene.Component_Detach(entity);
+					for (uint32_t i = 0; i < scene.component_manager_count; ++i)
+					{
+						scene.component_managers[i]->Remove(entity);
+					}
+					DestroyEntity(entity);
+				}
+			}
+			(signature ? time_signature : time_all) = timer.elapsed();
+		}
+
+		ss << entityCount << " entities" << std::endl;
+		ss << "Remove from every manager: " << time_all << " ms, Entity_Remove() with signature: " << time_signature << " ms" << std::endl;
+	}
+
+	ss << std::endl << "5) Entity find by name test:" << std::endl;
+
+	// Lookup time of Entity_FindByName() should not depend on the scene size, unlike the linear search that it replaced:
+	{
+		const uint32_t lookupCount = 10000;
+		const uint32_t linearLookupCount = 100;
+		for (uint32_t nameCount : { 1000u, 10000u, 100000u })
+		{
+			TestScene test;
+			Scene& scene = test.scene;
+			std::vector<Entity> entities(nameCount);
+			for (uint32_t i = 0; i < nameCount; ++i)
+			{
+				entities[i] = CreateEntity();
+				scene.names.Create(entities[i]) = "entity_" + std::to_string(i);
+			}
+			std::vector<std::string> queries(lookupCount);
+			std::mt19937 rng(17);
+			for (uint32_t i = 0; i < lookupCount; ++i)
+			{
+				queries[i] = "entity_" + std::to_string(rng() % nameCount);
+			}
+			uint32_t found = 0;
+
+			timer.record();
+			for (uint32_t i = 0; i < linearLookupCount; ++i)
+			{
+				for (size_t j = 0; j < scene.names.GetCount(); ++j)
+				{
+					if (scene.names[j] == queries[i])
+					{
+						found++;
+						break;
+					}
+				}
+			}
+			double time_linear = timer.elapsed();
+
+			timer.record();
+			found += scene.Entity_FindByName(queries[0]) != INVALID_ENTITY ? 1 : 0; // this builds the index
+			double time_build = timer.elapsed();
+
+			timer.record();
+			for (uint32_t i = 0; i < lookupCount; ++i)
+			{
+				found += scene.Entity_FindByName(queries[i]) != INVALID_ENTITY ? 1 : 0;
+			}
+			double time_indexed = timer.elapsed();
+
+			std::vector<Entity> results(lookupCount);
+			timer.record();
+			scene.Entity_FindByName(queries.data(), queries.size(), results.data());
+			double time_batched = timer.elapsed();
+
+			// Names that don't exist are checked with a linear search, because directly modified name strings are not tracked by the index:
+			timer.record();
+			for (uint32_t i = 0; i < linearLookupCount; ++i)
+			{
+				found += scene.Entity_FindByName("missing_" + std::to_string(i)) != INVALID_ENTITY ? 1 : 0;
+			}
+			double time_missing = timer.elapsed();
+
+			ss << nameCount << " names: linear " << time_linear * 1000 / linearLookupCount << " us/lookup, indexed " << time_indexed * 1000 / lookupCount << " us/lookup";
+			ss << ", batched " << time_batched * 1000 / lookupCount << " us/lookup, not found " << time_missing * 1000 / linearLookupCount << " us/lookup";
+			ss << " (index build: " << time_build << " ms, found: " << found << ")" << std::endl;
+		}
+	}
+
+	// Renames with SetName() update the name index of their own scene in place, and the first entity with a name is still found first:
+	{
+		TestScene test;
+		TestScene test_other;
+		Scene& scene = test.scene;
+		Scene& other = test_other.scene;
+		Entity entities[3];
+		for (Entity& entity : entities)
+		{
+			entity = CreateEntity();
+			scene.names.Create(entity) = "same";
+		}
+		Entity other_entity = CreateEntity();
+		other.names.Create(other_entity) = "other";
+		bool rename_ok = scene.Entity_FindByName("same") == entities[0] && other.Entity_FindByName("other") == other_entity; // builds both indices
+
+		other.names.GetComponent(other_entity)->SetName("renamed");
+		rename_ok &= other.Entity_FindByName("renamed") == other_entity && other.Entity_FindByName("other") == INVALID_ENTITY;
+		rename_ok &= scene.Entity_FindByName("renamed") == INVALID_ENTITY;
+
+		scene.names.GetComponent(entities[0])->SetName("first");
+		rename_ok &= scene.Entity_FindByName("same") == entities[1] && scene.Entity_FindByName("first") == entities[0];
+		scene.names.GetComponent(entities[0])->SetName("same");
+		std::vector<Entity> all;
+		scene.Entity_FindAllByName("same", all);
+		rename_ok &= scene.Entity_FindByName("same") == entities[0] && all.size() == 3 && all[0] == entities[0] && all[2] == entities[2];
+		ss << "Rename tracking: " << (rename_ok ? "ok" : "[stale name lookup!]") << std::endl;
+	}
+
+	return ss.str();
+}
+std::string TestsRenderer::RunHierarchyTest()
+{
+	wiTimer timer;
+
+	// This is created to be able to wait on the workload independently from other workload:
+	wiJobSystem::context ctx;
+
+	std::stringstream ss("");
+	ss << "Hierarchy performance test:" << std::endl;
+	ss << "You can find out more in Tests.cpp, RunHierarchyTest() function." << std::endl << std::endl;
+
+	ss << "1) Hierarchy update test:" << std::endl;
+
+	// The level-parallel hierarchy system is compared against the serial loop that it replaced, on a deep and on a wide tree:
+	{
+		const uint32_t nodeCount = 200000;
+		for (int wide = 0; wide < 2; ++wide)
+		{
+			TestScene test;
+			Scene& scene = test.scene;
+			std::vector<Entity> entities(nodeCount);
+			for (uint32_t i = 0; i < nodeCount; ++i)
+			{
+				entities[i] = CreateEntity();
+				scene.transforms.Create(entities[i]).translation_local = XMFLOAT3(1, 0, 0);
+				scene.layers.Create(entities[i]);
+				if (i > 0)
+				{
+					// deep: chains of 1000 nodes, wide: every node is a child of the first one
+					const bool chain_start = !wide && i % 1000 == 0;
+					scene.hierarchy.Create(entities[i]).parentID = (wide || chain_start) ? entities[0] : entities[i - 1];
+				}
+			}
+			scene.RunTransformUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+
+			timer.record();
+			for (size_t i = 0; i < scene.hierarchy.GetCount(); ++i)
+			{
+				const HierarchyComponent& parentcomponent = scene.hierarchy[i];
+				Entity entity = scene.hierarchy.GetEntity(i);
+				TransformComponent* transform_child = scene.transforms.GetComponent(entity);
+				TransformComponent* transform_parent = scene.transforms.GetComponent(parentcomponent.parentID);
+				if (transform_child != nullptr && transform_parent != nullptr)
+				{
+					transform_child->UpdateTransform_Parented(*transform_parent);
+				}
+				LayerComponent* layer_child = scene.layers.GetComponent(entity);
+				LayerComponent* layer_parent = scene.layers.GetComponent(parentcomponent.parentID);
+				if (layer_child != nullptr && layer_parent != nullptr)
+				{
+					layer_child->propagationMask = layer_parent->GetLayerMask();
+				}
+			}
+			double time_serial = timer.elapsed();
+
+			timer.record();
+			scene.RunHierarchyUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+			double time_first = timer.elapsed();
+
+			timer.record();
+			scene.RunHierarchyUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+			double time_cached = timer.elapsed();
+
+			ss << (wide ? "Wide tree (" : "Deep tree (") << nodeCount << " nodes, " << scene.hierarchy_update_levels.size() - 1 << " levels): ";
+			ss << "serial: " << time_serial << " ms, level-parallel: " << time_first << " ms (with level build), " << time_cached << " ms (cached levels)" << std::endl;
+		}
+	}
+
+	ss << std::endl << "2) Hierarchy attach test:" << std::endl;
+
+	// A random tree is built by attaching the nodes one by one with the parents first, and in bulk in random order, where children are often attached before their parents:
+	{
+		const uint32_t nodeCount = 100000;
+		std::mt19937 rng(11);
+		std::vector<uint32_t> parents(nodeCount);
+		for (uint32_t i = 1; i < nodeCount; ++i)
+		{
+			parents[i] = rng() % i;
+		}
+		std::vector<uint32_t> order(nodeCount - 1);
+		for (uint32_t i = 0; i < nodeCount - 1; ++i)
+		{
+			order[i] = i + 1;
+		}
+		std::shuffle(order.begin(), order.end(), rng);
+
+		for (int bulk = 0; bulk < 2; ++bulk)
+		{
+			TestScene test;
+			Scene& scene = test.scene;
+			std::vector<Entity> entities(nodeCount);
+			for (uint32_t i = 0; i < nodeCount; ++i)
+			{
+				entities[i] = CreateEntity();
+				scene.transforms.Create(entities[i]);
+			}
+			std::vector<Entity> attach_entities(nodeCount - 1);
+			std::vector<Entity> attach_parents(nodeCount - 1);
+			for (uint32_t i = 0; i < nodeCount - 1; ++i)
+			{
+				attach_entities[i] = entities[order[i]];
+				attach_parents[i] = entities[parents[order[i]]];
+			}
+
+			timer.record();
+			if (bulk)
+			{
+				scene.Component_Attach(attach_entities.data(), attach_parents.data(), attach_entities.size());
+			}
+			else
+			{
+				// Single attaches keep the ordering, which is constant time when the parents are attached first.
+				//	In random order a node is often attached after its children, then the nodes in between are moved, that case is for the bulk attach:
+				for (uint32_t i = 1; i < nodeCount; ++i)
+				{
+					scene.Component_Attach(entities[i], entities[parents[i]]);
+				}
+			}
+			double time_attach = timer.elapsed();
+
+			ss << (bulk ? "Bulk Component_Attach() in random order: " : "Component_Attach() per node, parents first: ") << time_attach << " ms for " << nodeCount - 1 << " nodes" << std::endl;
+
+			// Reattaching keeps the nodes in place, and the ordering stays intact when the parents are before their children:
+			timer.record();
+			for (size_t i = 0; i < attach_entities.size(); ++i)
+			{
+				scene.Component_Attach(attach_entities[i], attach_parents[i], true);
+			}
+			double time_reattach = timer.elapsed();
+
+			bool sorted = scene.IsHierarchySorted();
+			for (size_t i = 0; i < scene.hierarchy.GetCount() && sorted; ++i)
+			{
+				const size_t parent_index = scene.hierarchy.GetIndex(scene.hierarchy[i].parentID);
+				sorted = parent_index < i || parent_index >= scene.hierarchy.GetCount();
+			}
+			ss << "\tReattach every node: " << time_reattach << " ms, ordering: " << (sorted ? "ok" : "[children before parents!]") << std::endl;
+		}
+	}
+
+	// A single attach keeps parents before their children, also when a subtree is attached to a parent that is after it:
+	{
+		TestScene test;
+		Scene& scene = test.scene;
+		Entity a = CreateEntity();
+		Entity b = CreateEntity();
+		Entity c = CreateEntity();
+		Entity d = CreateEntity();
+		Entity e = CreateEntity();
+		scene.Component_Attach(e, d); // e
+		scene.Component_Attach(b, a); // e, b
+		scene.Component_Attach(d, b); // d is added after its child, and its parent is after the child too: b, d, e
+		scene.Component_Attach(c, a); // b, d, e, c
+		scene.Component_Attach(b, c); // b is reattached to a parent that is after its subtree: c, b, d, e
+
+		const Entity expected[] = { c, b, d, e };
+		bool success = scene.IsHierarchySorted() && scene.hierarchy.GetCount() == arraysize(expected);
+		for (size_t i = 0; i < scene.hierarchy.GetCount() && success; ++i)
+		{
+			success = scene.hierarchy.GetEntity(i) == expected[i];
+		}
+		ss << "Subtree moved after its parent: " << (success ? "ok" : "FAILED") << std::endl;
+	}
+
+	ss << std::endl << "3) Entity duplicate test:" << std::endl;
+
+	// A small prop (object with 4 child objects and a light, sharing one mesh) is duplicated many times.
+	//	Entity_Duplicate() is compared against the archive round trip that it used before:
+	{
+		const uint32_t duplicateCount = 1000;
+		TestScene test;
+		Scene& scene = test.scene;
+		Entity mesh = scene.Entity_CreateMesh("prop_mesh");
+		Entity prop = scene.Entity_CreateObject("prop");
+		scene.objects.GetComponent(prop)->meshID = mesh;
+		for (int i = 0; i < 4; ++i)
+		{
+			Entity child = scene.Entity_CreateObject("prop_part" + std::to_string(i));
+			scene.objects.GetComponent(child)->meshID = mesh;
+			scene.Component_Attach(child, prop);
+		}
+		scene.Component_Attach(scene.Entity_CreateLight("prop_light"), prop);
+
+		timer.record();
+		for (uint32_t i = 0; i < duplicateCount; ++i)
+		{
+			wiArchive archive;
+			archive.SetReadModeAndResetPos(false);
+			scene.Entity_Serialize(archive, prop);
+			archive.SetReadModeAndResetPos(true);
+			scene.Entity_Serialize(archive);
+		}
+		double time_archive = timer.elapsed();
+
+		timer.record();
+		for (uint32_t i = 0; i < duplicateCount; ++i)
+		{
+			scene.Entity_Duplicate(prop);
+		}
+		double time_direct = timer.elapsed();
+
+		ss << duplicateCount << " duplicates of 6 entities" << std::endl;
+		ss << "Archive round trip: " << time_archive << " ms, Entity_Duplicate(): " << time_direct << " ms" << std::endl;
+
+		// The mesh outside the duplicated hierarchy stays shared:
+		const Entity prop_clone = scene.Entity_Duplicate(prop);
+		bool mesh_ok = scene.objects.GetComponent(prop_clone)->meshID == mesh;
+
+		// A mesh that is on a duplicated entity is duplicated, and so is a mesh that is skinned by a duplicated armature:
+		Entity character = scene.Entity_CreateObject("character");
+		scene.armatures.Create(character);
+		Entity character_mesh = scene.Entity_CreateMesh("character_mesh");
+		for (Entity mesh_entity : { character_mesh, character })
+		{
+			MeshComponent& meshcomponent = mesh_entity == character ? scene.meshes.Create(character) : *scene.meshes.GetComponent(mesh_entity);
+			meshcomponent.vertex_positions = { XMFLOAT3(0, 0, 0), XMFLOAT3(1, 0, 0), XMFLOAT3(0, 1, 0) };
+			meshcomponent.indices = { 0, 1, 2 };
+			meshcomponent.subsets.emplace_back();
+			meshcomponent.subsets.back().indexCount = 3;
+			meshcomponent.CreateRenderData();
+		}
+		scene.meshes.GetComponent(character_mesh)->armatureID = character;
+		Entity body = scene.Entity_CreateObject("character_body");
+		scene.objects.GetComponent(body)->meshID = character_mesh;
+		scene.Component_Attach(body, character);
+		scene.objects.GetComponent(character)->meshID = character;
+
+		const Entity character_clone = scene.Entity_Duplicate(character);
+		Entity body_clone = INVALID_ENTITY;
+		for (size_t i = 0; i < scene.hierarchy.GetCount(); ++i)
+		{
+			if (scene.hierarchy[i].parentID == character_clone)
+			{
+				body_clone = scene.hierarchy.GetEntity(i);
+			}
+		}
+		const MeshComponent* own_mesh_clone = scene.meshes.GetComponent(character_clone);
+		mesh_ok &= own_mesh_clone != nullptr && own_mesh_clone->indices.size() == 3;
+		mesh_ok &= scene.objects.GetComponent(character_clone)->meshID == character_clone;
+		mesh_ok &= scene.meshes.GetComponent(character)->indices.size() == 3;
+		const Entity character_mesh_clone = body_clone == INVALID_ENTITY ? INVALID_ENTITY : scene.objects.GetComponent(body_clone)->meshID;
+		const MeshComponent* skinned_mesh_clone = scene.meshes.GetComponent(character_mesh_clone);
+		mesh_ok &= character_mesh_clone != character_mesh && skinned_mesh_clone != nullptr;
+		mesh_ok &= skinned_mesh_clone != nullptr && skinned_mesh_clone->armatureID == character_clone && skinned_mesh_clone->vertex_positions.size() == 3;
+		mesh_ok &= scene.meshes.GetComponent(character_mesh)->armatureID == character;
+		ss << "Mesh duplication: " << (mesh_ok ? "ok" : "[duplicated meshes are wrong!]") << std::endl;
+	}
+
+	ss << std::endl << "4) Transform propagation test:" << std::endl;
+
+	// A mostly static scene, where 1% of the transforms move every frame, is compared with every transform being dirty:
+	{
+		const uint32_t transformCount = 1000000;
+		const uint32_t frameCount = 10;
+		TestScene test;
+		Scene& scene = test.scene;
+		Entity parent = INVALID_ENTITY;
+		for (uint32_t i = 0; i < transformCount; ++i)
+		{
+			Entity entity = CreateEntity();
+			scene.transforms.Create(entity).translation_local = XMFLOAT3(float(i % 1000), 0, float(i / 1000));
+			if (i % 4 == 0)
+			{
+				parent = entity;
+			}
+			else
+			{
+				scene.Component_Attach(entity, parent, true);
+			}
+		}
+
+		// The first update computes everything:
+		scene.RunTransformUpdateSystem(ctx);
+		wiJobSystem::Wait(ctx);
+		scene.RunHierarchyUpdateSystem(ctx);
+		wiJobSystem::Wait(ctx);
+
+		double times[2] = {};
+		size_t changed = 0;
+		for (int all_dirty = 1; all_dirty >= 0; --all_dirty)
+		{
+			for (uint32_t frame = 0; frame < frameCount; ++frame)
+			{
+				if (all_dirty)
+				{
+					for (size_t i = 0; i < scene.transforms.GetCount(); ++i)
+					{
+						scene.transforms[i].SetDirty();
+					}
+				}
+				else
+				{
+					for (size_t i = frame; i < scene.transforms.GetCount(); i += 100)
+					{
+						scene.transforms[i].Translate(XMFLOAT3(0, 0.01f, 0));
+					}
+				}
+				timer.record();
+				scene.RunTransformUpdateSystem(ctx);
+				wiJobSystem::Wait(ctx);
+				scene.RunHierarchyUpdateSystem(ctx);
+				wiJobSystem::Wait(ctx);
+				scene.GatherChangedTransforms(ctx);
+				times[all_dirty] += timer.elapsed();
+				changed = scene.changed_transforms.size();
+			}
+		}
+
+		ss << transformCount << " transforms, " << scene.hierarchy.GetCount() << " parented: ";
+		ss << "all dirty: " << times[1] / frameCount << " ms/frame, 1% moving: " << times[0] / frameCount << " ms/frame (" << changed << " changed)" << std::endl;
+
+		// A transform that is moved and updated outside of the scene update (like scripts and the editor do) must still count as changed:
+		TransformComponent& moved = scene.transforms[0];
+		moved.Translate(XMFLOAT3(0, 1, 0));
+		moved.UpdateTransform();
+		scene.RunTransformUpdateSystem(ctx);
+		wiJobSystem::Wait(ctx);
+		scene.RunHierarchyUpdateSystem(ctx);
+		wiJobSystem::Wait(ctx);
+		const TransformComponent& child = scene.transforms[1];
+		ss << "Children of a transform updated outside of the scene: " << (std::abs(child.world._42 - moved.world._42 - child.translation_local.y) < 0.001f ? "ok" : "FAILED") << std::endl;
+	}
+
+	ss << std::endl << "5) Pipelined update test:" << std::endl;
+
+	// The scene update is followed by CPU heavy work that reads the transforms like rendering would, with and without running the next simulation step in parallel to it:
+	{
+		const uint32_t transformCount = 100000;
+		const uint32_t frameCount = 60;
+		TestScene test;
+		Scene& scene = test.scene;
+		Entity parent = INVALID_ENTITY;
+		for (uint32_t i = 0; i < transformCount; ++i)
+		{
+			Entity entity = CreateEntity();
+			scene.transforms.Create(entity).translation_local = XMFLOAT3(0, 0.3f, 0.1f);
+			if (i % 16 == 0)
+			{
+				scene.transforms.GetComponent(entity)->translation_local = XMFLOAT3(float(i / 16 % 100), 0, float(i / 1600));
+			}
+			else
+			{
+				scene.Component_Attach(entity, parent, true);
+				if (i % 16 >= 2)
+				{
+					scene.springs.Create(entity).wind_affection = 0.5f;
+				}
+			}
+			parent = entity;
+		}
+		scene.Update(0);
+
+		double times[2] = {};
+		volatile float result = 0; // keeps the reads from being optimized away
+		for (int pipelined = 0; pipelined < 2; ++pipelined)
+		{
+			for (uint32_t frame = 0; frame < frameCount; ++frame)
+			{
+				timer.record();
+				for (size_t i = frame % 16; i < scene.transforms.GetCount(); i += 16)
+				{
+					scene.transforms[i].Translate(XMFLOAT3(0.001f, 0, 0));
+				}
+				scene.Update(1.0f / 60.0f);
+				if (pipelined)
+				{
+					scene.BeginSimulation(1.0f / 60.0f);
+				}
+				for (size_t i = 0; i < scene.transforms.GetCount(); ++i)
+				{
+					const TransformComponent* transform = scene.GetRenderTransform(scene.transforms.GetEntity(i));
+					XMVECTOR P = XMVector3Transform(transform->GetPositionV(), XMLoadFloat4x4(&transform->world));
+					result += XMVectorGetX(XMVector3LengthEst(P));
+				}
+				if (pipelined)
+				{
+					scene.WaitSimulation();
+				}
+				times[pipelined] += timer.elapsed();
+			}
+		}
+
+		ss << transformCount << " transforms, " << scene.springs.GetCount() << " springs: ";
+		ss << "sequential: " << times[0] / frameCount << " ms/frame, pipelined: " << times[1] / frameCount << " ms/frame";
+		ss << " (frame time reduced by " << (1 - times[1] / times[0]) * 100 << "% on " << wiJobSystem::GetThreadCount() << " threads)" << std::endl;
+	}
+
+	// The simulation only writes transforms while the frame is rendered, the animated morph weights are written to the mesh by the next Update():
+	{
+		TestScene test;
+		Scene& scene = test.scene;
+		Entity meshID = CreateEntity();
+		MeshComponent& mesh = scene.meshes.Create(meshID);
+		mesh.targets.resize(2);
+		Entity objectID = CreateEntity();
+		scene.transforms.Create(objectID);
+		scene.objects.Create(objectID).meshID = meshID;
+
+		Entity dataID = CreateEntity();
+		AnimationDataComponent& data = scene.animation_datas.Create(dataID);
+		data.keyframe_times = { 0, 0.51f, 1 };
+		data.keyframe_data = { 0.25f, 0.25f, 0.75f, 0.75f, 1, 1 };
+		AnimationComponent& animation = scene.animations.Create(CreateEntity());
+		animation.end = 1;
+		animation.timer = 0.5f;
+		animation.Play();
+		AnimationComponent::AnimationChannel& channel = animation.channels.emplace_back();
+		channel.target = objectID;
+		channel.path = AnimationComponent::AnimationChannel::Path::WEIGHTS;
+		channel.samplerIndex = 0;
+		AnimationComponent::AnimationSampler& sampler = animation.samplers.emplace_back();
+		sampler.data = dataID;
+		sampler.mode = AnimationComponent::AnimationSampler::Mode::STEP;
+
+		scene.BeginSimulation(1.0f / 60.0f);
+		scene.WaitSimulation();
+		const MeshComponent& animated = *scene.meshes.GetComponent(meshID);
+		bool success = animated.targets[0].weight > 0 && animated.targets[0].weight == animated.targets[1].weight;
+		scene.meshes.GetComponent(meshID)->dirty_morph = false;
+		scene.BeginSimulation(1.0f / 60.0f);
+		const float weight = animated.targets[0].weight;
+		success &= !animated.dirty_morph; // not touched while the simulation is running
+		scene.WaitSimulation();
+		success &= animated.dirty_morph && animated.targets[0].weight > weight;
+		ss << "Morph weights applied after the simulation: " << (success ? "ok" : "FAILED") << std::endl;
+	}
+
+	return ss.str();
+}
+std::string TestsRenderer::RunAnimationTest()
+{
+	wiTimer timer;
+
+	// This is created to be able to wait on the workload independently from other workload:
+	wiJobSystem::context ctx;
+
+	std::stringstream ss("");
+	ss << "Animation performance test:" << std::endl;
+	ss << "You can find out more in Tests.cpp, RunAnimationTest() function." << std::endl << std::endl;
+
+	ss << "1) Animation update test:" << std::endl;
+
+	// Many long clips are played, two animations are layered on every target, so they are grouped together by the animation system.
+	//	The keyframe search is compared against the linear search that it replaced, and the result is checked against the keyframe data:
+	{
+		const uint32_t targetCount = 1000;
+		const uint32_t keyCount = 3000;
+		const uint32_t frameCount = 60;
+		TestScene test;
+		Scene& scene = test.scene;
+
+		const AnimationComponent::AnimationChannel::Path paths[] = {
+			AnimationComponent::AnimationChannel::Path::TRANSLATION,
+			AnimationComponent::AnimationChannel::Path::ROTATION,
+			AnimationComponent::AnimationChannel::Path::SCALE,
+		};
+		Entity datas[arraysize(paths)];
+		for (size_t i = 0; i < arraysize(paths); ++i)
+		{
+			datas[i] = CreateEntity();
+			AnimationDataComponent& data = scene.animation_datas.Create(datas[i]);
+			const uint32_t stride = paths[i] == AnimationComponent::AnimationChannel::Path::ROTATION ? 4 : 3;
+			data.keyframe_times.resize(keyCount);
+			data.keyframe_data.resize(keyCount * stride);
+			for (uint32_t j = 0; j < keyCount; ++j)
+			{
+				data.keyframe_times[j] = j / 30.0f;
+				for (uint32_t k = 0; k < stride; ++k)
+				{
+					data.keyframe_data[j * stride + k] = stride == 4 ? (k == 3 ? 1.0f : 0.0f) : float(j + k);
+				}
+			}
+		}
+
+		for (uint32_t i = 0; i < targetCount; ++i)
+		{
+			Entity target = CreateEntity();
+			scene.transforms.Create(target);
+			for (uint32_t layer = 0; layer < 2; ++layer)
+			{
+				Entity entity = CreateEntity();
+				AnimationComponent& animation = scene.animations.Create(entity);
+				animation.end = (keyCount - 1) / 30.0f;
+				animation.timer = float((i * 7 + layer * 13) % keyCount) / 30.0f;
+				animation.Play();
+				for (size_t j = 0; j < arraysize(paths); ++j)
+				{
+					AnimationComponent::AnimationChannel& channel = animation.channels.emplace_back();
+					channel.target = target;
+					channel.path = paths[j];
+					channel.samplerIndex = (int)j;
+					AnimationComponent::AnimationSampler& sampler = animation.samplers.emplace_back();
+					sampler.data = datas[j];
+					sampler.mode = j == 0 ? AnimationComponent::AnimationSampler::Mode::STEP : AnimationComponent::AnimationSampler::Mode::LINEAR;
+				}
+			}
+		}
+		scene.dt = 1.0f / 60.0f;
+
+		timer.record();
+		uint32_t keys = 0;
+		for (uint32_t frame = 0; frame < frameCount; ++frame)
+		{
+			for (size_t i = 0; i < scene.animations.GetCount(); ++i)
+			{
+				const AnimationComponent& animation = scene.animations[i];
+				for (const AnimationComponent::AnimationChannel& channel : animation.channels)
+				{
+					const AnimationDataComponent& data = *scene.animation_datas.GetComponent(animation.samplers[channel.samplerIndex].data);
+					int keyRight = 0;
+					while (data.keyframe_times[keyRight++] < animation.timer) {}
+					keys += keyRight;
+				}
+			}
+		}
+		double time_linear = timer.elapsed();
+
+		uint32_t mismatches = 0;
+		timer.record();
+		for (uint32_t frame = 0; frame < frameCount; ++frame)
+		{
+			scene.RunAnimationUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+		}
+		double time_parallel = timer.elapsed();
+
+		// After one more step, the translation of every target must be the left keyframe of the second (top layer) animation:
+		std::vector<float> expected(targetCount);
+		const AnimationDataComponent& translations = *scene.animation_datas.GetComponent(datas[0]);
+		for (uint32_t i = 0; i < targetCount; ++i)
+		{
+			const AnimationComponent& animation = scene.animations[i * 2 + 1];
+			int keyRight = int(std::lower_bound(translations.keyframe_times.begin(), translations.keyframe_times.end(), animation.timer) - translations.keyframe_times.begin());
+			keyRight = std::min(keyRight, int(keyCount - 1));
+			expected[i] = translations.keyframe_data[std::max(0, keyRight - 1) * 3];
+		}
+		scene.RunAnimationUpdateSystem(ctx);
+		wiJobSystem::Wait(ctx);
+		for (uint32_t i = 0; i < targetCount; ++i)
+		{
+			const TransformComponent& transform = *scene.transforms.GetComponent(scene.animations[i * 2].channels[0].target);
+			if (std::abs(transform.translation_local.x - expected[i]) > 0.001f)
+			{
+				mismatches++;
+			}
+		}
+
+		ss << scene.animations.GetCount() << " animations, " << keyCount << " keyframes, " << scene.animation_update_groups.GetCount() << " groups: ";
+		ss << "linear keyframe search alone: " << time_linear / frameCount << " ms/frame, parallel update: " << time_parallel / frameCount << " ms/frame";
+		ss << " (mismatches: " << mismatches << ", searched: " << keys << ")" << std::endl;
+	}
+
+	ss << std::endl << "2) Animation compression test:" << std::endl;
+
+	// A long motion captured clip (uniformly sampled, smooth rotations and translations, constant scales) is played on skeletons,
+	//	once with the raw keyframes and once compressed, then the memory, update time and the difference of the results are compared:
+	{
+		const uint32_t boneCount = 100;
+		const uint32_t skeletonCount = 10;
+		const uint32_t keyCount = 6000;
+		const uint32_t frameCount = 60;
+		const float frameRate = 120;
+		TestScene tests[2];
+		for (int compressed = 0; compressed < 2; ++compressed)
+		{
+			Scene& scene = tests[compressed].scene;
+			std::vector<Entity> datas(boneCount * 3);
+			for (uint32_t i = 0; i < boneCount * 3; ++i)
+			{
+				datas[i] = CreateEntity();
+				AnimationDataComponent& data = scene.animation_datas.Create(datas[i]);
+				const uint32_t path = i % 3;
+				data.keyframe_times.resize(keyCount);
+				data.keyframe_data.resize(keyCount * (path == 1 ? 4 : 3));
+				for (uint32_t j = 0; j < keyCount; ++j)
+				{
+					const float time = j / frameRate;
+					data.keyframe_times[j] = time;
+					switch (path)
+					{
+					case 0:
+						((XMFLOAT3*)data.keyframe_data.data())[j] = i < 3 ? XMFLOAT3(std::sin(time), 1, time) : XMFLOAT3(0, 0.1f * i, 0);
+						break;
+					case 1:
+						XMStoreFloat4((XMFLOAT4*)data.keyframe_data.data() + j, XMQuaternionRotationRollPitchYaw(std::sin(time + i) * 0.5f, std::cos(time * 0.7f) * 0.3f, time * 0.1f));
+						break;
+					default:
+						((XMFLOAT3*)data.keyframe_data.data())[j] = XMFLOAT3(1, 1, 1);
+						break;
+					}
+				}
+			}
+
+			for (uint32_t i = 0; i < skeletonCount; ++i)
+			{
+				Entity entity = CreateEntity();
+				AnimationComponent& animation = scene.animations.Create(entity);
+				animation.end = (keyCount - 1) / frameRate;
+				animation.timer = i * 3.7f;
+				animation.Play();
+				for (uint32_t j = 0; j < boneCount * 3; ++j)
+				{
+					if (j % 3 == 0)
+					{
+						Entity bone = CreateEntity();
+						scene.transforms.Create(bone);
+					}
+					AnimationComponent::AnimationChannel& channel = animation.channels.emplace_back();
+					channel.target = scene.transforms.GetEntity(scene.transforms.GetCount() - 1);
+					channel.path = (AnimationComponent::AnimationChannel::Path)(j % 3);
+					channel.samplerIndex = (int)j;
+					animation.samplers.emplace_back().data = datas[j];
+				}
+			}
+
+			if (compressed)
+			{
+				timer.record();
+				scene.CompressAnimations();
+				ss << "compression: " << timer.elapsed() << " ms, ";
+			}
+		}
+
+		size_t memory[2] = {};
+		double times[2] = {};
+		float error_translation = 0;
+		float error_rotation = 0;
+		for (int compressed = 0; compressed < 2; ++compressed)
+		{
+			const Scene& scene = tests[compressed].scene;
+			for (size_t i = 0; i < scene.animation_datas.GetCount(); ++i)
+			{
+				const AnimationDataComponent& data = scene.animation_datas[i];
+				memory[compressed] += data.keyframe_times.size() * sizeof(float) + data.keyframe_data.size() * sizeof(float);
+				memory[compressed] += data.keyframe_frames.size() * sizeof(uint16_t) + data.compressed_data.size() * sizeof(uint16_t);
+			}
+		}
+		for (uint32_t frame = 0; frame < frameCount; ++frame)
+		{
+			for (int compressed = 0; compressed < 2; ++compressed)
+			{
+				Scene& scene = tests[compressed].scene;
+				scene.dt = 1.0f / 60.0f;
+				timer.record();
+				scene.RunAnimationUpdateSystem(ctx);
+				wiJobSystem::Wait(ctx);
+				times[compressed] += timer.elapsed();
+			}
+			for (size_t i = 0; i < tests[0].scene.transforms.GetCount(); ++i)
+			{
+				const TransformComponent& a = tests[0].scene.transforms[i];
+				const TransformComponent& b = tests[1].scene.transforms[i];
+				// The angle between the rotations is computed from the chord length, because acos is not precise for small angles:
+				const XMVECTOR Ra = XMLoadFloat4(&a.rotation_local);
+				XMVECTOR Rb = XMLoadFloat4(&b.rotation_local);
+				Rb = XMVectorGetX(XMVector4Dot(Ra, Rb)) < 0 ? -Rb : Rb;
+				error_translation = std::max(error_translation, XMVectorGetX(XMVector3Length(XMLoadFloat3(&a.translation_local) - XMLoadFloat3(&b.translation_local))));
+				error_rotation = std::max(error_rotation, 4 * std::asin(std::min(1.0f, XMVectorGetX(XMVector4Length(Ra - Rb)) * 0.5f)));
+			}
+		}
+
+		ss << "raw: " << memory[0] / 1024 << " KB, " << times[0] / frameCount << " ms/frame, compressed: " << memory[1] / 1024 << " KB, " << times[1] / frameCount << " ms/frame";
+		ss << " (max error: " << error_translation << " translation, " << XMConvertToDegrees(error_rotation) << " degrees rotation)" << std::endl;
+	}
+
+	// The quantization error is part of the tolerance: a track with a range that is too large for it is not compressed,
+	//	and the compressed track is sampled at every original key (also with a CUBICSPLINE sampler, that interpolates the compressed keys linearly):
+	{
+		const uint32_t keyCount = 1000;
+		const float tolerance = 0.0001f;
+		TestScene test;
+		Scene& scene = test.scene;
+		Entity datas[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			datas[i] = CreateEntity();
+			AnimationDataComponent& data = scene.animation_datas.Create(datas[i]);
+			const float range = i == 0 ? 10000.0f : 4.0f;
+			for (uint32_t j = 0; j < keyCount; ++j)
+			{
+				const float time = j / 30.0f;
+				data.keyframe_times.push_back(time);
+				data.keyframe_data.push_back(range * 0.5f * (1 + std::sin(time)));
+				data.keyframe_data.push_back(range * j / keyCount);
+				data.keyframe_data.push_back(0);
+			}
+		}
+		const std::vector<float> original = scene.animation_datas.GetComponent(datas[1])->keyframe_data;
+		const std::vector<float> times = scene.animation_datas.GetComponent(datas[1])->keyframe_times;
+
+		Entity target = CreateEntity();
+		scene.transforms.Create(target);
+		AnimationComponent& animation = scene.animations.Create(CreateEntity());
+		animation.end = (keyCount - 1) / 30.0f;
+		animation.Play();
+		scene.dt = 0;
+		for (int i = 0; i < 2; ++i)
+		{
+			AnimationComponent::AnimationChannel& channel = animation.channels.emplace_back();
+			channel.target = target;
+			channel.path = AnimationComponent::AnimationChannel::Path::TRANSLATION;
+			channel.samplerIndex = i;
+			animation.samplers.emplace_back().data = datas[i];
+		}
+		scene.CompressAnimations(tolerance);
+
+		const AnimationDataComponent& large = *scene.animation_datas.GetComponent(datas[0]);
+		const AnimationDataComponent& compressed = *scene.animation_datas.GetComponent(datas[1]);
+		bool success = !large.IsCompressed() && compressed.IsCompressed() && compressed.GetKeyCount() < keyCount;
+
+		// Only the compressed track is sampled, once LINEAR and once as CUBICSPLINE:
+		animation.channels.erase(animation.channels.begin());
+		animation.channels.back().samplerIndex = 1;
+		float max_error = 0;
+		for (int cubic = 0; cubic < 2; ++cubic)
+		{
+			animation.samplers[1].mode = cubic ? AnimationComponent::AnimationSampler::Mode::CUBICSPLINE : AnimationComponent::AnimationSampler::Mode::LINEAR;
+			for (uint32_t j = 0; j < keyCount; ++j)
+			{
+				animation.timer = times[j];
+				scene.RunAnimationUpdateSystem(ctx);
+				wiJobSystem::Wait(ctx);
+				const XMFLOAT3 value = scene.transforms.GetComponent(target)->translation_local;
+				max_error = std::max(max_error, std::abs(value.x - original[j * 3 + 0]));
+				max_error = std::max(max_error, std::abs(value.y - original[j * 3 + 1]));
+			}
+		}
+		success &= max_error <= tolerance;
+		ss << "Compression error within tolerance (" << max_error << " <= " << tolerance << "), large range kept uncompressed: " << (success ? "ok" : "FAILED") << std::endl;
+	}
+
+	ss << std::endl << "3) Spring and IK update test:" << std::endl;
+
+	// Characters with spring tails and IK arms are updated with the groups by hierarchy root, and with everything forced into one group (serial):
+	{
+		const uint32_t characterCount = 200;
+		const uint32_t frameCount = 60;
+		TestScene test;
+		Scene& scene = test.scene;
+		for (uint32_t i = 0; i < characterCount; ++i)
+		{
+			Entity root = CreateEntity();
+			scene.transforms.Create(root).translation_local = XMFLOAT3(i * 3.0f, 0, 0);
+			Entity target = CreateEntity();
+			scene.transforms.Create(target).translation_local = XMFLOAT3(i * 3.0f + 1, 2, 1);
+
+			Entity parent = root;
+			for (uint32_t j = 0; j < 16; ++j)
+			{
+				Entity entity = CreateEntity();
+				scene.transforms.Create(entity).translation_local = XMFLOAT3(0, 0.3f, 0.1f);
+				scene.Component_Attach(entity, parent, true);
+				if (j >= 2)
+				{
+					SpringComponent& spring = scene.springs.Create(entity);
+					spring.wind_affection = 0.5f;
+				}
+				parent = entity;
+			}
+
+			parent = root;
+			for (uint32_t j = 0; j < 4; ++j)
+			{
+				Entity entity = CreateEntity();
+				scene.transforms.Create(entity).translation_local = XMFLOAT3(0.4f, 0.1f, 0);
+				scene.Component_Attach(entity, parent, true);
+				parent = entity;
+			}
+			InverseKinematicsComponent& ik = scene.inverse_kinematics.Create(parent);
+			ik.target = target;
+			ik.chain_length = 3;
+			ik.iteration_count = 4;
+		}
+
+		double times[2] = {};
+		for (int grouped = 1; grouped >= 0; --grouped)
+		{
+			for (uint32_t frame = 0; frame < frameCount; ++frame)
+			{
+				scene.RunTransformUpdateSystem(ctx);
+				wiJobSystem::Wait(ctx);
+				scene.RunHierarchyUpdateSystem(ctx);
+				wiJobSystem::Wait(ctx);
+				if (!grouped)
+				{
+					// The groups are rebuilt with everything in one group, and marked up to date, so that the systems keep using them:
+					scene.spring_update_groups.Build(nullptr, (uint32_t)scene.springs.GetCount(), 1, true);
+					scene.spring_update_groups.versions[0] = scene.springs.GetVersion();
+					scene.spring_update_groups.versions[1] = scene.hierarchy_update_generation;
+					scene.inverse_kinematics_update_groups.Build(nullptr, (uint32_t)scene.inverse_kinematics.GetCount(), 2, true);
+					scene.inverse_kinematics_update_groups.versions[0] = scene.inverse_kinematics.GetVersion();
+					scene.inverse_kinematics_update_groups.versions[1] = scene.hierarchy_update_generation;
+				}
+				scene.dt = 1.0f / 60.0f;
+				timer.record();
+				scene.RunSpringUpdateSystem(ctx);
+				wiJobSystem::Wait(ctx);
+				scene.RunInverseKinematicsUpdateSystem(ctx);
+				wiJobSystem::Wait(ctx);
+				times[grouped] += timer.elapsed();
+			}
+		}
+
+		ss << characterCount << " characters, " << scene.springs.GetCount() << " springs, " << scene.inverse_kinematics.GetCount() << " IK: ";
+		ss << "one group: " << times[0] / frameCount << " ms/frame, grouped by hierarchy root: " << times[1] / frameCount << " ms/frame" << std::endl;
+	}
+
+	return ss.str();
+}
+std::string TestsRenderer::RunSceneQueryTest()
+{
+	wiTimer timer;
+
+	// This is created to be able to wait on the workload independently from other workload:
+	wiJobSystem::context ctx;
+
+	std::stringstream ss("");
+	ss << "Scene query performance test:" << std::endl;
+	ss << "You can find out more in Tests.cpp, RunSceneQueryTest() function." << std::endl << std::endl;
+
+	ss << "1) Scene query test:" << std::endl;
+
+	// Ray, sphere and capsule queries in scenes of increasing object count, with the object BVH and with testing every object's bounds:
+	{
+		const uint32_t queryCount = 1000;
+		auto random = [](float minValue, float maxValue) { return minValue + (maxValue - minValue) * (rand() / float(RAND_MAX)); };
+		for (uint32_t objectCount : { 1000u, 10000u, 100000u })
+		{
+			TestScene test;
+			Scene& scene = test.scene;
+
+			// Every object is an instance of the same cube mesh:
+			Entity materialEntity = scene.Entity_CreateMaterial("material");
+			Entity meshEntity = scene.Entity_CreateMesh("cube");
+			MeshComponent& mesh = *scene.meshes.GetComponent(meshEntity);
+			for (int i = 0; i < 8; ++i)
+			{
+				mesh.vertex_positions.push_back(XMFLOAT3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f));
+			}
+			mesh.indices = {
+				0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1,
+				2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3,
+			};
+			mesh.subsets.emplace_back();
+			mesh.subsets.back().materialID = materialEntity;
+			mesh.subsets.back().indexCount = (uint32_t)mesh.indices.size();
+			mesh.SetDoubleSided(true);
+			mesh.CreateRenderData();
+
+			// The objects are spread out so that the density is the same in every scene size:
+			const float extent = std::cbrt(float(objectCount)) * 4;
+			for (uint32_t i = 0; i < objectCount; ++i)
+			{
+				Entity entity = scene.Entity_CreateObject("");
+				scene.objects.GetComponent(entity)->meshID = meshEntity;
+				scene.transforms.GetComponent(entity)->Translate(XMFLOAT3(random(-extent, extent), random(-extent, extent), random(-extent, extent)));
+			}
+			scene.Update(0);
+
+			std::vector<RAY> rays;
+			std::vector<SPHERE> spheres;
+			std::vector<CAPSULE> capsules;
+			for (uint32_t i = 0; i < queryCount; ++i)
+			{
+				const XMFLOAT3 position = XMFLOAT3(random(-extent, extent), random(-extent, extent), random(-extent, extent));
+				rays.push_back(RAY(position, XMFLOAT3(random(-1, 1), random(-1, 1), random(-1, 1))));
+				spheres.push_back(SPHERE(position, 1.0f));
+				capsules.push_back(CAPSULE(spheres.back(), 3.0f));
+			}
+
+			// The BVH is used first, then it is cleared, so the queries fall back to testing every object:
+			//	The sphere and capsule results are kept to check that the BVH returns the same hit, not only a hit
+			double qps[2][3] = {};
+			uint32_t hits[2][3] = {};
+			std::vector<SceneIntersectSphereResult> sphere_results[2];
+			std::vector<SceneIntersectSphereResult> capsule_results[2];
+			for (int bvh = 1; bvh >= 0; --bvh)
+			{
+				if (!bvh)
+				{
+					scene.object_bvh.Clear();
+				}
+				timer.record();
+				for (const RAY& ray : rays)
+				{
+					hits[bvh][0] += Pick(ray, RENDERTYPE_ALL, ~0u, scene).entity != INVALID_ENTITY;
+				}
+				qps[bvh][0] = queryCount / (timer.elapsed() / 1000.0);
+				timer.record();
+				for (const SPHERE& sphere : spheres)
+				{
+					const SceneIntersectSphereResult result = SceneIntersectSphere(sphere, RENDERTYPE_ALL, ~0u, scene);
+					hits[bvh][1] += result.entity != INVALID_ENTITY;
+					sphere_results[bvh].push_back(result);
+				}
+				qps[bvh][1] = queryCount / (timer.elapsed() / 1000.0);
+				timer.record();
+				for (const CAPSULE& capsule : capsules)
+				{
+					const SceneIntersectSphereResult result = SceneIntersectCapsule(capsule, RENDERTYPE_ALL, ~0u, scene);
+					hits[bvh][2] += result.entity != INVALID_ENTITY;
+					capsule_results[bvh].push_back(result);
+				}
+				qps[bvh][2] = queryCount / (timer.elapsed() / 1000.0);
+			}
+			auto same_result = [](const SceneIntersectSphereResult& a, const SceneIntersectSphereResult& b) {
+				return a.entity == b.entity && a.position.x == b.position.x && a.position.y == b.position.y && a.position.z == b.position.z;
+			};
+			uint32_t result_mismatches = 0;
+			for (uint32_t i = 0; i < queryCount; ++i)
+			{
+				result_mismatches += !same_result(sphere_results[0][i], sphere_results[1][i]);
+				result_mismatches += !same_result(capsule_results[0][i], capsule_results[1][i]);
+			}
+
+			ss << objectCount << " objects, queries/second with BVH (without): ";
+			ss << "ray: " << (uint64_t)qps[1][0] << " (" << (uint64_t)qps[0][0] << "), ";
+			ss << "sphere: " << (uint64_t)qps[1][1] << " (" << (uint64_t)qps[0][1] << "), ";
+			ss << "capsule: " << (uint64_t)qps[1][2] << " (" << (uint64_t)qps[0][2] << ")";
+			if (hits[0][0] != hits[1][0] || hits[0][1] != hits[1][1] || hits[0][2] != hits[1][2])
+			{
+				ss << " [hit count mismatch!]";
+			}
+			if (result_mismatches > 0)
+			{
+				ss << " [" << result_mismatches << " sphere/capsule results differ with the BVH!]";
+			}
+			ss << std::endl;
+		}
+	}
+
+	ss << std::endl << "2) Mesh BVH test:" << std::endl;
+
+	// Ray, sphere and capsule queries against one object with a high triangle count mesh, with testing every triangle and with the mesh BVH:
+	{
+		const uint32_t queryCount = 1000;
+		auto random = [](float minValue, float maxValue) { return minValue + (maxValue - minValue) * (rand() / float(RAND_MAX)); };
+		for (uint32_t gridSize : { 64u, 256u, 512u })
+		{
+			TestScene test;
+			Scene& scene = test.scene;
+
+			// A wavy grid, like a terrain:
+			Entity materialEntity = scene.Entity_CreateMaterial("material");
+			Entity meshEntity = scene.Entity_CreateMesh("grid");
+			MeshComponent& mesh = *scene.meshes.GetComponent(meshEntity);
+			for (uint32_t y = 0; y <= gridSize; ++y)
+			{
+				for (uint32_t x = 0; x <= gridSize; ++x)
+				{
+					const float u = float(x) / gridSize * 2 - 1;
+					const float v = float(y) / gridSize * 2 - 1;
+					mesh.vertex_positions.push_back(XMFLOAT3(u, std::sin(u * 10) * std::cos(v * 10) * 0.1f, v));
+				}
+			}
+			for (uint32_t y = 0; y < gridSize; ++y)
+			{
+				for (uint32_t x = 0; x < gridSize; ++x)
+				{
+					const uint32_t i = y * (gridSize + 1) + x;
+					mesh.indices.insert(mesh.indices.end(), { i, i + gridSize + 1, i + 1, i + 1, i + gridSize + 1, i + gridSize + 2 });
+				}
+			}
+			mesh.subsets.emplace_back();
+			mesh.subsets.back().materialID = materialEntity;
+			mesh.subsets.back().indexCount = (uint32_t)mesh.indices.size();
+			mesh.SetDoubleSided(true);
+			mesh.CreateRenderData();
+
+			// The object is scaled and rotated, so the queries are transformed into the mesh's space:
+			Entity objectEntity = scene.Entity_CreateObject("grid");
+			scene.objects.GetComponent(objectEntity)->meshID = meshEntity;
+			TransformComponent& transform = *scene.transforms.GetComponent(objectEntity);
+			transform.Scale(XMFLOAT3(100, 50, 100));
+			transform.RotateRollPitchYaw(XMFLOAT3(0.1f, 0.5f, 0.2f));
+			scene.Update(0);
+
+			std::vector<RAY> rays;
+			std::vector<SPHERE> spheres;
+			std::vector<CAPSULE> capsules;
+			for (uint32_t i = 0; i < queryCount; ++i)
+			{
+				const XMFLOAT3 position = XMFLOAT3(random(-80, 80), random(-20, 20), random(-80, 80));
+				rays.push_back(RAY(position, XMFLOAT3(random(-1, 1), random(-1, 1), random(-1, 1))));
+				spheres.push_back(SPHERE(position, 1.0f));
+				capsules.push_back(CAPSULE(spheres.back(), 3.0f));
+			}
+
+			// The first queries don't have a BVH yet, they only request it from the next update:
+			//	The sphere and capsule results are kept to check that the BVH returns the same hit, not only a hit
+			double qps[2][3] = {};
+			uint32_t hits[2][3] = {};
+			std::vector<SceneIntersectSphereResult> sphere_results[2];
+			std::vector<SceneIntersectSphereResult> capsule_results[2];
+			double buildTime = 0;
+			for (int bvh = 0; bvh <= 1; ++bvh)
+			{
+				if (bvh)
+				{
+					timer.record();
+					scene.Update(0);
+					buildTime = timer.elapsed();
+				}
+				timer.record();
+				for (const RAY& ray : rays)
+				{
+					hits[bvh][0] += Pick(ray, RENDERTYPE_ALL, ~0u, scene).entity != INVALID_ENTITY;
+				}
+				qps[bvh][0] = queryCount / (timer.elapsed() / 1000.0);
+				timer.record();
+				for (const SPHERE& sphere : spheres)
+				{
+					const SceneIntersectSphereResult result = SceneIntersectSphere(sphere, RENDERTYPE_ALL, ~0u, scene);
+					hits[bvh][1] += result.entity != INVALID_ENTITY;
+					sphere_results[bvh].push_back(result);
+				}
+				qps[bvh][1] = queryCount / (timer.elapsed() / 1000.0);
+				timer.record();
+				for (const CAPSULE& capsule : capsules)
+				{
+					const SceneIntersectSphereResult result = SceneIntersectCapsule(capsule, RENDERTYPE_ALL, ~0u, scene);
+					hits[bvh][2] += result.entity != INVALID_ENTITY;
+					capsule_results[bvh].push_back(result);
+				}
+				qps[bvh][2] = queryCount / (timer.elapsed() / 1000.0);
+			}
+			auto same_result = [](const SceneIntersectSphereResult& a, const SceneIntersectSphereResult& b) {
+				return a.entity == b.entity && a.position.x == b.position.x && a.position.y == b.position.y && a.position.z == b.position.z;
+			};
+			uint32_t result_mismatches = 0;
+			for (uint32_t i = 0; i < queryCount; ++i)
+			{
+				result_mismatches += !same_result(sphere_results[0][i], sphere_results[1][i]);
+				result_mismatches += !same_result(capsule_results[0][i], capsule_results[1][i]);
+			}
+
+			ss << mesh.indices.size() / 3 << " triangles, BVH built in " << buildTime << " ms, queries/second with BVH (without): ";
+			ss << "ray: " << (uint64_t)qps[1][0] << " (" << (uint64_t)qps[0][0] << "), ";
+			ss << "sphere: " << (uint64_t)qps[1][1] << " (" << (uint64_t)qps[0][1] << "), ";
+			ss << "capsule: " << (uint64_t)qps[1][2] << " (" << (uint64_t)qps[0][2] << ")";
+			if (!mesh.bvh.IsValid())
+			{
+				ss << " [BVH was not built!]";
+			}
+			if (hits[0][0] != hits[1][0] || hits[0][1] != hits[1][1] || hits[0][2] != hits[1][2])
+			{
+				ss << " [hit count mismatch!]";
+			}
+			if (result_mismatches > 0)
+			{
+				ss << " [" << result_mismatches << " sphere/capsule results differ with the BVH!]";
+			}
+			ss << std::endl;
+
+			// The mesh is edited in place like the editor's sculpting and mesh optimization do, the triangle count doesn't change, but the queries must not use the old BVH:
+			//	The grid is flattened to the local height 0.5, then the triangle order is reversed, and a ray is picked after each edit, before and after the next update
+			const XMMATRIX W = XMLoadFloat4x4(&transform.world);
+			const XMVECTOR expected = XMVector3Transform(XMVectorSet(0.1f, 0.5f, 0.1f, 1), W);
+			const RAY editRay(XMVector3Transform(XMVectorSet(0.1f, 2, 0.1f, 1), W), XMVector3Normalize(XMVector3TransformNormal(XMVectorSet(0, -1, 0, 0), W)));
+			auto edit_hit = [&]() {
+				const PickResult result = Pick(editRay, RENDERTYPE_ALL, ~0u, scene);
+				return result.entity == objectEntity && XMVectorGetX(XMVector3Length(XMLoadFloat3(&result.position) - expected)) < 0.01f;
+			};
+			bool edit_ok = true;
+			for (XMFLOAT3& position : mesh.vertex_positions)
+			{
+				position.y = 0.5f;
+			}
+			mesh.CreateRenderData();
+			edit_ok &= edit_hit();
+			scene.Update(0);
+			edit_ok &= edit_hit() && !mesh.dirty_bvh;
+			for (size_t i = 0; i < mesh.indices.size() / 2; i += 3)
+			{
+				const size_t j = mesh.indices.size() - 3 - i;
+				std::swap(mesh.indices[i + 0], mesh.indices[j + 0]);
+				std::swap(mesh.indices[i + 1], mesh.indices[j + 1]);
+				std::swap(mesh.indices[i + 2], mesh.indices[j + 2]);
+			}
+			mesh.CreateRenderData();
+			edit_ok &= edit_hit();
+			scene.Update(0);
+			edit_ok &= edit_hit();
+			if (!edit_ok)
+			{
+				ss << "\t[pick after editing the mesh in place hit the old surface!]" << std::endl;
+			}
+
+			// The BVH is saved with the mesh, the loaded copy can be used by the queries without waiting for the next update:
+			{
+				wiArchive archive;
+				archive.SetReadModeAndResetPos(false);
+				scene.Entity_Serialize(archive, meshEntity);
+				archive.SetReadModeAndResetPos(true);
+				const Entity loadedEntity = scene.Entity_Serialize(archive);
+				const MeshComponent& loaded = *scene.meshes.GetComponent(loadedEntity);
+				if (!loaded.bvh.IsValid() || loaded.dirty_bvh)
+				{
+					ss << "\t[the loaded mesh BVH waits for a refit!]" << std::endl;
+				}
+			}
+		}
+	}
+
+	ss << std::endl << "3) Batched pick test:" << std::endl;
+
+	// 100k rays in a scene of 10k objects, traced one by one with Pick(), and together with PickBatch() and PickBatchOcclusion():
+	{
+		const uint32_t objectCount = 10000;
+		const uint32_t rayCount = 100000;
+		auto random = [](float minValue, float maxValue) { return minValue + (maxValue - minValue) * (rand() / float(RAND_MAX)); };
+		TestScene test;
+		Scene& scene = test.scene;
+
+		// Every object is an instance of the same sphere mesh, with random scaling and rotation:
+		Entity materialEntity = scene.Entity_CreateMaterial("material");
+		Entity meshEntity = scene.Entity_CreateMesh("sphere");
+		MeshComponent& mesh = *scene.meshes.GetComponent(meshEntity);
+		const uint32_t rings = 16;
+		const uint32_t segments = 32;
+		for (uint32_t ring = 0; ring <= rings; ++ring)
+		{
+			for (uint32_t segment = 0; segment <= segments; ++segment)
+			{
+				const float theta = XM_PI * ring / rings;
+				const float phi = XM_2PI * segment / segments;
+				mesh.vertex_positions.push_back(XMFLOAT3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+			}
+		}
+		for (uint32_t ring = 0; ring < rings; ++ring)
+		{
+			for (uint32_t segment = 0; segment < segments; ++segment)
+			{
+				const uint32_t i = ring * (segments + 1) + segment;
+				mesh.indices.insert(mesh.indices.end(), { i, i + 1, i + segments + 1, i + 1, i + segments + 2, i + segments + 1 });
+			}
+		}
+		mesh.subsets.emplace_back();
+		mesh.subsets.back().materialID = materialEntity;
+		mesh.subsets.back().indexCount = (uint32_t)mesh.indices.size();
+		mesh.SetDoubleSided(true);
+		mesh.CreateRenderData();
+
+		const float extent = std::cbrt(float(objectCount)) * 4;
+		for (uint32_t i = 0; i < objectCount; ++i)
+		{
+			Entity entity = scene.Entity_CreateObject("");
+			scene.objects.GetComponent(entity)->meshID = meshEntity;
+			TransformComponent& transform = *scene.transforms.GetComponent(entity);
+			transform.Scale(XMFLOAT3(random(0.5f, 2), random(0.5f, 2), random(0.5f, 2)));
+			transform.RotateRollPitchYaw(XMFLOAT3(random(-XM_PI, XM_PI), random(-XM_PI, XM_PI), random(-XM_PI, XM_PI)));
+			transform.Translate(XMFLOAT3(random(-extent, extent), random(-extent, extent), random(-extent, extent)));
+		}
+		scene.Update(0);
+
+		std::vector<RAY> rays;
+		std::vector<float> maxDistances;
+		for (uint32_t i = 0; i < rayCount; ++i)
+		{
+			rays.push_back(RAY(XMFLOAT3(random(-extent, extent), random(-extent, extent), random(-extent, extent)), XMFLOAT3(random(-1, 1), random(-1, 1), random(-1, 1))));
+			maxDistances.push_back(random(0, extent));
+		}
+
+		// The first pick requests the mesh BVH, which is built by the next update:
+		Pick(rays[0], RENDERTYPE_ALL, ~0u, scene);
+		scene.Update(0);
+
+		std::vector<PickResult> results(rayCount);
+		std::vector<PickResult> batchResults(rayCount);
+		std::unique_ptr<bool[]> occluded(new bool[rayCount]);
+
+		timer.record();
+		for (uint32_t i = 0; i < rayCount; ++i)
+		{
+			results[i] = Pick(rays[i], RENDERTYPE_ALL, ~0u, scene);
+		}
+		const double pickTime = timer.elapsed();
+
+		timer.record();
+		PickBatch(rays.data(), rays.size(), batchResults.data(), RENDERTYPE_ALL, ~0u, scene);
+		const double batchTime = timer.elapsed();
+
+		timer.record();
+		PickBatchOcclusion(rays.data(), rays.size(), occluded.get(), maxDistances.data(), RENDERTYPE_ALL, ~0u, scene);
+		const double occlusionTime = timer.elapsed();
+
+		uint32_t hitMismatch = 0;
+		uint32_t occlusionMismatch = 0;
+		for (uint32_t i = 0; i < rayCount; ++i)
+		{
+			hitMismatch += results[i].entity != batchResults[i].entity;
+			occlusionMismatch += (results[i].distance < maxDistances[i]) != occluded[i];
+		}
+
+		ss << rayCount << " rays, rays/second with Pick(): " << (uint64_t)(rayCount / (pickTime / 1000.0));
+		ss << ", PickBatch(): " << (uint64_t)(rayCount / (batchTime / 1000.0));
+		ss << ", PickBatchOcclusion(): " << (uint64_t)(rayCount / (occlusionTime / 1000.0));
+		if (hitMismatch > 0 || occlusionMismatch > 0)
+		{
+			// Rays that hit exactly on the edge between two triangles can have different results, because the SIMD test rounds differently:
+			ss << " [" << hitMismatch << " hit and " << occlusionMismatch << " occlusion mismatch]";
+		}
+		ss << std::endl;
+
+		// Layers changed since the last update must be respected the same way by Pick() and PickBatch():
+		for (size_t i = 0; i < scene.objects.GetCount(); i += 2)
+		{
+			scene.layers.GetComponent(scene.objects.GetEntity(i))->layerMask = 1 << 1;
+		}
+		const size_t layerRayCount = 1000;
+		uint32_t layerMismatch = 0;
+		PickBatch(rays.data(), layerRayCount, batchResults.data(), RENDERTYPE_ALL, 1 << 0, scene);
+		for (size_t i = 0; i < layerRayCount; ++i)
+		{
+			layerMismatch += Pick(rays[i], RENDERTYPE_ALL, 1 << 0, scene).entity != batchResults[i].entity;
+		}
+		ss << "Pick() and PickBatch() with layers changed since the last update: " << (layerMismatch == 0 ? "ok" : "FAILED") << std::endl;
+	}
+
+	return ss.str();
+}
+std::string TestsRenderer::RunCullingTest()
+{
+	wiTimer timer;
+
+	// This is created to be able to wait on the workload independently from other workload:
+	wiJobSystem::context ctx;
+
+	std::stringstream ss("");
+	ss << "Culling performance test:" << std::endl;
+	ss << "You can find out more in Tests.cpp, RunCullingTest() function." << std::endl << std::endl;
+
+	ss << "1) SIMD frustum culling test:" << std::endl;
+
+	// The objects of the 65k Instances test are culled one by one with Frustum::CheckBoxFast(), and 8 at a time with Frustum::CheckBoxesFast():
+	{
+		TestScene test;
+		Scene& scene = test.scene;
+
+		Entity meshEntity = scene.Entity_CreateMesh("cube");
+		MeshComponent& mesh = *scene.meshes.GetComponent(meshEntity);
+		for (int i = 0; i < 8; ++i)
+		{
+			mesh.vertex_positions.push_back(XMFLOAT3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f));
+		}
+		mesh.indices = { 0, 1, 2 };
+		mesh.subsets.emplace_back();
+		mesh.subsets.back().indexCount = 3;
+		mesh.CreateRenderData();
+
+		const float scale = 0.06f;
+		for (int x = 0; x < 32; ++x)
+		{
+			for (int y = 0; y < 32; ++y)
+			{
+				for (int z = 0; z < 64; ++z)
+				{
+					Entity entity = scene.Entity_CreateObject("");
+					scene.objects.GetComponent(entity)->meshID = meshEntity;
+					TransformComponent& transform = *scene.transforms.GetComponent(entity);
+					transform.Scale(XMFLOAT3(scale, scale, scale));
+					transform.Translate(XMFLOAT3(-5.5f + 11 * float(x) / 32.f, -0.5f + 5 * y / 32.f, float(z) * 0.5f));
+					if (z % 7 == 0)
+					{
+						scene.layers.GetComponent(entity)->layerMask = 1 << 1; // some objects are on an other layer, so layer filtering is tested too
+					}
+				}
+			}
+		}
+		scene.Update(0);
+
+		CameraComponent camera;
+		camera.CreatePerspective(1920, 1080, 0.1f, 800);
+		camera.Eye = XMFLOAT3(0, 2, -4);
+		camera.UpdateCamera();
+		const Frustum& frustum = camera.frustum;
+		const uint32_t layerMask = 1 << 0;
+		const uint32_t objectCount = (uint32_t)scene.aabb_objects.GetCount();
+		const AABBSoA& bounds = scene.aabb_objects_soa;
+		assert(bounds.GetCount() == objectCount);
+
+		const int repeat = 100;
+		std::vector<uint32_t> visible;
+		std::vector<uint32_t> visibleSIMD;
+
+		timer.record();
+		for (int r = 0; r < repeat; ++r)
+		{
+			visible.clear();
+			for (uint32_t i = 0; i < objectCount; ++i)
+			{
+				const AABB& aabb = scene.aabb_objects[i];
+				if ((aabb.layerMask & layerMask) && frustum.CheckBoxFast(aabb))
+				{
+					visible.push_back(i);
+				}
+			}
+		}
+		const double scalarTime = timer.elapsed() / repeat;
+
+		timer.record();
+		for (int r = 0; r < repeat; ++r)
+		{
+			visibleSIMD.clear();
+			for (uint32_t block = 0; block < bounds.GetBlockCount(); ++block)
+			{
+				const uint32_t mask = frustum.CheckBoxesFast(bounds, block, layerMask);
+				for (uint32_t i = 0; i < AABBSoA::block_size; ++i)
+				{
+					if (mask & (1u << i))
+					{
+						visibleSIMD.push_back(block * AABBSoA::block_size + i);
+					}
+				}
+			}
+		}
+		const double simdTime = timer.elapsed() / repeat;
+
+		ss << objectCount << " objects, " << visible.size() << " visible, one by one: " << scalarTime << " ms, SIMD: " << simdTime << " ms";
+		if (visible != visibleSIMD)
+		{
+			ss << " [MISMATCH]";
+		}
+		ss << std::endl;
+	}
+
+	ss << std::endl << "2) Hierarchical frustum culling test:" << std::endl;
+
+	// An open world of 1M objects is culled with a camera that sees about 5% of it, every object one by one (8 at a time with SIMD), and hierarchically with a BVH:
+	{
+		const uint32_t objectCount = 1000000;
+		const float extent = 5000;
+		auto random = [](float minValue, float maxValue) { return minValue + (maxValue - minValue) * (rand() / float(RAND_MAX)); };
+		std::vector<AABB> aabbs(objectCount);
+		AABBSoA bounds;
+		bounds.Resize(objectCount);
+		for (uint32_t i = 0; i < objectCount; ++i)
+		{
+			const XMFLOAT3 center = XMFLOAT3(random(-extent, extent), random(0, 20), random(-extent, extent));
+			const float size = random(1, 8);
+			aabbs[i].createFromHalfWidth(center, XMFLOAT3(size, size, size));
+			bounds.Set(i, aabbs[i]);
+		}
+		wiBVH bvh;
+		wiJobSystem::context ctx;
+		timer.record();
+		bvh.Build(ctx, aabbs.data(), objectCount);
+		const double buildTime = timer.elapsed();
+
+		CameraComponent camera;
+		camera.CreatePerspective(1920, 1080, 0.1f, extent * 0.44f);
+		camera.Eye = XMFLOAT3(0, 10, 0);
+		camera.At = XMFLOAT3(1, 0, 0);
+		camera.UpdateCamera();
+		const Frustum& frustum = camera.frustum;
+
+		const int repeat = 10;
+		std::vector<uint32_t> visible;
+		std::vector<uint32_t> visibleBVH;
+
+		timer.record();
+		for (int r = 0; r < repeat; ++r)
+		{
+			visible.clear();
+			for (uint32_t block = 0; block < bounds.GetBlockCount(); ++block)
+			{
+				const uint32_t mask = frustum.CheckBoxesFast(bounds, block, ~0u);
+				for (uint32_t i = 0; i < AABBSoA::block_size; ++i)
+				{
+					if (mask & (1u << i))
+					{
+						visible.push_back(block * AABBSoA::block_size + i);
+					}
+				}
+			}
+		}
+		const double flatTime = timer.elapsed() / repeat;
+
+		timer.record();
+		for (int r = 0; r < repeat; ++r)
+		{
+			visibleBVH.clear();
+			bvh.Intersects(frustum, [&](uint32_t first, uint32_t last, bool inside) {
+				for (uint32_t i = first; i < last; ++i)
+				{
+					const uint32_t index = bvh.primitives[i];
+					if (inside || frustum.CheckBoxFast(aabbs[index]))
+					{
+						visibleBVH.push_back(index);
+					}
+				}
+			});
+		}
+		const double bvhTime = timer.elapsed() / repeat;
+
+		ss << objectCount << " objects, " << visible.size() << " visible (" << 100.0 * visible.size() / objectCount << "%), BVH build: " << buildTime << " ms";
+		ss << ", culling one by one: " << flatTime << " ms, hierarchical: " << bvhTime << " ms";
+		std::sort(visibleBVH.begin(), visibleBVH.end());
+		if (visible != visibleBVH)
+		{
+			ss << " [MISMATCH]";
+		}
+		ss << std::endl;
+	}
+
+	return ss.str();
+}
 void TestsRenderer::RunFontTest()
 {
 	static wiSpriteFont font;
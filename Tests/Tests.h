@@ -7,7 +7,14 @@ class TestsRenderer : public RenderPath3D
 	wiLabel label;
 	wiComboBox testSelector;
 	wiECS::Entity ik_entity = wiECS::INVALID_ENTITY;
+
+	wiJobSystem::context background_test_ctx;
+	std::string background_test_result;
+	bool background_test_pending = false;
+	wiSpriteFont background_test_font;
 public:
+	MainComponent* main = nullptr;
+
 	void Load() override;
 	void Update(float dt) override;
 	void ResizeLayout() override;
@@ -16,6 +23,15 @@ public:
 	void RunFontTest();
 	void RunSpriteTest();
 	void RunNetworkTest();
+
+	// Benchmarks that take a while, they return the text of their results:
+	static std::string RunECSTest();
+	static std::string RunHierarchyTest();
+	static std::string RunAnimationTest();
+	static std::string RunSceneQueryTest();
+	static std::string RunCullingTest();
+	// Runs one of the benchmarks above on a background job, so the application stays responsive. The results are displayed when it finished
+	void RunBackgroundTest(std::string(*test)());
 };
 
 class Tests : public MainComponent
@@ -34,6 +34,7 @@ void LoadingScreen::onFinished(std::function<void()> finishFunction)
 
 void LoadingScreen::Start()
 {
+	ctx.priority = wiJobSystem::Priority::Background; // loading must not delay the frame jobs
 	for (auto& x : tasks)
 	{
 		wiJobSystem::Execute(ctx, x);
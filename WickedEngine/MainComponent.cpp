@@ -162,6 +162,13 @@ void MainComponent::Run()
 	// Variable-timed update:
 	Update(dt);
 
+	if (pipelined_update && GetActivePath() != nullptr)
+	{
+		// The next frame's update can be started by the active path, it will run while this frame is rendered:
+		pipelined_path = GetActivePath();
+		pipelined_path->BeginPipelinedUpdate(dt);
+	}
+
 	Render();
 
 	wiInput::Update(window);
@@ -181,6 +188,14 @@ void MainComponent::Run()
 
 	wiProfiler::EndFrame(cmd);
 	device->SubmitCommandLists();
+
+	if (pipelined_path != nullptr)
+	{
+		auto range = wiProfiler::BeginRangeCPU("Pipelined Update Wait");
+		pipelined_path->EndPipelinedUpdate();
+		pipelined_path = nullptr;
+		wiProfiler::EndRange(range); // Pipelined Update Wait
+	}
 }
 
 void MainComponent::Update(float dt)
@@ -306,7 +321,9 @@ void MainComponent::Compose(CommandList cmd)
 			}
 
 			ss.precision(2);
-			ss << std::fixed << 1.0f / displaydeltatime << " FPS" << std::endl;
+			ss << std::fixed << 1.0f / displaydeltatime << " FPS";
+			// The frame time is shown to be able to compare the sequential and the pipelined update:
+			ss << " (" << displaydeltatime * 1000 << " ms" << (pipelined_update ? ", pipelined update" : "") << ")" << std::endl;
 		}
 		if (infoDisplay.heap_allocation_counter)
 		{
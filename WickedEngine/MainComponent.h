@@ -19,6 +19,8 @@ protected:
 	float targetFrameRate = 60;
 	bool frameskip = true;
 	bool framerate_lock = false;
+	bool pipelined_update = false;
+	RenderPath* pipelined_path = nullptr;
 	bool initialized = false;
 
 	wiFadeManager fadeManager;
@@ -55,6 +57,11 @@ public:
 	//	disabled	: the FixedUpdate() loop will run every frame only once.
 	void setFrameSkip(bool enabled) { frameskip = enabled; }
 	void setFrameRateLock(bool enabled) { framerate_lock = enabled; }
+	// Set pipelined update (default = false)
+	//	enabled		: the active RenderPath can start updating the next frame while the current frame is rendered (see RenderPath::BeginPipelinedUpdate())
+	//				  this makes CPU heavy scenes faster, but changes made by the application reach the simulation one frame later
+	void setPipelinedUpdate(bool enabled) { pipelined_update = enabled; }
+	bool getPipelinedUpdate() const { return pipelined_update; }
 
 	// This is where the critical initializations happen (before any rendering or anything else)
 	virtual void Initialize();
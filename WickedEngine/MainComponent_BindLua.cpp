@@ -13,6 +13,7 @@ Luna<MainComponent_BindLua>::FunctionType MainComponent_BindLua::methods[] = {
 	lunamethod(MainComponent_BindLua, SetFrameSkip),
 	lunamethod(MainComponent_BindLua, SetTargetFrameRate),
 	lunamethod(MainComponent_BindLua, SetFrameRateLock),
+	lunamethod(MainComponent_BindLua, SetPipelinedUpdate),
 	lunamethod(MainComponent_BindLua, SetInfoDisplay),
 	lunamethod(MainComponent_BindLua, SetWatermarkDisplay),
 	lunamethod(MainComponent_BindLua, SetFPSDisplay),
@@ -192,6 +193,23 @@ int MainComponent_BindLua::SetFrameRateLock(lua_State *L)
 		wiLua::SError(L, "SetFrameRateLock(bool enabled) not enought arguments!");
 	return 0;
 }
+int MainComponent_BindLua::SetPipelinedUpdate(lua_State *L)
+{
+	if (component == nullptr)
+	{
+		wiLua::SError(L, "SetPipelinedUpdate(bool enabled) component is empty!");
+		return 0;
+	}
+
+	int argc = wiLua::SGetArgCount(L);
+	if (argc > 0)
+	{
+		component->setPipelinedUpdate(wiLua::SGetBool(L, 1));
+	}
+	else
+		wiLua::SError(L, "SetPipelinedUpdate(bool enabled) not enought arguments!");
+	return 0;
+}
 int MainComponent_BindLua::SetInfoDisplay(lua_State *L)
 {
 	if (component == nullptr)
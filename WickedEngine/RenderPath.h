@@ -26,6 +26,11 @@ public:
 	virtual void Update(float dt) {}
 	// executed after Update()
 	virtual void PostUpdate() {}
+	// executed after PostUpdate() if pipelined update is enabled (see MainComponent::setPipelinedUpdate()), work for the next frame can be started here that runs while this frame is rendered
+	//	dt : elapsed time of the current frame in seconds, this is the estimate for the next frame
+	virtual void BeginPipelinedUpdate(float dt) {}
+	// executed after the frame was rendered if BeginPipelinedUpdate() was called, the work started for the next frame must be finished here
+	virtual void EndPipelinedUpdate() {}
 	// Render to layers, rendertargets, etc
 	// This will be rendered offscreen
 	virtual void Render() const {}
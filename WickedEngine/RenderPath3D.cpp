@@ -600,6 +600,24 @@ void RenderPath3D::Update(float dt)
 	std::swap(depthBuffer_Copy, depthBuffer_Copy1);
 }
 
+void RenderPath3D::BeginPipelinedUpdate(float dt)
+{
+	RenderPath2D::BeginPipelinedUpdate(dt);
+
+	if (getSceneUpdateEnabled())
+	{
+		// The simulation of the next frame runs while this frame is rendered, the render path only reads the state from the end of Update():
+		scene->BeginSimulation(dt * wiRenderer::GetGameSpeed());
+	}
+}
+
+void RenderPath3D::EndPipelinedUpdate()
+{
+	scene->WaitSimulation();
+
+	RenderPath2D::EndPipelinedUpdate();
+}
+
 void RenderPath3D::Render() const
 {
 	GraphicsDevice* device = wiRenderer::GetDevice();
@@ -252,6 +252,8 @@ public:
 
 	void PreUpdate() override;
 	void Update(float dt) override;
+	void BeginPipelinedUpdate(float dt) override;
+	void EndPipelinedUpdate() override;
 	void Render() const override;
 	void Compose(wiGraphics::CommandList cmd) const override;
 };
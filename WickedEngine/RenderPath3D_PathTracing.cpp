@@ -173,6 +173,7 @@ void RenderPath3D_PathTracing::Update(float dt)
 
 				texturedata_dst.resize(texturedata_src.size());
 
+				denoiserContext.priority = wiJobSystem::Priority::Background;
 				wiJobSystem::Execute(denoiserContext, [&](wiJobArgs args) {
 
 					size_t width = (size_t)traceResult.desc.Width;
@@ -245,6 +246,14 @@ void RenderPath3D_PathTracing::Update(float dt)
 #endif // OPEN_IMAGE_DENOISE
 }
 
+void RenderPath3D_PathTracing::BeginPipelinedUpdate(float dt)
+{
+	// The scene simulation is not started ahead of Update() here:
+	//	Update() restarts the accumulation when a transform IsDirty(), but the simulation would already clear those flags
+	//	the scene is only updated when the accumulation restarts anyway, so there is nothing to overlap with rendering
+	RenderPath2D::BeginPipelinedUpdate(dt);
+}
+
 void RenderPath3D_PathTracing::Render() const
 {
 	GraphicsDevice* device = wiRenderer::GetDevice();
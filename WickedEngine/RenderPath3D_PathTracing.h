@@ -27,6 +27,7 @@ public:
 	const wiGraphics::Texture* GetDepthStencil() const override { return nullptr; };
 
 	void Update(float dt) override;
+	void BeginPipelinedUpdate(float dt) override;
 	void Render() const override;
 	void Compose(wiGraphics::CommandList cmd) const override;
 
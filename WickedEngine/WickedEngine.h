@@ -55,6 +55,7 @@
 #include "wiOcean.h"
 #include "wiStartupArguments.h"
 #include "wiGPUBVH.h"
+#include "wiBVH.h"
 #include "wiGPUSortLib.h"
 #include "wiJobSystem.h"
 #include "wiNetwork.h"
@@ -4,7 +4,7 @@
 #include <fstream>
 
 // this should always be only INCREMENTED and only if a new serialization is implemeted somewhere!
-uint64_t __archiveVersion = 72;
+uint64_t __archiveVersion = 74;
 // this is the version number of which below the archive is not compatible with the current version
 uint64_t __archiveVersionBarrier = 22;
 
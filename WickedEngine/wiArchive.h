@@ -61,6 +61,11 @@ public:
 		_write((uint8_t)data);
 		return *this;
 	}
+	inline wiArchive& operator<<(unsigned short data)
+	{
+		_write((uint16_t)data);
+		return *this;
+	}
 	inline wiArchive& operator<<(int data)
 	{
 		_write((int64_t)data);
@@ -187,6 +192,13 @@ public:
 		data = (unsigned char)temp;
 		return *this;
 	}
+	inline wiArchive& operator >> (unsigned short& data)
+	{
+		uint16_t temp;
+		_read(temp);
+		data = (unsigned short)temp;
+		return *this;
+	}
 	inline wiArchive& operator >> (int& data)
 	{
 		int64_t temp;
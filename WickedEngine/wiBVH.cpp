@@ -0,0 +1,369 @@
+#include "wiBVH.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+static constexpr uint32_t bin_count = 16; // SAH split candidates are evaluated at the boundaries of this many bins per axis
+
+static inline float SurfaceArea(const XMFLOAT3& min, const XMFLOAT3& max)
+{
+	if (min.x > max.x || min.y > max.y || min.z > max.z)
+	{
+		return 0; // empty box
+	}
+	const float x = max.x - min.x;
+	const float y = max.y - min.y;
+	const float z = max.z - min.z;
+	return 2 * (x * y + y * z + z * x);
+}
+
+// The primitive bounds are copied next to each other and partitioned during the build, so that the build doesn't read them through indices:
+struct alignas(16) PrimitiveRef
+{
+	XMFLOAT4A min;
+	XMFLOAT4A max;
+	uint32_t index;
+};
+
+struct BuildState
+{
+	wiBVH* bvh;
+	wiJobSystem::context* ctx;
+	PrimitiveRef* refs;
+	std::atomic<uint32_t> node_count{ 1 };
+};
+
+static inline float Centroid(const PrimitiveRef& ref, int axis)
+{
+	return ((&ref.min.x)[axis] + (&ref.max.x)[axis]) * 0.5f;
+}
+
+static void BuildNode(BuildState& state, uint32_t index, uint32_t begin, uint32_t end, uint32_t depth)
+{
+	wiBVH& bvh = *state.bvh;
+	PrimitiveRef* refs = state.refs;
+	wiBVH::Node& node = bvh.nodes[index]; // nodes were allocated for the worst case, so they are not moved during the build
+
+	XMVECTOR bmin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR bmax = XMVectorReplicate(-FLT_MAX);
+	XMVECTOR cmin = bmin;
+	XMVECTOR cmax = bmax;
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		const XMVECTOR min = XMLoadFloat4A(&refs[i].min);
+		const XMVECTOR max = XMLoadFloat4A(&refs[i].max);
+		bmin = XMVectorMin(bmin, min);
+		bmax = XMVectorMax(bmax, max);
+		const XMVECTOR centroid = XMVectorScale(XMVectorAdd(min, max), 0.5f);
+		cmin = XMVectorMin(cmin, centroid);
+		cmax = XMVectorMax(cmax, centroid);
+	}
+	XMStoreFloat3(&node.min, bmin);
+	XMStoreFloat3(&node.max, bmax);
+
+	const uint32_t count = end - begin;
+	auto make_leaf = [&]() {
+		node.offset = begin;
+		node.count = count;
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			bvh.primitives[i] = refs[i].index;
+			bvh.primitive_leaves[refs[i].index] = index;
+		}
+	};
+	if (count == 1 || depth + 1 >= wiBVH::max_depth)
+	{
+		make_leaf();
+		return;
+	}
+
+	// Binned SAH: the primitives are sorted into bins by their centroids, and the split cost is evaluated at every bin boundary
+	//	Only the axis with the largest centroid extent is binned, this has most of the quality of trying every axis for a third of the cost
+	XMFLOAT3 centroid_min, centroid_max;
+	XMStoreFloat3(&centroid_min, cmin);
+	XMStoreFloat3(&centroid_max, cmax);
+	const float* cmin_axis = &centroid_min.x;
+	const float* cmax_axis = &centroid_max.x;
+	int axis = 0;
+	if (cmax_axis[1] - cmin_axis[1] > cmax_axis[axis] - cmin_axis[axis])
+		axis = 1;
+	if (cmax_axis[2] - cmin_axis[2] > cmax_axis[axis] - cmin_axis[axis])
+		axis = 2;
+	const float extent = cmax_axis[axis] - cmin_axis[axis];
+	const float axis_min = cmin_axis[axis];
+	const float scale = extent > 0 ? bin_count / extent : 0;
+
+	float best_cost = FLT_MAX;
+	uint32_t best_split = 0; // bins [0, best_split) go to the left child, 0 if there is no valid split
+	if (extent > 0)
+	{
+		struct Bin
+		{
+			XMVECTOR min = XMVectorReplicate(FLT_MAX);
+			XMVECTOR max = XMVectorReplicate(-FLT_MAX);
+			uint32_t count = 0;
+		};
+		Bin bins[bin_count];
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const uint32_t bin_index = std::min(bin_count - 1, uint32_t((Centroid(refs[i], axis) - axis_min) * scale));
+			Bin& bin = bins[bin_index];
+			bin.min = XMVectorMin(bin.min, XMLoadFloat4A(&refs[i].min));
+			bin.max = XMVectorMax(bin.max, XMLoadFloat4A(&refs[i].max));
+			bin.count++;
+		}
+
+		// Sweep from the right to have the right side area and count of every boundary, then from the left to evaluate them:
+		float right_area[bin_count];
+		uint32_t right_count[bin_count];
+		XMVECTOR rmin = XMVectorReplicate(FLT_MAX);
+		XMVECTOR rmax = XMVectorReplicate(-FLT_MAX);
+		uint32_t rcount = 0;
+		for (uint32_t i = bin_count - 1; i > 0; --i)
+		{
+			rmin = XMVectorMin(rmin, bins[i].min);
+			rmax = XMVectorMax(rmax, bins[i].max);
+			rcount += bins[i].count;
+			XMFLOAT3 mi, ma;
+			XMStoreFloat3(&mi, rmin);
+			XMStoreFloat3(&ma, rmax);
+			right_area[i] = SurfaceArea(mi, ma);
+			right_count[i] = rcount;
+		}
+		XMVECTOR lmin = XMVectorReplicate(FLT_MAX);
+		XMVECTOR lmax = XMVectorReplicate(-FLT_MAX);
+		uint32_t lcount = 0;
+		for (uint32_t i = 1; i < bin_count; ++i)
+		{
+			lmin = XMVectorMin(lmin, bins[i - 1].min);
+			lmax = XMVectorMax(lmax, bins[i - 1].max);
+			lcount += bins[i - 1].count;
+			if (lcount == 0 || right_count[i] == 0)
+			{
+				continue;
+			}
+			XMFLOAT3 mi, ma;
+			XMStoreFloat3(&mi, lmin);
+			XMStoreFloat3(&ma, lmax);
+			const float split_cost = SurfaceArea(mi, ma) * lcount + right_area[i] * right_count[i];
+			if (split_cost < best_cost)
+			{
+				best_cost = split_cost;
+				best_split = i;
+			}
+		}
+	}
+
+	// Small nodes stay leaves if splitting them wouldn't be cheaper to traverse (one node test is counted as much as one primitive test):
+	if (count <= wiBVH::leaf_size)
+	{
+		const float area = SurfaceArea(node.min, node.max);
+		if (best_split == 0 || area + best_cost >= area * count)
+		{
+			make_leaf();
+			return;
+		}
+	}
+
+	uint32_t mid = begin + count / 2; // if there is no valid split, the primitives are halved in their current order
+	if (best_split > 0)
+	{
+		PrimitiveRef* split = std::partition(refs + begin, refs + end, [&](const PrimitiveRef& ref) {
+			return std::min(bin_count - 1, uint32_t((Centroid(ref, axis) - axis_min) * scale)) < best_split;
+		});
+		if (split != refs + begin && split != refs + end)
+		{
+			mid = uint32_t(split - refs);
+		}
+	}
+
+	const uint32_t left = state.node_count.fetch_add(2);
+	node.offset = left;
+	node.count = 0;
+	bvh.parents[left] = index;
+	bvh.parents[left + 1] = index;
+
+	if (count > wiBVH::parallel_size)
+	{
+		wiJobSystem::Execute(*state.ctx, [&state, left, mid, end, depth](wiJobArgs args) {
+			BuildNode(state, left + 1, mid, end, depth + 1);
+		});
+	}
+	else
+	{
+		BuildNode(state, left + 1, mid, end, depth + 1);
+	}
+	BuildNode(state, left, begin, mid, depth + 1);
+}
+
+void wiBVH::Build(wiJobSystem::context& ctx, const AABB* aabbs, uint32_t count)
+{
+	Clear();
+	if (count == 0)
+	{
+		return;
+	}
+
+	// A tree with leaves of single primitives has the most nodes:
+	nodes.resize(count * 2 - 1);
+	parents.resize(nodes.size());
+	primitives.resize(count);
+	primitive_leaves.resize(count);
+
+	std::vector<PrimitiveRef> refs(count);
+	wiJobSystem::Dispatch(ctx, count, 1024, [&](wiJobArgs args) {
+		const AABB& aabb = aabbs[args.jobIndex];
+		PrimitiveRef& ref = refs[args.jobIndex];
+		ref.min = XMFLOAT4A(aabb._min.x, aabb._min.y, aabb._min.z, 0);
+		ref.max = XMFLOAT4A(aabb._max.x, aabb._max.y, aabb._max.z, 0);
+		ref.index = args.jobIndex;
+	});
+	wiJobSystem::Wait(ctx);
+
+	BuildState state;
+	state.bvh = this;
+	state.ctx = &ctx;
+	state.refs = refs.data();
+	parents[0] = ~0u;
+	BuildNode(state, 0, 0, count, 0);
+	wiJobSystem::Wait(ctx);
+
+	nodes.resize(state.node_count.load());
+	parents.resize(nodes.size());
+
+	cost = 0;
+	for (const Node& node : nodes)
+	{
+		cost += SurfaceArea(node.min, node.max);
+	}
+	build_cost = cost;
+}
+
+// Computes the box of a node from its primitives (leaf) or from its children (internal node):
+static inline void ComputeNodeBounds(const wiBVH& bvh, const AABB* aabbs, const wiBVH::Node& node, XMFLOAT3& min, XMFLOAT3& max)
+{
+	XMVECTOR bmin;
+	XMVECTOR bmax;
+	if (node.IsLeaf())
+	{
+		bmin = XMVectorReplicate(FLT_MAX);
+		bmax = XMVectorReplicate(-FLT_MAX);
+		for (uint32_t i = 0; i < node.count; ++i)
+		{
+			const AABB& aabb = aabbs[bvh.primitives[node.offset + i]];
+			bmin = XMVectorMin(bmin, XMLoadFloat3(&aabb._min));
+			bmax = XMVectorMax(bmax, XMLoadFloat3(&aabb._max));
+		}
+	}
+	else
+	{
+		const wiBVH::Node& left = bvh.nodes[node.offset];
+		const wiBVH::Node& right = bvh.nodes[node.offset + 1];
+		bmin = XMVectorMin(XMLoadFloat3(&left.min), XMLoadFloat3(&right.min));
+		bmax = XMVectorMax(XMLoadFloat3(&left.max), XMLoadFloat3(&right.max));
+	}
+	XMStoreFloat3(&min, bmin);
+	XMStoreFloat3(&max, bmax);
+}
+
+void wiBVH::Refit(const AABB* aabbs)
+{
+	// Children are always after their parent, so iterating backwards visits the children first:
+	cost = 0;
+	for (size_t index = nodes.size(); index > 0; --index)
+	{
+		Node& node = nodes[index - 1];
+		ComputeNodeBounds(*this, aabbs, node, node.min, node.max);
+		cost += SurfaceArea(node.min, node.max);
+	}
+}
+
+void wiBVH::Refit(const AABB* aabbs, const uint32_t* changed_primitives, uint32_t changed_count)
+{
+	for (uint32_t changed = 0; changed < changed_count; ++changed)
+	{
+		// Walk up from the leaf until a node's box doesn't change, because then none of its ancestors change either:
+		uint32_t index = primitive_leaves[changed_primitives[changed]];
+		while (index != ~0u)
+		{
+			Node& node = nodes[index];
+			XMFLOAT3 min, max;
+			ComputeNodeBounds(*this, aabbs, node, min, max);
+			if (std::memcmp(&min, &node.min, sizeof(min)) == 0 && std::memcmp(&max, &node.max, sizeof(max)) == 0)
+			{
+				break;
+			}
+			cost += SurfaceArea(min, max) - SurfaceArea(node.min, node.max);
+			node.min = min;
+			node.max = max;
+			index = parents[index];
+		}
+	}
+}
+
+void wiBVH::Clear()
+{
+	nodes.clear();
+	parents.clear();
+	primitives.clear();
+	primitive_leaves.clear();
+	cost = 0;
+	build_cost = 0;
+}
+
+void wiBVH::Serialize(wiArchive& archive)
+{
+	if (archive.IsReadMode())
+	{
+		size_t node_count;
+		archive >> node_count;
+		nodes.resize(node_count);
+		for (Node& node : nodes)
+		{
+			archive >> node.min;
+			archive >> node.offset;
+			archive >> node.max;
+			archive >> node.count;
+		}
+		archive >> primitives;
+
+		parents.resize(nodes.size());
+		primitive_leaves.resize(primitives.size());
+		cost = 0;
+		for (uint32_t index = 0; index < (uint32_t)nodes.size(); ++index)
+		{
+			const Node& node = nodes[index];
+			if (index == 0)
+			{
+				parents[index] = ~0u;
+			}
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = 0; i < node.count; ++i)
+				{
+					primitive_leaves[primitives[node.offset + i]] = index;
+				}
+			}
+			else
+			{
+				parents[node.offset] = index;
+				parents[node.offset + 1] = index;
+			}
+			cost += SurfaceArea(node.min, node.max);
+		}
+		build_cost = cost;
+	}
+	else
+	{
+		archive << nodes.size();
+		for (const Node& node : nodes)
+		{
+			archive << node.min;
+			archive << node.offset;
+			archive << node.max;
+			archive << node.count;
+		}
+		archive << primitives;
+	}
+}
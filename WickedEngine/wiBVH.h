@@ -0,0 +1,347 @@
+#pragma once
+#include "CommonInclude.h"
+#include "wiIntersect.h"
+#include "wiJobSystem.h"
+
+#include <vector>
+
+// Bounding volume hierarchy on the CPU, over primitives that are given by their axis aligned bounding boxes
+//	It is built with binned SAH on the job system, and it can be refitted when the primitives move, without changing the tree structure
+class wiBVH
+{
+public:
+	struct Node
+	{
+		XMFLOAT3 min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		uint32_t offset = 0; // leaf: first element in primitives, internal node: index of the left child (the right child is offset + 1)
+		XMFLOAT3 max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		uint32_t count = 0; // leaf: number of primitives, internal node: 0
+
+		constexpr bool IsLeaf() const { return count > 0; }
+	};
+	static_assert(sizeof(Node) == 32, "Two nodes should fit into a cache line");
+
+	static constexpr uint32_t max_depth = 64; // deeper nodes are made leaves, so traversal can use a fixed size stack
+	static constexpr uint32_t leaf_size = 4; // nodes with more primitives than this are always split (if possible)
+	static constexpr uint32_t parallel_size = 1024; // nodes with more primitives than this build their subtrees in parallel
+
+	std::vector<Node> nodes; // nodes[0] is the root, children are always after their parent
+	std::vector<uint32_t> parents; // parent node index of every node, ~0u for the root
+	std::vector<uint32_t> primitives; // primitive indices grouped by leaves
+	std::vector<uint32_t> primitive_leaves; // leaf node index of every primitive
+	float cost = 0; // sum of the node surface areas, the SAH cost of the tree (without the constant factors)
+	float build_cost = 0; // cost after the last Build(), refitting can only make the tree looser than this
+
+	// Builds the tree for the primitives with the bounding boxes aabbs[0...count-1]
+	//	This waits until ctx becomes idle
+	void Build(wiJobSystem::context& ctx, const AABB* aabbs, uint32_t count);
+	// Recomputes every node's bounding box from the primitive bounding boxes, the primitive count must be the same as in Build()
+	void Refit(const AABB* aabbs);
+	// Recomputes only the bounding boxes that contain the changed primitives, this is faster than a full Refit() when few primitives changed
+	void Refit(const AABB* aabbs, const uint32_t* changed_primitives, uint32_t changed_count);
+	void Clear();
+	// Only the nodes and primitives are serialized, the rest is reconstructed when reading
+	void Serialize(wiArchive& archive);
+
+	inline uint32_t GetPrimitiveCount() const { return (uint32_t)primitive_leaves.size(); }
+	inline bool IsValid() const { return !nodes.empty(); }
+
+	// Visits the primitives of the leaves whose bounding box passes the test:
+	//	test	: bool(const Node& node), it should return false if nothing in the node can be hit
+	//	visit	: bool(uint32_t primitive), return false to stop the traversal
+	template<typename Test, typename Visit>
+	inline void Traverse(const Test& test, const Visit& visit) const
+	{
+		if (nodes.empty())
+			return;
+		uint32_t stack[max_depth + 1];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = 0;
+		while (stack_size > 0)
+		{
+			const Node& node = nodes[stack[--stack_size]];
+			if (!test(node))
+				continue;
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = 0; i < node.count; ++i)
+				{
+					if (!visit(primitives[node.offset + i]))
+						return;
+				}
+			}
+			else
+			{
+				stack[stack_size++] = node.offset + 1;
+				stack[stack_size++] = node.offset;
+			}
+		}
+	}
+
+	// Visits the primitives whose leaf overlaps the box:
+	//	visit	: bool(uint32_t primitive), return false to stop the traversal
+	template<typename Visit>
+	inline void Intersects(const AABB& aabb, const Visit& visit) const
+	{
+		Traverse([&](const Node& node) {
+			return
+				node.min.x <= aabb._max.x && node.max.x >= aabb._min.x &&
+				node.min.y <= aabb._max.y && node.max.y >= aabb._min.y &&
+				node.min.z <= aabb._max.z && node.max.z >= aabb._min.z;
+		}, visit);
+	}
+
+	// Visits the primitives whose leaf overlaps the sphere:
+	//	visit	: bool(uint32_t primitive), return false to stop the traversal
+	template<typename Visit>
+	inline void Intersects(const SPHERE& sphere, const Visit& visit) const
+	{
+		const XMVECTOR center = XMLoadFloat3(&sphere.center);
+		const float radiusSq = sphere.radius * sphere.radius;
+		Traverse([&](const Node& node) {
+			const XMVECTOR closest = XMVectorMax(XMVectorMin(center, XMLoadFloat3(&node.max)), XMLoadFloat3(&node.min)); // not XMVectorClamp(), because empty nodes have min > max
+			return XMVectorGetX(XMVector3LengthSq(closest - center)) <= radiusSq;
+		}, visit);
+	}
+
+	// Returns the primitives of the subtree of the node as the range [first, last) of the primitives array
+	//	The build partitions the primitives in place, so a subtree's primitives are always next to each other
+	inline void GetPrimitiveRange(uint32_t node, uint32_t& first, uint32_t& last) const
+	{
+		uint32_t leftmost = node;
+		while (!nodes[leftmost].IsLeaf())
+		{
+			leftmost = nodes[leftmost].offset;
+		}
+		uint32_t rightmost = node;
+		while (!nodes[rightmost].IsLeaf())
+		{
+			rightmost = nodes[rightmost].offset + 1;
+		}
+		first = nodes[leftmost].offset;
+		last = nodes[rightmost].offset + nodes[rightmost].count;
+	}
+
+	// Visits the primitives of the nodes in the subtree of root that are inside or intersect the frustum
+	//	The planes that a node is entirely inside of are not tested again in its subtree, so a subtree that is entirely inside the frustum is visited without more tests
+	//	The ranges are visited in increasing order of the primitives array
+	//	visit	: void(uint32_t first, uint32_t last, bool inside), with a range [first, last) of the primitives array
+	//		if inside is false, the primitives of the range still need to be tested one by one
+	template<typename Visit>
+	inline void Intersects(const Frustum& frustum, const Visit& visit, uint32_t root = 0) const
+	{
+		if (nodes.empty())
+			return;
+		struct Entry
+		{
+			uint32_t node;
+			uint32_t planes; // bit mask of the planes that the node still has to be tested against
+		};
+		Entry stack[max_depth + 1];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = { root, (1u << arraysize(frustum.planes)) - 1 };
+		while (stack_size > 0)
+		{
+			const Entry entry = stack[--stack_size];
+			const Node& node = nodes[entry.node];
+			uint32_t planes = entry.planes;
+			bool outside = false;
+			for (uint32_t p = 0; p < arraysize(frustum.planes); ++p)
+			{
+				if ((planes & (1u << p)) == 0)
+					continue;
+				// The corner furthest along the plane normal is behind the plane if the node is outside, the nearest corner is in front of it if the node is entirely inside:
+				const XMFLOAT4& plane = frustum.planes[p];
+				const float far_dot =
+					plane.x * (plane.x < 0 ? node.min.x : node.max.x) +
+					plane.y * (plane.y < 0 ? node.min.y : node.max.y) +
+					plane.z * (plane.z < 0 ? node.min.z : node.max.z) + plane.w;
+				if (far_dot < 0)
+				{
+					outside = true;
+					break;
+				}
+				const float near_dot =
+					plane.x * (plane.x < 0 ? node.max.x : node.min.x) +
+					plane.y * (plane.y < 0 ? node.max.y : node.min.y) +
+					plane.z * (plane.z < 0 ? node.max.z : node.min.z) + plane.w;
+				if (near_dot >= 0)
+				{
+					planes &= ~(1u << p);
+				}
+			}
+			if (outside)
+				continue;
+
+			if (planes == 0)
+			{
+				uint32_t first, last;
+				GetPrimitiveRange(entry.node, first, last);
+				visit(first, last, true);
+			}
+			else if (node.IsLeaf())
+			{
+				visit(node.offset, node.offset + node.count, false);
+			}
+			else
+			{
+				stack[stack_size++] = { node.offset + 1, planes };
+				stack[stack_size++] = { node.offset, planes };
+			}
+		}
+	}
+
+	// Visits the primitives whose leaf is hit by the ray, the closer child nodes are visited first
+	//	The ray parameter is measured in the length of ray.direction, so it is the distance if the direction is normalized
+	//	visit	: float(uint32_t primitive), returns the ray parameter of the closest hit so far, the nodes farther than that are skipped
+	template<typename Visit>
+	inline void IntersectRay(const RAY& ray, const Visit& visit) const
+	{
+		if (nodes.empty())
+			return;
+		const XMVECTOR origin = XMLoadFloat3(&ray.origin);
+		const XMVECTOR direction_inverse = XMLoadFloat3(&ray.direction_inverse);
+		// Returns the entry ray parameter of the node, or FLT_MAX if it is not hit before tmax:
+		auto entry = [&](const Node& node, float tmax) {
+			const XMVECTOR t0 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&node.min), origin), direction_inverse);
+			const XMVECTOR t1 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&node.max), origin), direction_inverse);
+			const XMVECTOR tmin3 = XMVectorMin(t0, t1);
+			const XMVECTOR tmax3 = XMVectorMax(t0, t1);
+			const float tenter = std::max(std::max(XMVectorGetX(tmin3), XMVectorGetY(tmin3)), std::max(XMVectorGetZ(tmin3), 0.0f));
+			const float texit = std::min(std::min(XMVectorGetX(tmax3), XMVectorGetY(tmax3)), std::min(XMVectorGetZ(tmax3), tmax));
+			return tenter <= texit ? tenter : FLT_MAX;
+		};
+
+		float tmax = FLT_MAX;
+		if (entry(nodes[0], tmax) == FLT_MAX)
+			return;
+
+		// The stack holds the nodes together with their entry parameter, so they can be skipped if a closer hit was found in the meantime:
+		uint32_t stack[max_depth + 1];
+		float stack_t[max_depth + 1];
+		uint32_t stack_size = 0;
+		uint32_t current = 0;
+		while (true)
+		{
+			const Node& node = nodes[current];
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = 0; i < node.count; ++i)
+				{
+					tmax = std::min(tmax, visit(primitives[node.offset + i]));
+				}
+			}
+			else
+			{
+				uint32_t near_child = node.offset;
+				uint32_t far_child = node.offset + 1;
+				float near_t = entry(nodes[near_child], tmax);
+				float far_t = entry(nodes[far_child], tmax);
+				if (far_t < near_t)
+				{
+					std::swap(near_child, far_child);
+					std::swap(near_t, far_t);
+				}
+				if (near_t != FLT_MAX)
+				{
+					if (far_t != FLT_MAX)
+					{
+						stack[stack_size] = far_child;
+						stack_t[stack_size] = far_t;
+						stack_size++;
+					}
+					current = near_child;
+					continue;
+				}
+			}
+
+			// Next node from the stack that can still have a closer hit:
+			while (stack_size > 0 && stack_t[stack_size - 1] > tmax)
+			{
+				stack_size--;
+			}
+			if (stack_size == 0)
+				break;
+			current = stack[--stack_size];
+		}
+	}
+
+	// 4 rays in structure of arrays layout, so that they can be tested together against a node (SSE)
+	struct RayPacket
+	{
+		XMVECTOR origin[3]; // x, y and z of the 4 origins
+		XMVECTOR direction[3];
+		XMVECTOR direction_inverse[3];
+		XMVECTOR tmax; // the rays only hit until this ray parameter, negative for inactive lanes
+	};
+
+	// Returns the entry ray parameters of the packet into the box, FLT_MAX for the lanes that don't hit it before their tmax:
+	static inline XMVECTOR XM_CALLCONV IntersectRayPacket(const RayPacket& packet, const XMFLOAT3& min, const XMFLOAT3& max)
+	{
+		const XMVECTOR t0x = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate(min.x), packet.origin[0]), packet.direction_inverse[0]);
+		const XMVECTOR t0y = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate(min.y), packet.origin[1]), packet.direction_inverse[1]);
+		const XMVECTOR t0z = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate(min.z), packet.origin[2]), packet.direction_inverse[2]);
+		const XMVECTOR t1x = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate(max.x), packet.origin[0]), packet.direction_inverse[0]);
+		const XMVECTOR t1y = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate(max.y), packet.origin[1]), packet.direction_inverse[1]);
+		const XMVECTOR t1z = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate(max.z), packet.origin[2]), packet.direction_inverse[2]);
+		const XMVECTOR tenter = XMVectorMax(XMVectorMax(XMVectorMin(t0x, t1x), XMVectorMin(t0y, t1y)), XMVectorMax(XMVectorMin(t0z, t1z), XMVectorZero()));
+		const XMVECTOR texit = XMVectorMin(XMVectorMin(XMVectorMax(t0x, t1x), XMVectorMax(t0y, t1y)), XMVectorMin(XMVectorMax(t0z, t1z), packet.tmax));
+		return XMVectorSelect(XMVectorReplicate(FLT_MAX), tenter, XMVectorLessOrEqual(tenter, texit));
+	}
+
+	// Visits the primitives whose leaf is hit by any of the active rays of the packet, the nodes closer to the rays are visited first
+	//	visit	: void(uint32_t primitive, RayPacket& packet), it can lower the tmax of the lanes that found a closer hit, or make it negative to deactivate the lane
+	template<typename Visit>
+	inline void IntersectRayPacket(RayPacket& packet, const Visit& visit) const
+	{
+		if (nodes.empty())
+			return;
+
+		const XMVECTOR miss = XMVectorReplicate(FLT_MAX);
+		auto closest = [](FXMVECTOR t) {
+			const XMVECTOR m = XMVectorMin(t, XMVectorSwizzle<2, 3, 0, 1>(t));
+			return XMVectorGetX(XMVectorMin(m, XMVectorSwizzle<1, 0, 3, 2>(m)));
+		};
+
+		uint32_t stack[max_depth + 1];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = 0;
+		while (stack_size > 0)
+		{
+			// The node is tested when it's taken, because the lanes could have found closer hits since it was pushed:
+			uint32_t current = stack[--stack_size];
+			if (XMVector4Equal(IntersectRayPacket(packet, nodes[current].min, nodes[current].max), miss))
+				continue;
+
+			while (true)
+			{
+				const Node& node = nodes[current];
+				if (node.IsLeaf())
+				{
+					for (uint32_t i = 0; i < node.count; ++i)
+					{
+						visit(primitives[node.offset + i], packet);
+					}
+					break;
+				}
+
+				uint32_t near_child = node.offset;
+				uint32_t far_child = node.offset + 1;
+				float near_t = closest(IntersectRayPacket(packet, nodes[near_child].min, nodes[near_child].max));
+				float far_t = closest(IntersectRayPacket(packet, nodes[far_child].min, nodes[far_child].max));
+				if (far_t < near_t)
+				{
+					std::swap(near_child, far_child);
+					std::swap(near_t, far_t);
+				}
+				if (near_t == FLT_MAX)
+					break;
+				if (far_t != FLT_MAX)
+				{
+					stack[stack_size++] = far_child;
+				}
+				current = near_child;
+			}
+		}
+	}
+};
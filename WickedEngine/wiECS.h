@@ -3,22 +3,119 @@
 
 #include "wiArchive.h"
 #include "wiJobSystem.h"
+#include "wiSpinLock.h"
 
 #include <cstdint>
 #include <cassert>
 #include <vector>
+#include <deque>
 #include <unordered_map>
 #include <atomic>
+#include <memory>
+#include <array>
+#include <tuple>
+#include <utility>
 
 namespace wiECS
 {
 	using Entity = uint32_t;
 	static const Entity INVALID_ENTITY = 0;
+
+	// Entity handle layout:
+	//	lower bits: index, this is recycled after the entity was destroyed, which keeps lookup tables compact
+	//	upper bits: generation, this is incremented when the index is recycled, so stale handles can be detected
+	//	The generation has only 8 bits, it wraps around after an index was reused 256 times, then a very old stale handle becomes valid again
+	//	Lookup tables are addressed by the index, so only handles from CreateEntity() must be used (see SerializeEntity() for handles from archives)
+	static const uint32_t ENTITY_INDEX_BITS = 24;
+	static const uint32_t ENTITY_GENERATION_BITS = 32 - ENTITY_INDEX_BITS;
+	static const Entity ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+	static const uint32_t ENTITY_GENERATION_MASK = (1u << ENTITY_GENERATION_BITS) - 1;
+
+	inline uint32_t GetEntityIndex(Entity entity) { return entity & ENTITY_INDEX_MASK; }
+	inline uint32_t GetEntityGeneration(Entity entity) { return (entity >> ENTITY_INDEX_BITS) & ENTITY_GENERATION_MASK; }
+	inline Entity MakeEntity(uint32_t index, uint32_t generation) { return (index & ENTITY_INDEX_MASK) | ((generation & ENTITY_GENERATION_MASK) << ENTITY_INDEX_BITS); }
+
+	// Hands out entity handles and recycles the indices of destroyed entities
+	class EntityAllocator
+	{
+	public:
+		// Indices are only recycled when there are at least this many free ones.
+		//	This delays reusing the same index, so the generation counter wraps around much slower
+		static const size_t minimum_free_indices = 1024;
+
+		EntityAllocator()
+		{
+			generations.push_back(0); // index 0 is reserved, because that would be INVALID_ENTITY
+		}
+
+		inline Entity Create()
+		{
+			locker.lock();
+			uint32_t index;
+			if (free_indices.size() > minimum_free_indices)
+			{
+				index = free_indices.front();
+				free_indices.pop_front();
+			}
+			else
+			{
+				index = (uint32_t)generations.size();
+				assert(index <= ENTITY_INDEX_MASK); // ran out of entity indices!
+				generations.push_back(0);
+			}
+			const Entity entity = MakeEntity(index, generations[index]);
+			locker.unlock();
+			return entity;
+		}
+
+		// Destroying an entity that is not alive (stale or already destroyed) does nothing
+		inline void Destroy(Entity entity)
+		{
+			const uint32_t index = GetEntityIndex(entity);
+			locker.lock();
+			if (index != 0 && index < generations.size() && generations[index] == GetEntityGeneration(entity))
+			{
+				generations[index] = (generations[index] + 1) & ENTITY_GENERATION_MASK;
+				free_indices.push_back(index);
+			}
+			locker.unlock();
+		}
+
+		inline bool IsAlive(Entity entity)
+		{
+			const uint32_t index = GetEntityIndex(entity);
+			locker.lock();
+			const bool alive = index != 0 && index < generations.size() && generations[index] == GetEntityGeneration(entity);
+			locker.unlock();
+			return alive;
+		}
+
+	private:
+		wiSpinLock locker;
+		std::vector<uint32_t> generations; // current generation of every index that was ever created
+		std::deque<uint32_t> free_indices; // destroyed indices, reused in FIFO order
+	};
+	inline EntityAllocator& GetEntityAllocator()
+	{
+		static EntityAllocator allocator;
+		return allocator;
+	}
+
 	// Runtime can create a new entity with this
 	inline Entity CreateEntity()
 	{
-		static std::atomic<Entity> next{ INVALID_ENTITY + 1 };
-		return next.fetch_add(1);
+		return GetEntityAllocator().Create();
+	}
+	// Release the entity handle so that its index can be reused later. Existing copies of the handle will become stale.
+	//	This doesn't remove any components, that is the responsibility of the owner (for example Scene::Entity_Remove)
+	inline void DestroyEntity(Entity entity)
+	{
+		GetEntityAllocator().Destroy(entity);
+	}
+	// Check if the entity handle was created and not yet destroyed
+	inline bool IsEntityAlive(Entity entity)
+	{
+		return GetEntityAllocator().IsAlive(entity);
 	}
 
 	struct EntitySerializer
@@ -54,10 +151,25 @@ namespace wiECS
 					entity = it->second;
 				}
 			}
-			else
+			else if (mem == INVALID_ENTITY || (mem <= ~Entity(0) && IsEntityAlive((Entity)mem)))
 			{
 				entity = (Entity)mem;
 			}
+			else
+			{
+				// The reference is kept only if it is a live entity of this process. Others (from an older archive, an other process or a destroyed entity)
+				//	are remapped like above, because they could have the same index as a live entity, which would collide in the lookup tables
+				auto it = seri.remap.find(mem);
+				if (it == seri.remap.end())
+				{
+					entity = CreateEntity();
+					seri.remap[mem] = entity;
+				}
+				else
+				{
+					entity = it->second;
+				}
+			}
 		}
 		else
 		{
@@ -65,8 +177,228 @@ namespace wiECS
 		}
 	}
 
+	// Lookup table from entity to component index, implemented as a paged sparse array:
+	//	Finding an entity is array indexing without hashing
+	//	Memory is only allocated for the pages of the entity range that is in use
+	//	The slots are addressed by the entity index, the full handle is stored to reject stale handles
+	//	Two entities with the same index can't be in the table at the same time
+	class EntityLookup
+	{
+	public:
+		static const uint32_t page_size = 1024;
+		static const uint32_t invalid_index = ~0u;
+
+		EntityLookup() = default;
+		EntityLookup(const EntityLookup& other) { *this = other; }
+		EntityLookup& operator=(const EntityLookup& other)
+		{
+			if (this != &other)
+			{
+				pages.clear();
+				pages.resize(other.pages.size());
+				for (size_t i = 0; i < pages.size(); ++i)
+				{
+					if (other.pages[i] != nullptr)
+					{
+						pages[i].reset(new Slot[page_size]);
+						std::copy(other.pages[i].get(), other.pages[i].get() + page_size, pages[i].get());
+					}
+				}
+				count = other.count;
+			}
+			return *this;
+		}
+
+		// Returns the index of the entity, or invalid_index if it is not in the table
+		inline uint32_t Find(Entity entity) const
+		{
+			const uint32_t index = GetEntityIndex(entity);
+			const size_t page = index / page_size;
+			if (page < pages.size() && pages[page] != nullptr)
+			{
+				const Slot& slot = pages[page][index % page_size];
+				if (slot.entity == entity)
+				{
+					return slot.index;
+				}
+			}
+			return invalid_index;
+		}
+
+		// Add an entity, or change the index of an entity that is already in the table
+		//	Returns false and leaves the table unchanged if an other entity with the same index is in the table
+		//	(a stale handle, or a handle that is not from CreateEntity())
+		inline bool Insert(Entity entity, size_t value)
+		{
+			assert(value < invalid_index);
+			const uint32_t index = GetEntityIndex(entity);
+			const size_t page = index / page_size;
+			if (page >= pages.size())
+			{
+				pages.resize(page + 1);
+			}
+			if (pages[page] == nullptr)
+			{
+				pages[page].reset(new Slot[page_size]);
+			}
+			Slot& slot = pages[page][index % page_size];
+			if (slot.index == invalid_index)
+			{
+				slot.entity = entity;
+				count++;
+			}
+			else if (slot.entity != entity)
+			{
+				return false;
+			}
+			slot.index = (uint32_t)value;
+			return true;
+		}
+
+		// Returns the entity that is in the table with the same index as this entity (it can be this entity), or INVALID_ENTITY
+		inline Entity FindSameIndex(Entity entity) const
+		{
+			const uint32_t index = GetEntityIndex(entity);
+			const size_t page = index / page_size;
+			if (page < pages.size() && pages[page] != nullptr)
+			{
+				const Slot& slot = pages[page][index % page_size];
+				if (slot.index != invalid_index)
+				{
+					return slot.entity;
+				}
+			}
+			return INVALID_ENTITY;
+		}
+
+		// Remove an entity if it is in the table. Pages are not freed, they will be reused
+		inline void Erase(Entity entity)
+		{
+			const uint32_t index = GetEntityIndex(entity);
+			const size_t page = index / page_size;
+			if (page < pages.size() && pages[page] != nullptr)
+			{
+				Slot& slot = pages[page][index % page_size];
+				if (slot.entity == entity && slot.index != invalid_index)
+				{
+					slot.entity = INVALID_ENTITY;
+					slot.index = invalid_index;
+					count--;
+				}
+			}
+		}
+
+		inline void Clear()
+		{
+			pages.clear();
+			count = 0;
+		}
+
+		// Number of entities in the table
+		inline size_t GetCount() const { return count; }
+
+	private:
+		struct Slot
+		{
+			Entity entity = INVALID_ENTITY;
+			uint32_t index = invalid_index;
+		};
+		std::vector<std::unique_ptr<Slot[]>> pages;
+		size_t count = 0;
+	};
+
+	// Keeps track of which component managers contain an entity, with one bit per manager in a mask
+	//	Component managers update it on their own after they were registered with ComponentManager::SetSignatures()
+	//	It is paged and addressed by the entity index just like EntityLookup, stale entity handles return an empty mask
+	class EntitySignatures
+	{
+	public:
+		using Mask = uint64_t;
+		static const uint32_t max_component_types = 64;
+		static const uint32_t page_size = 1024;
+
+		// Retrieve the mask of the component managers that contain the entity
+		inline Mask Get(Entity entity) const
+		{
+			const uint32_t index = GetEntityIndex(entity);
+			const size_t page = index / page_size;
+			if (page < pages.size() && pages[page] != nullptr)
+			{
+				const Slot& slot = pages[page][index % page_size];
+				if (slot.entity == entity)
+				{
+					return slot.mask;
+				}
+			}
+			return 0;
+		}
+
+		// Check if the entity has all of the components in the mask
+		inline bool HasAll(Entity entity, Mask mask) const { return (Get(entity) & mask) == mask; }
+		// Check if the entity has any of the components in the mask
+		inline bool HasAny(Entity entity, Mask mask) const { return (Get(entity) & mask) != 0; }
+
+		inline void Set(Entity entity, Mask mask)
+		{
+			const uint32_t index = GetEntityIndex(entity);
+			const size_t page = index / page_size;
+			if (page >= pages.size())
+			{
+				pages.resize(page + 1);
+			}
+			if (pages[page] == nullptr)
+			{
+				pages[page].reset(new Slot[page_size]);
+			}
+			Slot& slot = pages[page][index % page_size];
+			if (slot.entity != entity)
+			{
+				// The slot was owned by an entity that is not alive anymore, it can't have components left:
+				assert(slot.mask == 0);
+				slot.entity = entity;
+				slot.mask = 0;
+			}
+			slot.mask |= mask;
+		}
+
+		inline void Clear(Entity entity, Mask mask)
+		{
+			const uint32_t index = GetEntityIndex(entity);
+			const size_t page = index / page_size;
+			if (page < pages.size() && pages[page] != nullptr)
+			{
+				Slot& slot = pages[page][index % page_size];
+				if (slot.entity == entity)
+				{
+					slot.mask &= ~mask;
+				}
+			}
+		}
+
+	private:
+		struct Slot
+		{
+			Entity entity = INVALID_ENTITY;
+			Mask mask = 0;
+		};
+		std::vector<std::unique_ptr<Slot[]>> pages;
+	};
+
+	// Type independent interface of ComponentManager, for the operations that can be done without knowing the component type
+	class ComponentManager_Interface
+	{
+	public:
+		virtual ~ComponentManager_Interface() = default;
+		virtual void SetSignatures(EntitySignatures* value, uint32_t bit) = 0;
+		virtual void Remove(Entity entity) = 0;
+		virtual void Remove_KeepSorted(Entity entity) = 0;
+		virtual bool Contains(Entity entity) const = 0;
+		virtual size_t GetCount() const = 0;
+		virtual Entity GetEntity(size_t index) const = 0;
+	};
+
 	template<typename Component>
-	class ComponentManager
+	class ComponentManager : public ComponentManager_Interface
 	{
 	public:
 
@@ -75,15 +407,54 @@ namespace wiECS
 		{
 			components.reserve(reservedCount);
 			entities.reserve(reservedCount);
-			lookup.reserve(reservedCount);
 		}
 
+		// Reserve memory for at least this many components, to avoid reallocations while creating them
+		inline void Reserve(size_t count)
+		{
+			components.reserve(count);
+			entities.reserve(count);
+		}
+
+		// Register a signature table that will be kept updated with the entities of this manager, or nullptr to unregister
+		//	bit : the bit of this manager in the signature masks
+		inline void SetSignatures(EntitySignatures* value, uint32_t bit) override
+		{
+			assert(bit < EntitySignatures::max_component_types);
+			if (signatures != nullptr)
+			{
+				for (Entity entity : entities)
+				{
+					signatures->Clear(entity, signature_mask);
+				}
+			}
+			signatures = value;
+			signature_mask = EntitySignatures::Mask(1) << bit;
+			if (signatures != nullptr)
+			{
+				for (Entity entity : entities)
+				{
+					signatures->Set(entity, signature_mask);
+				}
+			}
+		}
+		// The bit of this manager in the signature masks (0 if no signature table is registered)
+		inline EntitySignatures::Mask GetSignatureMask() const { return signatures != nullptr ? signature_mask : 0; }
+
 		// Clear the whole container
 		inline void Clear()
 		{
+			if (signatures != nullptr)
+			{
+				for (Entity entity : entities)
+				{
+					signatures->Clear(entity, signature_mask);
+				}
+			}
 			components.clear();
 			entities.clear();
-			lookup.clear();
+			lookup.Clear();
+			version++;
 		}
 
 		// Perform deep copy of all the contents of "other" into this
@@ -93,6 +464,14 @@ namespace wiECS
 			components = other.components;
 			entities = other.entities;
 			lookup = other.lookup;
+			if (signatures != nullptr)
+			{
+				for (Entity entity : entities)
+				{
+					signatures->Set(entity, signature_mask);
+				}
+			}
+			version++;
 		}
 
 		// Merge in an other component manager of the same type to this. 
@@ -102,16 +481,21 @@ namespace wiECS
 		{
 			components.reserve(GetCount() + other.GetCount());
 			entities.reserve(GetCount() + other.GetCount());
-			lookup.reserve(GetCount() + other.GetCount());
 
 			for (size_t i = 0; i < other.GetCount(); ++i)
 			{
 				Entity entity = other.entities[i];
 				assert(!Contains(entity));
+				RemoveStale(entity);
 				entities.push_back(entity);
-				lookup[entity] = components.size();
+				lookup.Insert(entity, components.size());
 				components.push_back(std::move(other.components[i]));
+				if (signatures != nullptr)
+				{
+					signatures->Set(entity, signature_mask);
+				}
 			}
+			version++;
 
 			other.Clear();
 		}
@@ -138,8 +522,16 @@ namespace wiECS
 					Entity entity;
 					SerializeEntity(archive, entity, seri);
 					entities[i] = entity;
-					lookup[entity] = i;
+					// The manager was cleared and the entities that are kept from the archive are alive, so they can't have the same index:
+					const bool inserted = lookup.Insert(entity, i);
+					assert(inserted);
+					(void)inserted;
+					if (signatures != nullptr)
+					{
+						signatures->Set(entity, signature_mask);
+					}
 				}
+				version++;
 			}
 			else
 			{
@@ -162,14 +554,16 @@ namespace wiECS
 			assert(entity != INVALID_ENTITY);
 
 			// Only one of this component type per entity is allowed!
-			assert(lookup.find(entity) == lookup.end());
+			assert(lookup.Find(entity) == EntityLookup::invalid_index);
+
+			RemoveStale(entity);
 
 			// Entity count must always be the same as the number of coponents!
 			assert(entities.size() == components.size());
-			assert(lookup.size() == components.size());
+			assert(lookup.GetCount() == components.size());
 
 			// Update the entity lookup table:
-			lookup[entity] = components.size();
+			lookup.Insert(entity, components.size());
 
 			// New components are always pushed to the end:
 			components.emplace_back();
@@ -177,19 +571,34 @@ namespace wiECS
 			// Also push corresponding entity:
 			entities.push_back(entity);
 
+			if (signatures != nullptr)
+			{
+				signatures->Set(entity, signature_mask);
+			}
+
+			version++;
+
 			return components.back();
 		}
 
-		// Remove a component of a certain entity if it exists
-		inline void Remove(Entity entity)
+		// Remove the component of an other entity that has the same index as this one. That is a stale handle whose index was recycled
+		//	while it still had this component, its component can't be reached with a valid handle any more.
+		//	This must be done before adding the entity, because an entity index can only be in the lookup table once:
+		inline void RemoveStale(Entity entity)
 		{
-			auto it = lookup.find(entity);
-			if (it != lookup.end())
+			const Entity stale = lookup.FindSameIndex(entity);
+			if (stale != INVALID_ENTITY && stale != entity)
 			{
-				// Directly index into components and entities array:
-				const size_t index = it->second;
-				const Entity entity = entities[index];
+				Remove(stale);
+			}
+		}
 
+		// Remove a component of a certain entity if it exists
+		inline void Remove(Entity entity) override
+		{
+			const size_t index = Find(entity);
+			if (index != EntityLookup::invalid_index)
+			{
 				if (index < components.size() - 1)
 				{
 					// Swap out the dead element with the last one:
@@ -197,26 +606,27 @@ namespace wiECS
 					entities[index] = entities.back();
 
 					// Update the lookup table:
-					lookup[entities[index]] = index;
+					lookup.Insert(entities[index], index);
 				}
 
 				// Shrink the container:
 				components.pop_back();
 				entities.pop_back();
-				lookup.erase(entity);
+				lookup.Erase(entity);
+				if (signatures != nullptr)
+				{
+					signatures->Clear(entity, signature_mask);
+				}
+				version++;
 			}
 		}
 
 		// Remove a component of a certain entity if it exists while keeping the current ordering
-		inline void Remove_KeepSorted(Entity entity)
+		inline void Remove_KeepSorted(Entity entity) override
 		{
-			auto it = lookup.find(entity);
-			if (it != lookup.end())
+			const size_t index = Find(entity);
+			if (index != EntityLookup::invalid_index)
 			{
-				// Directly index into components and entities array:
-				const size_t index = it->second;
-				const Entity entity = entities[index];
-
 				if (index < components.size() - 1)
 				{
 					// Move every component left by one that is after this element:
@@ -228,14 +638,19 @@ namespace wiECS
 					for (size_t i = index + 1; i < entities.size(); ++i)
 					{
 						entities[i - 1] = entities[i];
-						lookup[entities[i - 1]] = i - 1;
+						lookup.Insert(entities[i - 1], i - 1);
 					}
 				}
 
 				// Shrink the container:
 				components.pop_back();
 				entities.pop_back();
-				lookup.erase(entity);
+				lookup.Erase(entity);
+				if (signatures != nullptr)
+				{
+					signatures->Clear(entity, signature_mask);
+				}
+				version++;
 			}
 		}
 
@@ -260,28 +675,54 @@ namespace wiECS
 				const size_t next = i + direction;
 				components[i] = std::move(components[next]);
 				entities[i] = entities[next];
-				lookup[entities[i]] = i;
+				lookup.Insert(entities[i], i);
 			}
 
 			// Saved entity-component moved to the required position:
 			components[index_to] = std::move(component);
 			entities[index_to] = entity;
-			lookup[entity] = index_to;
+			lookup.Insert(entity, index_to);
+			version++;
+		}
+
+		// Reorder the entity-components in the range [first, first + count), the one at index order[i] is placed to first + i
+		//	order must be a permutation of the indices in the range
+		inline void Reorder(size_t first, const uint32_t* order, size_t count)
+		{
+			assert(first + count <= GetCount());
+
+			std::vector<Component> reordered_components;
+			std::vector<Entity> reordered_entities;
+			reordered_components.reserve(count);
+			reordered_entities.reserve(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				assert(order[i] >= first && order[i] < first + count);
+				reordered_components.push_back(std::move(components[order[i]]));
+				reordered_entities.push_back(entities[order[i]]);
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				components[first + i] = std::move(reordered_components[i]);
+				entities[first + i] = reordered_entities[i];
+				lookup.Insert(entities[first + i], first + i);
+			}
+			version++;
 		}
 
 		// Check if a component exists for a given entity or not
-		inline bool Contains(Entity entity) const
+		inline bool Contains(Entity entity) const override
 		{
-			return lookup.find(entity) != lookup.end();
+			return Find(entity) != EntityLookup::invalid_index;
 		}
 
 		// Retrieve a [read/write] component specified by an entity (if it exists, otherwise nullptr)
 		inline Component* GetComponent(Entity entity)
 		{
-			auto it = lookup.find(entity);
-			if (it != lookup.end())
+			const uint32_t index = Find(entity);
+			if (index != EntityLookup::invalid_index)
 			{
-				return &components[it->second];
+				return &components[index];
 			}
 			return nullptr;
 		}
@@ -289,10 +730,10 @@ namespace wiECS
 		// Retrieve a [read only] component specified by an entity (if it exists, otherwise nullptr)
 		inline const Component* GetComponent(Entity entity) const
 		{
-			const auto it = lookup.find(entity);
-			if (it != lookup.end())
+			const uint32_t index = Find(entity);
+			if (index != EntityLookup::invalid_index)
 			{
-				return &components[it->second];
+				return &components[index];
 			}
 			return nullptr;
 		}
@@ -300,20 +741,24 @@ namespace wiECS
 		// Retrieve component index by entity handle (if not exists, returns ~0 value)
 		inline size_t GetIndex(Entity entity) const 
 		{
-			const auto it = lookup.find(entity);
-			if (it != lookup.end())
+			const uint32_t index = Find(entity);
+			if (index != EntityLookup::invalid_index)
 			{
-				return it->second;
+				return index;
 			}
 			return ~0;
 		}
 
 		// Retrieve the number of existing entries
-		inline size_t GetCount() const { return components.size(); }
+		inline size_t GetCount() const override { return components.size(); }
+
+		// Retrieve a value that changes every time the entity-component layout changes (add, remove, reorder)
+		//	This can be used to detect when cached component indices must be refreshed
+		inline uint64_t GetVersion() const { return version; }
 
 		// Directly index a specific component without indirection
 		//	0 <= index < GetCount()
-		inline Entity GetEntity(size_t index) const { return entities[index]; }
+		inline Entity GetEntity(size_t index) const override { return entities[index]; }
 
 		// Directly index a specific [read/write] component without indirection
 		//	0 <= index < GetCount()
@@ -329,11 +774,146 @@ namespace wiECS
 		// This is a linear array of entities corresponding to each alive component
 		std::vector<Entity> entities;
 		// This is a lookup table for entities
-		std::unordered_map<Entity, size_t> lookup;
+		EntityLookup lookup;
+		// Incremented on every layout change
+		uint64_t version = 0;
+		// Optional signature table to keep updated
+		EntitySignatures* signatures = nullptr;
+		EntitySignatures::Mask signature_mask = 0;
+
+		// Lookup that also rejects stale entity handles which have the same index as a live one
+		inline uint32_t Find(Entity entity) const
+		{
+			return lookup.Find(entity);
+		}
 
 		// Disallow this to be copied by mistake
 		ComponentManager(const ComponentManager&) = delete;
 	};
+
+	// Iterates the entities that have a component in every one of the given managers
+	//	The smallest manager drives the iteration, the component indices of the others are gathered into a packed array
+	//	The gather is cached and only redone when one of the managers changed its layout since the last Refresh()
+	//	Items can be accessed by index, so the view can be used directly as the job count of wiJobSystem::Dispatch:
+	//
+	//		view.Refresh();
+	//		wiJobSystem::Dispatch(ctx, (uint32_t)view.GetCount(), 64, [&](wiJobArgs args) {
+	//			auto [a, b] = view[args.jobIndex];
+	//		});
+	//
+	//	The view must stay alive and unchanged until the jobs are finished
+	template<typename... Components>
+	class View
+	{
+	public:
+		static constexpr size_t component_count = sizeof...(Components);
+		static_assert(component_count > 0, "View needs at least one component type!");
+
+		View(ComponentManager<Components>&... managers) : managers(&managers...)
+		{
+			versions.fill(~0ull);
+		}
+
+		// Redo the gather if any of the managers changed since the last time, otherwise this is very cheap
+		inline void Refresh()
+		{
+			if (!IsOutdated())
+			{
+				return;
+			}
+			entities.clear();
+			indices.clear();
+
+			std::array<size_t, component_count> counts = GetCounts(std::index_sequence_for<Components...>{});
+			size_t driver = 0;
+			for (size_t i = 1; i < component_count; ++i)
+			{
+				if (counts[i] < counts[driver])
+				{
+					driver = i;
+				}
+			}
+			entities.reserve(counts[driver]);
+			indices.reserve(counts[driver]);
+
+			for (size_t i = 0; i < counts[driver]; ++i)
+			{
+				const Entity entity = GetDriverEntity(driver, i, std::index_sequence_for<Components...>{});
+				std::array<uint32_t, component_count> item;
+				if (Gather(entity, item, std::index_sequence_for<Components...>{}))
+				{
+					entities.push_back(entity);
+					indices.push_back(item);
+				}
+			}
+
+			versions = GetVersions(std::index_sequence_for<Components...>{});
+		}
+
+		// Check if the cached gather doesn't match the managers anymore
+		inline bool IsOutdated() const
+		{
+			return versions != GetVersions(std::index_sequence_for<Components...>{});
+		}
+
+		// Number of entities that have all the components (as of the last Refresh())
+		inline size_t GetCount() const { return entities.size(); }
+
+		// The entity of an item
+		//	0 <= index < GetCount()
+		inline Entity GetEntity(size_t index) const { return entities[index]; }
+
+		// Retrieve one component of an item, I is the position of the component type in the View template arguments
+		//	0 <= index < GetCount()
+		template<size_t I>
+		inline auto& Get(size_t index) const
+		{
+			return (*std::get<I>(managers))[indices[index][I]];
+		}
+
+		// Retrieve every component of an item as a tuple of references (works with structured bindings)
+		//	0 <= index < GetCount()
+		inline std::tuple<Components&...> operator[](size_t index) const
+		{
+			return GetAll(index, std::index_sequence_for<Components...>{});
+		}
+
+	private:
+		std::tuple<ComponentManager<Components>*...> managers;
+		std::array<uint64_t, component_count> versions;
+		std::vector<Entity> entities;
+		std::vector<std::array<uint32_t, component_count>> indices;
+
+		template<size_t... I>
+		inline std::array<size_t, component_count> GetCounts(std::index_sequence<I...>) const
+		{
+			return { std::get<I>(managers)->GetCount()... };
+		}
+		template<size_t... I>
+		inline std::array<uint64_t, component_count> GetVersions(std::index_sequence<I...>) const
+		{
+			return { std::get<I>(managers)->GetVersion()... };
+		}
+		template<size_t... I>
+		inline Entity GetDriverEntity(size_t driver, size_t index, std::index_sequence<I...>) const
+		{
+			Entity entity = INVALID_ENTITY;
+			((I == driver ? (void)(entity = std::get<I>(managers)->GetEntity(index)) : (void)0), ...);
+			return entity;
+		}
+		template<size_t... I>
+		inline bool Gather(Entity entity, std::array<uint32_t, component_count>& item, std::index_sequence<I...>) const
+		{
+			bool found = true;
+			((found = found && (item[I] = (uint32_t)std::get<I>(managers)->GetIndex(entity)) != EntityLookup::invalid_index), ...);
+			return found;
+		}
+		template<size_t... I>
+		inline std::tuple<Components&...> GetAll(size_t index, std::index_sequence<I...>) const
+		{
+			return std::tuple<Components&...>((*std::get<I>(managers))[indices[index][I]]...);
+		}
+	};
 }
 
 #endif // WI_ENTITY_COMPONENT_SYSTEM_H
@@ -1,6 +1,10 @@
 #include "wiIntersect.h"
 #include "wiMath.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 
 void AABB::createFromHalfWidth(const XMFLOAT3& center, const XMFLOAT3& halfwidth) 
 {
@@ -194,6 +198,38 @@ void AABB::Serialize(wiArchive& archive, wiECS::EntitySerializer& seri)
 	}
 }
 
+void AABBSoA::Resize(uint32_t newCount)
+{
+	count = newCount;
+	const size_t padded = size_t(GetBlockCount()) * block_size;
+	min_x.resize(padded);
+	min_y.resize(padded);
+	min_z.resize(padded);
+	max_x.resize(padded);
+	max_y.resize(padded);
+	max_z.resize(padded);
+	layerMask.resize(padded);
+
+	// The padding is an empty box without layers, it is never visible:
+	AABB empty;
+	empty.layerMask = 0;
+	for (size_t i = count; i < padded; ++i)
+	{
+		Set((uint32_t)i, empty);
+	}
+}
+void AABBSoA::Clear()
+{
+	min_x.clear();
+	min_y.clear();
+	min_z.clear();
+	max_x.clear();
+	max_y.clear();
+	max_z.clear();
+	layerMask.clear();
+	count = 0;
+}
+
 
 
 
@@ -387,6 +423,59 @@ bool Frustum::CheckBoxFast(const AABB& box) const
 	return true;
 }
 
+uint32_t Frustum::CheckBoxesFast(const AABBSoA& boxes, uint32_t block, uint32_t layerMask) const
+{
+	assert(block < boxes.GetBlockCount());
+	const size_t first = size_t(block) * AABBSoA::block_size;
+
+	// The plane is the same for every box, so the corner furthest along the plane normal is selected once for the whole block
+	//	The dot product is summed in the same order as XMPlaneDotCoord() in CheckBoxFast(), so that the results match exactly
+#if defined(__AVX2__)
+	const __m256i layers = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)&boxes.layerMask[first]), _mm256_set1_epi32((int)layerMask));
+	__m256 visible = _mm256_castsi256_ps(_mm256_xor_si256(_mm256_cmpeq_epi32(layers, _mm256_setzero_si256()), _mm256_set1_epi32(-1)));
+	for (size_t p = 0; p < 6; ++p)
+	{
+		const XMFLOAT4& plane = planes[p];
+		const __m256 x = _mm256_loadu_ps(plane.x < 0 ? &boxes.min_x[first] : &boxes.max_x[first]);
+		const __m256 y = _mm256_loadu_ps(plane.y < 0 ? &boxes.min_y[first] : &boxes.max_y[first]);
+		const __m256 z = _mm256_loadu_ps(plane.z < 0 ? &boxes.min_z[first] : &boxes.max_z[first]);
+		const __m256 xz = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), x), _mm256_mul_ps(_mm256_set1_ps(plane.z), z));
+		const __m256 yw = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.y), y), _mm256_set1_ps(plane.w));
+		const __m256 dot = _mm256_add_ps(yw, xz);
+		visible = _mm256_and_ps(visible, _mm256_cmp_ps(dot, _mm256_setzero_ps(), _CMP_NLT_UQ));
+	}
+	return (uint32_t)_mm256_movemask_ps(visible);
+#else
+	// Two halves of 4 boxes:
+	uint32_t result = 0;
+	for (size_t half = 0; half < AABBSoA::block_size; half += 4)
+	{
+		const size_t i = first + half;
+		const XMVECTOR layers = XMVectorAndInt(XMLoadInt4(&boxes.layerMask[i]), XMVectorReplicateInt(layerMask));
+		XMVECTOR visible = XMVectorNotEqualInt(layers, XMVectorZero());
+		for (size_t p = 0; p < 6; ++p)
+		{
+			const XMFLOAT4& plane = planes[p];
+			const XMVECTOR x = XMLoadFloat4((const XMFLOAT4*)(plane.x < 0 ? &boxes.min_x[i] : &boxes.max_x[i]));
+			const XMVECTOR y = XMLoadFloat4((const XMFLOAT4*)(plane.y < 0 ? &boxes.min_y[i] : &boxes.max_y[i]));
+			const XMVECTOR z = XMLoadFloat4((const XMFLOAT4*)(plane.z < 0 ? &boxes.min_z[i] : &boxes.max_z[i]));
+			const XMVECTOR xz = XMVectorAdd(XMVectorMultiply(XMVectorReplicate(plane.x), x), XMVectorMultiply(XMVectorReplicate(plane.z), z));
+			const XMVECTOR yw = XMVectorAdd(XMVectorMultiply(XMVectorReplicate(plane.y), y), XMVectorReplicate(plane.w));
+			const XMVECTOR dot = XMVectorAdd(yw, xz);
+			visible = XMVectorAndCInt(visible, XMVectorLess(dot, XMVectorZero())); // not culled by NaN, like in CheckBoxFast()
+		}
+#if defined(_XM_SSE_INTRINSICS_)
+		result |= uint32_t(_mm_movemask_ps(visible)) << half;
+#else
+		uint32_t lanes[4];
+		XMStoreInt4(lanes, visible);
+		result |= ((lanes[0] >> 31) | ((lanes[1] >> 31) << 1) | ((lanes[2] >> 31) << 2) | ((lanes[3] >> 31) << 3)) << half;
+#endif
+	}
+	return result;
+#endif
+}
+
 const XMFLOAT4& Frustum::getNearPlane() const { return planes[0]; }
 const XMFLOAT4& Frustum::getFarPlane() const { return planes[1]; }
 const XMFLOAT4& Frustum::getLeftPlane() const { return planes[2]; }
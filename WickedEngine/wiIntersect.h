@@ -61,6 +61,33 @@ struct AABB
 
 	void Serialize(wiArchive& archive, wiECS::EntitySerializer& seri);
 };
+// Axis aligned bounding boxes in structure of arrays layout, so that they can be tested in blocks of 8 with SIMD (see Frustum::CheckBoxesFast())
+//	The arrays are padded to whole blocks with empty boxes that are in no layer, so a block can always be read entirely
+struct AABBSoA
+{
+	static constexpr uint32_t block_size = 8;
+
+	std::vector<float> min_x, min_y, min_z;
+	std::vector<float> max_x, max_y, max_z;
+	std::vector<uint32_t> layerMask;
+	uint32_t count = 0;
+
+	void Resize(uint32_t newCount);
+	void Clear();
+
+	inline void Set(uint32_t index, const AABB& aabb)
+	{
+		min_x[index] = aabb._min.x;
+		min_y[index] = aabb._min.y;
+		min_z[index] = aabb._min.z;
+		max_x[index] = aabb._max.x;
+		max_y[index] = aabb._max.y;
+		max_z[index] = aabb._max.z;
+		layerMask[index] = aabb.layerMask;
+	}
+	inline uint32_t GetCount() const { return count; }
+	inline uint32_t GetBlockCount() const { return (count + block_size - 1) / block_size; }
+};
 struct SPHERE 
 {
 	XMFLOAT3 center;
@@ -125,6 +152,9 @@ struct Frustum
 	};
 	BoxFrustumIntersect CheckBox(const AABB& box) const;
 	bool CheckBoxFast(const AABB& box) const;
+	// Tests the block of 8 boxes starting at index block * AABBSoA::block_size, it gives the same result as CheckBoxFast() for each box
+	//	Returns one bit for every box of the block that is in the frustum and has a common layer with layerMask
+	uint32_t CheckBoxesFast(const AABBSoA& boxes, uint32_t block, uint32_t layerMask) const;
 
 	const XMFLOAT4& getNearPlane() const;
 	const XMFLOAT4& getFarPlane() const;
@@ -1,98 +1,449 @@
 #include "wiJobSystem.h"
 #include "wiSpinLock.h"
 #include "wiBackLog.h"
-#include "wiContainers.h"
 #include "wiPlatform.h"
 #include "wiTimer.h"
 
 #include <thread>
 #include <condition_variable>
+#include <vector>
+#include <memory>
 #include <string>
 #include <algorithm>
+#include <cassert>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WIJOBSYSTEM_PAUSE() _mm_pause()
+#else
+#define WIJOBSYSTEM_PAUSE() std::this_thread::yield()
+#endif
+
+#ifdef PLATFORM_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif // PLATFORM_LINUX
 
 namespace wiJobSystem
 {
 	struct Job
 	{
-		context* ctx;
-		std::function<void(wiJobArgs)> task;
+		JobBlock* block;
 		uint32_t groupID;
 		uint32_t groupJobOffset;
 		uint32_t groupJobEnd;
-		uint32_t sharedmemory_size;
+	};
+
+	// Job queue that is owned by one worker thread, but other threads can steal from it:
+	//	The owner pushes and pops at the back (LIFO, most recent jobs are likely still in cache)
+	//	Other threads steal from the front (FIFO, oldest jobs first)
+	//	Jobs are stored in a ring buffer that only grows, so it doesn't allocate memory after it reached the working size
+	//	It is aligned to cache line size, so that the queues of different workers don't share cache lines
+	struct alignas(64) JobQueue
+	{
+		std::vector<Job> ring = std::vector<Job>(256); // size is always power of two
+		uint32_t head = 0; // front of the queue (index before wrapping)
+		uint32_t tail = 0; // one past the back of the queue (index before wrapping)
+		std::atomic<uint32_t> count{ 0 }; // this can be checked without locking to skip empty queues
+		wiSpinLock locker;
+
+		// Must be called while locked:
+		inline void push_locked(const Job& item)
+		{
+			if (tail - head == (uint32_t)ring.size())
+			{
+				std::vector<Job> grown(ring.size() * 2);
+				for (uint32_t i = head; i != tail; ++i)
+				{
+					grown[i - head] = ring[i & (ring.size() - 1)];
+				}
+				ring.swap(grown);
+				tail -= head;
+				head = 0;
+			}
+			ring[tail & (ring.size() - 1)] = item;
+			tail++;
+		}
+		inline void push_back(const Job& item)
+		{
+			locker.lock();
+			push_locked(item);
+			count.fetch_add(1, std::memory_order_relaxed);
+			locker.unlock();
+		}
+		inline bool pop_back(Job& item)
+		{
+			if (count.load(std::memory_order_relaxed) == 0)
+			{
+				return false;
+			}
+			bool result = false;
+			locker.lock();
+			if (head != tail)
+			{
+				tail--;
+				item = ring[tail & (ring.size() - 1)];
+				count.fetch_sub(1, std::memory_order_relaxed);
+				result = true;
+			}
+			locker.unlock();
+			return result;
+		}
+		inline bool steal(Job& item)
+		{
+			if (count.load(std::memory_order_relaxed) == 0)
+			{
+				return false;
+			}
+			bool result = false;
+			locker.lock();
+			if (head != tail)
+			{
+				item = ring[head & (ring.size() - 1)];
+				head++;
+				count.fetch_sub(1, std::memory_order_relaxed);
+				result = true;
+			}
+			locker.unlock();
+			return result;
+		}
 	};
 
 	uint32_t numThreads = 0;
-	wiContainers::ThreadSafeRingBuffer<Job, 256> jobQueue;
-	std::condition_variable wakeCondition;
+	uint32_t numBackgroundThreads = 0; // only the first numBackgroundThreads workers execute background jobs
+	std::unique_ptr<JobQueue[]> jobQueuePerThread[int(Priority::Count)];
+	std::atomic<uint32_t> nextQueue{ 0 }; // round robin queue selection for threads that are not workers
+	IdlePolicy idlePolicy = IdlePolicy::SpinThenSleep;
+	uint32_t spinCount = 0;
+	bool workStealing = true;
+	std::atomic<bool> alive{ false }; // workers exit when this is cleared by ShutDown()
+	std::atomic<uint32_t> runningThreads{ 0 };
+
+	// Sleeping workers:
+	//	Submitting jobs only locks and signals when there are sleeping workers, and only wakes up as many of them as there are new jobs
+	//	The workers that execute background jobs sleep separately, so that only they are woken up for background jobs
+	struct Sleepers
+	{
+		std::condition_variable wakeCondition;
+		std::atomic<uint32_t> sleepingThreads{ 0 };
+		uint32_t wakeSignals = 0; // protected by wakeMutex
+	};
+	Sleepers sleepers[2]; // 0: workers that don't execute background jobs, 1: workers that execute background jobs
 	std::mutex wakeMutex;
 
-	// This function executes the next item from the job queue. Returns true if successful, false if there was no job available
-	inline bool work()
+	// Index of the queue that is owned by the current thread. Threads that are not workers don't own a queue.
+	thread_local uint32_t threadQueueIndex = ~0u;
+	// Random state for choosing steal victims, seeded differently per thread
+	thread_local uint32_t stealSeed = 0;
+
+	// Number of queues of a priority, every worker has one, except for background queues
+	//	Without work stealing there is only one queue that no thread owns, so every thread takes jobs from its front
+	inline uint32_t queue_count(Priority priority)
 	{
-		Job job;
-		if (jobQueue.pop_front(job))
+		if (!workStealing)
+		{
+			return 1;
+		}
+		return priority == Priority::Background ? numBackgroundThreads : numThreads;
+	}
+
+	inline uint32_t random_victim(uint32_t queueCount)
+	{
+		if (stealSeed == 0)
 		{
-			wiJobArgs args;
-			args.groupID = job.groupID;
-			if (job.sharedmemory_size > 0)
+			stealSeed = (uint32_t)std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1;
+		}
+		// xorshift32:
+		stealSeed ^= stealSeed << 13;
+		stealSeed ^= stealSeed >> 17;
+		stealSeed ^= stealSeed << 5;
+		return stealSeed % queueCount;
+	}
+
+	// Retrieve the next job, higher priorities first, down to lowestPriority
+	//	For each priority first from the own queue, then try stealing from the other queues starting with a random one
+	inline bool pop_job(Job& job, Priority lowestPriority)
+	{
+		for (int priority = 0; priority <= int(lowestPriority); ++priority)
+		{
+			const uint32_t queueCount = queue_count(Priority(priority));
+			JobQueue* jobQueues = jobQueuePerThread[priority].get();
+			if (threadQueueIndex < queueCount && jobQueues[threadQueueIndex].pop_back(job))
 			{
-				args.sharedmemory = alloca(job.sharedmemory_size);
+				return true;
 			}
-			else
+			const uint32_t victim = random_victim(queueCount);
+			for (uint32_t i = 0; i < queueCount; ++i)
+			{
+				const uint32_t queueIndex = (victim + i) % queueCount;
+				if (queueIndex != threadQueueIndex && jobQueues[queueIndex].steal(job))
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Check if there is any job down to lowestPriority without locking
+	inline bool has_jobs(Priority lowestPriority)
+	{
+		for (int priority = 0; priority <= int(lowestPriority); ++priority)
+		{
+			const uint32_t queueCount = queue_count(Priority(priority));
+			for (uint32_t i = 0; i < queueCount; ++i)
+			{
+				if (jobQueuePerThread[priority][i].count.load(std::memory_order_relaxed) > 0)
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Put the worker to sleep until it is woken up, unless jobs were added in the meantime
+	inline void sleep(Priority lowestPriority)
+	{
+		Sleepers& group = sleepers[lowestPriority == Priority::Background ? 1 : 0];
+		std::unique_lock<std::mutex> lock(wakeMutex);
+		group.sleepingThreads.fetch_add(1);
+		// Either this thread sees the new jobs, or the thread that added them sees this thread sleeping (pairs with the fence in wake()):
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!has_jobs(lowestPriority))
+		{
+			group.wakeCondition.wait(lock, [&] { return group.wakeSignals > 0 || !alive.load(); });
+			if (group.wakeSignals > 0)
 			{
-				args.sharedmemory = nullptr;
+				group.wakeSignals--;
 			}
+		}
+		group.sleepingThreads.fetch_sub(1);
+	}
 
-			for (uint32_t i = job.groupJobOffset; i < job.groupJobEnd; ++i)
+	// Wake up at most count sleeping workers that can execute jobs of the priority
+	//	For other than background jobs, the workers that don't execute background jobs are woken up first
+	inline void wake(uint32_t count, Priority priority)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		for (int i = priority == Priority::Background ? 1 : 0; i < 2 && count > 0; ++i)
+		{
+			Sleepers& group = sleepers[i];
+			if (group.sleepingThreads.load() == 0)
 			{
-				args.jobIndex = i;
-				args.groupIndex = i - job.groupJobOffset;
-				args.isFirstJobInGroup = (i == job.groupJobOffset);
-				args.isLastJobInGroup = (i == job.groupJobEnd - 1);
-				job.task(args);
+				continue;
 			}
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			const uint32_t sleeping = group.sleepingThreads.load();
+			const uint32_t woken = std::min(count, sleeping > group.wakeSignals ? sleeping - group.wakeSignals : 0);
+			group.wakeSignals += woken;
+			lock.unlock();
+			if (woken == sleeping)
+			{
+				group.wakeCondition.notify_all();
+			}
+			else
+			{
+				for (uint32_t j = 0; j < woken; ++j)
+				{
+					group.wakeCondition.notify_one();
+				}
+			}
+			count -= woken;
+		}
+	}
+
+	// Recycled job blocks:
+	JobBlock* freeBlocks = nullptr;
+	wiSpinLock freeBlocksLocker;
 
-			job.ctx->counter.fetch_sub(1);
+	JobBlock* AllocateJobBlock()
+	{
+		freeBlocksLocker.lock();
+		JobBlock* block = freeBlocks;
+		if (block != nullptr)
+		{
+			freeBlocks = block->next;
+		}
+		freeBlocksLocker.unlock();
+		if (block == nullptr)
+		{
+			block = new JobBlock;
+		}
+		return block;
+	}
+
+	inline void free_job_block(JobBlock* block)
+	{
+		block->destroy(block->callable);
+		block->callable = nullptr;
+		freeBlocksLocker.lock();
+		block->next = freeBlocks;
+		freeBlocks = block;
+		freeBlocksLocker.unlock();
+	}
+
+	inline void execute_job(const Job& job)
+	{
+		JobBlock* block = job.block;
+		context* ctx = block->ctx;
+
+		wiJobArgs args;
+		args.groupID = job.groupID;
+		if (block->sharedmemory_size > 0)
+		{
+			args.sharedmemory = alloca(block->sharedmemory_size);
+		}
+		else
+		{
+			args.sharedmemory = nullptr;
+		}
+
+		for (uint32_t i = job.groupJobOffset; i < job.groupJobEnd; ++i)
+		{
+			args.jobIndex = i;
+			args.groupIndex = i - job.groupJobOffset;
+			args.isFirstJobInGroup = (i == job.groupJobOffset);
+			args.isLastJobInGroup = (i == job.groupJobEnd - 1);
+			block->invoke(block->callable, args);
+		}
+
+		// The last job of the block releases the task before the context is signaled, so captured objects are destroyed when Wait() returns:
+		if (block->refcount.fetch_sub(1) == 1)
+		{
+			free_job_block(block);
+		}
+
+		ctx->counter.fetch_sub(1);
+	}
+
+	// This function executes the next item from the job queues that has at least lowestPriority. Returns true if successful, false if there was no job available
+	inline bool work(Priority lowestPriority)
+	{
+		Job job;
+		if (pop_job(job, lowestPriority))
+		{
+			execute_job(job);
 			return true;
 		}
 		return false;
 	}
 
-	void Initialize()
+	void Initialize(const InitDesc& desc)
 	{
 		wiTimer timer;
 
+		assert(runningThreads.load() == 0); // ShutDown() must be called before initializing again
+
 		// Retrieve the number of hardware threads in this system:
 		auto numCores = std::thread::hardware_concurrency();
 
 		// Calculate the actual number of worker threads we want (-1 main thread):
-		numThreads = std::max(1u, numCores - 1);
+		numThreads = desc.threadCount > 0 ? desc.threadCount : std::min(desc.maxThreadCount, std::max(1u, numCores - 1));
+		numBackgroundThreads = desc.backgroundThreadCount == ~0u ? std::max(1u, numThreads / 2) : std::max(1u, desc.backgroundThreadCount);
+		numBackgroundThreads = std::min(numBackgroundThreads, numThreads);
+		idlePolicy = desc.idlePolicy;
+		spinCount = desc.spinCount;
+		workStealing = desc.workStealing;
+		alive.store(true);
+		runningThreads.store(numThreads);
+		for (int priority = 0; priority < int(Priority::Count); ++priority)
+		{
+			jobQueuePerThread[priority].reset(new JobQueue[queue_count(Priority(priority))]);
+		}
+
+		// The workers are only pinned to the cores that the process is allowed to run on (taskset, containers, etc.):
+		std::vector<uint32_t> allowedCores;
+		if (desc.pinThreads)
+		{
+#ifdef _WIN32
+			DWORD_PTR processMask = 0;
+			DWORD_PTR systemMask = 0;
+			if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+			{
+				for (uint32_t core = 0; core < sizeof(DWORD_PTR) * 8; ++core)
+				{
+					if (processMask & (DWORD_PTR(1) << core))
+					{
+						allowedCores.push_back(core);
+					}
+				}
+			}
+#elif defined(PLATFORM_LINUX)
+			cpu_set_t processSet;
+			CPU_ZERO(&processSet);
+			if (sched_getaffinity(0, sizeof(cpu_set_t), &processSet) == 0)
+			{
+				for (uint32_t core = 0; core < CPU_SETSIZE; ++core)
+				{
+					if (CPU_ISSET(core, &processSet))
+					{
+						allowedCores.push_back(core);
+					}
+				}
+			}
+#endif // _WIN32
+
+			if (allowedCores.empty())
+			{
+				wiBackLog::post("wiJobSystem couldn't retrieve the process affinity, worker threads are not pinned to cores", wiBackLog::LogLevel::Warning);
+			}
+		}
 
 		for (uint32_t threadID = 0; threadID < numThreads; ++threadID)
 		{
-			std::thread worker([] {
+			std::thread worker([threadID] {
+
+				threadQueueIndex = workStealing ? threadID : ~0u;
+
+				// Only a limited number of workers pick up background jobs, the others are always available for frame work.
+				//	Any thread can still help with background jobs while it is waiting for them:
+				const Priority lowestPriority = threadID < numBackgroundThreads ? Priority::Background : Priority::Normal;
 
-				while (true)
+				while (alive.load(std::memory_order_relaxed))
 				{
-					if (!work())
+					if (work(lowestPriority))
 					{
-						// no job, put thread to sleep
-						std::unique_lock<std::mutex> lock(wakeMutex);
-						wakeCondition.wait(lock);
+						continue;
 					}
+
+					if (idlePolicy != IdlePolicy::Sleep)
+					{
+						// no job, keep checking for a while (or forever) before going to sleep:
+						bool found = false;
+						for (uint32_t i = 0; (i < spinCount || idlePolicy == IdlePolicy::Spin) && !found && alive.load(std::memory_order_relaxed); ++i)
+						{
+							WIJOBSYSTEM_PAUSE();
+							found = has_jobs(lowestPriority);
+						}
+						if (found)
+						{
+							continue;
+						}
+					}
+
+					// no job, put thread to sleep
+					sleep(lowestPriority);
 				}
 
+				runningThreads.fetch_sub(1);
+
 			});
 
 #ifdef _WIN32
 			// Do Windows-specific thread setup:
 			HANDLE handle = (HANDLE)worker.native_handle();
 
-			// Put each thread on to dedicated core:
-			DWORD_PTR affinityMask = 1ull << threadID;
-			DWORD_PTR affinity_result = SetThreadAffinityMask(handle, affinityMask);
-			assert(affinity_result > 0);
+			if (!allowedCores.empty())
+			{
+				// Put each thread on to dedicated core:
+				DWORD_PTR affinityMask = DWORD_PTR(1) << allowedCores[threadID % allowedCores.size()];
+				DWORD_PTR affinity_result = SetThreadAffinityMask(handle, affinityMask);
+				if (affinity_result == 0)
+				{
+					wiBackLog::post("wiJobSystem couldn't pin worker thread " + std::to_string(threadID) + " to a core", wiBackLog::LogLevel::Warning);
+				}
+			}
 
 			//// Increase thread priority:
 			//BOOL priority_result = SetThreadPriority(handle, THREAD_PRIORITY_HIGHEST);
@@ -102,69 +453,136 @@ namespace wiJobSystem
 			std::wstring wthreadname =  L"wiJobSystem_" + std::to_wstring(threadID);
 			HRESULT hr = SetThreadDescription(handle, wthreadname.c_str());
 			assert(SUCCEEDED(hr));
+#elif defined(PLATFORM_LINUX)
+			// Do Linux-specific thread setup:
+			pthread_t handle = worker.native_handle();
+
+			if (!allowedCores.empty())
+			{
+				// Put each thread on to dedicated core:
+				cpu_set_t cpuset;
+				CPU_ZERO(&cpuset);
+				CPU_SET(allowedCores[threadID % allowedCores.size()], &cpuset);
+				int affinity_result = pthread_setaffinity_np(handle, sizeof(cpu_set_t), &cpuset);
+				if (affinity_result != 0)
+				{
+					wiBackLog::post("wiJobSystem couldn't pin worker thread " + std::to_string(threadID) + " to a core (error " + std::to_string(affinity_result) + ")", wiBackLog::LogLevel::Warning);
+				}
+			}
+
+			// Name the thread (at most 15 characters):
+			std::string threadname = "wiJobSystem_" + std::to_string(threadID);
+			int name_result = pthread_setname_np(handle, threadname.substr(0, 15).c_str());
+			assert(name_result == 0);
 #endif // _WIN32
 
 			worker.detach();
 		}
 
-		wiBackLog::post("wiJobSystem Initialized with [" + std::to_string(numCores) + " cores] [" + std::to_string(numThreads) + " threads] (" + std::to_string((int)std::round(timer.elapsed())) + " ms)");
+		wiBackLog::post("wiJobSystem Initialized with [" + std::to_string(numCores) + " cores] [" + std::to_string(numThreads) + " threads] [" + std::to_string(numBackgroundThreads) + " background threads] (" + std::to_string((int)std::round(timer.elapsed())) + " ms)");
 	}
 
-	uint32_t GetThreadCount()
+	void ShutDown()
 	{
-		return numThreads;
-	}
+		if (numThreads == 0)
+		{
+			return;
+		}
 
-	void Execute(context& ctx, const std::function<void(wiJobArgs)>& task)
-	{
-		// Context state is updated:
-		ctx.counter.fetch_add(1);
+		// Cleared while locked, so a worker can't miss it between checking its wake condition and going to sleep:
+		{
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			alive.store(false);
+		}
+		for (Sleepers& group : sleepers)
+		{
+			group.wakeCondition.notify_all();
+		}
 
-		Job job;
-		job.ctx = &ctx;
-		job.task = task;
-		job.groupID = 0;
-		job.groupJobOffset = 0;
-		job.groupJobEnd = 1;
-		job.sharedmemory_size = 0;
+		// The workers are detached, so they are waited for until they left their loop:
+		while (runningThreads.load() > 0)
+		{
+			std::this_thread::yield();
+		}
 
-		// Try to push a new job until it is pushed successfully:
-		while (!jobQueue.push_back(job)) { wakeCondition.notify_all(); work(); }
+		// The jobs that were left in the queues, and the ones that they add, are finished here:
+		while (work(Priority::Background)) {}
 
-		// Wake any one thread that might be sleeping:
-		wakeCondition.notify_one();
+		numThreads = 0;
+		numBackgroundThreads = 0;
+		for (int priority = 0; priority < int(Priority::Count); ++priority)
+		{
+			jobQueuePerThread[priority].reset();
+		}
+		for (Sleepers& group : sleepers)
+		{
+			group.wakeSignals = 0;
+		}
 	}
 
-	void Dispatch(context& ctx, uint32_t jobCount, uint32_t groupSize, const std::function<void(wiJobArgs)>& task, size_t sharedmemory_size)
+	uint32_t GetThreadCount()
 	{
-		if (jobCount == 0 || groupSize == 0)
-		{
-			return;
-		}
+		return numThreads;
+	}
 
+	void Submit(context& ctx, JobBlock* block, uint32_t jobCount, uint32_t groupSize, size_t sharedmemory_size)
+	{
 		const uint32_t groupCount = DispatchGroupCount(jobCount, groupSize);
 
 		// Context state is updated:
 		ctx.counter.fetch_add(groupCount);
 
+		block->ctx = &ctx;
+		block->sharedmemory_size = (uint32_t)sharedmemory_size;
+		block->refcount.store(groupCount);
+
 		Job job;
-		job.ctx = &ctx;
-		job.task = task;
-		job.sharedmemory_size = (uint32_t)sharedmemory_size;
+		job.block = block;
 
-		for (uint32_t groupID = 0; groupID < groupCount; ++groupID)
+		if (numThreads == 0)
 		{
-			// For each group, generate one real job:
-			job.groupID = groupID;
-			job.groupJobOffset = groupID * groupSize;
-			job.groupJobEnd = std::min(job.groupJobOffset + groupSize, jobCount);
+			// Job system is not initialized, execute on the calling thread:
+			for (uint32_t groupID = 0; groupID < groupCount; ++groupID)
+			{
+				job.groupID = groupID;
+				job.groupJobOffset = groupID * groupSize;
+				job.groupJobEnd = std::min(job.groupJobOffset + groupSize, jobCount);
+				execute_job(job);
+			}
+			return;
+		}
 
-			// Try to push a new job until it is pushed successfully:
-			while (!jobQueue.push_back(job)) { wakeCondition.notify_all(); work(); }
+		// Workers push every group to their own queue of the context's priority and idle workers will steal from it.
+		//	Other threads (and workers that don't have a background queue) split the groups into contiguous batches, one batch per worker queue
+		//	so that each queue is locked only once:
+		const uint32_t queueCount = queue_count(ctx.priority);
+		JobQueue* jobQueues = jobQueuePerThread[int(ctx.priority)].get();
+		const bool owner = threadQueueIndex < queueCount;
+		const uint32_t batchCount = owner ? 1 : std::min(groupCount, queueCount);
+		const uint32_t firstQueue = owner ? threadQueueIndex : nextQueue.fetch_add(batchCount, std::memory_order_relaxed);
+
+		for (uint32_t batch = 0; batch < batchCount; ++batch)
+		{
+			JobQueue& jobQueue = jobQueues[(firstQueue + batch) % queueCount];
+			const uint32_t groupBegin = uint32_t(uint64_t(batch) * groupCount / batchCount);
+			const uint32_t groupEnd = uint32_t(uint64_t(batch + 1) * groupCount / batchCount);
+
+			jobQueue.locker.lock();
+			for (uint32_t groupID = groupBegin; groupID < groupEnd; ++groupID)
+			{
+				// For each group, generate one real job:
+				job.groupID = groupID;
+				job.groupJobOffset = groupID * groupSize;
+				job.groupJobEnd = std::min(job.groupJobOffset + groupSize, jobCount);
+				jobQueue.push_locked(job);
+			}
+			jobQueue.count.fetch_add(groupEnd - groupBegin, std::memory_order_relaxed);
+			jobQueue.locker.unlock();
 		}
 
-		// Wake any threads that might be sleeping:
-		wakeCondition.notify_all();
+		// Wake up sleeping workers, one for each new job.
+		//	Only the background workers can execute background jobs, so no more of them than that are woken up:
+		wake(ctx.priority == Priority::Background ? std::min(groupCount, numBackgroundThreads) : groupCount, ctx.priority);
 	}
 
 	uint32_t DispatchGroupCount(uint32_t jobCount, uint32_t groupSize)
@@ -173,6 +591,15 @@ namespace wiJobSystem
 		return (jobCount + groupSize - 1) / groupSize;
 	}
 
+	uint32_t GetParallelGroupSize(uint32_t itemCount, uint32_t minGroupSize)
+	{
+		// A few groups per thread (including the calling thread) for load balancing:
+		const uint32_t targetGroupCount = std::min(parallel_max_groupcount, std::max(1u, (numThreads + 1) * 4));
+		const uint32_t groupSize = std::max(minGroupSize, DispatchGroupCount(itemCount, targetGroupCount));
+		// Never exceed the group limit:
+		return std::max(groupSize, DispatchGroupCount(itemCount, parallel_max_groupcount));
+	}
+
 	bool IsBusy(const context& ctx)
 	{
 		// Whenever the context label is greater than zero, it means that there is still work that needs to be done
@@ -181,10 +608,76 @@ namespace wiJobSystem
 
 	void Wait(const context& ctx)
 	{
-		// Wake any threads that might be sleeping:
-		wakeCondition.notify_all();
+		// Waiting will also put the current thread to good use by working on an other job if it can.
+		//	Only jobs with equal or higher priority are picked up, so a long background job can't delay the waiting thread:
+		while (IsBusy(ctx)) { work(ctx.priority); }
+	}
+
+	uint32_t TaskGraph::AddTask(const Task& task)
+	{
+		nodes.emplace_back();
+		nodes.back().task = task;
+		return uint32_t(nodes.size() - 1);
+	}
 
-		// Waiting will also put the current thread to good use by working on an other job if it can:
-		while (IsBusy(ctx)) { work(); }
+	uint32_t TaskGraph::AddTask(const Task& task, std::initializer_list<uint32_t> dependencies)
+	{
+		uint32_t index = AddTask(task);
+		for (uint32_t dependency : dependencies)
+		{
+			AddDependency(index, dependency);
+		}
+		return index;
+	}
+
+	void TaskGraph::AddDependency(uint32_t task, uint32_t dependency)
+	{
+		assert(dependency < task);
+		assert(task < nodes.size());
+		nodes[dependency].successors.push_back(task);
+		nodes[task].dependencyCount++;
+	}
+
+	void TaskGraph::Clear()
+	{
+		nodes.clear();
+	}
+
+	void TaskGraph::Run(context& ctx)
+	{
+		for (auto& node : nodes)
+		{
+			assert(!IsBusy(node.ctx));
+			node.remaining.store(node.dependencyCount);
+			node.ctx.priority = ctx.priority;
+		}
+		for (uint32_t i = 0; i < (uint32_t)nodes.size(); ++i)
+		{
+			if (nodes[i].dependencyCount == 0)
+			{
+				Start(ctx, i);
+			}
+		}
+	}
+
+	void TaskGraph::Start(context& ctx, uint32_t index)
+	{
+		Execute(ctx, [this, &ctx, index](wiJobArgs args) {
+			Node& node = nodes[index];
+			node.task(node.ctx);
+
+			// The task can leave jobs behind in its own context, those are finished here (also helping with other work in the meantime):
+			Wait(node.ctx);
+
+			// Start the successors that have no more unfinished dependencies.
+			//	This job is still holding ctx, so ctx can't become idle before the successors are added to it:
+			for (uint32_t successor : node.successors)
+			{
+				if (nodes[successor].remaining.fetch_sub(1) == 1)
+				{
+					Start(ctx, successor);
+				}
+			}
+		});
 	}
 }
@@ -2,6 +2,12 @@
 
 #include <functional>
 #include <atomic>
+#include <vector>
+#include <deque>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
 
 struct wiJobArgs
 {
@@ -15,24 +21,112 @@ struct wiJobArgs
 
 namespace wiJobSystem
 {
-	void Initialize();
+	// How the worker threads behave when they run out of jobs
+	enum class IdlePolicy
+	{
+		Sleep,			// go to sleep immediately, lowest CPU usage
+		SpinThenSleep,	// keep looking for new jobs for a short time before going to sleep, new jobs are picked up faster
+		Spin,			// never sleep, lowest latency, but the worker threads keep their cores busy all the time
+	};
+
+	struct InitDesc
+	{
+		uint32_t maxThreadCount = ~0u;			// upper limit for worker threads, by default there is one worker for every hardware thread except the main thread. Zero means that jobs execute on the calling thread
+		uint32_t backgroundThreadCount = ~0u;	// how many worker threads can execute Priority::Background jobs (at least 1, at most every worker). ~0u means half of the workers
+		IdlePolicy idlePolicy = IdlePolicy::SpinThenSleep;
+		uint32_t spinCount = 2048;				// how many times an idle worker checks for new jobs before going to sleep with IdlePolicy::SpinThenSleep
+		bool pinThreads = false;				// put each worker thread on a dedicated core of the ones the process is allowed to run on. Off by default, because pinned workers compete badly with other processes
+		uint32_t threadCount = 0;				// if not zero, exactly this many worker threads are created, even more than the hardware threads, and maxThreadCount is ignored. For measuring the scheduler under contention
+		bool workStealing = true;				// every worker has its own job queue and idle workers steal from the others. If false, all threads share a single job queue per priority, as a baseline for comparison
+	};
+
+	void Initialize(const InitDesc& desc = {});
+
+	// Stops the worker threads, after this the job system can be initialized again
+	//	Jobs that are still in the queues are executed on the calling thread
+	//	No other thread can add jobs while this is running
+	void ShutDown();
 
 	uint32_t GetThreadCount();
 
+	enum class Priority
+	{
+		Critical,	// frame critical work, like culling. Executed before any other job
+		Normal,		// default priority
+		Background,	// long running work, like resource loading. Only a limited number of workers execute these, so they can't occupy the whole pool
+		Count
+	};
+
 	// Defines a state of execution, can be waited on
 	struct context
 	{
 		std::atomic<uint32_t> counter{ 0 };
+		Priority priority = Priority::Normal; // priority of the jobs that are added to this context
+	};
+
+	// Storage of a task that is shared between all the jobs of one Execute() or Dispatch()
+	//	Blocks are recycled by the job system, so submitting a task doesn't allocate memory, unless the task doesn't fit into the inline storage
+	//	Jobs only refer to a block and a range of job indices
+	struct JobBlock
+	{
+		alignas(16) uint8_t storage[128];
+		void* callable = nullptr;
+		void(*invoke)(void* callable, wiJobArgs& args) = nullptr;
+		void(*destroy)(void* callable) = nullptr;
+		context* ctx = nullptr;
+		uint32_t sharedmemory_size = 0;
+		std::atomic<uint32_t> refcount{ 0 }; // number of unfinished jobs referring to this block
+		JobBlock* next = nullptr; // free list
+
+		template<typename F>
+		inline void Store(F&& task)
+		{
+			using T = std::decay_t<F>;
+			if constexpr (sizeof(T) <= sizeof(storage) && alignof(T) <= 16)
+			{
+				callable = new (storage) T(std::forward<F>(task));
+				destroy = [](void* callable) { ((T*)callable)->~T(); };
+			}
+			else
+			{
+				callable = new T(std::forward<F>(task));
+				destroy = [](void* callable) { delete (T*)callable; };
+			}
+			invoke = [](void* callable, wiJobArgs& args) { (*(T*)callable)(args); };
+		}
 	};
 
+	// Returns a free JobBlock
+	JobBlock* AllocateJobBlock();
+
+	// Submit the jobs that will execute the task of the block
+	void Submit(context& ctx, JobBlock* block, uint32_t jobCount, uint32_t groupSize, size_t sharedmemory_size);
+
 	// Add a task to execute asynchronously. Any idle thread will execute this.
-	void Execute(context& ctx, const std::function<void(wiJobArgs)>& task);
+	//	task		: callable that receives a wiJobArgs as parameter
+	template<typename F>
+	inline void Execute(context& ctx, F&& task)
+	{
+		JobBlock* block = AllocateJobBlock();
+		block->Store(std::forward<F>(task));
+		Submit(ctx, block, 1, 1, 0);
+	}
 
 	// Divide a task onto multiple jobs and execute in parallel.
 	//	jobCount	: how many jobs to generate for this task.
 	//	groupSize	: how many jobs to execute per thread. Jobs inside a group execute serially. It might be worth to increase for small jobs
-	//	task		: receives a wiJobArgs as parameter
-	void Dispatch(context& ctx, uint32_t jobCount, uint32_t groupSize, const std::function<void(wiJobArgs)>& task, size_t sharedmemory_size = 0);
+	//	task		: callable that receives a wiJobArgs as parameter
+	template<typename F>
+	inline void Dispatch(context& ctx, uint32_t jobCount, uint32_t groupSize, F&& task, size_t sharedmemory_size = 0)
+	{
+		if (jobCount == 0 || groupSize == 0)
+		{
+			return;
+		}
+		JobBlock* block = AllocateJobBlock();
+		block->Store(std::forward<F>(task));
+		Submit(ctx, block, jobCount, groupSize, sharedmemory_size);
+	}
 
 	// Returns the amount of job groups that will be created for a set number of jobs and group size
 	uint32_t DispatchGroupCount(uint32_t jobCount, uint32_t groupSize);
@@ -40,6 +134,181 @@ namespace wiJobSystem
 	// Check if any threads are working currently or not
 	bool IsBusy(const context& ctx);
 
-	// Wait until all threads become idle
+	// Wait until all jobs of the context finished
+	//	The waiting thread helps executing jobs with equal or higher priority than the context's priority
 	void Wait(const context& ctx);
+
+	// Upper limit of groups for the parallel algorithms below, their temporary per group data lives on the stack
+	static constexpr uint32_t parallel_max_groupcount = 256;
+
+	// Returns a group size for processing itemCount items in parallel: a few groups per thread, but at least minGroupSize items in a group
+	uint32_t GetParallelGroupSize(uint32_t itemCount, uint32_t minGroupSize = 64);
+
+	// Parallel reduction: returns the result of reduce() applied to map(i) for every i in [0, itemCount) and identity
+	//	The items are split into contiguous groups and the group results are reduced in order, so the result doesn't depend on thread timing
+	//	map		: T(uint32_t index)
+	//	reduce	: T(const T& a, const T& b), must be associative
+	//	This waits until ctx becomes idle
+	template<typename T, typename Map, typename Reduce>
+	inline T ParallelReduce(context& ctx, uint32_t itemCount, const T& identity, const Map& map, const Reduce& reduce)
+	{
+		const uint32_t groupSize = GetParallelGroupSize(itemCount);
+		const uint32_t groupCount = DispatchGroupCount(itemCount, groupSize);
+		T results[parallel_max_groupcount];
+		Dispatch(ctx, groupCount, 1, [&](wiJobArgs args) {
+			const uint32_t begin = args.jobIndex * groupSize;
+			const uint32_t end = std::min(begin + groupSize, itemCount);
+			T result = identity;
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				result = reduce(result, map(i));
+			}
+			results[args.jobIndex] = result;
+		});
+		Wait(ctx);
+
+		T result = identity;
+		for (uint32_t i = 0; i < groupCount; ++i)
+		{
+			result = reduce(result, results[i]);
+		}
+		return result;
+	}
+
+	// Parallel exclusive prefix sum: output[i] = identity + input[0] + ... + input[i - 1]
+	//	input and output can be the same array
+	//	Returns the sum of all items (plus identity)
+	//	This waits until ctx becomes idle
+	template<typename T>
+	inline T ParallelExclusiveScan(context& ctx, const T* input, T* output, uint32_t itemCount, const T& identity = T())
+	{
+		const uint32_t groupSize = GetParallelGroupSize(itemCount);
+		const uint32_t groupCount = DispatchGroupCount(itemCount, groupSize);
+		T offsets[parallel_max_groupcount];
+
+		// Sum of each group:
+		Dispatch(ctx, groupCount, 1, [&](wiJobArgs args) {
+			const uint32_t begin = args.jobIndex * groupSize;
+			const uint32_t end = std::min(begin + groupSize, itemCount);
+			T sum = T();
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				sum = sum + input[i];
+			}
+			offsets[args.jobIndex] = sum;
+		});
+		Wait(ctx);
+
+		// Scan of the group sums:
+		T total = identity;
+		for (uint32_t i = 0; i < groupCount; ++i)
+		{
+			T sum = offsets[i];
+			offsets[i] = total;
+			total = total + sum;
+		}
+
+		// Scan within each group:
+		Dispatch(ctx, groupCount, 1, [&](wiJobArgs args) {
+			const uint32_t begin = args.jobIndex * groupSize;
+			const uint32_t end = std::min(begin + groupSize, itemCount);
+			T sum = offsets[args.jobIndex];
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				T value = input[i];
+				output[i] = sum;
+				sum = sum + value;
+			}
+		});
+		Wait(ctx);
+
+		return total;
+	}
+
+	// Parallel stream compaction: select(i, output_element) is called for every i in [0, itemCount) and the elements where it returned true are kept
+	//	The kept elements are written to the beginning of output in increasing order of i, without atomics, so the result is the same every time
+	//	select	: bool(uint32_t index, T& output_element)
+	//	output	: must have space for itemCount elements
+	//	Returns the number of kept elements
+	//	This waits until ctx becomes idle
+	template<typename T, typename Select>
+	inline uint32_t ParallelCompact(context& ctx, uint32_t itemCount, T* output, const Select& select)
+	{
+		const uint32_t groupSize = GetParallelGroupSize(itemCount);
+		const uint32_t groupCount = DispatchGroupCount(itemCount, groupSize);
+		uint32_t counts[parallel_max_groupcount];
+
+		// Each group compacts into the beginning of its own range:
+		Dispatch(ctx, groupCount, 1, [&](wiJobArgs args) {
+			const uint32_t begin = args.jobIndex * groupSize;
+			const uint32_t end = std::min(begin + groupSize, itemCount);
+			uint32_t count = 0;
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				if (select(i, output[begin + count]))
+				{
+					count++;
+				}
+			}
+			counts[args.jobIndex] = count;
+		});
+		Wait(ctx);
+
+		// Close the gaps between group ranges. Destinations never come after sources, so moving the groups in order is safe:
+		uint32_t total = 0;
+		for (uint32_t i = 0; i < groupCount; ++i)
+		{
+			const uint32_t begin = i * groupSize;
+			if (begin != total)
+			{
+				for (uint32_t j = 0; j < counts[i]; ++j)
+				{
+					output[total + j] = std::move(output[begin + j]);
+				}
+			}
+			total += counts[i];
+		}
+		return total;
+	}
+
+	// Tasks with dependencies between them, executed on the job system
+	//	Each task receives its own context to put jobs into. A task is finished when the task function returned and its context became idle
+	//	A task is started automatically when all of its dependencies finished
+	//	The graph can be run multiple times (for example every frame), but only when the previous run finished
+	class TaskGraph
+	{
+	public:
+		using Task = std::function<void(context& ctx)>;
+
+		// Add a task and returns its index that can be used to specify dependencies
+		uint32_t AddTask(const Task& task);
+
+		// Add a task that will only start after all the specified dependencies have finished
+		uint32_t AddTask(const Task& task, std::initializer_list<uint32_t> dependencies);
+
+		// Specify that task can only start after dependency has finished
+		//	The dependency must have been added before the task, this ensures that the graph has no cycles
+		void AddDependency(uint32_t task, uint32_t dependency);
+
+		// Remove all tasks
+		void Clear();
+
+		uint32_t GetTaskCount() const { return (uint32_t)nodes.size(); }
+
+		// Start executing the tasks asynchronously. The ctx will be busy until all tasks finished
+		void Run(context& ctx);
+
+	private:
+		struct Node
+		{
+			Task task;
+			std::vector<uint32_t> successors;
+			uint32_t dependencyCount = 0;
+			std::atomic<uint32_t> remaining{ 0 };
+			context ctx;
+		};
+		std::deque<Node> nodes;
+
+		void Start(context& ctx, uint32_t index);
+	};
 }
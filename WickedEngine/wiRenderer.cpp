@@ -2746,22 +2746,46 @@ void ProcessDeferredMipGenRequests(CommandList cmd)
 	deferredMIPGenLock.unlock();
 }
 
+// Frustum culls the bounds in parallel, a block of 8 boxes at a time with SIMD, the results are written to vis.culling_mask
+//	Returns false if the bounds are not up to date (the scene changed since its last Update()), then the boxes must be tested one by one
+static bool CullBounds(wiJobSystem::context& ctx, Visibility& vis, const AABBSoA& bounds, size_t count)
+{
+	static_assert(AABBSoA::block_size == 8, "A block of visibility bits must fit into a byte");
+	if (bounds.GetCount() != count)
+		return false;
+	const uint32_t blockCount = bounds.GetBlockCount();
+	vis.culling_mask.resize(blockCount);
+	wiJobSystem::Dispatch(ctx, blockCount, wiJobSystem::GetParallelGroupSize(blockCount), [&](wiJobArgs args) {
+		vis.culling_mask[args.jobIndex] = (uint8_t)vis.frustum.CheckBoxesFast(bounds, args.jobIndex, vis.layerMask);
+	});
+	wiJobSystem::Wait(ctx);
+	return true;
+}
+static inline bool IsBoxVisible(const Visibility& vis, bool culled, uint32_t index, const AABB& aabb)
+{
+	if (culled)
+	{
+		return (vis.culling_mask[index / AABBSoA::block_size] >> (index % AABBSoA::block_size)) & 1;
+	}
+	return (aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb);
+}
+
 void UpdateVisibility(Visibility& vis)
 {
 	// Perform parallel frustum culling and obtain closest reflector:
 	wiJobSystem::context ctx;
-	wiJobSystem::context ctx_lights;
+	wiJobSystem::context ctx_compact;
+	ctx.priority = wiJobSystem::Priority::Critical;
+	ctx_compact.priority = wiJobSystem::Priority::Critical;
 	auto range = wiProfiler::BeginRangeCPU("Frustum Culling");
 
 	assert(vis.scene != nullptr); // User must provide a scene!
 	assert(vis.camera != nullptr); // User must provide a camera!
 
-	// The parallel frustum culling is first performed in shared memory, 
-	//	then each group writes out it's local list to global memory
-	//	The shared memory approach reduces atomics and helps the list to remain
-	//	more coherent (less randomly organized compared to original order)
-	static const uint32_t groupSize = 64;
-	static const size_t sharedmemory_size = (groupSize + 1) * sizeof(uint32_t); // list + counter per group
+	// The objects are culled hierarchically with the object BVH of the scene, so the cost depends on the visible part of the scene, not on the object count
+	//	The lights and decals (and the objects when the BVH is not up to date) are culled with parallel stream compaction, which keeps the original order of the visible lists
+	//	Their bounding boxes are tested with SIMD before the compaction (CullBounds()), so the compaction only reads the results
+	//	The smaller lists are culled in the background meanwhile
 
 	// Initialize visible indices:
 	vis.Clear();
@@ -2776,36 +2800,97 @@ void UpdateVisibility(Visibility& vis)
 		vis.flags &= ~Visibility::ALLOW_OCCLUSION_CULLING;
 	}
 
-	if (vis.flags & Visibility::ALLOW_LIGHTS)
+	if (vis.flags & Visibility::ALLOW_ENVPROBES)
 	{
-		// Cull lights:
-		vis.visibleLights.resize(vis.scene->aabb_lights.GetCount());
-		wiJobSystem::Dispatch(ctx_lights, (uint32_t)vis.scene->aabb_lights.GetCount(), groupSize, [&](wiJobArgs args) {
+		wiJobSystem::Execute(ctx, [&](wiJobArgs args) {
+			// Cull probes:
+			const AABBSoA& bounds = vis.scene->aabb_probes_soa;
+			if (bounds.GetCount() == vis.scene->aabb_probes.GetCount())
+			{
+				for (uint32_t block = 0; block < bounds.GetBlockCount(); ++block)
+				{
+					const uint32_t mask = vis.frustum.CheckBoxesFast(bounds, block, vis.layerMask);
+					for (uint32_t i = 0; i < AABBSoA::block_size; ++i)
+					{
+						if (mask & (1u << i))
+						{
+							vis.visibleEnvProbes.push_back(block * AABBSoA::block_size + i);
+						}
+					}
+				}
+			}
+			else
+			{
+				for (size_t i = 0; i < vis.scene->aabb_probes.GetCount(); ++i)
+				{
+					const AABB& aabb = vis.scene->aabb_probes[i];
 
-			// Setup stream compaction:
-			uint32_t& group_count = *(uint32_t*)args.sharedmemory;
-			Visibility::VisibleLight* group_list = (Visibility::VisibleLight*)args.sharedmemory + 1;
-			if (args.isFirstJobInGroup)
+					if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
+					{
+						vis.visibleEnvProbes.push_back((uint32_t)i);
+					}
+				}
+			}
+			});
+	}
+
+	if (vis.flags & Visibility::ALLOW_EMITTERS)
+	{
+		wiJobSystem::Execute(ctx, [&](wiJobArgs args) {
+			// Cull emitters:
+			for (size_t i = 0; i < vis.scene->emitters.GetCount(); ++i)
 			{
-				group_count = 0; // first thread initializes local counter
+				const wiEmittedParticle& emitter = vis.scene->emitters[i];
+				if (!(emitter.layerMask & vis.layerMask))
+				{
+					continue;
+				}
+				vis.visibleEmitters.push_back((uint32_t)i);
 			}
+			});
+	}
 
-			const AABB& aabb = vis.scene->aabb_lights[args.jobIndex];
+	if (vis.flags & Visibility::ALLOW_HAIRS)
+	{
+		wiJobSystem::Execute(ctx, [&](wiJobArgs args) {
+			// Cull hairs:
+			for (size_t i = 0; i < vis.scene->hairs.GetCount(); ++i)
+			{
+				const wiHairParticle& hair = vis.scene->hairs[i];
+				if (!(hair.layerMask & vis.layerMask))
+				{
+					continue;
+				}
+				if (hair.meshID == INVALID_ENTITY || !vis.frustum.CheckBoxFast(hair.aabb))
+				{
+					continue;
+				}
+				vis.visibleHairs.push_back((uint32_t)i);
+			}
+			});
+	}
 
-			if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
+	if (vis.flags & Visibility::ALLOW_LIGHTS)
+	{
+		// Cull lights:
+		const bool culled = CullBounds(ctx_compact, vis, vis.scene->aabb_lights_soa, vis.scene->aabb_lights.GetCount());
+		vis.visibleLights.resize(vis.scene->aabb_lights.GetCount());
+		uint32_t count = wiJobSystem::ParallelCompact(ctx_compact, (uint32_t)vis.scene->aabb_lights.GetCount(), vis.visibleLights.data(), [&](uint32_t index, Visibility::VisibleLight& visibleLight) {
+
+			const AABB& aabb = vis.scene->aabb_lights[index];
+
+			if (IsBoxVisible(vis, culled, index, aabb))
 			{
-				// Local stream compaction:
-				//	(also compute light distance for shadow priority sorting)
-				assert(args.jobIndex < 0xFFFF);
-				group_list[group_count].index = (uint16_t)args.jobIndex;
-				const LightComponent& light = vis.scene->lights[args.jobIndex];
+				// Also compute light distance for shadow priority sorting:
+				assert(index < 0xFFFF);
+				visibleLight.index = (uint16_t)index;
+				const LightComponent& light = vis.scene->lights[index];
 				float distance = 0;
 				if (light.type != LightComponent::DIRECTIONAL)
 				{
 					distance = wiMath::DistanceEstimated(light.position, vis.camera->Eye);
 				}
-				group_list[group_count].distance = uint16_t(distance * 10);
-				group_count++;
+				visibleLight.distance = uint16_t(distance * 10);
 				if (light.IsVolumetricsEnabled())
 				{
 					vis.volumetriclight_request.store(true);
@@ -2821,196 +2906,174 @@ void UpdateVisibility(Visibility& vis)
 						}
 					}
 				}
+				return true;
 			}
+			return false;
+		});
+		vis.visibleLights.resize(count);
 
-			// Global stream compaction:
-			if (args.isLastJobInGroup && group_count > 0)
-			{
-				uint32_t prev_count = vis.light_counter.fetch_add(group_count);
-				for (uint32_t i = 0; i < group_count; ++i)
-				{
-					vis.visibleLights[prev_count + i] = group_list[i];
-				}
-			}
-
-			}, sharedmemory_size);
+		// Sort lights based on distance so that closer lights will receive shadow map priority:
+		std::sort(vis.visibleLights.begin(), vis.visibleLights.end());
 	}
 
 	if (vis.flags & Visibility::ALLOW_OBJECTS)
 	{
 		// Cull objects:
-		vis.visibleObjects.resize(vis.scene->aabb_objects.GetCount());
-		wiJobSystem::Dispatch(ctx, (uint32_t)vis.scene->aabb_objects.GetCount(), groupSize, [&](wiJobArgs args) {
-
-			// Setup stream compaction:
-			uint32_t& group_count = *(uint32_t*)args.sharedmemory;
-			uint32_t* group_list = (uint32_t*)args.sharedmemory + 1;
-			if (args.isFirstJobInGroup)
-			{
-				group_count = 0; // first thread initializes local counter
-			}
-
-			const AABB& aabb = vis.scene->aabb_objects[args.jobIndex];
+		//	visible_object() does the rest of the work for an object that passed the culling
+		auto visible_object = [&](uint32_t index, const AABB& aabb) {
+			const ObjectComponent& object = vis.scene->objects[index];
 
-			if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
+			if (vis.flags & Visibility::ALLOW_REQUEST_REFLECTION)
 			{
-				// Local stream compaction:
-				group_list[group_count++] = args.jobIndex;
-
-				const ObjectComponent& object = vis.scene->objects[args.jobIndex];
-
-				if (vis.flags & Visibility::ALLOW_REQUEST_REFLECTION)
+				if (object.IsRequestPlanarReflection())
 				{
-					if (object.IsRequestPlanarReflection())
+					float dist = wiMath::DistanceEstimated(vis.camera->Eye, object.center);
+					vis.locker.lock();
+					if (dist < vis.closestRefPlane)
 					{
-						float dist = wiMath::DistanceEstimated(vis.camera->Eye, object.center);
-						vis.locker.lock();
-						if (dist < vis.closestRefPlane)
-						{
-							vis.closestRefPlane = dist;
-							const TransformComponent& transform = vis.scene->transforms[object.transform_index];
-							XMVECTOR P = transform.GetPositionV();
-							XMVECTOR N = XMVectorSet(0, 1, 0, 0);
-							N = XMVector3TransformNormal(N, XMLoadFloat4x4(&transform.world));
-							XMVECTOR _refPlane = XMPlaneFromPointNormal(P, N);
-							XMStoreFloat4(&vis.reflectionPlane, _refPlane);
-
-							vis.planar_reflection_visible = true;
-						}
-						vis.locker.unlock();
+						vis.closestRefPlane = dist;
+						const TransformComponent& transform = vis.scene->transforms[object.transform_index];
+						XMVECTOR P = transform.GetPositionV();
+						XMVECTOR N = XMVectorSet(0, 1, 0, 0);
+						N = XMVector3TransformNormal(N, XMLoadFloat4x4(&transform.world));
+						XMVECTOR _refPlane = XMPlaneFromPointNormal(P, N);
+						XMStoreFloat4(&vis.reflectionPlane, _refPlane);
+
+						vis.planar_reflection_visible = true;
 					}
+					vis.locker.unlock();
 				}
+			}
 
-				if (vis.flags & Visibility::ALLOW_OCCLUSION_CULLING)
+			if (vis.flags & Visibility::ALLOW_OCCLUSION_CULLING)
+			{
+				if (object.IsRenderable() && object.occlusionQueries[vis.scene->queryheap_idx] < 0)
 				{
-					if (object.IsRenderable() && object.occlusionQueries[vis.scene->queryheap_idx] < 0)
+					if (aabb.intersects(vis.camera->Eye))
 					{
-						if (aabb.intersects(vis.camera->Eye))
-						{
-							// camera is inside the instance, mark it as visible in this frame:
-							object.occlusionHistory |= 1;
-						}
-						else
-						{
-							object.occlusionQueries[vis.scene->queryheap_idx] = vis.scene->queryAllocator.fetch_add(1); // allocate new occlusion query from heap
-						}
+						// camera is inside the instance, mark it as visible in this frame:
+						object.occlusionHistory |= 1;
+					}
+					else
+					{
+						object.occlusionQueries[vis.scene->queryheap_idx] = vis.scene->queryAllocator.fetch_add(1); // allocate new occlusion query from heap
 					}
 				}
 			}
+		};
 
-			// Global stream compaction:
-			if (args.isLastJobInGroup && group_count > 0)
+		const uint32_t objectCount = (uint32_t)vis.scene->aabb_objects.GetCount();
+		vis.visibleObjects.resize(objectCount);
+		uint32_t count = 0;
+		const wiBVH& bvh = vis.scene->object_bvh;
+		if (bvh.IsValid() && vis.scene->IsObjectBVHUpToDate())
+		{
+			// The object BVH is traversed from its top level subtrees in parallel, the subtrees outside of the frustum are skipped, and the subtrees inside are taken without testing their objects
+			//	A subtree owns a contiguous range of the BVH primitives, so it compacts its visible objects to the beginning of that range in the visible list, and the gaps are closed after
+			const uint32_t max_subtrees = std::min(wiJobSystem::parallel_max_groupcount, wiJobSystem::GetThreadCount() * 4);
+			uint32_t subtrees[2][wiJobSystem::parallel_max_groupcount];
+			uint32_t subtree_count = 1;
+			uint32_t current = 0;
+			subtrees[current][0] = 0;
+			while (subtree_count * 2 <= max_subtrees)
 			{
-				uint32_t prev_count = vis.object_counter.fetch_add(group_count);
-				for (uint32_t i = 0; i < group_count; ++i)
+				// The nodes are split in order, so the primitive ranges of the subtrees stay in increasing order:
+				uint32_t split_count = 0;
+				for (uint32_t i = 0; i < subtree_count; ++i)
 				{
-					vis.visibleObjects[prev_count + i] = group_list[i];
+					const wiBVH::Node& node = bvh.nodes[subtrees[current][i]];
+					if (node.IsLeaf())
+					{
+						subtrees[!current][split_count++] = subtrees[current][i];
+					}
+					else
+					{
+						subtrees[!current][split_count++] = node.offset;
+						subtrees[!current][split_count++] = node.offset + 1;
+					}
 				}
-			}
-
-			}, sharedmemory_size);
-	}
-
-	if (vis.flags & Visibility::ALLOW_DECALS)
-	{
-		vis.visibleDecals.resize(vis.scene->aabb_decals.GetCount());
-		wiJobSystem::Dispatch(ctx, (uint32_t)vis.scene->aabb_decals.GetCount(), groupSize, [&](wiJobArgs args) {
-
-			// Setup stream compaction:
-			uint32_t& group_count = *(uint32_t*)args.sharedmemory;
-			uint32_t* group_list = (uint32_t*)args.sharedmemory + 1;
-			if (args.isFirstJobInGroup)
-			{
-				group_count = 0; // first thread initializes local counter
-			}
-
-			const AABB& aabb = vis.scene->aabb_decals[args.jobIndex];
-
-			if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
-			{
-				// Local stream compaction:
-				group_list[group_count++] = args.jobIndex;
-			}
+				current = !current;
+				if (split_count == subtree_count)
+					break;
+				subtree_count = split_count;
+			}
+
+			uint32_t firsts[wiJobSystem::parallel_max_groupcount];
+			uint32_t counts[wiJobSystem::parallel_max_groupcount];
+			wiJobSystem::Dispatch(ctx_compact, subtree_count, 1, [&](wiJobArgs args) {
+				const uint32_t subtree = subtrees[current][args.jobIndex];
+				uint32_t first, last;
+				bvh.GetPrimitiveRange(subtree, first, last);
+				uint32_t* output = vis.visibleObjects.data() + first;
+				uint32_t visible_count = 0;
+				bvh.Intersects(vis.frustum, [&](uint32_t begin, uint32_t end, bool inside) {
+					for (uint32_t i = begin; i < end; ++i)
+					{
+						const uint32_t index = bvh.primitives[i];
+						const AABB& aabb = vis.scene->aabb_objects[index];
+						// The boxes inside the frustum are only checked for being empty (objects without mesh), because those wouldn't pass CheckBoxFast() either:
+						if ((aabb.layerMask & vis.layerMask) && (inside ? aabb._min.x <= aabb._max.x : vis.frustum.CheckBoxFast(aabb)))
+						{
+							output[visible_count++] = index;
+							visible_object(index, aabb);
+						}
+					}
+				}, subtree);
+				firsts[args.jobIndex] = first;
+				counts[args.jobIndex] = visible_count;
+			});
+			wiJobSystem::Wait(ctx_compact);
 
-			// Global stream compaction:
-			if (args.isLastJobInGroup && group_count > 0)
+			for (uint32_t i = 0; i < subtree_count; ++i)
 			{
-				uint32_t prev_count = vis.decal_counter.fetch_add(group_count);
-				for (uint32_t i = 0; i < group_count; ++i)
+				if (firsts[i] != count)
 				{
-					vis.visibleDecals[prev_count + i] = group_list[i];
+					std::copy(vis.visibleObjects.begin() + firsts[i], vis.visibleObjects.begin() + firsts[i] + counts[i], vis.visibleObjects.begin() + count);
 				}
+				count += counts[i];
 			}
+		}
+		else
+		{
+			// Without an up to date BVH (the objects changed since the last Scene::Update()), every object is tested:
+			const bool culled = CullBounds(ctx_compact, vis, vis.scene->aabb_objects_soa, objectCount);
+			count = wiJobSystem::ParallelCompact(ctx_compact, objectCount, vis.visibleObjects.data(), [&](uint32_t index, uint32_t& visibleObject) {
 
-			}, sharedmemory_size);
-	}
-
-	if (vis.flags & Visibility::ALLOW_ENVPROBES)
-	{
-		wiJobSystem::Execute(ctx, [&](wiJobArgs args) {
-			// Cull probes:
-			for (size_t i = 0; i < vis.scene->aabb_probes.GetCount(); ++i)
-			{
-				const AABB& aabb = vis.scene->aabb_probes[i];
+				const AABB& aabb = vis.scene->aabb_objects[index];
 
-				if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
+				if (IsBoxVisible(vis, culled, index, aabb))
 				{
-					vis.visibleEnvProbes.push_back((uint32_t)i);
+					visibleObject = index;
+					visible_object(index, aabb);
+					return true;
 				}
-			}
+				return false;
 			});
+		}
+		vis.visibleObjects.resize(count);
 	}
 
-	if (vis.flags & Visibility::ALLOW_EMITTERS)
+	if (vis.flags & Visibility::ALLOW_DECALS)
 	{
-		wiJobSystem::Execute(ctx, [&](wiJobArgs args) {
-			// Cull emitters:
-			for (size_t i = 0; i < vis.scene->emitters.GetCount(); ++i)
-			{
-				const wiEmittedParticle& emitter = vis.scene->emitters[i];
-				if (!(emitter.layerMask & vis.layerMask))
-				{
-					continue;
-				}
-				vis.visibleEmitters.push_back((uint32_t)i);
-			}
-			});
-	}
+		// Cull decals:
+		const bool culled = CullBounds(ctx_compact, vis, vis.scene->aabb_decals_soa, vis.scene->aabb_decals.GetCount());
+		vis.visibleDecals.resize(vis.scene->aabb_decals.GetCount());
+		uint32_t count = wiJobSystem::ParallelCompact(ctx_compact, (uint32_t)vis.scene->aabb_decals.GetCount(), vis.visibleDecals.data(), [&](uint32_t index, uint32_t& visibleDecal) {
 
-	if (vis.flags & Visibility::ALLOW_HAIRS)
-	{
-		wiJobSystem::Execute(ctx, [&](wiJobArgs args) {
-			// Cull hairs:
-			for (size_t i = 0; i < vis.scene->hairs.GetCount(); ++i)
+			const AABB& aabb = vis.scene->aabb_decals[index];
+
+			if (IsBoxVisible(vis, culled, index, aabb))
 			{
-				const wiHairParticle& hair = vis.scene->hairs[i];
-				if (!(hair.layerMask & vis.layerMask))
-				{
-					continue;
-				}
-				if (hair.meshID == INVALID_ENTITY || !vis.frustum.CheckBoxFast(hair.aabb))
-				{
-					continue;
-				}
-				vis.visibleHairs.push_back((uint32_t)i);
+				visibleDecal = index;
+				return true;
 			}
-			});
-	}
-
-	if (vis.flags & Visibility::ALLOW_LIGHTS)
-	{
-		wiJobSystem::Wait(ctx_lights);
-		vis.visibleLights.resize((size_t)vis.light_counter.load());
-		// Sort lights based on distance so that closer lights will receive shadow map priority:
-		std::sort(vis.visibleLights.begin(), vis.visibleLights.end());
+			return false;
+		});
+		vis.visibleDecals.resize(count);
 	}
 
 	wiJobSystem::Wait(ctx);
 
-	// finalize stream compaction:
-	vis.visibleObjects.resize((size_t)vis.object_counter.load());
-	vis.visibleDecals.resize((size_t)vis.decal_counter.load());
-
 	if ((vis.flags & Visibility::ALLOW_REQUEST_REFLECTION) && vis.scene->weather.IsOceanEnabled())
 	{
 		// Ocean will override any current reflectors
@@ -3695,9 +3758,9 @@ void UpdateRenderData(
 				barrier_stack[cmd].push_back(GPUBarrier::Buffer(&mesh.subsetBuffer, RESOURCE_STATE_COPY_DST, RESOURCE_STATE_SHADER_RESOURCE));
 			}
 
-			if (mesh.dirty_morph)
+			if (mesh.dirty_morph_upload)
 			{
-				mesh.dirty_morph = false;
+				mesh.dirty_morph_upload = false;
 				wiRenderer::GetDevice()->UpdateBuffer(&mesh.vertexBuffer_POS, mesh.vertex_positions_morphed.data(), cmd);
 				barrier_stack[cmd].push_back(GPUBarrier::Buffer(&mesh.vertexBuffer_POS, RESOURCE_STATE_COPY_DST, RESOURCE_STATE_SHADER_RESOURCE));
 			}
@@ -3930,7 +3993,7 @@ void UpdateRenderDataAsync(
 		{
 			const wiEmittedParticle& emitter = vis.scene->emitters[emitterIndex];
 			Entity entity = vis.scene->emitters.GetEntity(emitterIndex);
-			const TransformComponent& transform = *vis.scene->transforms.GetComponent(entity);
+			const TransformComponent& transform = *vis.scene->GetRenderTransform(entity);
 			const MaterialComponent& material = *vis.scene->materials.GetComponent(entity);
 			const MeshComponent* mesh = vis.scene->meshes.GetComponent(emitter.meshID);
 
@@ -5201,8 +5264,8 @@ void DrawDebugWorld(
 				{
 					continue;
 				}
-				const TransformComponent& transform = *scene.transforms.GetComponent(entity);
-				const TransformComponent& parent = *scene.transforms.GetComponent(hierarchy->parentID);
+				const TransformComponent& transform = *scene.GetRenderTransform(entity);
+				const TransformComponent& parent = *scene.GetRenderTransform(hierarchy->parentID);
 
 				XMMATRIX transform_world = XMLoadFloat4x4(&transform.world);
 				XMMATRIX parent_world = XMLoadFloat4x4(&parent.world);
@@ -5780,7 +5843,7 @@ void DrawDebugWorld(
 			}
 
 			Entity entity = scene.probes.GetEntity(i);
-			const TransformComponent& transform = *scene.transforms.GetComponent(entity);
+			const TransformComponent& transform = *scene.GetRenderTransform(entity);
 
 			XMStoreFloat4x4(&sb.g_xTransform, XMLoadFloat4x4(&transform.world)*camera.GetViewProjection());
 			sb.g_xColor = float4(0, 1, 1, 1);
@@ -5880,7 +5943,7 @@ void DrawDebugWorld(
 		{
 			const wiEmittedParticle& emitter = scene.emitters[i];
 			Entity entity = scene.emitters.GetEntity(i);
-			const TransformComponent& transform = *scene.transforms.GetComponent(entity);
+			const TransformComponent& transform = *scene.GetRenderTransform(entity);
 			const MeshComponent* mesh = scene.meshes.GetComponent(emitter.meshID);
 
 			XMStoreFloat4x4(&sb.g_xTransform, XMLoadFloat4x4(&transform.world)*camera.GetViewProjection());
@@ -5931,7 +5994,7 @@ void DrawDebugWorld(
 		for (auto& x : paintrads)
 		{
 			const ObjectComponent& object = *scene.objects.GetComponent(x.objectEntity);
-			const TransformComponent& transform = *scene.transforms.GetComponent(x.objectEntity);
+			const TransformComponent& transform = *scene.GetRenderTransform(x.objectEntity);
 			const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
 			const MeshComponent::MeshSubset& subset = mesh.subsets[x.subset];
 			const MaterialComponent& material = *scene.materials.GetComponent(subset.materialID);
@@ -7372,7 +7435,7 @@ void RefreshLightmaps(const Scene& scene, CommandList cmd)
 				vp.Height = (float)desc.Height;
 				device->BindViewports(1, &vp, cmd);
 
-				const TransformComponent& transform = scene.transforms[object.transform_index];
+				const TransformComponent& transform = *scene.GetRenderTransform(scene.objects.GetEntity(i));
 
 				MiscCB misccb;
 				misccb.g_xTransform = transform.world;
@@ -113,9 +113,7 @@ namespace wiRenderer
 		};
 		std::vector<VisibleLight> visibleLights;
 
-		std::atomic<uint32_t> object_counter;
-		std::atomic<uint32_t> light_counter;
-		std::atomic<uint32_t> decal_counter;
+		std::vector<uint8_t> culling_mask; // visibility bits of the boxes culled with SIMD, 8 per byte, reused between frames
 
 		wiSpinLock locker;
 		bool planar_reflection_visible = false;
@@ -132,10 +130,6 @@ namespace wiRenderer
 			visibleEmitters.clear();
 			visibleHairs.clear();
 
-			object_counter.store(0);
-			light_counter.store(0);
-			decal_counter.store(0);
-
 			closestRefPlane = FLT_MAX;
 			planar_reflection_visible = false;
 			volumetriclight_request.store(false);
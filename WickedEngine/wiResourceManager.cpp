@@ -128,7 +128,12 @@ namespace wiResourceManager
 		case wiResource::IMAGE:
 		{
 			GraphicsDevice* device = wiRenderer::GetDevice();
-			if (!ext.compare("KTX2"))
+			if (device == nullptr)
+			{
+				// Without graphics device (headless) the texture is not created, but the resource is kept, so it can still be serialized:
+				success = true;
+			}
+			else if (!ext.compare("KTX2"))
 			{
 				basist::ktx2_transcoder transcoder(&g_basis_global_codebook);
 				if (transcoder.init(filedata, (uint32_t)filesize))
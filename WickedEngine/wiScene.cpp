@@ -23,6 +23,16 @@ using namespace wiGraphics;
 namespace wiScene
 {
 
+	void NameComponent::SetName(std::string value)
+	{
+		if (scene == nullptr)
+		{
+			name = std::move(value);
+			return;
+		}
+		scene->NameIndex_Rename(*this, std::move(value));
+	}
+
 	XMFLOAT3 TransformComponent::GetPosition() const
 	{
 		return *((XMFLOAT3*)&world._41);
@@ -81,6 +91,7 @@ namespace wiScene
 		W = W * W_parent;
 
 		XMStoreFloat4x4(&world, W);
+		SetChanged();
 	}
 	void TransformComponent::ApplyTransform()
 	{
@@ -375,6 +386,9 @@ namespace wiScene
 	{
 		GraphicsDevice* device = wiRenderer::GetDevice();
 
+		// The vertices or indices could have been edited in place (for example by the editor's sculpting or mesh optimization), so the BVH is refitted by the next scene update:
+		dirty_bvh = bvh.IsValid();
+
 		vertex_subsets.resize(vertex_positions.size());
 		uint32_t subsetCounter = 0;
 		for (auto& subset : subsets)
@@ -387,6 +401,25 @@ namespace wiScene
 			subsetCounter++;
 		}
 
+		if (device == nullptr)
+		{
+			// Without graphics device (headless), only the CPU side data is initialized:
+			if (!targets.empty())
+			{
+				vertex_positions_morphed.resize(vertex_positions.size());
+				dirty_morph = true;
+			}
+			XMFLOAT3 _min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+			XMFLOAT3 _max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (const XMFLOAT3& pos : vertex_positions)
+			{
+				_min = wiMath::Min(_min, pos);
+				_max = wiMath::Max(_max, pos);
+			}
+			aabb = AABB(_min, _max);
+			return;
+		}
+
 		// Create index buffer GPU data:
 		{
 			GPUBufferDesc bd;
@@ -1136,6 +1169,64 @@ namespace wiScene
 
 		return sphere;
 	}
+	// Computes the triangle bounding boxes for the mesh BVH, from the same positions as the scene queries use for non-skinned meshes:
+	static void ComputeTriangleBounds(const MeshComponent& mesh, const SoftBodyPhysicsComponent* softbody, std::vector<AABB>& aabbs)
+	{
+		const bool softbody_active = softbody != nullptr && !softbody->vertex_positions_simulation.empty();
+		auto load_position = [&](uint32_t index) {
+			if (softbody_active)
+			{
+				return softbody->vertex_positions_simulation[index].LoadPOS();
+			}
+			if (!mesh.vertex_positions_morphed.empty())
+			{
+				return mesh.vertex_positions_morphed[index].LoadPOS();
+			}
+			return XMLoadFloat3(&mesh.vertex_positions[index]);
+		};
+
+		const uint32_t triangle_count = (uint32_t)mesh.indices.size() / 3;
+		aabbs.resize(triangle_count);
+		for (uint32_t i = 0; i < triangle_count; ++i)
+		{
+			const XMVECTOR p0 = load_position(mesh.indices[i * 3 + 0]);
+			const XMVECTOR p1 = load_position(mesh.indices[i * 3 + 1]);
+			const XMVECTOR p2 = load_position(mesh.indices[i * 3 + 2]);
+			XMStoreFloat3(&aabbs[i]._min, XMVectorMin(p0, XMVectorMin(p1, p2)));
+			XMStoreFloat3(&aabbs[i]._max, XMVectorMax(p0, XMVectorMax(p1, p2)));
+		}
+	}
+	void MeshComponent::BuildBVH(const SoftBodyPhysicsComponent* softbody)
+	{
+		std::vector<AABB> aabbs;
+		ComputeTriangleBounds(*this, softbody, aabbs);
+
+		wiJobSystem::context ctx;
+		bvh.Build(ctx, aabbs.data(), (uint32_t)aabbs.size());
+		dirty_bvh = false;
+	}
+	void MeshComponent::RefitBVH(const SoftBodyPhysicsComponent* softbody)
+	{
+		assert(bvh.GetPrimitiveCount() == indices.size() / 3);
+
+		std::vector<AABB> aabbs;
+		ComputeTriangleBounds(*this, softbody, aabbs);
+
+		bvh.Refit(aabbs.data());
+		dirty_bvh = false;
+	}
+	int MeshComponent::GetSubsetIndex(uint32_t index) const
+	{
+		for (size_t i = 0; i < subsets.size(); ++i)
+		{
+			const MeshSubset& subset = subsets[i];
+			if (index >= subset.indexOffset && index < subset.indexOffset + subset.indexCount)
+			{
+				return (int)i;
+			}
+		}
+		return -1;
+	}
 
 	void ObjectComponent::ClearLightmap()
 	{
@@ -1288,6 +1379,10 @@ namespace wiScene
 	void ArmatureComponent::CreateRenderData()
 	{
 		GraphicsDevice* device = wiRenderer::GetDevice();
+		if (device == nullptr)
+		{
+			return;
+		}
 
 		GPUBufferDesc bd;
 		bd.Size = sizeof(ShaderTransform) * (uint32_t)boneCollection.size();
@@ -1298,6 +1393,317 @@ namespace wiScene
 		device->CreateBuffer(&bd, nullptr, &boneBuffer);
 	}
 
+	// The smallest three components of a unit quaternion are in [-1/sqrt(2), 1/sqrt(2)] range:
+	static constexpr float smallest_three_range = 0.70710678f;
+
+	size_t AnimationDataComponent::GetKeyCount() const
+	{
+		if (IsCompressed())
+		{
+			return compressed_data.size() / 3;
+		}
+		return keyframe_times.size();
+	}
+	float AnimationDataComponent::GetKeyTime(size_t key) const
+	{
+		if (!IsCompressed() || time_step == 0)
+		{
+			return keyframe_times[key];
+		}
+		const size_t frame = keyframe_frames.empty() ? key : keyframe_frames[key];
+		return time_start + float(frame) * time_step;
+	}
+	int AnimationDataComponent::FindKey(float time, int& cursor) const
+	{
+		// Animation time mostly moves forward a little each frame, so first the previous result is checked, then the next one,
+		//	and binary search is only used when the time jumped:
+		const int keyCount = (int)GetKeyCount();
+		auto is_right_key = [&](int key) {
+			return GetKeyTime(key) >= time && (key == 0 || GetKeyTime(key - 1) < time);
+		};
+		const int start = std::max(0, std::min(cursor, keyCount - 1));
+		if (is_right_key(start))
+		{
+			cursor = start;
+		}
+		else if (start + 1 < keyCount && is_right_key(start + 1))
+		{
+			cursor = start + 1;
+		}
+		else
+		{
+			int first = 0;
+			int count = keyCount;
+			while (count > 0)
+			{
+				const int step = count / 2;
+				if (GetKeyTime(first + step) < time)
+				{
+					first += step + 1;
+					count -= step + 1;
+				}
+				else
+				{
+					count = step;
+				}
+			}
+			cursor = first;
+		}
+		return cursor;
+	}
+	void AnimationDataComponent::DecodeKey(size_t key, float* result) const
+	{
+		assert(compressed_components == 3 || compressed_components == 4);
+		const uint16_t* data = compressed_data.data() + key * 3;
+		if (compressed_components == 4)
+		{
+			// The largest component is reconstructed from the smallest three, it was made positive by the compression:
+			const uint32_t largest = (data[0] >> 15) | ((data[1] >> 15) << 1);
+			float sum = 0;
+			for (uint32_t i = 0, j = 0; i < 4; ++i)
+			{
+				if (i != largest)
+				{
+					const float value = (float(data[j++] & 0x7FFF) / 32767.0f * 2 - 1) * smallest_three_range;
+					result[i] = value;
+					sum += value * value;
+				}
+			}
+			result[largest] = std::sqrt(std::max(0.0f, 1 - sum));
+		}
+		else
+		{
+			result[0] = compressed_min.x + float(data[0]) / 65535.0f * compressed_range.x;
+			result[1] = compressed_min.y + float(data[1]) / 65535.0f * compressed_range.y;
+			result[2] = compressed_min.z + float(data[2]) / 65535.0f * compressed_range.z;
+		}
+	}
+	void AnimationDataComponent::Compress(uint32_t components, bool step, float tolerance)
+	{
+		assert(components == 3 || components == 4);
+		const size_t keyCount = keyframe_times.size();
+		if (IsCompressed() || keyCount == 0 || keyframe_data.size() != keyCount * components)
+		{
+			return;
+		}
+
+		auto load = [&](size_t key) {
+			return components == 4 ? XMLoadFloat4((const XMFLOAT4*)keyframe_data.data() + key) : XMLoadFloat3((const XMFLOAT3*)keyframe_data.data() + key);
+		};
+		auto decode = [&](size_t key) {
+			float values[4] = {};
+			DecodeKey(key, values);
+			return XMLoadFloat4((const XMFLOAT4*)values);
+		};
+		// Largest component difference, q and -q are the same rotation:
+		auto difference = [&](XMVECTOR value, XMVECTOR original) {
+			if (components == 4 && XMVectorGetX(XMVector4Dot(value, original)) < 0)
+			{
+				original = XMVectorNegate(original);
+			}
+			XMFLOAT4 diff;
+			XMStoreFloat4(&diff, XMVectorAbs(value - original));
+			return std::max(std::max(diff.x, diff.y), components == 4 ? std::max(diff.z, diff.w) : diff.z);
+		};
+		auto revert = [&] {
+			compressed_components = 0;
+			compressed_min = XMFLOAT3(0, 0, 0);
+			compressed_range = XMFLOAT3(0, 0, 0);
+			compressed_data.clear();
+		};
+
+		// Quantization of every key, the kept ones are selected later:
+		compressed_components = components;
+		compressed_data.resize(keyCount * 3);
+		if (components == 4)
+		{
+			for (size_t i = 0; i < keyCount; ++i)
+			{
+				XMFLOAT4 q;
+				XMStoreFloat4(&q, XMQuaternionNormalize(load(i)));
+				float values[4] = { q.x, q.y, q.z, q.w };
+				uint32_t largest = 0;
+				for (uint32_t j = 1; j < 4; ++j)
+				{
+					if (std::abs(values[j]) > std::abs(values[largest]))
+					{
+						largest = j;
+					}
+				}
+				// q and -q are the same rotation, so the sign of the largest doesn't need to be stored:
+				const float sign = values[largest] < 0 ? -1.0f : 1.0f;
+				uint16_t* data = compressed_data.data() + i * 3;
+				for (uint32_t j = 0, k = 0; j < 4; ++j)
+				{
+					if (j != largest)
+					{
+						const float value = wiMath::Clamp((values[j] * sign / smallest_three_range + 1) * 0.5f, 0, 1);
+						data[k++] = uint16_t(value * 32767.0f + 0.5f);
+					}
+				}
+				data[0] |= uint16_t((largest & 1) << 15);
+				data[1] |= uint16_t((largest >> 1) << 15);
+			}
+		}
+		else
+		{
+			XMVECTOR vMin = XMVectorReplicate(FLT_MAX);
+			XMVECTOR vMax = XMVectorReplicate(-FLT_MAX);
+			for (size_t i = 0; i < keyCount; ++i)
+			{
+				vMin = XMVectorMin(vMin, load(i));
+				vMax = XMVectorMax(vMax, load(i));
+			}
+			XMStoreFloat3(&compressed_min, vMin);
+			XMStoreFloat3(&compressed_range, vMax - vMin);
+			const XMVECTOR vRange = vMax - vMin;
+			const XMVECTOR vScale = XMVectorSelect(XMVectorReplicate(65535.0f) / vRange, XMVectorZero(), XMVectorEqual(vRange, XMVectorZero()));
+			for (size_t i = 0; i < keyCount; ++i)
+			{
+				XMFLOAT3 value;
+				XMStoreFloat3(&value, (load(i) - vMin) * vScale + XMVectorReplicate(0.5f));
+				compressed_data[i * 3 + 0] = uint16_t(value.x);
+				compressed_data[i * 3 + 1] = uint16_t(value.y);
+				compressed_data[i * 3 + 2] = uint16_t(value.z);
+			}
+		}
+
+		// The quantization error is added to the error of key reduction (interpolating between quantized keys can't make it larger),
+		//	so it is reserved from the tolerance. If the range of the track is too large for that, the track is not compressed:
+		float quantization_error = 0;
+		for (size_t i = 0; i < keyCount; ++i)
+		{
+			quantization_error = std::max(quantization_error, difference(decode(i), components == 4 ? XMQuaternionNormalize(load(i)) : load(i)));
+		}
+		if (quantization_error >= tolerance)
+		{
+			revert();
+			return;
+		}
+		const float reduction_tolerance = tolerance - quantization_error;
+
+		// Key reduction: a key is removed if sampling the remaining neighbours reproduces it within tolerance
+		//	The segment length is limited, so that constant tracks don't make this quadratic
+		const size_t max_segment = 256;
+		auto sample = [&](XMVECTOR a, XMVECTOR b, float t) {
+			return components == 4 ? XMQuaternionNormalize(XMQuaternionSlerp(a, b, t)) : XMVectorLerp(a, b, t);
+		};
+		auto reproduces = [&](size_t a, size_t b, size_t key) {
+			const XMVECTOR value = step ? load(a) : sample(load(a), load(b), (keyframe_times[key] - keyframe_times[a]) / (keyframe_times[b] - keyframe_times[a]));
+			return difference(value, load(key)) <= reduction_tolerance;
+		};
+		std::vector<uint32_t> kept;
+		kept.push_back(0);
+		for (size_t b = 2; b < keyCount; ++b)
+		{
+			const size_t a = kept.back();
+			bool valid = b - a <= max_segment;
+			for (size_t key = step ? b - 1 : a + 1; key < b && valid; ++key)
+			{
+				valid = reproduces(a, b, key);
+			}
+			if (!valid)
+			{
+				kept.push_back(uint32_t(b - 1));
+			}
+		}
+		if (keyCount > 1)
+		{
+			kept.push_back(uint32_t(keyCount - 1));
+		}
+
+		for (size_t i = 0; i < kept.size(); ++i)
+		{
+			compressed_data[i * 3 + 0] = compressed_data[kept[i] * 3 + 0];
+			compressed_data[i * 3 + 1] = compressed_data[kept[i] * 3 + 1];
+			compressed_data[i * 3 + 2] = compressed_data[kept[i] * 3 + 2];
+		}
+		compressed_data.resize(kept.size() * 3);
+
+		// The final error is checked at every original key by sampling the compressed keys, the track is kept uncompressed if it is not within tolerance:
+		for (size_t i = 0, key = 0; key < keyCount; ++key)
+		{
+			while (i + 1 < kept.size() && kept[i + 1] <= key)
+			{
+				++i;
+			}
+			XMVECTOR value;
+			if (kept[i] == key || step || i + 1 == kept.size())
+			{
+				value = decode(i);
+			}
+			else
+			{
+				const float t = (keyframe_times[key] - keyframe_times[kept[i]]) / (keyframe_times[kept[i + 1]] - keyframe_times[kept[i]]);
+				value = sample(decode(i), decode(i + 1), t);
+			}
+			if (difference(value, load(key)) > tolerance)
+			{
+				revert();
+				return;
+			}
+		}
+
+		// Shared uniform time base, if the keyframes are evenly spaced (which is typical for sampled or motion captured animations):
+		bool uniform = keyCount > 1 && keyCount <= 0x10000;
+		const float frame_time = keyCount > 1 ? (keyframe_times.back() - keyframe_times.front()) / float(keyCount - 1) : 0;
+		uniform = uniform && frame_time > 0;
+		for (size_t key = 0; key < keyCount && uniform; ++key)
+		{
+			uniform = std::abs(keyframe_times[key] - (keyframe_times.front() + float(key) * frame_time)) <= frame_time * 0.01f;
+		}
+		time_start = keyframe_times.front();
+		time_step = uniform ? frame_time : 0;
+		keyframe_frames.clear();
+		if (uniform && kept.size() < keyCount)
+		{
+			keyframe_frames.reserve(kept.size());
+			for (uint32_t key : kept)
+			{
+				keyframe_frames.push_back(uint16_t(key));
+			}
+		}
+
+		if (uniform)
+		{
+			keyframe_times.clear();
+		}
+		else
+		{
+			for (size_t i = 0; i < kept.size(); ++i)
+			{
+				keyframe_times[i] = keyframe_times[kept[i]];
+			}
+			keyframe_times.resize(kept.size());
+		}
+		keyframe_times.shrink_to_fit();
+		keyframe_data.clear();
+		keyframe_data.shrink_to_fit();
+		_flags |= COMPRESSED;
+	}
+	void AnimationDataComponent::Decompress()
+	{
+		if (!IsCompressed())
+		{
+			return;
+		}
+		const size_t keyCount = GetKeyCount();
+		std::vector<float> times(keyCount);
+		keyframe_data.resize(keyCount * compressed_components);
+		for (size_t key = 0; key < keyCount; ++key)
+		{
+			times[key] = GetKeyTime(key);
+			DecodeKey(key, keyframe_data.data() + key * compressed_components);
+		}
+		keyframe_times = std::move(times);
+		keyframe_frames.clear();
+		compressed_data.clear();
+		time_start = 0;
+		time_step = 0;
+		compressed_components = 0;
+		_flags &= ~COMPRESSED;
+	}
+
 	void SoftBodyPhysicsComponent::CreateFromMesh(const MeshComponent& mesh)
 	{
 		vertex_positions_simulation.resize(mesh.vertex_positions.size());
@@ -1448,193 +1854,193 @@ namespace wiScene
 
 	void Scene::Update(float dt)
 	{
+		// If the simulation systems were started ahead by BeginSimulation(), they are not run again by the update graph:
+		WaitSimulation();
+
 		this->dt = dt;
 
-		GraphicsDevice* device = wiRenderer::GetDevice();
+		// In headless mode the graphics device is not used, and the GPU side arrays are not allocated:
+		GraphicsDevice* device = IsHeadless() ? nullptr : wiRenderer::GetDevice();
 
-		instanceArraySize = objects.GetCount() + hairs.GetCount();
-		if (instanceBuffer.desc.Size < (instanceArraySize * sizeof(ShaderMeshInstance)))
+		instanceArrayMapped = nullptr;
+		meshArrayMapped = nullptr;
+		materialArrayMapped = nullptr;
+		TLAS_instancesMapped = nullptr;
+		if (device != nullptr)
 		{
-			GPUBufferDesc desc;
-			desc.Stride = sizeof(ShaderMeshInstance);
-			desc.Size = desc.Stride * instanceArraySize;
-			desc.BindFlags = BIND_SHADER_RESOURCE;
-			desc.MiscFlags = RESOURCE_MISC_BUFFER_RAW;
-			device->CreateBuffer(&desc, nullptr, &instanceBuffer);
-			device->SetName(&instanceBuffer, "instanceBuffer");
-
-			desc.Usage = USAGE_UPLOAD;
-			desc.BindFlags = BIND_NONE;
-			desc.MiscFlags = RESOURCE_MISC_NONE;
-			for (int i = 0; i < arraysize(instanceUploadBuffer); ++i)
+			instanceArraySize = objects.GetCount() + hairs.GetCount();
+			if (instanceBuffer.desc.Size < (instanceArraySize * sizeof(ShaderMeshInstance)))
 			{
-				device->CreateBuffer(&desc, nullptr, &instanceUploadBuffer[i]);
-				device->SetName(&instanceUploadBuffer[i], "instanceUploadBuffer");
-			}
-		}
-		instanceArrayMapped = (ShaderMeshInstance*)instanceUploadBuffer[device->GetBufferIndex()].mapped_data;
-
-		meshArraySize = meshes.GetCount() + hairs.GetCount();
-		if (meshBuffer.desc.Size < (meshArraySize * sizeof(ShaderMesh)))
-		{
-			GPUBufferDesc desc;
-			desc.Stride = sizeof(ShaderMesh);
-			desc.Size = desc.Stride * meshArraySize;
-			desc.BindFlags = BIND_SHADER_RESOURCE;
-			desc.MiscFlags = RESOURCE_MISC_BUFFER_RAW;
-			device->CreateBuffer(&desc, nullptr, &meshBuffer);
-			device->SetName(&meshBuffer, "meshBuffer");
+				GPUBufferDesc desc;
+				desc.Stride = sizeof(ShaderMeshInstance);
+				desc.Size = desc.Stride * instanceArraySize;
+				desc.BindFlags = BIND_SHADER_RESOURCE;
+				desc.MiscFlags = RESOURCE_MISC_BUFFER_RAW;
+				device->CreateBuffer(&desc, nullptr, &instanceBuffer);
+				device->SetName(&instanceBuffer, "instanceBuffer");
+
+				desc.Usage = USAGE_UPLOAD;
+				desc.BindFlags = BIND_NONE;
+				desc.MiscFlags = RESOURCE_MISC_NONE;
+				for (int i = 0; i < arraysize(instanceUploadBuffer); ++i)
+				{
+					device->CreateBuffer(&desc, nullptr, &instanceUploadBuffer[i]);
+					device->SetName(&instanceUploadBuffer[i], "instanceUploadBuffer");
+				}
 
-			desc.Usage = USAGE_UPLOAD;
-			desc.BindFlags = BIND_NONE;
-			desc.MiscFlags = RESOURCE_MISC_NONE;
-			for (int i = 0; i < arraysize(meshUploadBuffer); ++i)
-			{
-				device->CreateBuffer(&desc, nullptr, &meshUploadBuffer[i]);
-				device->SetName(&meshUploadBuffer[i], "meshUploadBuffer");
+				// The new upload buffers must be filled with all the object instances:
+				object_update_cache.clear();
 			}
-		}
-		meshArrayMapped = (ShaderMesh*)meshUploadBuffer[device->GetBufferIndex()].mapped_data;
-
-		materialArraySize = materials.GetCount();
-		if (materialBuffer.desc.Size < (materialArraySize * sizeof(ShaderMaterial)))
-		{
-			GPUBufferDesc desc;
-			desc.Stride = sizeof(ShaderMaterial);
-			desc.Size = desc.Stride * materialArraySize;
-			desc.BindFlags = BIND_SHADER_RESOURCE;
-			desc.MiscFlags = RESOURCE_MISC_BUFFER_RAW;
-			device->CreateBuffer(&desc, nullptr, &materialBuffer);
-			device->SetName(&materialBuffer, "materialBuffer");
+			instanceArrayMapped = (ShaderMeshInstance*)instanceUploadBuffer[device->GetBufferIndex()].mapped_data;
 
-			desc.Usage = USAGE_UPLOAD;
-			desc.BindFlags = BIND_NONE;
-			desc.MiscFlags = RESOURCE_MISC_NONE;
-			for (int i = 0; i < arraysize(materialUploadBuffer); ++i)
+			meshArraySize = meshes.GetCount() + hairs.GetCount();
+			if (meshBuffer.desc.Size < (meshArraySize * sizeof(ShaderMesh)))
 			{
-				device->CreateBuffer(&desc, nullptr, &materialUploadBuffer[i]);
-				device->SetName(&materialUploadBuffer[i], "materialUploadBuffer");
+				GPUBufferDesc desc;
+				desc.Stride = sizeof(ShaderMesh);
+				desc.Size = desc.Stride * meshArraySize;
+				desc.BindFlags = BIND_SHADER_RESOURCE;
+				desc.MiscFlags = RESOURCE_MISC_BUFFER_RAW;
+				device->CreateBuffer(&desc, nullptr, &meshBuffer);
+				device->SetName(&meshBuffer, "meshBuffer");
+
+				desc.Usage = USAGE_UPLOAD;
+				desc.BindFlags = BIND_NONE;
+				desc.MiscFlags = RESOURCE_MISC_NONE;
+				for (int i = 0; i < arraysize(meshUploadBuffer); ++i)
+				{
+					device->CreateBuffer(&desc, nullptr, &meshUploadBuffer[i]);
+					device->SetName(&meshUploadBuffer[i], "meshUploadBuffer");
+				}
 			}
-		}
-		materialArrayMapped = (ShaderMaterial*)materialUploadBuffer[device->GetBufferIndex()].mapped_data;
+			meshArrayMapped = (ShaderMesh*)meshUploadBuffer[device->GetBufferIndex()].mapped_data;
 
-		TLAS_instancesMapped = nullptr;
-		if (device->CheckCapability(GRAPHICSDEVICE_CAPABILITY_RAYTRACING))
-		{
-			GPUBufferDesc desc;
-			desc.Stride = (uint32_t)device->GetTopLevelAccelerationStructureInstanceSize();
-			desc.Size = desc.Stride * instanceArraySize;
-			desc.Usage = USAGE_UPLOAD;
-			if (TLAS_instancesUpload->desc.Size < desc.Size)
+			materialArraySize = materials.GetCount();
+			if (materialBuffer.desc.Size < (materialArraySize * sizeof(ShaderMaterial)))
 			{
-				for (int i = 0; i < arraysize(TLAS_instancesUpload); ++i)
+				GPUBufferDesc desc;
+				desc.Stride = sizeof(ShaderMaterial);
+				desc.Size = desc.Stride * materialArraySize;
+				desc.BindFlags = BIND_SHADER_RESOURCE;
+				desc.MiscFlags = RESOURCE_MISC_BUFFER_RAW;
+				device->CreateBuffer(&desc, nullptr, &materialBuffer);
+				device->SetName(&materialBuffer, "materialBuffer");
+
+				desc.Usage = USAGE_UPLOAD;
+				desc.BindFlags = BIND_NONE;
+				desc.MiscFlags = RESOURCE_MISC_NONE;
+				for (int i = 0; i < arraysize(materialUploadBuffer); ++i)
 				{
-					device->CreateBuffer(&desc, nullptr, &TLAS_instancesUpload[i]);
-					device->SetName(&TLAS_instancesUpload[i], "TLAS_instancesUpload");
+					device->CreateBuffer(&desc, nullptr, &materialUploadBuffer[i]);
+					device->SetName(&materialUploadBuffer[i], "materialUploadBuffer");
 				}
 			}
-			TLAS_instancesMapped = TLAS_instancesUpload[device->GetBufferIndex()].mapped_data;
-		}
+			materialArrayMapped = (ShaderMaterial*)materialUploadBuffer[device->GetBufferIndex()].mapped_data;
 
-		// Occlusion culling read:
-		if(wiRenderer::GetOcclusionCullingEnabled() && !wiRenderer::GetFreezeCullingCameraEnabled())
-		{
-			uint32_t minQueryCount = uint32_t(objects.GetCount() + lights.GetCount());
-			if (queryHeap.desc.queryCount < minQueryCount)
+			if (device->CheckCapability(GRAPHICSDEVICE_CAPABILITY_RAYTRACING))
 			{
-				GPUQueryHeapDesc desc;
-				desc.type = GPU_QUERY_TYPE_OCCLUSION_BINARY;
-				desc.queryCount = minQueryCount;
-				bool success = device->CreateQueryHeap(&desc, &queryHeap);
-				assert(success);
-
-				GPUBufferDesc bd;
-				bd.Usage = USAGE_READBACK;
-				bd.Size = desc.queryCount * sizeof(uint64_t);
-
-				for (int i = 0; i < arraysize(queryResultBuffer); ++i)
+				GPUBufferDesc desc;
+				desc.Stride = (uint32_t)device->GetTopLevelAccelerationStructureInstanceSize();
+				desc.Size = desc.Stride * instanceArraySize;
+				desc.Usage = USAGE_UPLOAD;
+				if (TLAS_instancesUpload->desc.Size < desc.Size)
 				{
-					success = device->CreateBuffer(&bd, nullptr, &queryResultBuffer[i]);
-					assert(success);
+					for (int i = 0; i < arraysize(TLAS_instancesUpload); ++i)
+					{
+						device->CreateBuffer(&desc, nullptr, &TLAS_instancesUpload[i]);
+						device->SetName(&TLAS_instancesUpload[i], "TLAS_instancesUpload");
+					}
 				}
+				TLAS_instancesMapped = TLAS_instancesUpload[device->GetBufferIndex()].mapped_data;
+			}
 
-				if (device->CheckCapability(GRAPHICSDEVICE_CAPABILITY_PREDICATION))
+			// Occlusion culling read:
+			if(wiRenderer::GetOcclusionCullingEnabled() && !wiRenderer::GetFreezeCullingCameraEnabled())
+			{
+				uint32_t minQueryCount = uint32_t(objects.GetCount() + lights.GetCount());
+				if (queryHeap.desc.queryCount < minQueryCount)
 				{
-					bd.Usage = USAGE_DEFAULT;
-					bd.MiscFlags |= RESOURCE_MISC_PREDICATION;
-					success = device->CreateBuffer(&bd, nullptr, &queryPredicationBuffer);
+					GPUQueryHeapDesc desc;
+					desc.type = GPU_QUERY_TYPE_OCCLUSION_BINARY;
+					desc.queryCount = minQueryCount;
+					bool success = device->CreateQueryHeap(&desc, &queryHeap);
 					assert(success);
-				}
-			}
-
-			// Advance to next query result buffer to use (this will be the oldest one that was written)
-			queryheap_idx = (queryheap_idx + 1) % arraysize(queryResultBuffer);
-
-			// Clear query allocation state:
-			queryAllocator.store(0);
-		}
-
-		wiJobSystem::context ctx;
-
-		RunPreviousFrameTransformUpdateSystem(ctx);
-
-		RunAnimationUpdateSystem(ctx);
-
-		RunTransformUpdateSystem(ctx);
-
-		wiJobSystem::Wait(ctx); // dependencies
-
-		RunHierarchyUpdateSystem(ctx);
-
-		RunSpringUpdateSystem(ctx);
-
-		RunInverseKinematicsUpdateSystem(ctx);
-
-		RunArmatureUpdateSystem(ctx);
-
-		RunMeshUpdateSystem(ctx);
-
-		RunMaterialUpdateSystem(ctx);
-
-		RunImpostorUpdateSystem(ctx);
-
-		RunWeatherUpdateSystem(ctx);
-
-		wiJobSystem::Wait(ctx); // dependencies
 
-		wiPhysicsEngine::RunPhysicsUpdateSystem(ctx, *this, dt);
+					GPUBufferDesc bd;
+					bd.Usage = USAGE_READBACK;
+					bd.Size = desc.queryCount * sizeof(uint64_t);
 
-		RunObjectUpdateSystem(ctx);
-
-		RunCameraUpdateSystem(ctx);
-
-		RunDecalUpdateSystem(ctx);
-
-		RunProbeUpdateSystem(ctx);
+					for (int i = 0; i < arraysize(queryResultBuffer); ++i)
+					{
+						success = device->CreateBuffer(&bd, nullptr, &queryResultBuffer[i]);
+						assert(success);
+					}
 
-		RunForceUpdateSystem(ctx);
+					if (device->CheckCapability(GRAPHICSDEVICE_CAPABILITY_PREDICATION))
+					{
+						bd.Usage = USAGE_DEFAULT;
+						bd.MiscFlags |= RESOURCE_MISC_PREDICATION;
+						success = device->CreateBuffer(&bd, nullptr, &queryPredicationBuffer);
+						assert(success);
+					}
+				}
 
-		RunLightUpdateSystem(ctx);
+				// Advance to next query result buffer to use (this will be the oldest one that was written)
+				queryheap_idx = (queryheap_idx + 1) % arraysize(queryResultBuffer);
 
-		RunParticleUpdateSystem(ctx);
+				// Clear query allocation state:
+				queryAllocator.store(0);
+			}
+		}
 
-		RunSoundUpdateSystem(ctx);
+		if (update_graph.GetTaskCount() == 0)
+		{
+			// The systems are scheduled by their data dependencies, independent systems can run in parallel:
+			//	The physics system only writes local transforms (the world matrices are updated next frame), so systems reading the final world matrices only depend on IK
+			//	The simulation systems (until IK) are skipped if they were already run by BeginSimulation()
+			auto& g = update_graph;
+			const uint32_t prev_transform = g.AddTask([this](wiJobSystem::context& ctx) { if (!simulation_started) RunPreviousFrameTransformUpdateSystem(ctx); });
+			const uint32_t animation = g.AddTask([this](wiJobSystem::context& ctx) { if (!simulation_started) RunAnimationUpdateSystem(ctx); });
+			const uint32_t transform = g.AddTask([this](wiJobSystem::context& ctx) { if (!simulation_started) RunTransformUpdateSystem(ctx); }, { prev_transform, animation });
+			const uint32_t hierarchy = g.AddTask([this](wiJobSystem::context& ctx) { if (!simulation_started) RunHierarchyUpdateSystem(ctx); }, { transform });
+			const uint32_t spring = g.AddTask([this](wiJobSystem::context& ctx) { if (!simulation_started) RunSpringUpdateSystem(ctx); }, { hierarchy });
+			const uint32_t ik = g.AddTask([this](wiJobSystem::context& ctx) { if (!simulation_started) RunInverseKinematicsUpdateSystem(ctx); }, { spring });
+			const uint32_t changed = g.AddTask([this](wiJobSystem::context& ctx) { if (!simulation_started) GatherChangedTransforms(ctx); }, { ik });
+			const uint32_t armature = g.AddTask([this](wiJobSystem::context& ctx) { RunArmatureUpdateSystem(ctx); }, { ik });
+			const uint32_t material = g.AddTask([this](wiJobSystem::context& ctx) { RunMaterialUpdateSystem(ctx); });
+			const uint32_t mesh = g.AddTask([this](wiJobSystem::context& ctx) { RunMeshUpdateSystem(ctx); }, { animation, material });
+			const uint32_t impostor = g.AddTask([this](wiJobSystem::context& ctx) { RunImpostorUpdateSystem(ctx); });
+			const uint32_t weather = g.AddTask([this](wiJobSystem::context& ctx) { RunWeatherUpdateSystem(ctx); });
+			const uint32_t physics = g.AddTask([this](wiJobSystem::context& ctx) { wiPhysicsEngine::RunPhysicsUpdateSystem(ctx, *this, this->dt); }, { ik, armature, mesh, weather });
+			const uint32_t object = g.AddTask([this](wiJobSystem::context& ctx) { RunObjectUpdateSystem(ctx); }, { physics, material, impostor, changed });
+			g.AddTask([this](wiJobSystem::context& ctx) { RunObjectBVHUpdateSystem(ctx); }, { object });
+			g.AddTask([this](wiJobSystem::context& ctx) { RunMeshBVHUpdateSystem(ctx); }, { mesh, physics });
+			g.AddTask([this](wiJobSystem::context& ctx) { RunCameraUpdateSystem(ctx); }, { ik });
+			g.AddTask([this](wiJobSystem::context& ctx) { RunDecalUpdateSystem(ctx); }, { ik, material });
+			g.AddTask([this](wiJobSystem::context& ctx) { RunProbeUpdateSystem(ctx); }, { ik });
+			g.AddTask([this](wiJobSystem::context& ctx) { RunForceUpdateSystem(ctx); }, { ik });
+			g.AddTask([this](wiJobSystem::context& ctx) { RunLightUpdateSystem(ctx); }, { ik, weather });
+			g.AddTask([this](wiJobSystem::context& ctx) { RunParticleUpdateSystem(ctx); }, { ik, mesh });
+			g.AddTask([this](wiJobSystem::context& ctx) { RunSoundUpdateSystem(ctx); }, { ik });
+		}
 
+		wiJobSystem::context ctx;
+		update_graph.Run(ctx);
 		wiJobSystem::Wait(ctx); // dependencies
+		simulation_started = false;
 
-		// Merge parallel bounds computation (depends on object update system):
-		bounds = AABB();
-		for (auto& group_bound : parallel_bounds)
-		{
-			bounds = AABB::Merge(bounds, group_bound);
-		}
+		// Scene bounds (depends on object update system):
+		bounds = wiJobSystem::ParallelReduce(ctx, (uint32_t)aabb_objects.GetCount(), AABB(),
+			[&](uint32_t i) { return aabb_objects[i]; },
+			[](const AABB& a, const AABB& b) { return AABB::Merge(a, b); }
+		);
 
 		if (lightmap_refresh_needed.load())
 		{
 			SetAccelerationStructureUpdateRequested(true);
 		}
 
-		if (device->CheckCapability(GRAPHICSDEVICE_CAPABILITY_RAYTRACING))
+		if (device != nullptr && device->CheckCapability(GRAPHICSDEVICE_CAPABILITY_RAYTRACING))
 		{
 			// Recreate top level acceleration structure if the object count changed:
 			if (instanceArraySize > 0 && (uint32_t)instanceArraySize != TLAS.desc.toplevel.count)
@@ -1671,6 +2077,11 @@ namespace wiScene
 			}
 		}
 
+		if (device == nullptr)
+		{
+			return;
+		}
+
 		if (wiRenderer::GetSurfelGIEnabled() && !surfelBuffer.IsValid())
 		{
 			GPUBufferDesc desc;
@@ -1730,19 +2141,127 @@ namespace wiScene
 			shaderscene.globalenvmap = device->GetDescriptorIndex(&weather.skyMap->texture, SRV);
 		}
 	}
-	void Scene::Clear()
+	void Scene::BeginSimulation(float dt)
 	{
-		names.Clear();
-		layers.Clear();
-		transforms.Clear();
-		prev_transforms.Clear();
-		hierarchy.Clear();
-		materials.Clear();
-		meshes.Clear();
-		impostors.Clear();
-		objects.Clear();
-		aabb_objects.Clear();
-		rigidbodies.Clear();
+		WaitSimulation();
+
+		// The transforms are copied for the renderer, because the simulation will modify them:
+		const uint32_t transform_count = (uint32_t)transforms.GetCount();
+		render_transforms.resize(transform_count);
+		wiJobSystem::context copy_ctx;
+		wiJobSystem::Dispatch(copy_ctx, transform_count, 1024, [this](wiJobArgs args) {
+			render_transforms[args.jobIndex] = transforms[args.jobIndex];
+		});
+		wiJobSystem::Wait(copy_ctx);
+
+		this->dt = dt;
+		simulation_started = true;
+		simulation_running = true;
+
+		wiJobSystem::Execute(simulation_ctx, [this](wiJobArgs args) {
+			wiJobSystem::context ctx;
+			RunPreviousFrameTransformUpdateSystem(ctx);
+			RunAnimationUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+			RunTransformUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+			RunHierarchyUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+			RunSpringUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+			RunInverseKinematicsUpdateSystem(ctx);
+			wiJobSystem::Wait(ctx);
+			GatherChangedTransforms(ctx);
+		});
+	}
+	void Scene::WaitSimulation()
+	{
+		if (!simulation_running)
+		{
+			return;
+		}
+		wiJobSystem::Wait(simulation_ctx);
+		simulation_running = false;
+
+		// The morph weights that the animation system deferred are written to the meshes in the order the animations were updated in:
+		for (size_t i = 0; i < animations.GetCount(); ++i)
+		{
+			AnimationComponent& animation = animations[i];
+			for (const AnimationComponent::DeferredMorphWeights& deferred : animation.morph_targets_deferred)
+			{
+				MeshComponent* mesh = meshes.GetComponent(deferred.meshID);
+				if (mesh == nullptr)
+				{
+					continue;
+				}
+				const size_t count = std::min(mesh->targets.size(), (size_t)deferred.count);
+				for (size_t j = 0; j < count; ++j)
+				{
+					mesh->targets[j].weight = wiMath::Lerp(mesh->targets[j].weight, animation.morph_weights_deferred[deferred.offset + j], deferred.amount);
+				}
+				mesh->dirty_morph = true;
+			}
+			animation.morph_targets_deferred.clear();
+			animation.morph_weights_deferred.clear();
+		}
+	}
+	Scene::Scene()
+	{
+		// Every component manager gets a bit in the entity signatures:
+		ComponentManager_Interface* managers[] = {
+			&names,
+			&layers,
+			&transforms,
+			&prev_transforms,
+			&hierarchy,
+			&materials,
+			&meshes,
+			&impostors,
+			&objects,
+			&aabb_objects,
+			&rigidbodies,
+			&softbodies,
+			&armatures,
+			&lights,
+			&aabb_lights,
+			&cameras,
+			&probes,
+			&aabb_probes,
+			&forces,
+			&decals,
+			&aabb_decals,
+			&animations,
+			&animation_datas,
+			&emitters,
+			&hairs,
+			&weathers,
+			&sounds,
+			&inverse_kinematics,
+			&springs,
+		};
+		for (ComponentManager_Interface* manager : managers)
+		{
+			assert(component_manager_count < arraysize(component_managers));
+			manager->SetSignatures(&signatures, component_manager_count);
+			component_managers[component_manager_count++] = manager;
+		}
+	}
+	void Scene::Clear()
+	{
+		WaitSimulation();
+		simulation_started = false;
+
+		names.Clear();
+		layers.Clear();
+		transforms.Clear();
+		prev_transforms.Clear();
+		hierarchy.Clear();
+		materials.Clear();
+		meshes.Clear();
+		impostors.Clear();
+		objects.Clear();
+		aabb_objects.Clear();
+		rigidbodies.Clear();
 		softbodies.Clear();
 		armatures.Clear();
 		lights.Clear();
@@ -1764,6 +2283,13 @@ namespace wiScene
 
 		TLAS = RaytracingAccelerationStructure();
 		BVH.Clear();
+		object_bvh.Clear();
+		object_bvh_version = ~0ull;
+		mesh_bvh_requests.clear();
+		aabb_objects_soa.Clear();
+		aabb_lights_soa.Clear();
+		aabb_probes_soa.Clear();
+		aabb_decals_soa.Clear();
 		waterRipples.clear();
 
 		surfelBuffer = {};
@@ -1774,6 +2300,8 @@ namespace wiScene
 	}
 	void Scene::Merge(Scene& other)
 	{
+		WaitSimulation();
+
 		names.Merge(other.names);
 		layers.Merge(other.layers);
 		transforms.Merge(other.transforms);
@@ -1806,64 +2334,421 @@ namespace wiScene
 
 		bounds = AABB::Merge(bounds, other.bounds);
 	}
+	void Scene::CompressAnimations(float tolerance)
+	{
+		// Animation data can be shared by multiple samplers, it is only compressed if all of them use it as the same kind of track:
+		struct Usage
+		{
+			uint32_t components = 0;
+			bool step = false;
+			bool compressible = true;
+		};
+		std::unordered_map<Entity, Usage> usages;
+		for (size_t i = 0; i < animations.GetCount(); ++i)
+		{
+			const AnimationComponent& animation = animations[i];
+			for (const AnimationComponent::AnimationChannel& channel : animation.channels)
+			{
+				const AnimationComponent::AnimationSampler& sampler = animation.samplers[channel.samplerIndex];
+				if (sampler.data == INVALID_ENTITY)
+				{
+					continue;
+				}
+				uint32_t components = 0;
+				switch (channel.path)
+				{
+				case AnimationComponent::AnimationChannel::Path::TRANSLATION:
+				case AnimationComponent::AnimationChannel::Path::SCALE:
+					components = 3;
+					break;
+				case AnimationComponent::AnimationChannel::Path::ROTATION:
+					components = 4;
+					break;
+				default:
+					break;
+				}
+				const bool step = sampler.mode == AnimationComponent::AnimationSampler::Mode::STEP;
+
+				auto inserted = usages.try_emplace(sampler.data);
+				Usage& usage = inserted.first->second;
+				if (inserted.second)
+				{
+					usage.components = components;
+					usage.step = step;
+				}
+				usage.compressible = usage.compressible && components != 0 && usage.components == components && usage.step == step &&
+					sampler.mode != AnimationComponent::AnimationSampler::Mode::CUBICSPLINE;
+			}
+		}
+
+		for (auto& it : usages)
+		{
+			AnimationDataComponent* animationdata = animation_datas.GetComponent(it.first);
+			if (animationdata != nullptr && it.second.compressible)
+			{
+				animationdata->Compress(it.second.components, it.second.step, tolerance);
+			}
+		}
+	}
 
-	void Scene::Entity_Remove(Entity entity)
+	void Scene::Entity_Remove(Entity entity, bool destroy_entity)
 	{
 		Component_Detach(entity); // special case, this will also remove entity from hierarchy but also do more!
 
-		names.Remove(entity);
-		layers.Remove(entity);
-		transforms.Remove(entity);
-		prev_transforms.Remove(entity);
-		materials.Remove(entity);
-		meshes.Remove(entity);
-		impostors.Remove(entity);
-		objects.Remove(entity);
-		aabb_objects.Remove(entity);
-		rigidbodies.Remove(entity);
-		softbodies.Remove(entity);
-		armatures.Remove(entity);
-		lights.Remove(entity);
-		aabb_lights.Remove(entity);
-		cameras.Remove(entity);
-		probes.Remove(entity);
-		aabb_probes.Remove(entity);
-		forces.Remove(entity);
-		decals.Remove(entity);
-		aabb_decals.Remove(entity);
-		animations.Remove(entity);
-		animation_datas.Remove(entity);
-		emitters.Remove(entity);
-		hairs.Remove(entity);
-		weathers.Remove(entity);
-		sounds.Remove(entity);
-		inverse_kinematics.Remove(entity);
-		springs.Remove(entity);
+		// Only the managers that contain the entity are visited:
+		EntitySignatures::Mask mask = signatures.Get(entity);
+		for (uint32_t bit = 0; mask != 0; ++bit, mask >>= 1)
+		{
+			if (mask & 1)
+			{
+				component_managers[bit]->Remove(entity);
+			}
+		}
+
+		if (destroy_entity)
+		{
+			// The entity has no more components in this scene, its index can be recycled:
+			DestroyEntity(entity);
+		}
+	}
+	void Scene::UpdateNameIndex()
+	{
+		if (name_index_version == names.GetVersion())
+		{
+			return;
+		}
+
+		name_index.clear();
+		name_index.reserve(names.GetCount());
+		name_index_next.resize(names.GetCount());
+
+		// Going backwards, so that the chain of every name is in increasing index order:
+		for (size_t i = names.GetCount(); i > 0; --i)
+		{
+			const uint32_t index = uint32_t(i - 1);
+			// Components are moved when names are added or removed, which resets their scene, so it is set again:
+			names[index].scene = this;
+			auto result = name_index.emplace(names[index].name, index);
+			if (result.second)
+			{
+				name_index_next[index] = ~0u;
+			}
+			else
+			{
+				name_index_next[index] = result.first->second;
+				result.first->second = index;
+			}
+		}
+
+		name_index_version = names.GetVersion();
+	}
+	void Scene::NameIndex_Rename(NameComponent& component, std::string&& value)
+	{
+		name_index_locker.lock();
+		std::string old_name = std::move(component.name);
+		component.name = std::move(value);
+
+		// If the index is out of date, it will be rebuilt on the next lookup anyway:
+		const size_t count = names.GetCount();
+		const uint32_t index = count > 0 ? uint32_t(&component - &names[0]) : ~0u;
+		if (name_index_version == names.GetVersion() && index < count && &names[index] == &component && old_name != component.name)
+		{
+			// Unlink from the chain of the old name:
+			auto it = name_index.find(old_name);
+			if (it != name_index.end())
+			{
+				if (it->second == index)
+				{
+					if (name_index_next[index] == ~0u)
+					{
+						name_index.erase(it);
+					}
+					else
+					{
+						it->second = name_index_next[index];
+					}
+				}
+				else
+				{
+					uint32_t prev = it->second;
+					while (name_index_next[prev] != ~0u && name_index_next[prev] != index)
+					{
+						prev = name_index_next[prev];
+					}
+					if (name_index_next[prev] == index)
+					{
+						name_index_next[prev] = name_index_next[index];
+					}
+				}
+			}
+
+			// Link into the chain of the new name, keeping the increasing index order:
+			auto result = name_index.emplace(component.name, index);
+			if (result.second)
+			{
+				name_index_next[index] = ~0u;
+			}
+			else if (index < result.first->second)
+			{
+				name_index_next[index] = result.first->second;
+				result.first->second = index;
+			}
+			else
+			{
+				uint32_t prev = result.first->second;
+				while (name_index_next[prev] != ~0u && name_index_next[prev] < index)
+				{
+					prev = name_index_next[prev];
+				}
+				name_index_next[index] = name_index_next[prev];
+				name_index_next[prev] = index;
+			}
+		}
+		name_index_locker.unlock();
 	}
 	Entity Scene::Entity_FindByName(const std::string& name)
 	{
-		for (size_t i = 0; i < names.GetCount(); ++i)
+		Entity result;
+		Entity_FindByName(&name, 1, &result);
+		return result;
+	}
+	void Scene::Entity_FindByName(const std::string* names_to_find, size_t count, Entity* results)
+	{
+		name_index_locker.lock();
+		UpdateNameIndex();
+		for (size_t i = 0; i < count; ++i)
+		{
+			results[i] = INVALID_ENTITY;
+			auto it = name_index.find(names_to_find[i]);
+			if (it != name_index.end())
+			{
+				// The chain can only contain other names if a name string was written directly, those are skipped:
+				for (uint32_t index = it->second; index != ~0u; index = name_index_next[index])
+				{
+					if (names[index] == names_to_find[i])
+					{
+						results[i] = names.GetEntity(index);
+						break;
+					}
+				}
+			}
+		}
+		name_index_locker.unlock();
+	}
+	void Scene::Entity_FindAllByName(const std::string& name, std::vector<Entity>& results)
+	{
+		name_index_locker.lock();
+		UpdateNameIndex();
+		auto it = name_index.find(name);
+		if (it != name_index.end())
 		{
-			if (names[i] == name)
+			for (uint32_t index = it->second; index != ~0u; index = name_index_next[index])
 			{
-				return names.GetEntity(i);
+				if (names[index] == name)
+				{
+					results.push_back(names.GetEntity(index));
+				}
 			}
 		}
-		return INVALID_ENTITY;
+		name_index_locker.unlock();
+	}
+	// Copies the component of an entity to an other entity in the same manager, returns the new component or nullptr if it didn't exist
+	template<typename T>
+	T* DuplicateComponent(ComponentManager<T>& manager, Entity from, Entity to)
+	{
+		const T* component = manager.GetComponent(from);
+		if (component == nullptr)
+		{
+			return nullptr;
+		}
+		T copy = *component; // copy first, because Create() can reallocate the container
+		T& result = manager.Create(to);
+		result = std::move(copy);
+		return &result;
+	}
+	// Same as DuplicateComponent, but through serialization, for components that own runtime resources which can't be shared
+	template<typename T>
+	T* DuplicateComponent_Serialized(ComponentManager<T>& manager, Entity from, Entity to, wiArchive& archive)
+	{
+		T* component = manager.GetComponent(from);
+		if (component == nullptr)
+		{
+			return nullptr;
+		}
+		archive.SetReadModeAndResetPos(false);
+		{
+			EntitySerializer seri;
+			seri.allow_remap = false;
+			component->Serialize(archive, seri);
+		}
+		archive.SetReadModeAndResetPos(true);
+		T& result = manager.Create(to);
+		{
+			EntitySerializer seri;
+			seri.allow_remap = false;
+			result.Serialize(archive, seri);
+		}
+		return &result;
 	}
 	Entity Scene::Entity_Duplicate(Entity entity)
 	{
-		wiArchive archive;
+		if (entity == INVALID_ENTITY)
+		{
+			return INVALID_ENTITY;
+		}
 
-		// First write the root entity to staging area:
-		archive.SetReadModeAndResetPos(false);
-		Entity_Serialize(archive, entity);
+		// Gather the entity and all its descendants, after sorting the hierarchy a single pass is enough for this:
+		SortHierarchy();
+		assert(IsHierarchySorted());
+		std::unordered_map<Entity, Entity> remap;
+		std::vector<Entity> sources;
+		remap[entity] = CreateEntity();
+		sources.push_back(entity);
+		for (size_t i = 0; i < hierarchy.GetCount(); ++i)
+		{
+			if (remap.count(hierarchy[i].parentID) > 0)
+			{
+				const Entity child = hierarchy.GetEntity(i);
+				if (child != entity)
+				{
+					remap[child] = CreateEntity();
+					sources.push_back(child);
+				}
+			}
+		}
 
-		// Then deserialize root:
-		archive.SetReadModeAndResetPos(true);
-		Entity root = Entity_Serialize(archive);
+		// Meshes outside the tree that are skinned by a duplicated armature are also duplicated, so the copies can be animated separately.
+		//	Other meshes outside the tree stay shared between the original and the duplicated objects:
+		std::vector<Entity> skinned_meshes;
+		const size_t tree_count = sources.size();
+		for (size_t i = 0; i < tree_count; ++i)
+		{
+			const ObjectComponent* object = objects.GetComponent(sources[i]);
+			if (object == nullptr || remap.count(object->meshID) > 0)
+			{
+				continue;
+			}
+			const MeshComponent* mesh = meshes.GetComponent(object->meshID);
+			if (mesh != nullptr && remap.count(mesh->armatureID) > 0)
+			{
+				remap[object->meshID] = CreateEntity();
+				skinned_meshes.push_back(object->meshID);
+			}
+		}
 
-		return root;
+		// Entity references that point inside the duplicated tree are redirected to the duplicates:
+		auto remap_entity = [&](Entity& ref) {
+			auto it = remap.find(ref);
+			if (it != remap.end())
+			{
+				ref = it->second;
+			}
+		};
+
+		wiArchive archive; // only for components that can't be copied directly
+
+		// Meshes own GPU buffers and the skinning output, so they go through serialization, which recreates the render data:
+		auto duplicate_mesh = [&](Entity src, Entity dst) {
+			if (MeshComponent* component = DuplicateComponent_Serialized(meshes, src, dst, archive))
+			{
+				remap_entity(component->armatureID);
+				for (auto& subset : component->subsets)
+				{
+					remap_entity(subset.materialID);
+				}
+			}
+			DuplicateComponent_Serialized(softbodies, src, dst, archive);
+		};
+
+		for (Entity src : sources)
+		{
+			const Entity dst = remap[src];
+
+			DuplicateComponent(names, src, dst);
+			DuplicateComponent(layers, src, dst);
+			DuplicateComponent(transforms, src, dst);
+			DuplicateComponent(prev_transforms, src, dst);
+			if (HierarchyComponent* component = DuplicateComponent(hierarchy, src, dst))
+			{
+				remap_entity(component->parentID); // the root keeps its original parent
+			}
+			DuplicateComponent(materials, src, dst);
+			duplicate_mesh(src, dst);
+			DuplicateComponent(impostors, src, dst);
+			if (ObjectComponent* component = DuplicateComponent(objects, src, dst))
+			{
+				remap_entity(component->meshID);
+				component->lightmap = {};
+				component->renderpass_lightmap_clear = {};
+				component->renderpass_lightmap_accumulate = {};
+				component->occlusionHistory = ~0;
+				for (int& query : component->occlusionQueries)
+				{
+					query = -1;
+				}
+			}
+			DuplicateComponent(aabb_objects, src, dst);
+			if (RigidBodyPhysicsComponent* component = DuplicateComponent(rigidbodies, src, dst))
+			{
+				component->physicsobject = nullptr;
+			}
+			if (ArmatureComponent* component = DuplicateComponent(armatures, src, dst))
+			{
+				for (Entity& bone : component->boneCollection)
+				{
+					remap_entity(bone);
+				}
+				component->boneBuffer = {};
+			}
+			if (LightComponent* component = DuplicateComponent(lights, src, dst))
+			{
+				component->occlusionquery = -1;
+			}
+			DuplicateComponent(aabb_lights, src, dst);
+			DuplicateComponent(cameras, src, dst);
+			if (EnvironmentProbeComponent* component = DuplicateComponent(probes, src, dst))
+			{
+				component->textureIndex = -1;
+				component->SetDirty();
+			}
+			DuplicateComponent(aabb_probes, src, dst);
+			DuplicateComponent(forces, src, dst);
+			DuplicateComponent(decals, src, dst);
+			DuplicateComponent(aabb_decals, src, dst);
+			if (AnimationComponent* component = DuplicateComponent(animations, src, dst))
+			{
+				for (auto& channel : component->channels)
+				{
+					remap_entity(channel.target);
+				}
+				for (auto& sampler : component->samplers)
+				{
+					remap_entity(sampler.data);
+				}
+			}
+			DuplicateComponent(animation_datas, src, dst);
+			DuplicateComponent_Serialized(emitters, src, dst, archive);
+			DuplicateComponent_Serialized(hairs, src, dst, archive);
+			DuplicateComponent(weathers, src, dst);
+			DuplicateComponent_Serialized(sounds, src, dst, archive);
+			if (InverseKinematicsComponent* component = DuplicateComponent(inverse_kinematics, src, dst))
+			{
+				remap_entity(component->target);
+			}
+			DuplicateComponent(springs, src, dst);
+		}
+
+		for (Entity src : skinned_meshes)
+		{
+			const Entity dst = remap[src];
+			DuplicateComponent(names, src, dst);
+			duplicate_mesh(src, dst);
+		}
+
+		// The duplicates were added after their parents, so the hierarchy is still sorted:
+		hierarchy_sorted_version = hierarchy.GetVersion();
+
+		return remap[entity];
 	}
 	Entity Scene::Entity_CreateMaterial(
 		const std::string& name
@@ -2088,37 +2973,58 @@ namespace wiScene
 	{
 		assert(entity != parent);
 
-		if (hierarchy.Contains(entity))
+		// Every single attach keeps the ordering, so it is only sorted here if the hierarchy was modified directly:
+		SortHierarchy();
+
+		// The number of children tells if a newly added node has to be moved before its children, without searching for them:
+		if (hierarchy_child_counts_version != hierarchy.GetVersion())
+		{
+			hierarchy_child_counts.clear();
+			for (size_t i = 0; i < hierarchy.GetCount(); ++i)
+			{
+				hierarchy_child_counts[hierarchy[i].parentID]++;
+			}
+		}
+		const HierarchyComponent* previous = hierarchy.GetComponent(entity);
+		const bool added = previous == nullptr;
+		if (!added)
 		{
-			Component_Detach(entity);
+			auto it = hierarchy_child_counts.find(previous->parentID);
+			if (it != hierarchy_child_counts.end() && --it->second == 0)
+			{
+				hierarchy_child_counts.erase(it);
+			}
 		}
+		hierarchy_child_counts[parent]++;
+
+		Component_Attach_Unordered(entity, parent, child_already_in_local_space);
 
-		// Add a new hierarchy node to the end of container:
-		hierarchy.Create(entity).parentID = parent;
+		hierarchy_sorted = KeepHierarchyOrder(entity, added);
+		hierarchy_sorted_version = hierarchy.GetVersion();
+		hierarchy_child_counts_version = hierarchy.GetVersion();
+	}
+	void Scene::Component_Attach_Unordered(Entity entity, Entity parent, bool child_already_in_local_space)
+	{
+		assert(entity != parent);
 
-		// Detect breaks in the tree and fix them:
-		//	when children are before parents, we move the parents before the children while keeping ordering of other components intact
-		if (hierarchy.GetCount() > 1)
+		HierarchyComponent* parentcomponent = hierarchy.GetComponent(entity);
+		if (parentcomponent != nullptr)
 		{
-			for (size_t i = hierarchy.GetCount() - 1; i > 0; --i)
+			// Reattaching keeps the node in place, instead of removing it from the middle of the container
+			//	The transform is brought back to world space first, like in Component_Detach():
+			TransformComponent* transform = transforms.GetComponent(entity);
+			if (transform != nullptr)
 			{
-				Entity parent_candidate_entity = hierarchy.GetEntity(i);
-				for (size_t j = 0; j < i; ++j)
-				{
-					const HierarchyComponent& child_candidate = hierarchy[j];
-
-					if (child_candidate.parentID == parent_candidate_entity)
-					{
-						hierarchy.MoveItem(i, j);
-						++i; // next outer iteration will check the same index again as parent candidate, however things were moved upwards, so it will be a different entity!
-						break;
-					}
-				}
+				transform->ApplyTransform();
 			}
+			parentcomponent->parentID = parent;
 		}
-
-		// Re-query parent after potential MoveItem(), because it invalidates references:
-		HierarchyComponent& parentcomponent = *hierarchy.GetComponent(entity);
+		else
+		{
+			// Add a new hierarchy node to the end of container:
+			hierarchy.Create(entity).parentID = parent;
+		}
+		hierarchy_sorted = false;
 
 		TransformComponent* transform_parent = transforms.GetComponent(parent);
 		if (transform_parent == nullptr)
@@ -2149,30 +3055,172 @@ namespace wiScene
 		if (layer_child == nullptr)
 		{
 			layer_child = &layers.Create(entity);
+			layer_parent = layers.GetComponent(parent); // after layers.Create(), layer_parent pointer could have become invalidated!
 		}
 		layer_child->propagationMask = layer_parent->GetLayerMask();
 	}
-	void Scene::Component_Detach(Entity entity)
+	bool Scene::KeepHierarchyOrder(Entity entity, bool added)
 	{
-		const HierarchyComponent* parent = hierarchy.GetComponent(entity);
+		const size_t count = hierarchy.GetCount();
+		const size_t index = hierarchy.GetIndex(entity);
+		const size_t parent_index = hierarchy.GetIndex(hierarchy[index].parentID);
+
+		// A reattached node already was before its descendants. A new node is at the end, its existing children are before it,
+		//	and the first of its descendants is always a direct child:
+		size_t first = index;
+		if (added && hierarchy_child_counts.count(entity) > 0)
+		{
+			for (first = 0; first < index && hierarchy[first].parentID != entity; ++first);
+		}
 
-		if (parent != nullptr)
+		if (parent_index >= count || parent_index < first)
 		{
-			TransformComponent* transform = transforms.GetComponent(entity);
-			if (transform != nullptr)
+			// The parent is not in the way, the node only needs to be before its descendants:
+			if (first < index)
 			{
-				transform->ApplyTransform();
+				hierarchy.MoveItem(index, first);
 			}
+			return true;
+		}
 
-			LayerComponent* layer = layers.GetComponent(entity);
-			if (layer != nullptr)
+		// The parent is after the node or some of its descendants. The nodes between them keep their ordering,
+		//	except the node and its descendants, which are moved to just after the parent:
+		const size_t last = std::max(index, parent_index);
+		std::vector<uint8_t> descendant(last - first + 1, 0);
+		std::vector<uint32_t> order;
+		order.reserve(last - first + 1);
+		for (size_t i = first; i <= parent_index; ++i)
+		{
+			if (i == index)
 			{
-				layer->propagationMask = ~0;
+				continue;
 			}
-
-			hierarchy.Remove_KeepSorted(entity);
-		}
-	}
+			const Entity parentID = hierarchy[i].parentID;
+			const size_t ancestor = hierarchy.GetIndex(parentID);
+			if (parentID == entity || (ancestor >= first && ancestor < i && descendant[ancestor - first]))
+			{
+				descendant[i - first] = 1;
+			}
+			else
+			{
+				order.push_back((uint32_t)i);
+			}
+		}
+		if (descendant[parent_index - first])
+		{
+			// The parent is a descendant of the node:
+			return false;
+		}
+		order.push_back((uint32_t)index);
+		for (size_t i = first; i <= parent_index; ++i)
+		{
+			if (descendant[i - first])
+			{
+				order.push_back((uint32_t)i);
+			}
+		}
+		for (size_t i = parent_index + 1; i <= last; ++i)
+		{
+			if (i != index)
+			{
+				order.push_back((uint32_t)i);
+			}
+		}
+		hierarchy.Reorder(first, order.data(), order.size());
+		return true;
+	}
+	void Scene::Component_Attach(const Entity* entities, const Entity* parents, size_t count, bool child_already_in_local_space)
+	{
+		hierarchy.Reserve(hierarchy.GetCount() + count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			Component_Attach_Unordered(entities[i], parents[i], child_already_in_local_space);
+		}
+		SortHierarchy();
+	}
+	void Scene::SortHierarchy()
+	{
+		if (IsHierarchySorted())
+		{
+			return;
+		}
+
+		// Stable topological sort: every node is moved after its ancestors, otherwise the relative ordering is kept
+		const size_t count = hierarchy.GetCount();
+		std::vector<uint8_t> states(count, 0); // 0: not visited, 1: visiting, 2: placed
+		std::vector<uint32_t> order;
+		order.reserve(count);
+		std::vector<uint32_t> chain;
+		bool changed = false;
+		for (size_t i = 0; i < count; ++i)
+		{
+			// Walk up until a placed ancestor or a root, collecting the ancestors that are not placed yet
+			//	(a node in visiting state would mean a cycle, which is left as is):
+			size_t node = i;
+			while (node < count && states[node] == 0)
+			{
+				states[node] = 1;
+				chain.push_back((uint32_t)node);
+				node = hierarchy.GetIndex(hierarchy[node].parentID);
+			}
+			// Place the collected chain, topmost ancestor first:
+			while (!chain.empty())
+			{
+				const uint32_t index = chain.back();
+				chain.pop_back();
+				states[index] = 2;
+				changed |= index != (uint32_t)order.size();
+				order.push_back(index);
+			}
+		}
+
+		if (changed)
+		{
+			hierarchy.Reorder(0, order.data(), count);
+		}
+
+		hierarchy_sorted = true;
+		hierarchy_sorted_version = hierarchy.GetVersion();
+	}
+	void Scene::Component_Detach(Entity entity)
+	{
+		const HierarchyComponent* parent = hierarchy.GetComponent(entity);
+
+		if (parent != nullptr)
+		{
+			TransformComponent* transform = transforms.GetComponent(entity);
+			if (transform != nullptr)
+			{
+				transform->ApplyTransform();
+			}
+
+			LayerComponent* layer = layers.GetComponent(entity);
+			if (layer != nullptr)
+			{
+				layer->propagationMask = ~0;
+			}
+
+			const bool sorted = IsHierarchySorted();
+			const bool counted = hierarchy_child_counts_version == hierarchy.GetVersion();
+			if (counted)
+			{
+				auto it = hierarchy_child_counts.find(parent->parentID);
+				if (it != hierarchy_child_counts.end() && --it->second == 0)
+				{
+					hierarchy_child_counts.erase(it);
+				}
+			}
+			hierarchy.Remove_KeepSorted(entity);
+			if (sorted)
+			{
+				hierarchy_sorted_version = hierarchy.GetVersion(); // removal keeps the ordering
+			}
+			if (counted)
+			{
+				hierarchy_child_counts_version = hierarchy.GetVersion();
+			}
+		}
+	}
 	void Scene::Component_DetachChildren(Entity parent)
 	{
 		for (size_t i = 0; i < hierarchy.GetCount(); )
@@ -2194,19 +3242,115 @@ namespace wiScene
 
 	void Scene::RunPreviousFrameTransformUpdateSystem(wiJobSystem::context& ctx)
 	{
-		wiJobSystem::Dispatch(ctx, (uint32_t)prev_transforms.GetCount(), small_subtask_groupsize, [&](wiJobArgs args) {
+		view_prev_transforms.Refresh();
+		wiJobSystem::Dispatch(ctx, (uint32_t)view_prev_transforms.GetCount(), small_subtask_groupsize, [&](wiJobArgs args) {
 
-			PreviousFrameTransformComponent& prev_transform = prev_transforms[args.jobIndex];
-			Entity entity = prev_transforms.GetEntity(args.jobIndex);
-			const TransformComponent& transform = *transforms.GetComponent(entity);
+			auto [prev_transform, transform] = view_prev_transforms[args.jobIndex];
 
 			prev_transform.world_prev = transform.world;
 		});
 	}
+	Entity Scene::GetHierarchyRoot(Entity entity) const
+	{
+		const size_t index = hierarchy.GetIndex(entity);
+		if (index < hierarchy_update_roots.size())
+		{
+			return hierarchy_update_roots[index];
+		}
+		return entity;
+	}
+	void Scene::UpdateGroups::Build(const Entity* keys, const uint32_t* key_offsets, uint32_t count, uint32_t key_count, bool single_group)
+	{
+		// Union-find over the items, items that have a common key are joined:
+		parents.resize(count);
+		auto find = [&](uint32_t index) {
+			while (parents[index] != index)
+			{
+				parents[index] = parents[parents[index]];
+				index = parents[index];
+			}
+			return index;
+		};
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			parents[i] = single_group ? 0 : i;
+		}
+		if (!single_group)
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const uint32_t key_begin = key_offsets == nullptr ? i * key_count : key_offsets[i];
+				const uint32_t key_end = key_offsets == nullptr ? key_begin + key_count : key_offsets[i + 1];
+				for (uint32_t j = key_begin; j < key_end; ++j)
+				{
+					const Entity key = keys[j];
+					if (key == INVALID_ENTITY)
+					{
+						continue;
+					}
+					const uint32_t other = first_items.Find(key);
+					if (other == EntityLookup::invalid_index)
+					{
+						first_items.Insert(key, i);
+						first_item_keys.push_back(key);
+					}
+					else
+					{
+						const uint32_t a = find(i);
+						const uint32_t b = find(other);
+						parents[std::max(a, b)] = std::min(a, b);
+					}
+				}
+			}
+			// Only the used slots are cleared, the pages of the lookup are reused by the next build:
+			for (Entity key : first_item_keys)
+			{
+				first_items.Erase(key);
+			}
+			first_item_keys.clear();
+		}
+
+		// Counting sort of the items by group, the original ordering is kept inside a group:
+		offsets.assign(count + 1, 0);
+		items.resize(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			offsets[find(i) + 1]++;
+		}
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			offsets[i + 1] += offsets[i];
+		}
+		next.assign(offsets.begin(), offsets.end() - 1);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			items[next[find(i)]++] = i;
+		}
+
+		// Only keep the groups that are not empty:
+		uint32_t group_count = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (offsets[i] != offsets[i + 1])
+			{
+				offsets[group_count++] = offsets[i];
+			}
+		}
+		offsets[group_count] = count;
+		offsets.resize(group_count + 1);
+	}
 	void Scene::RunAnimationUpdateSystem(wiJobSystem::context& ctx)
 	{
-		for (size_t i = 0; i < animations.GetCount(); ++i)
+		// Animations that write to the same transform or mesh must be updated in order, because they blend on top of each other.
+		//	These are put into the same group, and the groups are updated in parallel.
+		//	This pass is serial, because backwards compatibility conversion can create components too
+		const uint32_t animation_count = (uint32_t)animations.GetCount();
+		animation_group_keys.clear();
+		animation_group_key_offsets.resize(animation_count + 1);
+		for (uint32_t i = 0; i < animation_count; ++i)
 		{
+			animation_group_key_offsets[i] = (uint32_t)animation_group_keys.size();
+
 			AnimationComponent& animation = animations[i];
 			if (!animation.IsPlaying() && animation.timer == 0.0f)
 			{
@@ -2225,31 +3369,86 @@ namespace wiScene
 					sampler.backwards_compatibility_data.keyframe_times.clear();
 					sampler.backwards_compatibility_data.keyframe_data.clear();
 				}
+
+				// Morph weights are written to the mesh, which can be shared by multiple objects:
+				Entity target = channel.target;
+				if (channel.path == AnimationComponent::AnimationChannel::Path::WEIGHTS)
+				{
+					const ObjectComponent* object = objects.GetComponent(channel.target);
+					if (object != nullptr)
+					{
+						target = object->meshID;
+					}
+				}
+				animation_group_keys.push_back(target);
+			}
+		}
+		animation_group_key_offsets[animation_count] = (uint32_t)animation_group_keys.size();
+		animation_update_groups.Build(animation_group_keys.data(), animation_group_key_offsets.data(), animation_count);
+
+		wiJobSystem::Dispatch(ctx, animation_update_groups.GetCount(), 1, [this](wiJobArgs args) {
+
+		for (uint32_t item = animation_update_groups.offsets[args.jobIndex]; item < animation_update_groups.offsets[args.jobIndex + 1]; ++item)
+		{
+			AnimationComponent& animation = animations[animation_update_groups.items[item]];
+			if (!animation.IsPlaying() && animation.timer == 0.0f)
+			{
+				continue;
+			}
+
+			for (const AnimationComponent::AnimationChannel& channel : animation.channels)
+			{
+				assert(channel.samplerIndex < (int)animation.samplers.size());
+				AnimationComponent::AnimationSampler& sampler = animation.samplers[channel.samplerIndex];
 				const AnimationDataComponent* animationdata = animation_datas.GetComponent(sampler.data);
-				if (animationdata == nullptr)
+				if (animationdata == nullptr || animationdata->GetKeyCount() == 0)
 				{
 					continue;
 				}
+				// Compressed data only has the key values without tangents, so a CUBICSPLINE sampler interpolates it linearly:
+				AnimationComponent::AnimationSampler::Mode mode = sampler.mode;
+				if (animationdata->IsCompressed() && mode == AnimationComponent::AnimationSampler::Mode::CUBICSPLINE)
+				{
+					mode = AnimationComponent::AnimationSampler::Mode::LINEAR;
+				}
 
 				int keyLeft = 0;
 				int keyRight = 0;
 
-				if (animationdata->keyframe_times.back() < animation.timer)
+				const int keyCount = (int)animationdata->GetKeyCount();
+				if (animationdata->GetKeyTime(keyCount - 1) < animation.timer)
 				{
 					// Rightmost keyframe is already outside animation, so just snap to last keyframe:
-					keyLeft = keyRight = (int)animationdata->keyframe_times.size() - 1;
+					keyLeft = keyRight = keyCount - 1;
 				}
 				else
 				{
 					// Search for the right keyframe (greater/equal to anim time):
-					while (animationdata->keyframe_times[keyRight++] < animation.timer) {}
-					keyRight--;
+					keyRight = animationdata->FindKey(animation.timer, sampler.cursor);
 
 					// Left keyframe is just near right:
 					keyLeft = std::max(0, keyRight - 1);
 				}
 
-				float left = animationdata->keyframe_times[keyLeft];
+				const float left = animationdata->GetKeyTime(keyLeft);
+				const float right = animationdata->GetKeyTime(keyRight);
+
+				const float* keyframe_data = animationdata->keyframe_data.data();
+				size_t keyframe_data_size = animationdata->keyframe_data.size();
+				size_t keyframe_count = animationdata->keyframe_times.size();
+				float decoded_data[8];
+				if (animationdata->IsCompressed())
+				{
+					// Only the two keys that are sampled are decoded, then they are used the same way as uncompressed data:
+					const size_t components = animationdata->compressed_components;
+					animationdata->DecodeKey(keyLeft, decoded_data);
+					animationdata->DecodeKey(keyRight, decoded_data + components);
+					keyframe_data = decoded_data;
+					keyframe_data_size = components * 2;
+					keyframe_count = 2;
+					keyRight = keyLeft == keyRight ? 0 : 1;
+					keyLeft = 0;
+				}
 
 				TransformComponent transform;
 
@@ -2267,6 +3466,11 @@ namespace wiScene
 					if (target_mesh == nullptr)
 						continue;
 					animation.morph_weights_temp.resize(target_mesh->targets.size());
+					if (animationdata->IsCompressed() && animationdata->compressed_components != target_mesh->targets.size())
+					{
+						// Compressed keys have 3 or 4 values, they can only be used as weights if there are as many morph targets:
+						continue;
+					}
 				}
 				else
 				{
@@ -2277,7 +3481,7 @@ namespace wiScene
 					transform = *target_transform;
 				}
 
-				switch (sampler.mode)
+				switch (mode)
 				{
 				default:
 				case AnimationComponent::AnimationSampler::Mode::STEP:
@@ -2288,28 +3492,28 @@ namespace wiScene
 					default:
 					case AnimationComponent::AnimationChannel::Path::TRANSLATION:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * 3);
-						transform.translation_local = ((const XMFLOAT3*)animationdata->keyframe_data.data())[keyLeft];
+						assert(keyframe_data_size == keyframe_count * 3);
+						transform.translation_local = ((const XMFLOAT3*)keyframe_data)[keyLeft];
 					}
 					break;
 					case AnimationComponent::AnimationChannel::Path::ROTATION:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * 4);
-						transform.rotation_local = ((const XMFLOAT4*)animationdata->keyframe_data.data())[keyLeft];
+						assert(keyframe_data_size == keyframe_count * 4);
+						transform.rotation_local = ((const XMFLOAT4*)keyframe_data)[keyLeft];
 					}
 					break;
 					case AnimationComponent::AnimationChannel::Path::SCALE:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * 3);
-						transform.scale_local = ((const XMFLOAT3*)animationdata->keyframe_data.data())[keyLeft];
+						assert(keyframe_data_size == keyframe_count * 3);
+						transform.scale_local = ((const XMFLOAT3*)keyframe_data)[keyLeft];
 					}
 					break;
 					case AnimationComponent::AnimationChannel::Path::WEIGHTS:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * animation.morph_weights_temp.size());
+						assert(keyframe_data_size == keyframe_count * animation.morph_weights_temp.size());
 						for (size_t j = 0; j < animation.morph_weights_temp.size(); ++j)
 						{
-							animation.morph_weights_temp[j] = animationdata->keyframe_data[keyLeft * animation.morph_weights_temp.size() + j];
+							animation.morph_weights_temp[j] = keyframe_data[keyLeft * animation.morph_weights_temp.size() + j];
 						}
 					}
 					break;
@@ -2326,7 +3530,6 @@ namespace wiScene
 					}
 					else
 					{
-						float right = animationdata->keyframe_times[keyRight];
 						t = (animation.timer - left) / (right - left);
 					}
 
@@ -2335,8 +3538,8 @@ namespace wiScene
 					default:
 					case AnimationComponent::AnimationChannel::Path::TRANSLATION:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * 3);
-						const XMFLOAT3* data = (const XMFLOAT3*)animationdata->keyframe_data.data();
+						assert(keyframe_data_size == keyframe_count * 3);
+						const XMFLOAT3* data = (const XMFLOAT3*)keyframe_data;
 						XMVECTOR vLeft = XMLoadFloat3(&data[keyLeft]);
 						XMVECTOR vRight = XMLoadFloat3(&data[keyRight]);
 						XMVECTOR vAnim = XMVectorLerp(vLeft, vRight, t);
@@ -2345,8 +3548,8 @@ namespace wiScene
 					break;
 					case AnimationComponent::AnimationChannel::Path::ROTATION:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * 4);
-						const XMFLOAT4* data = (const XMFLOAT4*)animationdata->keyframe_data.data();
+						assert(keyframe_data_size == keyframe_count * 4);
+						const XMFLOAT4* data = (const XMFLOAT4*)keyframe_data;
 						XMVECTOR vLeft = XMLoadFloat4(&data[keyLeft]);
 						XMVECTOR vRight = XMLoadFloat4(&data[keyRight]);
 						XMVECTOR vAnim = XMQuaternionSlerp(vLeft, vRight, t);
@@ -2356,8 +3559,8 @@ namespace wiScene
 					break;
 					case AnimationComponent::AnimationChannel::Path::SCALE:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * 3);
-						const XMFLOAT3* data = (const XMFLOAT3*)animationdata->keyframe_data.data();
+						assert(keyframe_data_size == keyframe_count * 3);
+						const XMFLOAT3* data = (const XMFLOAT3*)keyframe_data;
 						XMVECTOR vLeft = XMLoadFloat3(&data[keyLeft]);
 						XMVECTOR vRight = XMLoadFloat3(&data[keyRight]);
 						XMVECTOR vAnim = XMVectorLerp(vLeft, vRight, t);
@@ -2366,11 +3569,11 @@ namespace wiScene
 					break;
 					case AnimationComponent::AnimationChannel::Path::WEIGHTS:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * animation.morph_weights_temp.size());
+						assert(keyframe_data_size == keyframe_count * animation.morph_weights_temp.size());
 						for (size_t j = 0; j < animation.morph_weights_temp.size(); ++j)
 						{
-							float vLeft = animationdata->keyframe_data[keyLeft * animation.morph_weights_temp.size() + j];
-							float vRight = animationdata->keyframe_data[keyLeft * animation.morph_weights_temp.size() + j];
+							float vLeft = keyframe_data[keyLeft * animation.morph_weights_temp.size() + j];
+							float vRight = keyframe_data[keyLeft * animation.morph_weights_temp.size() + j];
 							float vAnim = wiMath::Lerp(vLeft, vRight, t);
 							animation.morph_weights_temp[j] = vAnim;
 						}
@@ -2389,7 +3592,6 @@ namespace wiScene
 					}
 					else
 					{
-						float right = animationdata->keyframe_times[keyRight];
 						t = (animation.timer - left) / (right - left);
 					}
 
@@ -2401,8 +3603,8 @@ namespace wiScene
 					default:
 					case AnimationComponent::AnimationChannel::Path::TRANSLATION:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * 3 * 3);
-						const XMFLOAT3* data = (const XMFLOAT3*)animationdata->keyframe_data.data();
+						assert(keyframe_data_size == keyframe_count * 3 * 3);
+						const XMFLOAT3* data = (const XMFLOAT3*)keyframe_data;
 						XMVECTOR vLeft = XMLoadFloat3(&data[keyLeft * 3 + 1]);
 						XMVECTOR vLeftTanOut = dt * XMLoadFloat3(&data[keyLeft * 3 + 2]);
 						XMVECTOR vRightTanIn = dt * XMLoadFloat3(&data[keyRight * 3 + 0]);
@@ -2413,8 +3615,8 @@ namespace wiScene
 					break;
 					case AnimationComponent::AnimationChannel::Path::ROTATION:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * 4 * 3);
-						const XMFLOAT4* data = (const XMFLOAT4*)animationdata->keyframe_data.data();
+						assert(keyframe_data_size == keyframe_count * 4 * 3);
+						const XMFLOAT4* data = (const XMFLOAT4*)keyframe_data;
 						XMVECTOR vLeft = XMLoadFloat4(&data[keyLeft * 3 + 1]);
 						XMVECTOR vLeftTanOut = dt * XMLoadFloat4(&data[keyLeft * 3 + 2]);
 						XMVECTOR vRightTanIn = dt * XMLoadFloat4(&data[keyRight * 3 + 0]);
@@ -2426,8 +3628,8 @@ namespace wiScene
 					break;
 					case AnimationComponent::AnimationChannel::Path::SCALE:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * 3 * 3);
-						const XMFLOAT3* data = (const XMFLOAT3*)animationdata->keyframe_data.data();
+						assert(keyframe_data_size == keyframe_count * 3 * 3);
+						const XMFLOAT3* data = (const XMFLOAT3*)keyframe_data;
 						XMVECTOR vLeft = XMLoadFloat3(&data[keyLeft * 3 + 1]);
 						XMVECTOR vLeftTanOut = dt * XMLoadFloat3(&data[keyLeft * 3 + 2]);
 						XMVECTOR vRightTanIn = dt * XMLoadFloat3(&data[keyRight * 3 + 0]);
@@ -2438,13 +3640,13 @@ namespace wiScene
 					break;
 					case AnimationComponent::AnimationChannel::Path::WEIGHTS:
 					{
-						assert(animationdata->keyframe_data.size() == animationdata->keyframe_times.size() * animation.morph_weights_temp.size() * 3);
+						assert(keyframe_data_size == keyframe_count * animation.morph_weights_temp.size() * 3);
 						for (size_t j = 0; j < animation.morph_weights_temp.size(); ++j)
 						{
-							float vLeft = animationdata->keyframe_data[(keyLeft * animation.morph_weights_temp.size() + j) * 3 + 1];
-							float vLeftTanOut = animationdata->keyframe_data[(keyLeft * animation.morph_weights_temp.size() + j) * 3 + 2];
-							float vRightTanIn = animationdata->keyframe_data[(keyLeft * animation.morph_weights_temp.size() + j) * 3 + 0];
-							float vRight = animationdata->keyframe_data[(keyLeft * animation.morph_weights_temp.size() + j) * 3 + 1];
+							float vLeft = keyframe_data[(keyLeft * animation.morph_weights_temp.size() + j) * 3 + 1];
+							float vLeftTanOut = keyframe_data[(keyLeft * animation.morph_weights_temp.size() + j) * 3 + 2];
+							float vRightTanIn = keyframe_data[(keyLeft * animation.morph_weights_temp.size() + j) * 3 + 0];
+							float vRight = keyframe_data[(keyLeft * animation.morph_weights_temp.size() + j) * 3 + 1];
 							float vAnim = (2 * t3 - 3 * t2 + 1) * vLeft + (t3 - 2 * t2 + t) * vLeftTanOut + (-2 * t3 + 3 * t2) * vRight + (t3 - t2) * vRightTanIn;
 							animation.morph_weights_temp[j] = vAnim;
 						}
@@ -2482,6 +3684,18 @@ namespace wiScene
 				{
 					const float t = animation.amount;
 
+					if (simulation_running)
+					{
+						// The mesh can be read by the renderer now (see BeginSimulation()), the weights are applied by the next Update():
+						AnimationComponent::DeferredMorphWeights& deferred = animation.morph_targets_deferred.emplace_back();
+						deferred.meshID = objects.GetComponent(channel.target)->meshID;
+						deferred.amount = t;
+						deferred.offset = (uint32_t)animation.morph_weights_deferred.size();
+						deferred.count = (uint32_t)animation.morph_weights_temp.size();
+						animation.morph_weights_deferred.insert(animation.morph_weights_deferred.end(), animation.morph_weights_temp.begin(), animation.morph_weights_temp.end());
+						continue;
+					}
+
 					for (size_t j = 0; j < target_mesh->targets.size(); ++j)
 					{
 						target_mesh->targets[j].weight = wiMath::Lerp(target_mesh->targets[j].weight, animation.morph_weights_temp[j], t);
@@ -2502,50 +3716,206 @@ namespace wiScene
 				animation.timer = animation.start;
 			}
 		}
+
+		});
 	}
 	void Scene::RunTransformUpdateSystem(wiJobSystem::context& ctx)
 	{
-		wiJobSystem::Dispatch(ctx, (uint32_t)transforms.GetCount(), small_subtask_groupsize, [&](wiJobArgs args) {
+		// The changes are tracked by transform index, so if the transforms were reordered, everything is treated as changed:
+		const uint32_t transform_count = (uint32_t)transforms.GetCount();
+		const bool all_changed = transforms_changed_version != transforms.GetVersion() || transforms_changed.size() != transform_count;
+		transforms_changed.resize(transform_count);
+		transforms_changed_version = transforms.GetVersion();
+
+		wiJobSystem::Dispatch(ctx, transform_count, small_subtask_groupsize, [this, all_changed](wiJobArgs args) {
 
 			TransformComponent& transform = transforms[args.jobIndex];
+			transforms_changed[args.jobIndex] = all_changed || transform.IsChanged() ? 1 : 0;
 			transform.UpdateTransform();
+			transform.SetChanged(false);
 		});
 	}
 	void Scene::RunHierarchyUpdateSystem(wiJobSystem::context& ctx)
 	{
-		// This needs serialized execution because there are dependencies enforced by component order!
+		// Parents must be updated before their children, hierarchy is topologically sorted by SortHierarchy() when its layout changed
+		//	Nodes are grouped by depth, each depth level only depends on the previous levels
+
+		bool rebuild =
+			hierarchy_update_versions[0] != hierarchy.GetVersion() ||
+			hierarchy_update_versions[1] != transforms.GetVersion() ||
+			hierarchy_update_versions[2] != layers.GetVersion();
+		for (size_t i = 0; i < hierarchy.GetCount() && !rebuild; ++i)
+		{
+			rebuild = hierarchy[i].parentID != hierarchy_update_parents[i];
+			if (rebuild)
+			{
+				// A parentID was written directly, not by Component_Attach():
+				hierarchy_sorted = false;
+				hierarchy_child_counts_version = ~0ull;
+			}
+		}
 
-		for (size_t i = 0; i < hierarchy.GetCount(); ++i)
+		if (transforms_changed.size() != transforms.GetCount())
 		{
-			const HierarchyComponent& parentcomponent = hierarchy[i];
-			Entity entity = hierarchy.GetEntity(i);
+			// The transform update system didn't run, so the changes are unknown:
+			transforms_changed.assign(transforms.GetCount(), 1);
+		}
+
+		if (rebuild)
+		{
+			SortHierarchy();
+			assert(IsHierarchySorted());
+
+			const size_t count = hierarchy.GetCount();
+			hierarchy_update_parents.resize(count);
+			hierarchy_update_sorted = true;
+
+			// Depth of a node is the depth of its parent + 1, roots are the ones whose parent is not in the hierarchy:
+			std::vector<uint32_t> depths(count);
+			uint32_t maxdepth = 0;
+			for (size_t i = 0; i < count; ++i)
+			{
+				const Entity parent = hierarchy[i].parentID;
+				hierarchy_update_parents[i] = parent;
+				const size_t parent_index = hierarchy.GetIndex(parent);
+				if (parent_index >= count)
+				{
+					depths[i] = 0;
+				}
+				else if (parent_index < i)
+				{
+					depths[i] = depths[parent_index] + 1;
+				}
+				else
+				{
+					// Only possible with a cycle in the hierarchy:
+					hierarchy_update_sorted = false;
+					depths[i] = 0;
+				}
+				maxdepth = std::max(maxdepth, depths[i]);
+			}
+
+			// Counting sort by depth, order within a level is kept:
+			hierarchy_update_levels.clear();
+			hierarchy_update_levels.resize(maxdepth + 2);
+			for (size_t i = 0; i < count; ++i)
+			{
+				hierarchy_update_levels[depths[i] + 1]++;
+			}
+			for (size_t i = 1; i < hierarchy_update_levels.size(); ++i)
+			{
+				hierarchy_update_levels[i] += hierarchy_update_levels[i - 1];
+			}
+			std::vector<uint32_t> offsets(hierarchy_update_levels.begin(), hierarchy_update_levels.end() - 1);
+
+			hierarchy_update_nodes.resize(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const Entity entity = hierarchy.GetEntity(i);
+				const Entity parent = hierarchy[i].parentID;
+				HierarchyUpdateNode& node = hierarchy_update_nodes[hierarchy_update_sorted ? offsets[depths[i]]++ : i];
+				node.transform_child = (uint32_t)transforms.GetIndex(entity);
+				node.transform_parent = (uint32_t)transforms.GetIndex(parent);
+				node.layer_child = (uint32_t)layers.GetIndex(entity);
+				node.layer_parent = (uint32_t)layers.GetIndex(parent);
+			}
 
-			TransformComponent* transform_child = transforms.GetComponent(entity);
-			TransformComponent* transform_parent = transforms.GetComponent(parentcomponent.parentID);
-			if (transform_child != nullptr && transform_parent != nullptr)
+			// Parents come before their children, so the root of the parent is already known:
+			hierarchy_update_roots.resize(count);
+			for (size_t i = 0; i < count; ++i)
 			{
-				transform_child->UpdateTransform_Parented(*transform_parent);
+				const Entity parent = hierarchy[i].parentID;
+				const size_t parent_index = hierarchy.GetIndex(parent);
+				hierarchy_update_roots[i] = parent_index < i ? hierarchy_update_roots[parent_index] : parent;
 			}
 
+			hierarchy_update_versions[0] = hierarchy.GetVersion();
+			hierarchy_update_versions[1] = transforms.GetVersion();
+			hierarchy_update_versions[2] = layers.GetVersion();
+			hierarchy_update_generation++;
+
+			// Parents could have changed, so everything will be recomputed:
+			std::fill(transforms_changed.begin(), transforms_changed.end(), uint8_t(1));
+		}
+
+		// Only the transforms that changed and the descendants of changed transforms are recomputed
+		//	The changed flag of a child is written after the parent's flag is final, because parents are in earlier levels:
+		auto update_node = [this](const HierarchyUpdateNode& node) {
+			if (node.transform_child != ~0u && node.transform_parent != ~0u &&
+				(transforms_changed[node.transform_child] || transforms_changed[node.transform_parent]))
+			{
+				TransformComponent& transform = transforms[node.transform_child];
+				transform.UpdateTransform_Parented(transforms[node.transform_parent]);
+				transform.SetChanged(false); // already recorded in transforms_changed
+				transforms_changed[node.transform_child] = 1;
+			}
+			if (node.layer_child != ~0u && node.layer_parent != ~0u)
+			{
+				layers[node.layer_child].propagationMask = layers[node.layer_parent].GetLayerMask();
+			}
+		};
 
-			LayerComponent* layer_child = layers.GetComponent(entity);
-			LayerComponent* layer_parent = layers.GetComponent(parentcomponent.parentID);
-			if (layer_child != nullptr && layer_parent != nullptr)
+		if (!hierarchy_update_sorted)
+		{
+			// Nodes are in original order here, so this is the same as the serial update
+			for (const HierarchyUpdateNode& node : hierarchy_update_nodes)
 			{
-				layer_child->propagationMask = layer_parent->GetLayerMask();
+				update_node(node);
 			}
+			return;
+		}
 
+		// Small levels (for example long chains of bones) are not worth dispatching, they are updated on this thread:
+		const uint32_t parallel_level_threshold = 256;
+
+		wiJobSystem::context level_ctx;
+		level_ctx.priority = ctx.priority;
+		for (size_t level = 0; level + 1 < hierarchy_update_levels.size(); ++level)
+		{
+			const uint32_t level_offset = hierarchy_update_levels[level];
+			const uint32_t level_count = hierarchy_update_levels[level + 1] - level_offset;
+			if (level_count < parallel_level_threshold)
+			{
+				for (uint32_t i = 0; i < level_count; ++i)
+				{
+					update_node(hierarchy_update_nodes[level_offset + i]);
+				}
+			}
+			else
+			{
+				wiJobSystem::Dispatch(level_ctx, level_count, wiJobSystem::GetParallelGroupSize(level_count), [&](wiJobArgs args) {
+					update_node(hierarchy_update_nodes[level_offset + args.jobIndex]);
+				});
+				wiJobSystem::Wait(level_ctx);
+			}
 		}
 	}
 	void Scene::RunSpringUpdateSystem(wiJobSystem::context& ctx)
 	{
-		static float time = 0;
-		time += dt;
+		spring_time += dt;
+
+		// Springs modify their parent transforms, so the ones under the same hierarchy root are updated in order on one thread:
+		const uint32_t spring_count = (uint32_t)springs.GetCount();
+		if (spring_update_groups.versions[0] != springs.GetVersion() || spring_update_groups.versions[1] != hierarchy_update_generation)
+		{
+			std::vector<Entity> keys(spring_count);
+			for (uint32_t i = 0; i < spring_count; ++i)
+			{
+				keys[i] = GetHierarchyRoot(springs.GetEntity(i));
+			}
+			spring_update_groups.Build(keys.data(), spring_count, 1, !hierarchy_update_sorted);
+			spring_update_groups.versions[0] = springs.GetVersion();
+			spring_update_groups.versions[1] = hierarchy_update_generation;
+		}
+
+		wiJobSystem::Dispatch(ctx, spring_update_groups.GetCount(), 1, [this](wiJobArgs args) {
+
 		const XMVECTOR windDir = XMLoadFloat3(&weather.windDirection);
 		const XMVECTOR gravity = XMVectorSet(0, -9.8f, 0, 0);
 
-		for (size_t i = 0; i < springs.GetCount(); ++i)
+		for (uint32_t item = spring_update_groups.offsets[args.jobIndex]; item < spring_update_groups.offsets[args.jobIndex + 1]; ++item)
 		{
+			const uint32_t i = spring_update_groups.items[item];
 			SpringComponent& spring = springs[i];
 			if (spring.IsDisabled())
 			{
@@ -2582,7 +3952,7 @@ namespace wiScene
 
 			if (spring.wind_affection > 0)
 			{
-				force += std::sin(time * weather.windSpeed + XMVectorGetX(XMVector3Dot(position_current, windDir))) * windDir * spring.wind_affection;
+				force += std::sin(spring_time * weather.windSpeed + XMVectorGetX(XMVector3Dot(position_current, windDir))) * windDir * spring.wind_affection;
 			}
 			if (spring.IsGravityEnabled())
 			{
@@ -2623,13 +3993,45 @@ namespace wiScene
 			velocity *= spring.damping;
 			XMStoreFloat3(&spring.velocity, velocity);
 			*((XMFLOAT3*)&transform->world._41) = spring.center_of_mass;
+
+			// The world matrices were modified without modifying the local transforms, so they must be recomputed in the next frame:
+			transform->SetDirty();
+			transforms_changed[transforms.GetIndex(entity)] = 1;
+			if (parent_transform != nullptr)
+			{
+				parent_transform->SetDirty();
+				transforms_changed[transforms.GetIndex(hier->parentID)] = 1;
+			}
 		}
+
+		});
 	}
 	void Scene::RunInverseKinematicsUpdateSystem(wiJobSystem::context& ctx)
 	{
-		bool recompute_hierarchy = false;
-		for (size_t i = 0; i < inverse_kinematics.GetCount(); ++i)
+		// IK modifies the transforms of the chain and reads the target, so the chains that share a hierarchy root with an other chain or target
+		//	are updated in order on one thread:
+		const uint32_t ik_count = (uint32_t)inverse_kinematics.GetCount();
+		if (inverse_kinematics_update_groups.versions[0] != inverse_kinematics.GetVersion() || inverse_kinematics_update_groups.versions[1] != hierarchy_update_generation)
+		{
+			std::vector<Entity> keys(ik_count * 2);
+			for (uint32_t i = 0; i < ik_count; ++i)
+			{
+				keys[i * 2 + 0] = GetHierarchyRoot(inverse_kinematics.GetEntity(i));
+				keys[i * 2 + 1] = GetHierarchyRoot(inverse_kinematics[i].target);
+			}
+			inverse_kinematics_update_groups.Build(keys.data(), ik_count, 2, !hierarchy_update_sorted);
+			inverse_kinematics_update_groups.versions[0] = inverse_kinematics.GetVersion();
+			inverse_kinematics_update_groups.versions[1] = hierarchy_update_generation;
+		}
+
+		std::atomic_bool recompute_hierarchy{ false };
+		wiJobSystem::context group_ctx;
+		group_ctx.priority = ctx.priority;
+		wiJobSystem::Dispatch(group_ctx, inverse_kinematics_update_groups.GetCount(), 1, [&](wiJobArgs args) {
+
+		for (uint32_t item = inverse_kinematics_update_groups.offsets[args.jobIndex]; item < inverse_kinematics_update_groups.offsets[args.jobIndex + 1]; ++item)
 		{
+			const uint32_t i = inverse_kinematics_update_groups.items[item];
 			const InverseKinematicsComponent& ik = inverse_kinematics[i];
 			if (ik.IsDisabled())
 			{
@@ -2652,7 +4054,7 @@ namespace wiScene
 				TransformComponent* child_transform = transform;
 				for (uint32_t chain = 0; chain < std::min(ik.chain_length, (uint32_t)arraysize(stack)); ++chain)
 				{
-					recompute_hierarchy = true; // any IK will trigger a full transform hierarchy recompute step at the end(**)
+					recompute_hierarchy.store(true, std::memory_order_relaxed); // any IK will trigger a full transform hierarchy recompute step at the end(**)
 
 					// stack stores all traversed chain links so far:
 					stack[chain] = child_transform;
@@ -2668,6 +4070,7 @@ namespace wiScene
 
 					// parent to world space:
 					parent_transform->ApplyTransform();
+					transforms_changed[transforms.GetIndex(parent_entity)] = 1;
 					// rotate parent:
 					parent_transform->Rotate(Q);
 					parent_transform->UpdateTransform();
@@ -2705,32 +4108,36 @@ namespace wiScene
 			}
 		}
 
-		if (recompute_hierarchy)
+		});
+		wiJobSystem::Wait(group_ctx);
+
+		if (recompute_hierarchy.load())
 		{
 			// (**)If there was IK, we need to recompute transform hierarchy. This is only necessary for transforms that have parent
 			//	transforms that are IK. Because the IK chain is computed from child to parent upwards, IK that have child would not update
 			//	its transform properly in some cases (such as if animation writes to that child)
-			for (size_t i = 0; i < hierarchy.GetCount(); ++i)
-			{
-				const HierarchyComponent& parentcomponent = hierarchy[i];
-				Entity entity = hierarchy.GetEntity(i);
-
-				TransformComponent* transform_child = transforms.GetComponent(entity);
-				TransformComponent* transform_parent = transforms.GetComponent(parentcomponent.parentID);
-				if (transform_child != nullptr && transform_parent != nullptr)
-				{
-					transform_child->UpdateTransform_Parented(*transform_parent);
-				}
-			}
+			//	The cached hierarchy update order is used, which is the same as a full serial hierarchy update
+			RunHierarchyUpdateSystem(ctx);
 		}
 	}
+	void Scene::GatherChangedTransforms(wiJobSystem::context& ctx)
+	{
+		const uint32_t transform_count = (uint32_t)transforms_changed.size();
+		changed_transforms.resize(transform_count);
+		wiJobSystem::context compact_ctx;
+		compact_ctx.priority = ctx.priority;
+		const uint32_t changed_count = wiJobSystem::ParallelCompact(compact_ctx, transform_count, changed_transforms.data(), [this](uint32_t index, uint32_t& output) {
+			output = index;
+			return transforms_changed[index] != 0;
+		});
+		changed_transforms.resize(changed_count);
+	}
 	void Scene::RunArmatureUpdateSystem(wiJobSystem::context& ctx)
 	{
-		wiJobSystem::Dispatch(ctx, (uint32_t)armatures.GetCount(), 1, [&](wiJobArgs args) {
+		view_armatures.Refresh();
+		wiJobSystem::Dispatch(ctx, (uint32_t)view_armatures.GetCount(), 1, [&](wiJobArgs args) {
 
-			ArmatureComponent& armature = armatures[args.jobIndex];
-			Entity entity = armatures.GetEntity(args.jobIndex);
-			const TransformComponent& transform = *transforms.GetComponent(entity);
+			auto [armature, transform] = view_armatures[args.jobIndex];
 
 			// The transform world matrices are in world space, but skinning needs them in armature-local space, 
 			//	so that the skin is reusable for instanced meshes.
@@ -2775,7 +4182,7 @@ namespace wiScene
 
 			armature.aabb = AABB(_min, _max);
 
-			if (!armature.boneBuffer.IsValid() || armature.boneBuffer.desc.Size != armature.boneData.size() * sizeof(ShaderTransform))
+			if (!IsHeadless() && (!armature.boneBuffer.IsValid() || armature.boneBuffer.desc.Size != armature.boneData.size() * sizeof(ShaderTransform)))
 			{
 				armature.CreateRenderData();
 			}
@@ -2787,9 +4194,9 @@ namespace wiScene
 
 			Entity entity = meshes.GetEntity(args.jobIndex);
 			MeshComponent& mesh = meshes[args.jobIndex];
-			GraphicsDevice* device = wiRenderer::GetDevice();
+			GraphicsDevice* device = IsHeadless() ? nullptr : wiRenderer::GetDevice();
 
-			if (!mesh.vertexBuffer_PRE.IsValid())
+			if (device != nullptr && !mesh.vertexBuffer_PRE.IsValid())
 			{
 				const SoftBodyPhysicsComponent* softbody = softbodies.GetComponent(entity);
 				if (softbody != nullptr && wiPhysicsEngine::IsSimulationEnabled())
@@ -2901,7 +4308,18 @@ namespace wiScene
 			    mesh.aabb = AABB(_min, _max);
 			}
 
-			mesh.WriteShaderMesh(meshArrayMapped + args.jobIndex);
+			if (mesh.dirty_morph)
+			{
+				// The renderer has its own flag, because the animation system can set dirty_morph while the previous frame is rendered (see BeginSimulation()):
+				mesh.dirty_morph = false;
+				mesh.dirty_morph_upload = true;
+				mesh.dirty_bvh = mesh.bvh.IsValid();
+			}
+
+			if (meshArrayMapped != nullptr)
+			{
+				mesh.WriteShaderMesh(meshArrayMapped + args.jobIndex);
+			}
 
 		});
 	}
@@ -2938,13 +4356,16 @@ namespace wiScene
 				material.SetDirty(false);
 			}
 
-			material.WriteShaderMaterial(materialArrayMapped + args.jobIndex);
+			if (materialArrayMapped != nullptr)
+			{
+				material.WriteShaderMaterial(materialArrayMapped + args.jobIndex);
+			}
 
 		});
 	}
 	void Scene::RunImpostorUpdateSystem(wiJobSystem::context& ctx)
 	{
-		if (impostors.GetCount() > 0 && !impostorArray.IsValid())
+		if (!IsHeadless() && impostors.GetCount() > 0 && !impostorArray.IsValid())
 		{
 			GraphicsDevice* device = wiRenderer::GetDevice();
 
@@ -3013,13 +4434,20 @@ namespace wiScene
 	{
 		assert(objects.GetCount() == aabb_objects.GetCount());
 
-		parallel_bounds.clear();
-		parallel_bounds.resize((size_t)wiJobSystem::DispatchGroupCount((uint32_t)objects.GetCount(), small_subtask_groupsize));
-		
+		if (object_update_cache_version != objects.GetVersion() || object_update_cache.size() != objects.GetCount())
+		{
+			object_update_cache.clear();
+			object_update_cache.resize(objects.GetCount());
+			object_update_cache_version = objects.GetVersion();
+		}
+		const bool transform_changes_valid = transforms_changed.size() == transforms.GetCount();
+		aabb_objects_soa.Resize((uint32_t)aabb_objects.GetCount());
+
 		wiJobSystem::Dispatch(ctx, (uint32_t)objects.GetCount(), small_subtask_groupsize, [&](wiJobArgs args) {
 
 			ObjectComponent& object = objects[args.jobIndex];
 			AABB& aabb = aabb_objects[args.jobIndex];
+			ObjectUpdateCache& cache = object_update_cache[args.jobIndex];
 
 			// Update occlusion culling status:
 			if (!wiRenderer::GetFreezeCullingCameraEnabled())
@@ -3041,6 +4469,7 @@ namespace wiScene
 			}
 			object.occlusionQueries[queryheap_idx] = -1; // invalidate query
 
+			const AABB aabb_prev = aabb;
 			aabb = AABB();
 			object.rendertypeMask = 0;
 			object.SetDynamic(false);
@@ -3061,15 +4490,36 @@ namespace wiScene
 
 				if (mesh != nullptr)
 				{
+					SoftBodyPhysicsComponent* softbody = softbodies.GetComponent(object.meshID);
+
+					// A static object is unchanged if its transform didn't change and its mesh bounds are the same as in the previous frame:
+					const bool unchanged =
+						transform_changes_valid &&
+						!transforms_changed[object.transform_index] &&
+						!mesh->IsSkinned() && !mesh->IsDynamic() && softbody == nullptr &&
+						cache.meshID == object.meshID &&
+						std::memcmp(&cache.mesh_aabb._min, &mesh->aabb._min, sizeof(XMFLOAT3)) == 0 &&
+						std::memcmp(&cache.mesh_aabb._max, &mesh->aabb._max, sizeof(XMFLOAT3)) == 0;
+					cache.unchanged_frames = unchanged ? std::min(cache.unchanged_frames + 1, 0xFFFFu) : 0;
+					cache.meshID = object.meshID;
+					cache.mesh_aabb = mesh->aabb;
+
 					XMMATRIX W = XMLoadFloat4x4(&transform.world);
-					aabb = mesh->aabb.transform(W);
+					if (unchanged)
+					{
+						aabb = aabb_prev;
+					}
+					else
+					{
+						aabb = mesh->aabb.transform(W);
 
-					// This is instance bounding box matrix:
-					XMFLOAT4X4 meshMatrix;
-					XMStoreFloat4x4(&meshMatrix, mesh->aabb.getAsBoxMatrix() * W);
+						// This is instance bounding box matrix:
+						XMFLOAT4X4 meshMatrix;
+						XMStoreFloat4x4(&meshMatrix, mesh->aabb.getAsBoxMatrix() * W);
 
-					// We need sometimes the center of the instance bounding box, not the transform position (which can be outside the bounding box)
-					object.center = *((XMFLOAT3*)&meshMatrix._41);
+						// We need sometimes the center of the instance bounding box, not the transform position (which can be outside the bounding box)
+						object.center = *((XMFLOAT3*)&meshMatrix._41);
+					}
 
 					if (mesh->IsSkinned() || mesh->IsDynamic())
 					{
@@ -3114,7 +4564,6 @@ namespace wiScene
 						locker.unlock();
 					}
 
-					SoftBodyPhysicsComponent* softbody = softbodies.GetComponent(object.meshID);
 					if (softbody != nullptr)
 					{
 						// this will be registered as soft body in the next physics update
@@ -3136,100 +4585,111 @@ namespace wiScene
 						object.prev_transform_index = -1;
 					}
 
-					// Create GPU instance data:
-					const XMFLOAT4X4& worldMatrix = object.transform_index >= 0 ? transforms[object.transform_index].world : IDENTITYMATRIX;
-					const XMFLOAT4X4& worldMatrixPrev = object.prev_transform_index >= 0 ? prev_transforms[object.prev_transform_index].world_prev : IDENTITYMATRIX;
-
-					XMMATRIX worldMatrixInverseTranspose = XMLoadFloat4x4(&worldMatrix);
-					worldMatrixInverseTranspose = XMMatrixInverse(nullptr, worldMatrixInverseTranspose);
-					worldMatrixInverseTranspose = XMMatrixTranspose(worldMatrixInverseTranspose);
-					XMFLOAT4X4 transformIT;
-					XMStoreFloat4x4(&transformIT, worldMatrixInverseTranspose);
-
-					GraphicsDevice* device = wiRenderer::GetDevice();
-					ShaderMeshInstance& inst = instanceArrayMapped[args.jobIndex];
-					inst.init();
-					inst.transform.Create(worldMatrix);
-					inst.transformInverseTranspose.Create(transformIT);
-					inst.transformPrev.Create(worldMatrixPrev);
-					if (object.lightmap.IsValid())
-					{
-						inst.lightmap = device->GetDescriptorIndex(&object.lightmap, SRV);
-					}
-					inst.uid = entity;
-					inst.color = wiMath::CompressColor(object.color);
-					inst.emissive = wiMath::CompressColor(object.emissiveColor);
-					inst.meshIndex = (uint)meshes.GetIndex(object.meshID);
-
-					if (TLAS_instancesMapped != nullptr)
+					// Create GPU instance data (not in headless mode):
+					GraphicsDevice* device = IsHeadless() ? nullptr : wiRenderer::GetDevice();
+					if (device != nullptr)
 					{
-						// TLAS instance data:
-						RaytracingAccelerationStructureDesc::TopLevel::Instance instance = {};
-						instance = {};
-						instance.transform = XMFLOAT3X4(
-							worldMatrix._11, worldMatrix._21, worldMatrix._31, worldMatrix._41,
-							worldMatrix._12, worldMatrix._22, worldMatrix._32, worldMatrix._42,
-							worldMatrix._13, worldMatrix._23, worldMatrix._33, worldMatrix._43
-						);
-						instance.InstanceID = args.jobIndex;
-						instance.InstanceMask = 1;
-						instance.bottomlevel = mesh->BLAS;
+						const XMFLOAT4X4& worldMatrix = object.transform_index >= 0 ? transforms[object.transform_index].world : IDENTITYMATRIX;
+						const XMFLOAT4X4& worldMatrixPrev = object.prev_transform_index >= 0 ? prev_transforms[object.prev_transform_index].world_prev : IDENTITYMATRIX;
 
-						if (mesh->IsDoubleSided() || mesh->_flags & MeshComponent::TLAS_FORCE_DOUBLE_SIDED)
+						ShaderMeshInstance& inst = instanceArrayMapped[args.jobIndex];
+						if (cache.unchanged_frames > device->GetBufferCount())
 						{
-							instance.Flags |= RaytracingAccelerationStructureDesc::TopLevel::Instance::FLAG_TRIANGLE_CULL_DISABLE;
+							// The object didn't change since every upload buffer was last written, so the matrices in this one are up to date:
+							inst.lightmap = -1;
 						}
-
-						if (XMVectorGetX(XMMatrixDeterminant(W)) > 0)
+						else
+						{
+							XMMATRIX worldMatrixInverseTranspose = XMLoadFloat4x4(&worldMatrix);
+							worldMatrixInverseTranspose = XMMatrixInverse(nullptr, worldMatrixInverseTranspose);
+							worldMatrixInverseTranspose = XMMatrixTranspose(worldMatrixInverseTranspose);
+							XMFLOAT4X4 transformIT;
+							XMStoreFloat4x4(&transformIT, worldMatrixInverseTranspose);
+
+							inst.init();
+							inst.transform.Create(worldMatrix);
+							inst.transformInverseTranspose.Create(transformIT);
+							inst.transformPrev.Create(worldMatrixPrev);
+						}
+						if (object.lightmap.IsValid())
 						{
-							// There is a mismatch between object space winding and BLAS winding:
-							//	https://docs.microsoft.com/en-us/windows/win32/api/d3d12/ne-d3d12-d3d12_raytracing_instance_flags
-							instance.Flags |= RaytracingAccelerationStructureDesc::TopLevel::Instance::FLAG_TRIANGLE_FRONT_COUNTERCLOCKWISE;
+							inst.lightmap = device->GetDescriptorIndex(&object.lightmap, SRV);
 						}
+						inst.uid = entity;
+						inst.color = wiMath::CompressColor(object.color);
+						inst.emissive = wiMath::CompressColor(object.emissiveColor);
+						inst.meshIndex = (uint)meshes.GetIndex(object.meshID);
 
-						void* dest = (void*)((size_t)TLAS_instancesMapped + (size_t)args.jobIndex * device->GetTopLevelAccelerationStructureInstanceSize());
-						device->WriteTopLevelAccelerationStructureInstance(&instance, dest);
-					}
+						if (TLAS_instancesMapped != nullptr)
+						{
+							// TLAS instance data:
+							RaytracingAccelerationStructureDesc::TopLevel::Instance instance = {};
+							instance = {};
+							instance.transform = XMFLOAT3X4(
+								worldMatrix._11, worldMatrix._21, worldMatrix._31, worldMatrix._41,
+								worldMatrix._12, worldMatrix._22, worldMatrix._32, worldMatrix._42,
+								worldMatrix._13, worldMatrix._23, worldMatrix._33, worldMatrix._43
+							);
+							instance.InstanceID = args.jobIndex;
+							instance.InstanceMask = 1;
+							instance.bottomlevel = mesh->BLAS;
+
+							if (mesh->IsDoubleSided() || mesh->_flags & MeshComponent::TLAS_FORCE_DOUBLE_SIDED)
+							{
+								instance.Flags |= RaytracingAccelerationStructureDesc::TopLevel::Instance::FLAG_TRIANGLE_CULL_DISABLE;
+							}
 
-					// lightmap things:
-					if (object.IsLightmapRenderRequested() && dt > 0)
-					{
-						if (!object.lightmap.IsValid())
+							if (XMVectorGetX(XMMatrixDeterminant(W)) > 0)
+							{
+								// There is a mismatch between object space winding and BLAS winding:
+								//	https://docs.microsoft.com/en-us/windows/win32/api/d3d12/ne-d3d12-d3d12_raytracing_instance_flags
+								instance.Flags |= RaytracingAccelerationStructureDesc::TopLevel::Instance::FLAG_TRIANGLE_FRONT_COUNTERCLOCKWISE;
+							}
+
+							void* dest = (void*)((size_t)TLAS_instancesMapped + (size_t)args.jobIndex * device->GetTopLevelAccelerationStructureInstanceSize());
+							device->WriteTopLevelAccelerationStructureInstance(&instance, dest);
+						}
+
+						// lightmap things:
+						if (object.IsLightmapRenderRequested() && dt > 0)
 						{
-							object.lightmapWidth = wiMath::GetNextPowerOfTwo(object.lightmapWidth + 1) / 2;
-							object.lightmapHeight = wiMath::GetNextPowerOfTwo(object.lightmapHeight + 1) / 2;
+							if (!object.lightmap.IsValid())
+							{
+								object.lightmapWidth = wiMath::GetNextPowerOfTwo(object.lightmapWidth + 1) / 2;
+								object.lightmapHeight = wiMath::GetNextPowerOfTwo(object.lightmapHeight + 1) / 2;
 
-							TextureDesc desc;
-							desc.Width = object.lightmapWidth;
-							desc.Height = object.lightmapHeight;
-							desc.BindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE;
-							// Note: we need the full precision format to achieve correct accumulative blending! 
-							//	But the final lightmap will be compressed into an optimal format when the rendering is finished
-							desc.Format = FORMAT_R32G32B32A32_FLOAT;
+								TextureDesc desc;
+								desc.Width = object.lightmapWidth;
+								desc.Height = object.lightmapHeight;
+								desc.BindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE;
+								// Note: we need the full precision format to achieve correct accumulative blending! 
+								//	But the final lightmap will be compressed into an optimal format when the rendering is finished
+								desc.Format = FORMAT_R32G32B32A32_FLOAT;
 
-							device->CreateTexture(&desc, nullptr, &object.lightmap);
-							device->SetName(&object.lightmap, "lightmap_renderable");
+								device->CreateTexture(&desc, nullptr, &object.lightmap);
+								device->SetName(&object.lightmap, "lightmap_renderable");
 
-							RenderPassDesc renderpassdesc;
+								RenderPassDesc renderpassdesc;
 
-							renderpassdesc.attachments.push_back(RenderPassAttachment::RenderTarget(&object.lightmap, RenderPassAttachment::LOADOP_CLEAR));
+								renderpassdesc.attachments.push_back(RenderPassAttachment::RenderTarget(&object.lightmap, RenderPassAttachment::LOADOP_CLEAR));
 
-							device->CreateRenderPass(&renderpassdesc, &object.renderpass_lightmap_clear);
+								device->CreateRenderPass(&renderpassdesc, &object.renderpass_lightmap_clear);
 
-							renderpassdesc.attachments.back().loadop = RenderPassAttachment::LOADOP_LOAD;
-							device->CreateRenderPass(&renderpassdesc, &object.renderpass_lightmap_accumulate);
+								renderpassdesc.attachments.back().loadop = RenderPassAttachment::LOADOP_LOAD;
+								device->CreateRenderPass(&renderpassdesc, &object.renderpass_lightmap_accumulate);
 
-							object.lightmapIterationCount = 0; // reset accumulation
+								object.lightmapIterationCount = 0; // reset accumulation
+							}
+							lightmap_refresh_needed.store(true);
 						}
-						lightmap_refresh_needed.store(true);
-					}
 
-					if (!object.lightmapTextureData.empty() && !object.lightmap.IsValid())
-					{
-						// Create a GPU-side per object lighmap if there is none yet, but the data exists already:
-						object.lightmap.desc.Format = FORMAT_R11G11B10_FLOAT;
-						wiTextureHelper::CreateTexture(object.lightmap, object.lightmapTextureData.data(), object.lightmapWidth, object.lightmapHeight, object.lightmap.desc.Format);
-						device->SetName(&object.lightmap, "lightmap");
+						if (!object.lightmapTextureData.empty() && !object.lightmap.IsValid())
+						{
+							// Create a GPU-side per object lighmap if there is none yet, but the data exists already:
+							object.lightmap.desc.Format = FORMAT_R11G11B10_FLOAT;
+							wiTextureHelper::CreateTexture(object.lightmap, object.lightmapTextureData.data(), object.lightmapWidth, object.lightmapHeight, object.lightmap.desc.Format);
+							device->SetName(&object.lightmap, "lightmap");
+						}
 					}
 				}
 
@@ -3242,24 +4702,107 @@ namespace wiScene
 				{
 					aabb.layerMask = layer->GetLayerMask();
 				}
+			}
 
-				// parallel bounds computation using shared memory:
-				AABB* shared_bounds = (AABB*)args.sharedmemory;
-				if (args.isFirstJobInGroup)
-				{
-					*shared_bounds = aabb_objects[args.jobIndex];
-				}
-				else
+			aabb_objects_soa.Set(args.jobIndex, aabb);
+		});
+	}
+	void Scene::RunObjectBVHUpdateSystem(wiJobSystem::context& ctx)
+	{
+		const uint32_t object_count = (uint32_t)aabb_objects.GetCount();
+		if (object_count == 0)
+		{
+			object_bvh.Clear();
+			object_bvh_version = aabb_objects.GetVersion();
+			return;
+		}
+
+		// Objects were added, removed or reordered, or the tree became too loose from refitting:
+		if (object_bvh_version != aabb_objects.GetVersion() ||
+			object_bvh.GetPrimitiveCount() != object_count ||
+			object_bvh.cost > object_bvh.build_cost * object_bvh_rebuild_threshold)
+		{
+			object_bvh.Build(ctx, &aabb_objects[0], object_count);
+			object_bvh_version = aabb_objects.GetVersion();
+			return;
+		}
+
+		if (object_update_cache.size() != object_count)
+		{
+			object_bvh.Refit(&aabb_objects[0]);
+			return;
+		}
+
+		// The object update system kept the bounds of unchanged objects, only the others need to be refitted:
+		object_bvh_changed.resize(object_count);
+		const uint32_t changed_count = wiJobSystem::ParallelCompact(ctx, object_count, object_bvh_changed.data(), [&](uint32_t i, uint32_t& changed) {
+			changed = i;
+			return object_update_cache[i].unchanged_frames == 0;
+		});
+
+		// Walking up from the changed leaves is only faster than refitting every node if a small part of the objects changed:
+		if (changed_count > object_count / 8)
+		{
+			object_bvh.Refit(&aabb_objects[0]);
+		}
+		else
+		{
+			object_bvh.Refit(&aabb_objects[0], object_bvh_changed.data(), changed_count);
+		}
+	}
+	void Scene::RequestMeshBVH(Entity meshID, const MeshComponent& mesh) const
+	{
+		mesh_bvh_request_locker.lock();
+		if (!mesh.bvh_requested)
+		{
+			mesh.bvh_requested = true;
+			mesh_bvh_requests.push_back(meshID);
+		}
+		mesh_bvh_request_locker.unlock();
+	}
+	void Scene::RunMeshBVHUpdateSystem(wiJobSystem::context& ctx)
+	{
+		// Build the BVHs that the scene queries requested since the last update, each build is parallel in itself:
+		for (Entity entity : mesh_bvh_requests)
+		{
+			MeshComponent* mesh = meshes.GetComponent(entity);
+			if (mesh != nullptr)
+			{
+				mesh->bvh_requested = false;
+				if (mesh->bvh.GetPrimitiveCount() != mesh->indices.size() / 3 || !mesh->bvh.IsValid())
 				{
-					*shared_bounds = AABB::Merge(*shared_bounds, aabb_objects[args.jobIndex]);
+					mesh->BuildBVH(softbodies.GetComponent(entity));
 				}
-				if (args.isLastJobInGroup)
+			}
+		}
+		mesh_bvh_requests.clear();
+
+		// Refit the BVHs whose vertex positions changed, soft bodies are refitted every frame after the physics simulation:
+		wiJobSystem::Dispatch(ctx, (uint32_t)meshes.GetCount(), small_subtask_groupsize, [&](wiJobArgs args) {
+
+			MeshComponent& mesh = meshes[args.jobIndex];
+			if (!mesh.bvh.IsValid())
+				return;
+			if (mesh.bvh.GetPrimitiveCount() != mesh.indices.size() / 3)
+			{
+				// The triangles were changed, the queries will request a new one:
+				mesh.bvh.Clear();
+				return;
+			}
+
+			Entity entity = meshes.GetEntity(args.jobIndex);
+			const SoftBodyPhysicsComponent* softbody = softbodies.GetComponent(entity);
+			if (mesh.dirty_bvh || softbody != nullptr)
+			{
+				mesh.RefitBVH(softbody);
+
+				// Large deformations can make the refitted tree much slower to traverse:
+				if (mesh.bvh.cost > mesh.bvh.build_cost * object_bvh_rebuild_threshold)
 				{
-					parallel_bounds[args.groupID] = *shared_bounds;
+					mesh.BuildBVH(softbody);
 				}
 			}
-
-		}, sizeof(AABB));
+		});
 	}
 	void Scene::RunCameraUpdateSystem(wiJobSystem::context& ctx)
 	{
@@ -3278,6 +4821,7 @@ namespace wiScene
 	void Scene::RunDecalUpdateSystem(wiJobSystem::context& ctx)
 	{
 		assert(decals.GetCount() == aabb_decals.GetCount());
+		aabb_decals_soa.Resize((uint32_t)aabb_decals.GetCount());
 
 		for (size_t i = 0; i < decals.GetCount(); ++i)
 		{
@@ -3311,6 +4855,7 @@ namespace wiScene
 			{
 				aabb.layerMask = layer->GetLayerMask();
 			}
+			aabb_decals_soa.Set((uint32_t)i, aabb);
 
 			const MaterialComponent& material = *materials.GetComponent(entity);
 			decal.color = material.baseColor;
@@ -3322,8 +4867,9 @@ namespace wiScene
 	void Scene::RunProbeUpdateSystem(wiJobSystem::context& ctx)
 	{
 		assert(probes.GetCount() == aabb_probes.GetCount());
+		aabb_probes_soa.Resize((uint32_t)aabb_probes.GetCount());
 
-		if (!envmapArray.IsValid()) // even when zero probes, this will be created, since sometimes only the sky will be rendered into it
+		if (!IsHeadless() && !envmapArray.IsValid()) // even when zero probes, this will be created, since sometimes only the sky will be rendered into it
 		{
 			GraphicsDevice* device = wiRenderer::GetDevice();
 
@@ -3443,6 +4989,7 @@ namespace wiScene
 			{
 				aabb.layerMask = layer->GetLayerMask();
 			}
+			aabb_probes_soa.Set((uint32_t)probeIndex, aabb);
 
 			if (probe.IsDirty() || probe.IsRealTime())
 			{
@@ -3488,6 +5035,7 @@ namespace wiScene
 	void Scene::RunLightUpdateSystem(wiJobSystem::context& ctx)
 	{
 		assert(lights.GetCount() == aabb_lights.GetCount());
+		aabb_lights_soa.Resize((uint32_t)aabb_lights.GetCount());
 
 		wiJobSystem::Dispatch(ctx, (uint32_t)lights.GetCount(), small_subtask_groupsize, [&](wiJobArgs args) {
 
@@ -3542,10 +5090,17 @@ namespace wiScene
 				break;
 			}
 
+			aabb_lights_soa.Set(args.jobIndex, aabb);
 		});
 	}
 	void Scene::RunParticleUpdateSystem(wiJobSystem::context& ctx)
 	{
+		if (IsHeadless())
+		{
+			// Particles are simulated and drawn on the GPU, they are not needed without rendering
+			return;
+		}
+
 		wiJobSystem::Dispatch(ctx, (uint32_t)emitters.GetCount(), small_subtask_groupsize, [&](wiJobArgs args) {
 
 			wiEmittedParticle& emitter = emitters[args.jobIndex];
@@ -3632,7 +5187,7 @@ namespace wiScene
 			weather = weathers[0];
 			weather.most_important_light_index = ~0;
 
-			if (weather.IsOceanEnabled() && !ocean.IsValid())
+			if (weather.IsOceanEnabled() && !ocean.IsValid() && !IsHeadless())
 			{
 				OceanRegenerate();
 			}
@@ -3640,6 +5195,11 @@ namespace wiScene
 	}
 	void Scene::RunSoundUpdateSystem(wiJobSystem::context& ctx)
 	{
+		if (IsHeadless())
+		{
+			return;
+		}
+
 		const CameraComponent& camera = GetCamera();
 		wiAudio::SoundInstance3D instance3D;
 		instance3D.listenerPos = camera.Eye;
@@ -3787,7 +5347,7 @@ namespace wiScene
 			{
 				// In this case, we don't care about the root anymore, so delete it. This will simplify overall hierarchy
 				scene.Component_DetachChildren(root);
-				scene.Entity_Remove(root);
+				scene.Entity_Remove(root, true);
 				root = INVALID_ENTITY;
 			}
 
@@ -3797,6 +5357,142 @@ namespace wiScene
 		return INVALID_ENTITY;
 	}
 
+	// The mesh BVH can be used by the scene queries if it was built for the current triangles, otherwise it is requested for the next update:
+	//	A dirty BVH is not used, because the triangles moved since it was built or refitted, the next update refits it
+	static inline bool IsMeshBVHUpToDate(const Scene& scene, Entity meshID, const MeshComponent& mesh)
+	{
+		if (mesh.bvh.IsValid() && !mesh.dirty_bvh && mesh.bvh.GetPrimitiveCount() == mesh.indices.size() / 3)
+		{
+			return true;
+		}
+		scene.RequestMeshBVH(meshID, mesh);
+		return false;
+	}
+
+	// Construct a matrix that will orient to position (P) according to surface normal (N):
+	static inline void ComputePickOrientation(const RAY& ray, PickResult& result)
+	{
+		XMVECTOR N = XMLoadFloat3(&result.normal);
+		XMVECTOR P = XMLoadFloat3(&result.position);
+		XMVECTOR E = XMLoadFloat3(&ray.origin);
+		XMVECTOR T = XMVector3Normalize(XMVector3Cross(N, P - E));
+		XMVECTOR B = XMVector3Normalize(XMVector3Cross(T, N));
+		XMMATRIX M = { T, N, B, P };
+		XMStoreFloat4x4(&result.orientation, M);
+	}
+
+	// Finds the hit of the ray with the triangles of an object, the result is only changed if it's closer than result.distance
+	//	rayDirection must be normalized
+	static void PickObject(const Scene& scene, uint32_t objectIndex, FXMVECTOR rayOrigin, FXMVECTOR rayDirection, PickResult& result)
+	{
+		const ObjectComponent& object = scene.objects[objectIndex];
+		Entity entity = scene.aabb_objects.GetEntity(objectIndex);
+		const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
+		const SoftBodyPhysicsComponent* softbody = scene.softbodies.GetComponent(object.meshID);
+		const bool softbody_active = softbody != nullptr && !softbody->vertex_positions_simulation.empty();
+
+		const XMMATRIX objectMat = object.transform_index >= 0 ? XMLoadFloat4x4(&scene.transforms[object.transform_index].world) : XMMatrixIdentity();
+		const XMMATRIX objectMat_Inverse = XMMatrixInverse(nullptr, objectMat);
+
+		const XMVECTOR rayOrigin_local = XMVector3Transform(rayOrigin, objectMat_Inverse);
+		const XMVECTOR rayDirection_local = XMVector3Normalize(XMVector3TransformNormal(rayDirection, objectMat_Inverse));
+
+		const ArmatureComponent* armature = mesh.IsSkinned() ? scene.armatures.GetComponent(mesh.armatureID) : nullptr;
+
+		// Tests the triangle at mesh.indices[first], the subset index is looked up for a closer hit if it's not given:
+		auto pick_triangle = [&](uint32_t first, int subsetIndex) {
+			const uint32_t i0 = mesh.indices[first + 0];
+			const uint32_t i1 = mesh.indices[first + 1];
+			const uint32_t i2 = mesh.indices[first + 2];
+
+			XMVECTOR p0;
+			XMVECTOR p1;
+			XMVECTOR p2;
+
+			if (softbody_active)
+			{
+				p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
+				p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
+				p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
+			}
+			else
+			{
+				if (armature == nullptr)
+				{
+					if (mesh.vertex_positions_morphed.empty())
+				    {
+						p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
+						p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
+						p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
+					}
+					else
+					{
+					    p0 = mesh.vertex_positions_morphed[i0].LoadPOS();
+					    p1 = mesh.vertex_positions_morphed[i1].LoadPOS();
+					    p2 = mesh.vertex_positions_morphed[i2].LoadPOS();
+					}
+				}
+				else
+				{
+					p0 = SkinVertex(mesh, *armature, i0);
+					p1 = SkinVertex(mesh, *armature, i1);
+					p2 = SkinVertex(mesh, *armature, i2);
+				}
+			}
+
+			float distance;
+			XMFLOAT2 bary;
+			if (wiMath::RayTriangleIntersects(rayOrigin_local, rayDirection_local, p0, p1, p2, distance, bary))
+			{
+				const XMVECTOR pos = XMVector3Transform(XMVectorAdd(rayOrigin_local, rayDirection_local*distance), objectMat);
+				distance = wiMath::Distance(pos, rayOrigin);
+				if (distance < result.distance && subsetIndex < 0)
+				{
+					subsetIndex = mesh.GetSubsetIndex(first);
+				}
+
+				if (distance < result.distance && subsetIndex >= 0)
+				{
+					const XMVECTOR nor = XMVector3Normalize(XMVector3TransformNormal(XMVector3Cross(XMVectorSubtract(p2, p1), XMVectorSubtract(p1, p0)), objectMat));
+
+					result.entity = entity;
+					XMStoreFloat3(&result.position, pos);
+					XMStoreFloat3(&result.normal, nor);
+					result.distance = distance;
+					result.subsetIndex = subsetIndex;
+					result.vertexID0 = (int)i0;
+					result.vertexID1 = (int)i1;
+					result.vertexID2 = (int)i2;
+					result.bary = bary;
+				}
+			}
+		};
+
+		if (armature == nullptr && IsMeshBVHUpToDate(scene, object.meshID, mesh))
+		{
+			// The ray parameter in local space is converted to world space distance with the length of the transformed local direction:
+			const float local_to_world = XMVectorGetX(XMVector3Length(XMVector3TransformNormal(rayDirection_local, objectMat)));
+			XMFLOAT3 origin_local, direction_local;
+			XMStoreFloat3(&origin_local, rayOrigin_local);
+			XMStoreFloat3(&direction_local, rayDirection_local);
+			mesh.bvh.IntersectRay(RAY(origin_local, direction_local), [&](uint32_t triangle) {
+				pick_triangle(triangle * 3, -1);
+				return result.distance / local_to_world;
+			});
+		}
+		else
+		{
+			for (size_t subsetIndex = 0; subsetIndex < mesh.subsets.size(); ++subsetIndex)
+			{
+				const MeshComponent::MeshSubset& subset = mesh.subsets[subsetIndex];
+				for (uint32_t i = 0; i < subset.indexCount; i += 3)
+				{
+					pick_triangle(subset.indexOffset + i, (int)subsetIndex);
+				}
+			}
+		}
+	}
+
 	PickResult Pick(const RAY& ray, uint32_t renderTypeMask, uint32_t layerMask, const Scene& scene)
 	{
 		PickResult result;
@@ -3806,126 +5502,417 @@ namespace wiScene
 			const XMVECTOR rayOrigin = XMLoadFloat3(&ray.origin);
 			const XMVECTOR rayDirection = XMVector3Normalize(XMLoadFloat3(&ray.direction));
 
-			for (size_t i = 0; i < scene.aabb_objects.GetCount(); ++i)
-			{
+			// Returns the closest hit distance so far, the BVH traversal skips the objects that are farther:
+			auto pick_object = [&](uint32_t i) {
 				const AABB& aabb = scene.aabb_objects[i];
 				if (!ray.intersects(aabb))
 				{
-					continue;
+					return result.distance;
 				}
 
 				const ObjectComponent& object = scene.objects[i];
 				if (object.meshID == INVALID_ENTITY)
 				{
-					continue;
+					return result.distance;
 				}
 				if (!(renderTypeMask & object.GetRenderTypes()))
 				{
-					continue;
+					return result.distance;
 				}
 
 				Entity entity = scene.aabb_objects.GetEntity(i);
 				const LayerComponent* layer = scene.layers.GetComponent(entity);
 				if (layer != nullptr && !(layer->GetLayerMask() & layerMask))
 				{
-					continue;
+					return result.distance;
 				}
 
-				const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
-				const SoftBodyPhysicsComponent* softbody = scene.softbodies.GetComponent(object.meshID);
-				const bool softbody_active = softbody != nullptr && !softbody->vertex_positions_simulation.empty();
+				PickObject(scene, i, rayOrigin, rayDirection, result);
+				return result.distance;
+			};
 
-				const XMMATRIX objectMat = object.transform_index >= 0 ? XMLoadFloat4x4(&scene.transforms[object.transform_index].world) : XMMatrixIdentity();
-				const XMMATRIX objectMat_Inverse = XMMatrixInverse(nullptr, objectMat);
+			if (scene.IsObjectBVHUpToDate())
+			{
+				// The BVH is traversed with the normalized direction, so that the ray parameter is the same as the hit distance:
+				scene.object_bvh.IntersectRay(RAY(rayOrigin, rayDirection), pick_object);
+			}
+			else
+			{
+				for (uint32_t i = 0; i < (uint32_t)scene.aabb_objects.GetCount(); ++i)
+				{
+					pick_object(i);
+				}
+			}
+		}
 
-				const XMVECTOR rayOrigin_local = XMVector3Transform(rayOrigin, objectMat_Inverse);
-				const XMVECTOR rayDirection_local = XMVector3Normalize(XMVector3TransformNormal(rayDirection, objectMat_Inverse));
+		ComputePickOrientation(ray, result);
 
-				const ArmatureComponent* armature = mesh.IsSkinned() ? scene.armatures.GetComponent(mesh.armatureID) : nullptr;
+		return result;
+	}
 
-				int subsetCounter = 0;
-				for (auto& subset : mesh.subsets)
+	// Returns the lanes of a vector comparison result as bits:
+	static inline uint32_t XM_CALLCONV GetLaneMask(FXMVECTOR comparison)
+	{
+		uint32_t lanes[4];
+		XMStoreInt4(lanes, comparison);
+		return (lanes[0] & 1) | ((lanes[1] & 1) << 1) | ((lanes[2] & 1) << 2) | ((lanes[3] & 1) << 3);
+	}
+
+	// The same test as wiMath::RayTriangleIntersects(), but for the 4 rays of a packet with one triangle
+	//	Returns the ray parameters of the hits, FLT_MAX for the lanes that miss, and the barycentrics of the hits in u and v
+	static inline XMVECTOR XM_CALLCONV RayPacketTriangleIntersects(const wiBVH::RayPacket& packet, FXMVECTOR p0, FXMVECTOR p1, FXMVECTOR p2, XMVECTOR& u_out, XMVECTOR& v_out)
+	{
+		const XMVECTOR e1 = XMVectorSubtract(p1, p0);
+		const XMVECTOR e2 = XMVectorSubtract(p2, p0);
+		const XMVECTOR e1x = XMVectorSplatX(e1);
+		const XMVECTOR e1y = XMVectorSplatY(e1);
+		const XMVECTOR e1z = XMVectorSplatZ(e1);
+		const XMVECTOR e2x = XMVectorSplatX(e2);
+		const XMVECTOR e2y = XMVectorSplatY(e2);
+		const XMVECTOR e2z = XMVectorSplatZ(e2);
+		const XMVECTOR* D = packet.direction;
+
+		// p = Direction ^ e2;
+		const XMVECTOR px = XMVectorSubtract(XMVectorMultiply(D[1], e2z), XMVectorMultiply(D[2], e2y));
+		const XMVECTOR py = XMVectorSubtract(XMVectorMultiply(D[2], e2x), XMVectorMultiply(D[0], e2z));
+		const XMVECTOR pz = XMVectorSubtract(XMVectorMultiply(D[0], e2y), XMVectorMultiply(D[1], e2x));
+
+		// det = e1 * p;
+		const XMVECTOR det = XMVectorAdd(XMVectorAdd(XMVectorMultiply(e1x, px), XMVectorMultiply(e1y, py)), XMVectorMultiply(e1z, pz));
+
+		// s = Origin - V0;
+		const XMVECTOR sx = XMVectorSubtract(packet.origin[0], XMVectorSplatX(p0));
+		const XMVECTOR sy = XMVectorSubtract(packet.origin[1], XMVectorSplatY(p0));
+		const XMVECTOR sz = XMVectorSubtract(packet.origin[2], XMVectorSplatZ(p0));
+
+		// u = s * p;
+		const XMVECTOR u = XMVectorAdd(XMVectorAdd(XMVectorMultiply(sx, px), XMVectorMultiply(sy, py)), XMVectorMultiply(sz, pz));
+
+		// q = s ^ e1;
+		const XMVECTOR qx = XMVectorSubtract(XMVectorMultiply(sy, e1z), XMVectorMultiply(sz, e1y));
+		const XMVECTOR qy = XMVectorSubtract(XMVectorMultiply(sz, e1x), XMVectorMultiply(sx, e1z));
+		const XMVECTOR qz = XMVectorSubtract(XMVectorMultiply(sx, e1y), XMVectorMultiply(sy, e1x));
+
+		// v = Direction * q;
+		const XMVECTOR v = XMVectorAdd(XMVectorAdd(XMVectorMultiply(D[0], qx), XMVectorMultiply(D[1], qy)), XMVectorMultiply(D[2], qz));
+
+		// t = e2 * q;
+		const XMVECTOR t = XMVectorAdd(XMVectorAdd(XMVectorMultiply(e2x, qx), XMVectorMultiply(e2y, qy)), XMVectorMultiply(e2z, qz));
+
+		const XMVECTOR zero = XMVectorZero();
+		const XMVECTOR uv = XMVectorAdd(u, v);
+
+		// Determinant is positive (front side of the triangle):
+		XMVECTOR front = XMVectorGreaterOrEqual(det, XMVectorReplicate(1e-20f));
+		front = XMVectorAndInt(front, XMVectorAndInt(XMVectorGreaterOrEqual(u, zero), XMVectorLessOrEqual(u, det)));
+		front = XMVectorAndInt(front, XMVectorAndInt(XMVectorGreaterOrEqual(v, zero), XMVectorLessOrEqual(uv, det)));
+		front = XMVectorAndInt(front, XMVectorGreaterOrEqual(t, zero));
+
+		// Determinant is negative (back side of the triangle):
+		XMVECTOR back = XMVectorLessOrEqual(det, XMVectorReplicate(-1e-20f));
+		back = XMVectorAndInt(back, XMVectorAndInt(XMVectorLessOrEqual(u, zero), XMVectorGreaterOrEqual(u, det)));
+		back = XMVectorAndInt(back, XMVectorAndInt(XMVectorLessOrEqual(v, zero), XMVectorGreaterOrEqual(uv, det)));
+		back = XMVectorAndInt(back, XMVectorLessOrEqual(t, zero));
+
+		const XMVECTOR invdet = XMVectorReciprocal(det);
+		u_out = XMVectorMultiply(u, invdet);
+		v_out = XMVectorMultiply(v, invdet);
+		return XMVectorSelect(XMVectorReplicate(FLT_MAX), XMVectorDivide(t, det), XMVectorOrInt(front, back));
+	}
+
+	// 4 rays of PickBatch() or PickBatchOcclusion() that are traced together
+	struct PickPacket
+	{
+		wiBVH::RayPacket packet; // world space, tmax is the closest hit distance of each lane so far
+		XMFLOAT3 origin[4];
+		XMFLOAT3 direction[4]; // normalized
+		PickResult* results[4]; // nullptr for occlusion tests, those lanes are deactivated by their first hit
+	};
+
+	// Tests the rays of the packet with an object, like the object and triangle tests of Pick()
+	static void PickObjectPacket(const Scene& scene, uint32_t objectIndex, uint32_t renderTypeMask, uint32_t layerMask, PickPacket& p)
+	{
+		const AABB& aabb = scene.aabb_objects[objectIndex];
+		const XMVECTOR miss = XMVectorReplicate(FLT_MAX);
+		const XMVECTOR aabb_hit = XMVectorLess(wiBVH::IntersectRayPacket(p.packet, aabb._min, aabb._max), miss);
+		const uint32_t lanes = GetLaneMask(aabb_hit);
+		if (lanes == 0)
+			return;
+
+		const ObjectComponent& object = scene.objects[objectIndex];
+		if (object.meshID == INVALID_ENTITY)
+			return;
+		if (!(renderTypeMask & object.GetRenderTypes()))
+			return;
+
+		// The current layer is used like in Pick(), not the one stored in the bounds by the last object update:
+		const LayerComponent* layer = scene.layers.GetComponent(scene.aabb_objects.GetEntity(objectIndex));
+		if (layer != nullptr && !(layer->GetLayerMask() & layerMask))
+			return;
+
+		const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
+		const ArmatureComponent* armature = mesh.IsSkinned() ? scene.armatures.GetComponent(mesh.armatureID) : nullptr;
+		if (armature != nullptr || !IsMeshBVHUpToDate(scene, object.meshID, mesh))
+		{
+			// Skinned meshes and meshes without BVH are tested one ray at a time:
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				if (!(lanes & (1u << lane)))
+					continue;
+				const XMVECTOR origin = XMLoadFloat3(&p.origin[lane]);
+				const XMVECTOR direction = XMLoadFloat3(&p.direction[lane]);
+				if (p.results[lane] != nullptr)
 				{
-					for (size_t i = 0; i < subset.indexCount; i += 3)
+					PickObject(scene, objectIndex, origin, direction, *p.results[lane]);
+					p.packet.tmax = XMVectorSetByIndex(p.packet.tmax, p.results[lane]->distance, lane);
+				}
+				else
+				{
+					PickResult result;
+					result.distance = XMVectorGetByIndex(p.packet.tmax, lane);
+					PickObject(scene, objectIndex, origin, direction, result);
+					if (result.entity != INVALID_ENTITY)
 					{
-						const uint32_t i0 = mesh.indices[subset.indexOffset + i + 0];
-						const uint32_t i1 = mesh.indices[subset.indexOffset + i + 1];
-						const uint32_t i2 = mesh.indices[subset.indexOffset + i + 2];
+						p.packet.tmax = XMVectorSetByIndex(p.packet.tmax, -1, lane);
+					}
+				}
+			}
+			return;
+		}
 
-						XMVECTOR p0;
-						XMVECTOR p1;
-						XMVECTOR p2;
+		const SoftBodyPhysicsComponent* softbody = scene.softbodies.GetComponent(object.meshID);
+		const bool softbody_active = softbody != nullptr && !softbody->vertex_positions_simulation.empty();
+		const Entity entity = scene.aabb_objects.GetEntity(objectIndex);
 
-						if (softbody_active)
-						{
-							p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
-							p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
-							p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
-						}
-						else
-						{
-							if (armature == nullptr)
-							{
-								if (mesh.vertex_positions_morphed.empty())
-							    {
-									p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
-									p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
-									p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
-								}
-								else
-								{
-								    p0 = mesh.vertex_positions_morphed[i0].LoadPOS();
-								    p1 = mesh.vertex_positions_morphed[i1].LoadPOS();
-								    p2 = mesh.vertex_positions_morphed[i2].LoadPOS();
-								}
-							}
-							else
-							{
-								p0 = SkinVertex(mesh, *armature, i0);
-								p1 = SkinVertex(mesh, *armature, i1);
-								p2 = SkinVertex(mesh, *armature, i2);
-							}
-						}
+		const XMMATRIX objectMat = object.transform_index >= 0 ? XMLoadFloat4x4(&scene.transforms[object.transform_index].world) : XMMatrixIdentity();
+		XMFLOAT4X4 m;
+		XMStoreFloat4x4(&m, XMMatrixInverse(nullptr, objectMat));
 
-						float distance;
-						XMFLOAT2 bary;
-						if (wiMath::RayTriangleIntersects(rayOrigin_local, rayDirection_local, p0, p1, p2, distance, bary))
-						{
-							const XMVECTOR pos = XMVector3Transform(XMVectorAdd(rayOrigin_local, rayDirection_local*distance), objectMat);
-							distance = wiMath::Distance(pos, rayOrigin);
+		// The packet is transformed into the mesh's local space, and the directions are normalized there, like in Pick()
+		//	The local ray parameter is the world space distance multiplied by the length of the transformed direction
+		wiBVH::RayPacket local;
+		for (int c = 0; c < 3; ++c)
+		{
+			local.origin[c] = XMVectorAdd(XMVectorAdd(XMVectorMultiply(p.packet.origin[0], XMVectorReplicate(m.m[0][c])), XMVectorMultiply(p.packet.origin[1], XMVectorReplicate(m.m[1][c]))),
+				XMVectorAdd(XMVectorMultiply(p.packet.origin[2], XMVectorReplicate(m.m[2][c])), XMVectorReplicate(m.m[3][c])));
+			local.direction[c] = XMVectorAdd(XMVectorAdd(XMVectorMultiply(p.packet.direction[0], XMVectorReplicate(m.m[0][c])), XMVectorMultiply(p.packet.direction[1], XMVectorReplicate(m.m[1][c]))),
+				XMVectorMultiply(p.packet.direction[2], XMVectorReplicate(m.m[2][c])));
+		}
+		const XMVECTOR length = XMVectorSqrt(XMVectorAdd(XMVectorAdd(XMVectorMultiply(local.direction[0], local.direction[0]), XMVectorMultiply(local.direction[1], local.direction[1])),
+			XMVectorMultiply(local.direction[2], local.direction[2])));
+		for (int c = 0; c < 3; ++c)
+		{
+			local.direction[c] = XMVectorDivide(local.direction[c], length);
+			local.direction_inverse[c] = XMVectorReciprocal(local.direction[c]);
+		}
+		local.tmax = XMVectorSelect(XMVectorReplicate(-1), XMVectorMin(XMVectorMultiply(p.packet.tmax, length), miss), aabb_hit);
 
-							if (distance < result.distance)
-							{
-								const XMVECTOR nor = XMVector3Normalize(XMVector3TransformNormal(XMVector3Cross(XMVectorSubtract(p2, p1), XMVectorSubtract(p1, p0)), objectMat));
-
-								result.entity = entity;
-								XMStoreFloat3(&result.position, pos);
-								XMStoreFloat3(&result.normal, nor);
-								result.distance = distance;
-								result.subsetIndex = subsetCounter;
-								result.vertexID0 = (int)i0;
-								result.vertexID1 = (int)i1;
-								result.vertexID2 = (int)i2;
-								result.bary = bary;
-							}
-						}
-					}
-					subsetCounter++;
+		mesh.bvh.IntersectRayPacket(local, [&](uint32_t triangle, wiBVH::RayPacket& local) {
+			const uint32_t i0 = mesh.indices[triangle * 3 + 0];
+			const uint32_t i1 = mesh.indices[triangle * 3 + 1];
+			const uint32_t i2 = mesh.indices[triangle * 3 + 2];
+
+			XMVECTOR p0;
+			XMVECTOR p1;
+			XMVECTOR p2;
+			if (softbody_active)
+			{
+				p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
+				p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
+				p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
+			}
+			else if (mesh.vertex_positions_morphed.empty())
+			{
+				p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
+				p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
+				p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
+			}
+			else
+			{
+				p0 = mesh.vertex_positions_morphed[i0].LoadPOS();
+				p1 = mesh.vertex_positions_morphed[i1].LoadPOS();
+				p2 = mesh.vertex_positions_morphed[i2].LoadPOS();
+			}
+
+			XMVECTOR u, v;
+			const XMVECTOR t = RayPacketTriangleIntersects(local, p0, p1, p2, u, v);
+			const uint32_t hits = GetLaneMask(XMVectorLess(t, local.tmax));
+			if (hits == 0)
+				return;
+			const int subsetIndex = mesh.GetSubsetIndex(triangle * 3);
+			if (subsetIndex < 0)
+				return;
+
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				if (!(hits & (1u << lane)))
+					continue;
+
+				if (p.results[lane] == nullptr)
+				{
+					local.tmax = XMVectorSetByIndex(local.tmax, -1, lane);
+					p.packet.tmax = XMVectorSetByIndex(p.packet.tmax, -1, lane);
+					continue;
 				}
 
+				// The hit position and distance are computed in world space, like in Pick():
+				const float distance_local = XMVectorGetByIndex(t, lane);
+				const XMVECTOR origin_local = XMVectorSet(XMVectorGetByIndex(local.origin[0], lane), XMVectorGetByIndex(local.origin[1], lane), XMVectorGetByIndex(local.origin[2], lane), 1);
+				const XMVECTOR direction_local = XMVectorSet(XMVectorGetByIndex(local.direction[0], lane), XMVectorGetByIndex(local.direction[1], lane), XMVectorGetByIndex(local.direction[2], lane), 0);
+				const XMVECTOR pos = XMVector3Transform(XMVectorAdd(origin_local, direction_local * distance_local), objectMat);
+				const float distance = wiMath::Distance(pos, XMLoadFloat3(&p.origin[lane]));
+
+				PickResult& result = *p.results[lane];
+				if (distance < result.distance)
+				{
+					const XMVECTOR nor = XMVector3Normalize(XMVector3TransformNormal(XMVector3Cross(XMVectorSubtract(p2, p1), XMVectorSubtract(p1, p0)), objectMat));
+
+					result.entity = entity;
+					XMStoreFloat3(&result.position, pos);
+					XMStoreFloat3(&result.normal, nor);
+					result.distance = distance;
+					result.subsetIndex = subsetIndex;
+					result.vertexID0 = (int)i0;
+					result.vertexID1 = (int)i1;
+					result.vertexID2 = (int)i2;
+					result.bary = XMFLOAT2(XMVectorGetByIndex(u, lane), XMVectorGetByIndex(v, lane));
+
+					local.tmax = XMVectorSetByIndex(local.tmax, distance_local, lane);
+					p.packet.tmax = XMVectorSetByIndex(p.packet.tmax, distance, lane);
+				}
 			}
+		});
+	}
+
+	// Spreads the lower 10 bits of the value to every third bit:
+	static inline uint32_t MortonExpandBits(uint32_t v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	// Common implementation of PickBatch() and PickBatchOcclusion(), exactly one of results and occluded is not nullptr
+	static void TracePickBatch(const RAY* rays, size_t count, PickResult* results, bool* occluded, const float* maxDistances, uint32_t renderTypeMask, uint32_t layerMask, const Scene& scene)
+	{
+		if (count == 0)
+			return;
+		assert(count < (1ull << 31)); // the ray index is stored in the lower 31 bits of the sorting key
+
+		// The rays are sorted by their direction octant, then by the Morton code of their origin, so that the rays of a packet are coherent:
+		AABB bounds;
+		for (size_t i = 0; i < count; ++i)
+		{
+			bounds._min = wiMath::Min(bounds._min, rays[i].origin);
+			bounds._max = wiMath::Max(bounds._max, rays[i].origin);
+		}
+		const XMVECTOR bounds_min = XMLoadFloat3(&bounds._min);
+		const XMVECTOR bounds_scale = XMVectorDivide(XMVectorReplicate(1023), XMVectorMax(XMVectorSubtract(XMLoadFloat3(&bounds._max), bounds_min), XMVectorReplicate(FLT_EPSILON)));
+		std::vector<uint64_t> order(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const RAY& ray = rays[i];
+			XMFLOAT3 cell;
+			XMStoreFloat3(&cell, XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&ray.origin), bounds_min), bounds_scale));
+			const uint32_t morton = (MortonExpandBits((uint32_t)cell.x) << 2) | (MortonExpandBits((uint32_t)cell.y) << 1) | MortonExpandBits((uint32_t)cell.z);
+			const uint32_t octant = (ray.direction.x < 0 ? 4 : 0) | (ray.direction.y < 0 ? 2 : 0) | (ray.direction.z < 0 ? 1 : 0);
+			order[i] = (uint64_t(octant) << 61) | (uint64_t(morton) << 31) | uint64_t(i);
 		}
+		std::sort(order.begin(), order.end());
 
-		// Construct a matrix that will orient to position (P) according to surface normal (N):
-		XMVECTOR N = XMLoadFloat3(&result.normal);
-		XMVECTOR P = XMLoadFloat3(&result.position);
-		XMVECTOR E = XMLoadFloat3(&ray.origin);
-		XMVECTOR T = XMVector3Normalize(XMVector3Cross(N, P - E));
-		XMVECTOR B = XMVector3Normalize(XMVector3Cross(T, N));
-		XMMATRIX M = { T, N, B, P };
-		XMStoreFloat4x4(&result.orientation, M);
+		const bool object_bvh = scene.IsObjectBVHUpToDate();
+		const uint32_t packet_count = uint32_t((count + 3) / 4);
+		wiJobSystem::context ctx;
+		wiJobSystem::Dispatch(ctx, packet_count, wiJobSystem::GetParallelGroupSize(packet_count, 16), [&](wiJobArgs args) {
+
+			PickPacket p;
+			uint32_t indices[4];
+			XMFLOAT4A origin[3];
+			XMFLOAT4A direction[3];
+			XMFLOAT4A tmax;
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				// The missing rays of the last packet are copies of the first one, but inactive:
+				const size_t sorted = args.jobIndex * 4 + lane;
+				const bool active = sorted < count;
+				const uint32_t index = uint32_t(order[active ? sorted : args.jobIndex * 4] & 0x7FFFFFFF);
+				indices[lane] = active ? index : ~0u;
+
+				const RAY& ray = rays[index];
+				p.origin[lane] = ray.origin;
+				XMStoreFloat3(&p.direction[lane], XMVector3Normalize(XMLoadFloat3(&ray.direction)));
+				(&origin[0].x)[lane] = p.origin[lane].x;
+				(&origin[1].x)[lane] = p.origin[lane].y;
+				(&origin[2].x)[lane] = p.origin[lane].z;
+				(&direction[0].x)[lane] = p.direction[lane].x;
+				(&direction[1].x)[lane] = p.direction[lane].y;
+				(&direction[2].x)[lane] = p.direction[lane].z;
+
+				p.results[lane] = nullptr;
+				if (!active)
+				{
+					(&tmax.x)[lane] = -1;
+				}
+				else if (results != nullptr)
+				{
+					p.results[lane] = &results[index];
+					results[index] = PickResult();
+					(&tmax.x)[lane] = FLT_MAX;
+				}
+				else
+				{
+					(&tmax.x)[lane] = maxDistances == nullptr ? FLT_MAX : std::max(0.0f, maxDistances[index]);
+				}
+			}
+			for (int c = 0; c < 3; ++c)
+			{
+				p.packet.origin[c] = XMLoadFloat4A(&origin[c]);
+				p.packet.direction[c] = XMLoadFloat4A(&direction[c]);
+				p.packet.direction_inverse[c] = XMVectorReciprocal(p.packet.direction[c]);
+			}
+			p.packet.tmax = XMLoadFloat4A(&tmax);
 
-		return result;
+			if (object_bvh)
+			{
+				scene.object_bvh.IntersectRayPacket(p.packet, [&](uint32_t i, wiBVH::RayPacket&) {
+					PickObjectPacket(scene, i, renderTypeMask, layerMask, p);
+				});
+			}
+			else
+			{
+				for (uint32_t i = 0; i < (uint32_t)scene.aabb_objects.GetCount(); ++i)
+				{
+					PickObjectPacket(scene, i, renderTypeMask, layerMask, p);
+				}
+			}
+
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				const uint32_t index = indices[lane];
+				if (index == ~0u)
+					continue;
+				if (results != nullptr)
+				{
+					ComputePickOrientation(rays[index], results[index]);
+				}
+				else
+				{
+					occluded[index] = XMVectorGetByIndex(p.packet.tmax, lane) < 0;
+				}
+			}
+		});
+		wiJobSystem::Wait(ctx);
+	}
+
+	void PickBatch(const RAY* rays, size_t count, PickResult* results, uint32_t renderTypeMask, uint32_t layerMask, const Scene& scene)
+	{
+		TracePickBatch(rays, count, results, nullptr, nullptr, renderTypeMask, layerMask, scene);
+	}
+	void PickBatchOcclusion(const RAY* rays, size_t count, bool* occluded, const float* maxDistances, uint32_t renderTypeMask, uint32_t layerMask, const Scene& scene)
+	{
+		TracePickBatch(rays, count, nullptr, occluded, maxDistances, renderTypeMask, layerMask, scene);
 	}
 
 	SceneIntersectSphereResult SceneIntersectSphere(const SPHERE& sphere, uint32_t renderTypeMask, uint32_t layerMask, const Scene& scene)
@@ -3934,33 +5921,35 @@ namespace wiScene
 		XMVECTOR Center = XMLoadFloat3(&sphere.center);
 		XMVECTOR Radius = XMVectorReplicate(sphere.radius);
 		XMVECTOR RadiusSq = XMVectorMultiply(Radius, Radius);
+		AABB sphere_aabb;
+		sphere_aabb.createFromHalfWidth(sphere.center, XMFLOAT3(sphere.radius, sphere.radius, sphere.radius));
 
 		if (scene.objects.GetCount() > 0)
 		{
 
-			for (size_t i = 0; i < scene.aabb_objects.GetCount(); ++i)
-			{
+			// Returns false when an intersection was found, to stop the search:
+			auto intersect_object = [&](uint32_t i) {
 				const AABB& aabb = scene.aabb_objects[i];
 				if (!sphere.intersects(aabb))
 				{
-					continue;
+					return true;
 				}
 
 				const ObjectComponent& object = scene.objects[i];
 				if (object.meshID == INVALID_ENTITY)
 				{
-					continue;
+					return true;
 				}
 				if (!(renderTypeMask & object.GetRenderTypes()))
 				{
-					continue;
+					return true;
 				}
 
 				Entity entity = scene.aabb_objects.GetEntity(i);
 				const LayerComponent* layer = scene.layers.GetComponent(entity);
 				if (layer != nullptr && !(layer->GetLayerMask() & layerMask))
 				{
-					continue;
+					return true;
 				}
 
 				const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
@@ -3971,159 +5960,213 @@ namespace wiScene
 
 				const ArmatureComponent* armature = mesh.IsSkinned() ? scene.armatures.GetComponent(mesh.armatureID) : nullptr;
 
-				int subsetCounter = 0;
-				for (auto& subset : mesh.subsets)
-				{
-					for (size_t i = 0; i < subset.indexCount; i += 3)
-					{
-						const uint32_t i0 = mesh.indices[subset.indexOffset + i + 0];
-						const uint32_t i1 = mesh.indices[subset.indexOffset + i + 1];
-						const uint32_t i2 = mesh.indices[subset.indexOffset + i + 2];
+				// Tests the triangle at mesh.indices[first], returns true if it intersects (the result is filled):
+				auto intersect_triangle = [&](uint32_t first) {
+					const uint32_t i0 = mesh.indices[first + 0];
+					const uint32_t i1 = mesh.indices[first + 1];
+					const uint32_t i2 = mesh.indices[first + 2];
 
-						XMVECTOR p0;
-						XMVECTOR p1;
-						XMVECTOR p2;
+					XMVECTOR p0;
+					XMVECTOR p1;
+					XMVECTOR p2;
 
-						if (softbody_active)
+					if (softbody_active)
+					{
+						p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
+						p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
+						p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
+					}
+					else
+					{
+						if (armature == nullptr)
 						{
-							p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
-							p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
-							p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
+							p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
+							p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
+							p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
 						}
 						else
 						{
-							if (armature == nullptr)
-							{
-								p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
-								p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
-								p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
-							}
-							else
-							{
-								p0 = SkinVertex(mesh, *armature, i0);
-								p1 = SkinVertex(mesh, *armature, i1);
-								p2 = SkinVertex(mesh, *armature, i2);
-							}
+							p0 = SkinVertex(mesh, *armature, i0);
+							p1 = SkinVertex(mesh, *armature, i1);
+							p2 = SkinVertex(mesh, *armature, i2);
 						}
+					}
 
-						p0 = XMVector3Transform(p0, objectMat);
-						p1 = XMVector3Transform(p1, objectMat);
-						p2 = XMVector3Transform(p2, objectMat);
+					p0 = XMVector3Transform(p0, objectMat);
+					p1 = XMVector3Transform(p1, objectMat);
+					p2 = XMVector3Transform(p2, objectMat);
 
-						XMFLOAT3 min, max;
-						XMStoreFloat3(&min, XMVectorMin(p0, XMVectorMin(p1, p2)));
-						XMStoreFloat3(&max, XMVectorMax(p0, XMVectorMax(p1, p2)));
-						AABB aabb_triangle(min, max);
-						if (sphere.intersects(aabb_triangle) == AABB::OUTSIDE)
-						{
-							continue;
-						}
+					XMFLOAT3 min, max;
+					XMStoreFloat3(&min, XMVectorMin(p0, XMVectorMin(p1, p2)));
+					XMStoreFloat3(&max, XMVectorMax(p0, XMVectorMax(p1, p2)));
+					AABB aabb_triangle(min, max);
+					if (sphere.intersects(aabb_triangle) == AABB::OUTSIDE)
+					{
+						return false;
+					}
 
-						// Compute the plane of the triangle (has to be normalized).
-						XMVECTOR N = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
+					// Compute the plane of the triangle (has to be normalized).
+					XMVECTOR N = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
 
-						// Assert that the triangle is not degenerate.
-						assert(!XMVector3Equal(N, XMVectorZero()));
+					// Assert that the triangle is not degenerate.
+					assert(!XMVector3Equal(N, XMVectorZero()));
 
-						// Find the nearest feature on the triangle to the sphere.
-						XMVECTOR Dist = XMVector3Dot(XMVectorSubtract(Center, p0), N);
+					// Find the nearest feature on the triangle to the sphere.
+					XMVECTOR Dist = XMVector3Dot(XMVectorSubtract(Center, p0), N);
 
-						if (!mesh.IsDoubleSided() && XMVectorGetX(Dist) > 0)
-						{
-							continue; // pass through back faces
-						}
+					if (!mesh.IsDoubleSided() && XMVectorGetX(Dist) > 0)
+					{
+						return false; // pass through back faces
+					}
 
-						// If the center of the sphere is farther from the plane of the triangle than
-						// the radius of the sphere, then there cannot be an intersection.
-						XMVECTOR NoIntersection = XMVectorLess(Dist, XMVectorNegate(Radius));
-						NoIntersection = XMVectorOrInt(NoIntersection, XMVectorGreater(Dist, Radius));
+					// If the center of the sphere is farther from the plane of the triangle than
+					// the radius of the sphere, then there cannot be an intersection.
+					XMVECTOR NoIntersection = XMVectorLess(Dist, XMVectorNegate(Radius));
+					NoIntersection = XMVectorOrInt(NoIntersection, XMVectorGreater(Dist, Radius));
 
-						// Project the center of the sphere onto the plane of the triangle.
-						XMVECTOR Point0 = XMVectorNegativeMultiplySubtract(N, Dist, Center);
+					// Project the center of the sphere onto the plane of the triangle.
+					XMVECTOR Point0 = XMVectorNegativeMultiplySubtract(N, Dist, Center);
 
-						// Is it inside all the edges? If so we intersect because the distance 
-						// to the plane is less than the radius.
-						//XMVECTOR Intersection = DirectX::Internal::PointOnPlaneInsideTriangle(Point0, p0, p1, p2);
+					// Is it inside all the edges? If so we intersect because the distance 
+					// to the plane is less than the radius.
+					//XMVECTOR Intersection = DirectX::Internal::PointOnPlaneInsideTriangle(Point0, p0, p1, p2);
 
-						// Compute the cross products of the vector from the base of each edge to 
-						// the point with each edge vector.
-						XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(Point0, p0), XMVectorSubtract(p1, p0));
-						XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(Point0, p1), XMVectorSubtract(p2, p1));
-						XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(Point0, p2), XMVectorSubtract(p0, p2));
+					// Compute the cross products of the vector from the base of each edge to 
+					// the point with each edge vector.
+					XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(Point0, p0), XMVectorSubtract(p1, p0));
+					XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(Point0, p1), XMVectorSubtract(p2, p1));
+					XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(Point0, p2), XMVectorSubtract(p0, p2));
 
-						// If the cross product points in the same direction as the normal the the
-						// point is inside the edge (it is zero if is on the edge).
-						XMVECTOR Zero = XMVectorZero();
-						XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
-						XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
-						XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
+					// If the cross product points in the same direction as the normal the the
+					// point is inside the edge (it is zero if is on the edge).
+					XMVECTOR Zero = XMVectorZero();
+					XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
+					XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
+					XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
 
-						// If the point inside all of the edges it is inside.
-						XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
+					// If the point inside all of the edges it is inside.
+					XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
 
-						bool inside = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
+					bool inside = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
 
-						// Find the nearest point on each edge.
+					// Find the nearest point on each edge.
 
-						// Edge 0,1
-						XMVECTOR Point1 = DirectX::Internal::PointOnLineSegmentNearestPoint(p0, p1, Center);
+					// Edge 0,1
+					XMVECTOR Point1 = DirectX::Internal::PointOnLineSegmentNearestPoint(p0, p1, Center);
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point1)), RadiusSq));
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point1)), RadiusSq));
 
-						// Edge 1,2
-						XMVECTOR Point2 = DirectX::Internal::PointOnLineSegmentNearestPoint(p1, p2, Center);
+					// Edge 1,2
+					XMVECTOR Point2 = DirectX::Internal::PointOnLineSegmentNearestPoint(p1, p2, Center);
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point2)), RadiusSq));
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point2)), RadiusSq));
 
-						// Edge 2,0
-						XMVECTOR Point3 = DirectX::Internal::PointOnLineSegmentNearestPoint(p2, p0, Center);
+					// Edge 2,0
+					XMVECTOR Point3 = DirectX::Internal::PointOnLineSegmentNearestPoint(p2, p0, Center);
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point3)), RadiusSq));
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point3)), RadiusSq));
 
-						bool intersects = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
+					bool intersects = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
 
-						if (intersects)
+					if (intersects)
+					{
+						XMVECTOR bestPoint = Point0;
+						if (!inside)
 						{
-							XMVECTOR bestPoint = Point0;
-							if (!inside)
+							// If the sphere center's projection on the triangle plane is not within the triangle,
+							//	determine the closest point on triangle to the sphere center
+							float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - Center));
+							bestPoint = Point1;
+
+							float d = XMVectorGetX(XMVector3LengthSq(Point2 - Center));
+							if (d < bestDist)
+							{
+								bestDist = d;
+								bestPoint = Point2;
+							}
+							d = XMVectorGetX(XMVector3LengthSq(Point3 - Center));
+							if (d < bestDist)
 							{
-								// If the sphere center's projection on the triangle plane is not within the triangle,
-								//	determine the closest point on triangle to the sphere center
-								float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - Center));
-								bestPoint = Point1;
+								bestDist = d;
+								bestPoint = Point3;
+							}
+						}
+						XMVECTOR intersectionVec = Center - bestPoint;
+						XMVECTOR intersectionVecLen = XMVector3Length(intersectionVec);
+
+						result.entity = entity;
+						result.depth = sphere.radius - XMVectorGetX(intersectionVecLen);
+						XMStoreFloat3(&result.position, bestPoint);
+						XMStoreFloat3(&result.normal, intersectionVec / intersectionVecLen);
+						return true;
+					}
 
-								float d = XMVectorGetX(XMVector3LengthSq(Point2 - Center));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									bestPoint = Point2;
-								}
-								d = XMVectorGetX(XMVector3LengthSq(Point3 - Center));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									bestPoint = Point3;
-								}
+					return false;
+				};
+
+				// The BVH is built from the morphed positions if there are any, but these queries test the unmorphed ones, so then it can't be used:
+				if (armature == nullptr && mesh.vertex_positions_morphed.empty() && IsMeshBVHUpToDate(scene, object.meshID, mesh))
+				{
+					// The BVH is in the mesh's local space, so it is tested with the local space bounding box of the query:
+					const AABB aabb_local = sphere_aabb.transform(XMMatrixInverse(nullptr, objectMat));
+					// The triangles are visited in BVH order, the result is the first intersecting one in subset order, the same as without the BVH:
+					uint64_t first_hit = ~0ull;
+					mesh.bvh.Intersects(aabb_local, [&](uint32_t triangle) {
+						const int subsetIndex = mesh.GetSubsetIndex(triangle * 3);
+						const uint64_t order = (uint64_t(subsetIndex) << 32) | triangle;
+						if (subsetIndex >= 0 && order < first_hit && intersect_triangle(triangle * 3))
+						{
+							first_hit = order;
+						}
+						return true;
+					});
+					if (first_hit != ~0ull)
+					{
+						return false;
+					}
+				}
+				else
+				{
+					for (auto& subset : mesh.subsets)
+					{
+						for (uint32_t i = 0; i < subset.indexCount; i += 3)
+						{
+							if (intersect_triangle(subset.indexOffset + i))
+							{
+								return false;
 							}
-							XMVECTOR intersectionVec = Center - bestPoint;
-							XMVECTOR intersectionVecLen = XMVector3Length(intersectionVec);
-
-							result.entity = entity;
-							result.depth = sphere.radius - XMVectorGetX(intersectionVecLen);
-							XMStoreFloat3(&result.position, bestPoint);
-							XMStoreFloat3(&result.normal, intersectionVec / intersectionVecLen);
-							return result;
 						}
 					}
-					subsetCounter++;
 				}
 
+				return true;
+			};
+
+			if (scene.IsObjectBVHUpToDate())
+			{
+				// The objects are visited in BVH order, the result is from the first intersecting object in scene order, the same as without the BVH:
+				uint32_t first_hit = ~0u;
+				scene.object_bvh.Intersects(sphere, [&](uint32_t i) {
+					if (i < first_hit && !intersect_object(i))
+					{
+						first_hit = i;
+					}
+					return true;
+				});
+			}
+			else
+			{
+				for (uint32_t i = 0; i < (uint32_t)scene.aabb_objects.GetCount(); ++i)
+				{
+					if (!intersect_object(i))
+						break;
+				}
 			}
 		}
 
@@ -4144,29 +6187,29 @@ namespace wiScene
 		if (scene.objects.GetCount() > 0)
 		{
 
-			for (size_t i = 0; i < scene.aabb_objects.GetCount(); ++i)
-			{
+			// Returns false when an intersection was found, to stop the search:
+			auto intersect_object = [&](uint32_t i) {
 				const AABB& aabb = scene.aabb_objects[i];
 				if (capsule_aabb.intersects(aabb) == AABB::INTERSECTION_TYPE::OUTSIDE)
 				{
-					continue;
+					return true;
 				}
 
 				const ObjectComponent& object = scene.objects[i];
 				if (object.meshID == INVALID_ENTITY)
 				{
-					continue;
+					return true;
 				}
 				if (!(renderTypeMask & object.GetRenderTypes()))
 				{
-					continue;
+					return true;
 				}
 
 				Entity entity = scene.aabb_objects.GetEntity(i);
 				const LayerComponent* layer = scene.layers.GetComponent(entity);
 				if (layer != nullptr && !(layer->GetLayerMask() & layerMask))
 				{
-					continue;
+					return true;
 				}
 
 				const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
@@ -4177,230 +6220,284 @@ namespace wiScene
 
 				const ArmatureComponent* armature = mesh.IsSkinned() ? scene.armatures.GetComponent(mesh.armatureID) : nullptr;
 
-				int subsetCounter = 0;
-				for (auto& subset : mesh.subsets)
-				{
-					for (size_t i = 0; i < subset.indexCount; i += 3)
-					{
-						const uint32_t i0 = mesh.indices[subset.indexOffset + i + 0];
-						const uint32_t i1 = mesh.indices[subset.indexOffset + i + 1];
-						const uint32_t i2 = mesh.indices[subset.indexOffset + i + 2];
+				// Tests the triangle at mesh.indices[first], returns true if it intersects (the result is filled):
+				auto intersect_triangle = [&](uint32_t first) {
+					const uint32_t i0 = mesh.indices[first + 0];
+					const uint32_t i1 = mesh.indices[first + 1];
+					const uint32_t i2 = mesh.indices[first + 2];
 
-						XMVECTOR p0;
-						XMVECTOR p1;
-						XMVECTOR p2;
+					XMVECTOR p0;
+					XMVECTOR p1;
+					XMVECTOR p2;
 
-						if (softbody_active)
+					if (softbody_active)
+					{
+						p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
+						p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
+						p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
+					}
+					else
+					{
+						if (armature == nullptr || armature->boneData.empty())
 						{
-							p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
-							p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
-							p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
+							p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
+							p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
+							p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
 						}
 						else
 						{
-							if (armature == nullptr || armature->boneData.empty())
-							{
-								p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
-								p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
-								p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
-							}
-							else
-							{
-								p0 = SkinVertex(mesh, *armature, i0);
-								p1 = SkinVertex(mesh, *armature, i1);
-								p2 = SkinVertex(mesh, *armature, i2);
-							}
-						}
-						
-						p0 = XMVector3Transform(p0, objectMat);
-						p1 = XMVector3Transform(p1, objectMat);
-						p2 = XMVector3Transform(p2, objectMat);
-
-						XMFLOAT3 min, max;
-						XMStoreFloat3(&min, XMVectorMin(p0, XMVectorMin(p1, p2)));
-						XMStoreFloat3(&max, XMVectorMax(p0, XMVectorMax(p1, p2)));
-						AABB aabb_triangle(min, max);
-						if (capsule_aabb.intersects(aabb_triangle) == AABB::OUTSIDE)
-						{
-							continue;
+							p0 = SkinVertex(mesh, *armature, i0);
+							p1 = SkinVertex(mesh, *armature, i1);
+							p2 = SkinVertex(mesh, *armature, i2);
 						}
+					}
+					
+					p0 = XMVector3Transform(p0, objectMat);
+					p1 = XMVector3Transform(p1, objectMat);
+					p2 = XMVector3Transform(p2, objectMat);
+
+					XMFLOAT3 min, max;
+					XMStoreFloat3(&min, XMVectorMin(p0, XMVectorMin(p1, p2)));
+					XMStoreFloat3(&max, XMVectorMax(p0, XMVectorMax(p1, p2)));
+					AABB aabb_triangle(min, max);
+					if (capsule_aabb.intersects(aabb_triangle) == AABB::OUTSIDE)
+					{
+						return false;
+					}
+
+					// Compute the plane of the triangle (has to be normalized).
+					XMVECTOR N = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
+					
+					XMVECTOR ReferencePoint;
+					XMVECTOR d = XMVector3Normalize(B - A);
+					if (abs(XMVectorGetX(XMVector3Dot(N, d))) < FLT_EPSILON)
+					{
+						// Capsule line cannot be intersected with triangle plane (they are parallel)
+						//	In this case, just take a point from triangle
+						ReferencePoint = p0;
+					}
+					else
+					{
+						// Intersect capsule line with triangle plane:
+						XMVECTOR t = XMVector3Dot(N, (Base - p0) / XMVectorAbs(XMVector3Dot(N, d)));
+						XMVECTOR LinePlaneIntersection = Base + d * t;
+
+						// Compute the cross products of the vector from the base of each edge to 
+						// the point with each edge vector.
+						XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p0), XMVectorSubtract(p1, p0));
+						XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p1), XMVectorSubtract(p2, p1));
+						XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p2), XMVectorSubtract(p0, p2));
+
+						// If the cross product points in the same direction as the normal the the
+						// point is inside the edge (it is zero if is on the edge).
+						XMVECTOR Zero = XMVectorZero();
+						XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
+						XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
+						XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
+
+						// If the point inside all of the edges it is inside.
+						XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
 
-						// Compute the plane of the triangle (has to be normalized).
-						XMVECTOR N = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
-						
-						XMVECTOR ReferencePoint;
-						XMVECTOR d = XMVector3Normalize(B - A);
-						if (abs(XMVectorGetX(XMVector3Dot(N, d))) < FLT_EPSILON)
+						bool inside = XMVectorGetIntX(Intersection) != 0;
+
+						if (inside)
 						{
-							// Capsule line cannot be intersected with triangle plane (they are parallel)
-							//	In this case, just take a point from triangle
-							ReferencePoint = p0;
+							ReferencePoint = LinePlaneIntersection;
 						}
 						else
 						{
-							// Intersect capsule line with triangle plane:
-							XMVECTOR t = XMVector3Dot(N, (Base - p0) / XMVectorAbs(XMVector3Dot(N, d)));
-							XMVECTOR LinePlaneIntersection = Base + d * t;
-
-							// Compute the cross products of the vector from the base of each edge to 
-							// the point with each edge vector.
-							XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p0), XMVectorSubtract(p1, p0));
-							XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p1), XMVectorSubtract(p2, p1));
-							XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p2), XMVectorSubtract(p0, p2));
+							// Find the nearest point on each edge.
 
-							// If the cross product points in the same direction as the normal the the
-							// point is inside the edge (it is zero if is on the edge).
-							XMVECTOR Zero = XMVectorZero();
-							XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
-							XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
-							XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
+							// Edge 0,1
+							XMVECTOR Point1 = wiMath::ClosestPointOnLineSegment(p0, p1, LinePlaneIntersection);
 
-							// If the point inside all of the edges it is inside.
-							XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
+							// Edge 1,2
+							XMVECTOR Point2 = wiMath::ClosestPointOnLineSegment(p1, p2, LinePlaneIntersection);
 
-							bool inside = XMVectorGetIntX(Intersection) != 0;
+							// Edge 2,0
+							XMVECTOR Point3 = wiMath::ClosestPointOnLineSegment(p2, p0, LinePlaneIntersection);
 
-							if (inside)
+							ReferencePoint = Point1;
+							float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - LinePlaneIntersection));
+							float d = abs(XMVectorGetX(XMVector3LengthSq(Point2 - LinePlaneIntersection)));
+							if (d < bestDist)
 							{
-								ReferencePoint = LinePlaneIntersection;
+								bestDist = d;
+								ReferencePoint = Point2;
 							}
-							else
+							d = abs(XMVectorGetX(XMVector3LengthSq(Point3 - LinePlaneIntersection)));
+							if (d < bestDist)
 							{
-								// Find the nearest point on each edge.
-
-								// Edge 0,1
-								XMVECTOR Point1 = wiMath::ClosestPointOnLineSegment(p0, p1, LinePlaneIntersection);
+								bestDist = d;
+								ReferencePoint = Point3;
+							}
+						}
 
-								// Edge 1,2
-								XMVECTOR Point2 = wiMath::ClosestPointOnLineSegment(p1, p2, LinePlaneIntersection);
 
-								// Edge 2,0
-								XMVECTOR Point3 = wiMath::ClosestPointOnLineSegment(p2, p0, LinePlaneIntersection);
+					}
 
-								ReferencePoint = Point1;
-								float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - LinePlaneIntersection));
-								float d = abs(XMVectorGetX(XMVector3LengthSq(Point2 - LinePlaneIntersection)));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									ReferencePoint = Point2;
-								}
-								d = abs(XMVectorGetX(XMVector3LengthSq(Point3 - LinePlaneIntersection)));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									ReferencePoint = Point3;
-								}
-							}
+					// Place a sphere on closest point on line segment to intersection:
+					XMVECTOR Center = wiMath::ClosestPointOnLineSegment(A, B, ReferencePoint);
 
+					// Assert that the triangle is not degenerate.
+					assert(!XMVector3Equal(N, XMVectorZero()));
 
-						}
+					// Find the nearest feature on the triangle to the sphere.
+					XMVECTOR Dist = XMVector3Dot(XMVectorSubtract(Center, p0), N);
 
-						// Place a sphere on closest point on line segment to intersection:
-						XMVECTOR Center = wiMath::ClosestPointOnLineSegment(A, B, ReferencePoint);
+					if (!mesh.IsDoubleSided() && XMVectorGetX(Dist) > 0)
+					{
+						return false; // pass through back faces
+					}
 
-						// Assert that the triangle is not degenerate.
-						assert(!XMVector3Equal(N, XMVectorZero()));
+					// If the center of the sphere is farther from the plane of the triangle than
+					// the radius of the sphere, then there cannot be an intersection.
+					XMVECTOR NoIntersection = XMVectorLess(Dist, XMVectorNegate(Radius));
+					NoIntersection = XMVectorOrInt(NoIntersection, XMVectorGreater(Dist, Radius));
 
-						// Find the nearest feature on the triangle to the sphere.
-						XMVECTOR Dist = XMVector3Dot(XMVectorSubtract(Center, p0), N);
+					// Project the center of the sphere onto the plane of the triangle.
+					XMVECTOR Point0 = XMVectorNegativeMultiplySubtract(N, Dist, Center);
 
-						if (!mesh.IsDoubleSided() && XMVectorGetX(Dist) > 0)
-						{
-							continue; // pass through back faces
-						}
+					// Is it inside all the edges? If so we intersect because the distance 
+					// to the plane is less than the radius.
+					//XMVECTOR Intersection = DirectX::Internal::PointOnPlaneInsideTriangle(Point0, p0, p1, p2);
 
-						// If the center of the sphere is farther from the plane of the triangle than
-						// the radius of the sphere, then there cannot be an intersection.
-						XMVECTOR NoIntersection = XMVectorLess(Dist, XMVectorNegate(Radius));
-						NoIntersection = XMVectorOrInt(NoIntersection, XMVectorGreater(Dist, Radius));
+					// Compute the cross products of the vector from the base of each edge to 
+					// the point with each edge vector.
+					XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(Point0, p0), XMVectorSubtract(p1, p0));
+					XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(Point0, p1), XMVectorSubtract(p2, p1));
+					XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(Point0, p2), XMVectorSubtract(p0, p2));
 
-						// Project the center of the sphere onto the plane of the triangle.
-						XMVECTOR Point0 = XMVectorNegativeMultiplySubtract(N, Dist, Center);
+					// If the cross product points in the same direction as the normal the the
+					// point is inside the edge (it is zero if is on the edge).
+					XMVECTOR Zero = XMVectorZero();
+					XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
+					XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
+					XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
 
-						// Is it inside all the edges? If so we intersect because the distance 
-						// to the plane is less than the radius.
-						//XMVECTOR Intersection = DirectX::Internal::PointOnPlaneInsideTriangle(Point0, p0, p1, p2);
+					// If the point inside all of the edges it is inside.
+					XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
 
-						// Compute the cross products of the vector from the base of each edge to 
-						// the point with each edge vector.
-						XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(Point0, p0), XMVectorSubtract(p1, p0));
-						XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(Point0, p1), XMVectorSubtract(p2, p1));
-						XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(Point0, p2), XMVectorSubtract(p0, p2));
+					bool inside = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
 
-						// If the cross product points in the same direction as the normal the the
-						// point is inside the edge (it is zero if is on the edge).
-						XMVECTOR Zero = XMVectorZero();
-						XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
-						XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
-						XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
+					// Find the nearest point on each edge.
 
-						// If the point inside all of the edges it is inside.
-						XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
+					// Edge 0,1
+					XMVECTOR Point1 = wiMath::ClosestPointOnLineSegment(p0, p1, Center);
 
-						bool inside = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point1)), RadiusSq));
 
-						// Find the nearest point on each edge.
+					// Edge 1,2
+					XMVECTOR Point2 = wiMath::ClosestPointOnLineSegment(p1, p2, Center);
 
-						// Edge 0,1
-						XMVECTOR Point1 = wiMath::ClosestPointOnLineSegment(p0, p1, Center);
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point2)), RadiusSq));
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point1)), RadiusSq));
+					// Edge 2,0
+					XMVECTOR Point3 = wiMath::ClosestPointOnLineSegment(p2, p0, Center);
 
-						// Edge 1,2
-						XMVECTOR Point2 = wiMath::ClosestPointOnLineSegment(p1, p2, Center);
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point3)), RadiusSq));
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point2)), RadiusSq));
+					bool intersects = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
 
-						// Edge 2,0
-						XMVECTOR Point3 = wiMath::ClosestPointOnLineSegment(p2, p0, Center);
+					if (intersects)
+					{
+						XMVECTOR bestPoint = Point0;
+						if (!inside)
+						{
+							// If the sphere center's projection on the triangle plane is not within the triangle,
+							//	determine the closest point on triangle to the sphere center
+							float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - Center));
+							bestPoint = Point1;
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point3)), RadiusSq));
+							float d = XMVectorGetX(XMVector3LengthSq(Point2 - Center));
+							if (d < bestDist)
+							{
+								bestDist = d;
+								bestPoint = Point2;
+							}
+							d = XMVectorGetX(XMVector3LengthSq(Point3 - Center));
+							if (d < bestDist)
+							{
+								bestDist = d;
+								bestPoint = Point3;
+							}
+						}
+						XMVECTOR intersectionVec = Center - bestPoint;
+						XMVECTOR intersectionVecLen = XMVector3Length(intersectionVec);
+
+						result.entity = entity;
+						result.depth = capsule.radius - XMVectorGetX(intersectionVecLen);
+						XMStoreFloat3(&result.position, bestPoint);
+						XMStoreFloat3(&result.normal, intersectionVec / intersectionVecLen);
+						return true;
+					}
 
-						bool intersects = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
+					return false;
+				};
 
-						if (intersects)
+				// The BVH is built from the morphed positions if there are any, but these queries test the unmorphed ones, so then it can't be used:
+				if ((armature == nullptr || armature->boneData.empty()) && mesh.vertex_positions_morphed.empty() && IsMeshBVHUpToDate(scene, object.meshID, mesh))
+				{
+					// The BVH is in the mesh's local space, so it is tested with the local space bounding box of the query:
+					const AABB aabb_local = capsule_aabb.transform(XMMatrixInverse(nullptr, objectMat));
+					// The triangles are visited in BVH order, the result is the first intersecting one in subset order, the same as without the BVH:
+					uint64_t first_hit = ~0ull;
+					mesh.bvh.Intersects(aabb_local, [&](uint32_t triangle) {
+						const int subsetIndex = mesh.GetSubsetIndex(triangle * 3);
+						const uint64_t order = (uint64_t(subsetIndex) << 32) | triangle;
+						if (subsetIndex >= 0 && order < first_hit && intersect_triangle(triangle * 3))
 						{
-							XMVECTOR bestPoint = Point0;
-							if (!inside)
+							first_hit = order;
+						}
+						return true;
+					});
+					if (first_hit != ~0ull)
+					{
+						return false;
+					}
+				}
+				else
+				{
+					for (auto& subset : mesh.subsets)
+					{
+						for (uint32_t i = 0; i < subset.indexCount; i += 3)
+						{
+							if (intersect_triangle(subset.indexOffset + i))
 							{
-								// If the sphere center's projection on the triangle plane is not within the triangle,
-								//	determine the closest point on triangle to the sphere center
-								float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - Center));
-								bestPoint = Point1;
-
-								float d = XMVectorGetX(XMVector3LengthSq(Point2 - Center));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									bestPoint = Point2;
-								}
-								d = XMVectorGetX(XMVector3LengthSq(Point3 - Center));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									bestPoint = Point3;
-								}
+								return false;
 							}
-							XMVECTOR intersectionVec = Center - bestPoint;
-							XMVECTOR intersectionVecLen = XMVector3Length(intersectionVec);
-
-							result.entity = entity;
-							result.depth = capsule.radius - XMVectorGetX(intersectionVecLen);
-							XMStoreFloat3(&result.position, bestPoint);
-							XMStoreFloat3(&result.normal, intersectionVec / intersectionVecLen);
-							return result;
 						}
 					}
-					subsetCounter++;
 				}
 
+				return true;
+			};
+
+			if (scene.IsObjectBVHUpToDate())
+			{
+				// The objects are visited in BVH order, the result is from the first intersecting object in scene order, the same as without the BVH:
+				uint32_t first_hit = ~0u;
+				scene.object_bvh.Intersects(capsule_aabb, [&](uint32_t i) {
+					if (i < first_hit && !intersect_object(i))
+					{
+						first_hit = i;
+					}
+					return true;
+				});
+			}
+			else
+			{
+				for (uint32_t i = 0; i < (uint32_t)scene.aabb_objects.GetCount(); ++i)
+				{
+					if (!intersect_object(i))
+						break;
+				}
 			}
 		}
 
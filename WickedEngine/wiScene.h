@@ -10,6 +10,7 @@
 #include "wiResourceManager.h"
 #include "wiSpinLock.h"
 #include "wiGPUBVH.h"
+#include "wiBVH.h"
 #include "wiOcean.h"
 #include "wiSprite.h"
 
@@ -19,6 +20,8 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
+#include <atomic>
 
 class wiArchive;
 
@@ -26,11 +29,23 @@ namespace wiScene
 {
 	struct NameComponent
 	{
-		std::string name;
+		std::string name; // rename with SetName(), so that the name index of the scene is kept up to date
 
-		inline void operator=(const std::string& str) { name = str; }
-		inline void operator=(std::string&& str) { name = std::move(str); }
+		// Non-serialized attributes:
+		//	The scene that contains this component, SetName() updates its name index. It is set by the scene (see Scene::UpdateNameIndex())
+		//	and it is not copied (writing the name string directly is not tracked, Scene::Entity_FindByName() won't find the new name)
+		Scene* scene = nullptr;
+
+		NameComponent() = default;
+		NameComponent(const NameComponent& other) : name(other.name) {}
+		NameComponent(NameComponent&& other) noexcept : name(std::move(other.name)) {}
+		inline NameComponent& operator=(const NameComponent& other) { SetName(other.name); return *this; }
+		inline NameComponent& operator=(NameComponent&& other) noexcept { SetName(std::move(other.name)); return *this; }
+
+		inline void operator=(const std::string& str) { SetName(str); }
+		inline void operator=(std::string&& str) { SetName(std::move(str)); }
 		inline bool operator==(const std::string& str) const { return name.compare(str) == 0; }
+		void SetName(std::string value);
 
 		void Serialize(wiArchive& archive, wiECS::EntitySerializer& seri);
 	};
@@ -53,8 +68,9 @@ namespace wiScene
 		{
 			EMPTY = 0,
 			DIRTY = 1 << 0,
+			CHANGED = 1 << 1, // the world matrix was modified since the scene last processed it, only the scene update clears this
 		};
-		uint32_t _flags = DIRTY;
+		uint32_t _flags = DIRTY | CHANGED;
 
 		XMFLOAT3 scale_local = XMFLOAT3(1, 1, 1);
 		XMFLOAT4 rotation_local = XMFLOAT4(0, 0, 0, 1);	// this is a quaternion
@@ -67,8 +83,11 @@ namespace wiScene
 		//	- or by calling SetDirty() and letting the TransformUpdateSystem handle the updating
 		XMFLOAT4X4 world = IDENTITYMATRIX;
 
-		inline void SetDirty(bool value = true) { if (value) { _flags |= DIRTY; } else { _flags &= ~DIRTY; } }
+		inline void SetDirty(bool value = true) { if (value) { _flags |= DIRTY | CHANGED; } else { _flags &= ~DIRTY; } }
 		inline bool IsDirty() const { return _flags & DIRTY; }
+		// Unlike dirtiness, this is not cleared by UpdateTransform(), so the scene sees the changes that were applied outside of it:
+		inline void SetChanged(bool value = true) { if (value) { _flags |= CHANGED; } else { _flags &= ~CHANGED; } }
+		inline bool IsChanged() const { return _flags & CHANGED; }
 
 		XMFLOAT3 GetPosition() const;
 		XMFLOAT4 GetRotation() const;
@@ -311,6 +330,7 @@ namespace wiScene
 		void Serialize(wiArchive& archive, wiECS::EntitySerializer& seri);
 	};
 
+	struct SoftBodyPhysicsComponent;
 	struct MeshComponent
 	{
 		enum FLAGS
@@ -370,6 +390,11 @@ namespace wiScene
 		};
 		std::vector<MeshMorphTarget> targets;
 
+		// CPU BVH of the triangles for the scene queries (Pick, SceneIntersectSphere, SceneIntersectCapsule), primitive i is the triangle at indices[i * 3]
+		//	It is built by the scene update after a query needed it, or it can be baked with BuildBVH() before saving, because it is serialized
+		//	Skinned meshes don't use it, their triangles are tested one by one
+		wiBVH bvh;
+
 		// Non-serialized attributes:
 		AABB aabb;
 		wiGraphics::GPUBuffer indexBuffer;
@@ -401,7 +426,10 @@ namespace wiScene
 		uint32_t terrain_material3_index = ~0u;
 
 		mutable bool dirty_morph = false;
+		mutable bool dirty_morph_upload = false; // set by the mesh update system when the morphed vertices changed, cleared by the renderer when uploaded
 		mutable bool dirty_subsets = true;
+		bool dirty_bvh = false; // set when the triangles changed (morph targets, CreateRenderData()), the mesh BVH update system refits the bvh, the queries don't use it until then
+		mutable bool bvh_requested = false; // a scene query needed the bvh, it is in the Scene::mesh_bvh_requests
 
 		inline void SetRenderable(bool value) { if (value) { _flags |= RENDERABLE; } else { _flags &= ~RENDERABLE; } }
 		inline void SetDoubleSided(bool value) { if (value) { _flags |= DOUBLE_SIDED; } else { _flags &= ~DOUBLE_SIDED; } }
@@ -434,6 +462,12 @@ namespace wiScene
 		void Recenter();
 		void RecenterToBottom();
 		SPHERE GetBoundingSphere() const;
+		// Builds the triangle bvh from the vertex positions that the scene queries use (soft body simulation or morphed positions if available)
+		void BuildBVH(const SoftBodyPhysicsComponent* softbody = nullptr);
+		// Updates the bvh bounds after the vertex positions changed, the triangles must be the same as when it was built
+		void RefitBVH(const SoftBodyPhysicsComponent* softbody = nullptr);
+		// Returns the subset index that contains indices[index], or -1 if it's not in any subset
+		int GetSubsetIndex(uint32_t index) const;
 
 		void Serialize(wiArchive& archive, wiECS::EntitySerializer& seri);
 
@@ -887,7 +921,7 @@ namespace wiScene
 		XMFLOAT4X4 View, Projection, VP;
 		Frustum frustum;
 		XMFLOAT4X4 InvView, InvProjection, InvVP;
-		XMFLOAT2 jitter;
+		XMFLOAT2 jitter = XMFLOAT2(0, 0);
 		XMFLOAT4 clipPlane = XMFLOAT4(0, 0, 0, 0); // default: no clip plane
 
 		void CreatePerspective(float newWidth, float newHeight, float newNear, float newFar, float newFOV = XM_PI / 3.0f);
@@ -991,12 +1025,43 @@ namespace wiScene
 		enum FLAGS
 		{
 			EMPTY = 0,
+			COMPRESSED = 1 << 0,
 		};
 		uint32_t _flags = EMPTY;
 
 		std::vector<float> keyframe_times;
 		std::vector<float> keyframe_data;
 
+		// Compressed representation (only when COMPRESSED flag is set, keyframe_data is empty then):
+		//	If the keyframes are uniformly spaced, the times are not stored, keyframe_times is empty and time_step is not zero.
+		//	Keys that are removed by key reduction are not stored, keyframe_frames holds the frame index of the remaining keys on the uniform time base.
+		//	Float3 keys are quantized to 16 bits per component in the [compressed_min, compressed_min + compressed_range] range,
+		//	rotations are stored with the smallest three components in 15 bits each, and the index of the largest component in the top bits.
+		float time_start = 0;
+		float time_step = 0;
+		std::vector<uint16_t> keyframe_frames;
+		uint32_t compressed_components = 0; // 3: translation or scale, 4: rotation
+		XMFLOAT3 compressed_min = XMFLOAT3(0, 0, 0);
+		XMFLOAT3 compressed_range = XMFLOAT3(0, 0, 0);
+		std::vector<uint16_t> compressed_data;
+
+		inline bool IsCompressed() const { return _flags & COMPRESSED; }
+
+		size_t GetKeyCount() const;
+		float GetKeyTime(size_t key) const;
+		// Returns the first key whose time is greater or equal to time, cursor is the result of the previous search to speed up the next one
+		int FindKey(float time, int& cursor) const;
+		// Writes compressed_components floats into result
+		void DecodeKey(size_t key, float* result) const;
+
+		// Compresses the keyframes of a translation, scale (components = 3) or rotation (components = 4) track
+		//	step: the track is sampled with STEP mode, otherwise LINEAR
+		//	tolerance: the largest error of the compressed track at the original keys (key reduction and quantization together), in the units of the track
+		//	The track is left uncompressed if the quantization alone can't be within tolerance (for example a translation with a very large range)
+		//	Compressed keys don't have tangents, CUBICSPLINE samplers interpolate them linearly
+		void Compress(uint32_t components, bool step, float tolerance);
+		void Decompress();
+
 		void Serialize(wiArchive& archive, wiECS::EntitySerializer& seri);
 	};
 
@@ -1056,12 +1121,25 @@ namespace wiScene
 
 			// The data is now not part of the sampler, so it can be shared. This is kept only for backwards compatibility with previous versions.
 			AnimationDataComponent backwards_compatibility_data;
+
+			// Non-serialized attributes:
+			int cursor = 0; // the right keyframe that was found last time, to speed up the next search
 		};
 		std::vector<AnimationChannel> channels;
 		std::vector<AnimationSampler> samplers;
 
 		// Non-serialzied attributes:
 		std::vector<float> morph_weights_temp;
+		// When updated by Scene::BeginSimulation(), the morph weights are not written to the meshes, they are applied by the next Scene::Update():
+		struct DeferredMorphWeights
+		{
+			wiECS::Entity meshID = wiECS::INVALID_ENTITY;
+			float amount = 1;
+			uint32_t offset = 0; // into morph_weights_deferred
+			uint32_t count = 0;
+		};
+		std::vector<DeferredMorphWeights> morph_targets_deferred;
+		std::vector<float> morph_weights_deferred;
 
 		inline bool IsPlaying() const { return _flags & PLAYING; }
 		inline bool IsLooped() const { return _flags & LOOPED; }
@@ -1224,7 +1302,7 @@ namespace wiScene
 		wiECS::ComponentManager<LayerComponent> layers;
 		wiECS::ComponentManager<TransformComponent> transforms;
 		wiECS::ComponentManager<PreviousFrameTransformComponent> prev_transforms;
-		wiECS::ComponentManager<HierarchyComponent> hierarchy;
+		wiECS::ComponentManager<HierarchyComponent> hierarchy; // parents are before their children, unless it was modified directly, see IsHierarchySorted()
 		wiECS::ComponentManager<MaterialComponent> materials;
 		wiECS::ComponentManager<MeshComponent> meshes;
 		wiECS::ComponentManager<ImpostorComponent> impostors;
@@ -1250,18 +1328,165 @@ namespace wiScene
 		wiECS::ComponentManager<InverseKinematicsComponent> inverse_kinematics;
 		wiECS::ComponentManager<SpringComponent> springs;
 
+		Scene();
+
 		// Non-serialized attributes:
+		wiECS::EntitySignatures signatures; // which component managers contain an entity, kept updated by the managers
+		wiECS::ComponentManager_Interface* component_managers[wiECS::EntitySignatures::max_component_types] = {}; // indexed by signature bit
+		uint32_t component_manager_count = 0;
+
+		// Name lookup table of Entity_FindByName(), it is rebuilt on the first lookup after names were added or removed
+		//	It maps a name to the first index in names, the next index with the same name is in name_index_next (in increasing order)
+		//	Renames with NameComponent::SetName() update it in place
+		std::unordered_map<std::string, uint32_t> name_index;
+		std::vector<uint32_t> name_index_next;
+		uint64_t name_index_version = ~0ull;
+		wiSpinLock name_index_locker;
+		void UpdateNameIndex();
+		// Called by NameComponent::SetName() for the components of this scene:
+		void NameIndex_Rename(NameComponent& component, std::string&& value);
+
 		float dt = 0;
 		enum FLAGS
 		{
 			EMPTY = 0,
+			HEADLESS = 1 << 0,
 		};
 		uint32_t flags = EMPTY;
 
+		// Headless mode: Update() only runs the simulation (animation, hierarchy, physics, springs, IK, bounds...) without using the graphics device
+		//	GPU side arrays, textures and render data are not created, particles and sounds are not updated. For example for dedicated servers
+		inline void SetHeadless(bool value = true) { if (value) { flags |= HEADLESS; } else { flags &= ~HEADLESS; } }
+		inline bool IsHeadless() const { return flags & HEADLESS; }
+
 
 		wiSpinLock locker;
 		AABB bounds;
-		std::vector<AABB> parallel_bounds;
+		wiJobSystem::TaskGraph update_graph; // update systems with their dependencies, built on first Update()
+		wiECS::View<PreviousFrameTransformComponent, TransformComponent> view_prev_transforms{ prev_transforms, transforms };
+		wiECS::View<ArmatureComponent, TransformComponent> view_armatures{ armatures, transforms };
+
+		// Cached update order of the hierarchy system, nodes are grouped by their depth in the tree
+		//	Nodes of the same depth don't depend on each other, so one depth level can be updated in parallel
+		struct HierarchyUpdateNode
+		{
+			uint32_t transform_child;
+			uint32_t transform_parent;
+			uint32_t layer_child;
+			uint32_t layer_parent;
+		};
+		std::vector<HierarchyUpdateNode> hierarchy_update_nodes;
+		std::vector<uint32_t> hierarchy_update_levels; // depth level L is [levels[L], levels[L + 1]) in hierarchy_update_nodes
+		std::vector<wiECS::Entity> hierarchy_update_parents; // parentIDs at the time of building, to detect reattachment
+		uint64_t hierarchy_update_versions[3] = { ~0ull, ~0ull, ~0ull }; // hierarchy, transforms, layers
+		bool hierarchy_update_sorted = true; // false if there is a cycle in the hierarchy, then serial update is used
+		std::vector<wiECS::Entity> hierarchy_update_roots; // the topmost ancestor of every hierarchy component
+		uint64_t hierarchy_update_generation = 0; // incremented when the cached update order is rebuilt
+		uint64_t hierarchy_sorted_version = ~0ull; // hierarchy version when the ordering was last known to be intact
+		bool hierarchy_sorted = false; // false if an attach could have broken the ordering without changing the hierarchy version
+		std::unordered_map<wiECS::Entity, uint32_t> hierarchy_child_counts; // number of hierarchy nodes per parent entity
+		uint64_t hierarchy_child_counts_version = ~0ull; // hierarchy version that hierarchy_child_counts is valid for
+		// Attaches without keeping the hierarchy ordering, the bulk Component_Attach() sorts only once at the end:
+		void Component_Attach_Unordered(wiECS::Entity entity, wiECS::Entity parent, bool child_already_in_local_space);
+		// Restores the ordering after only this entity was attached, by moving it (and its descendants if needed) to just after its parent
+		//	added	: the hierarchy node was just created, so it can be after its existing children
+		//	Returns false if the parent is a descendant of the entity, a cycle can't be ordered
+		bool KeepHierarchyOrder(wiECS::Entity entity, bool added);
+		// Returns the topmost ancestor of the entity (or the entity itself if it has no parent), as of the last hierarchy update
+		wiECS::Entity GetHierarchyRoot(wiECS::Entity entity) const;
+
+		// Components that depend on each other are put into the same group, and the groups can be updated in parallel:
+		struct UpdateGroups
+		{
+			std::vector<uint32_t> offsets; // group i is [offsets[i], offsets[i + 1]) in items
+			std::vector<uint32_t> items; // component indices sorted by group, the original order is kept inside a group
+			uint64_t versions[2] = { ~0ull, ~0ull }; // component manager version, hierarchy_update_generation
+
+			inline uint32_t GetCount() const { return offsets.empty() ? 0 : uint32_t(offsets.size() - 1); }
+			// keys[i * key_count + j] are the entities that item i depends on (or INVALID_ENTITY), items with a common key are in the same group
+			//	single_group: everything is put into one group (keys are not used then), for example when dependencies can't be determined
+			void Build(const wiECS::Entity* keys, uint32_t count, uint32_t key_count, bool single_group = false) { Build(keys, nullptr, count, key_count, single_group); }
+			// Same as above, but the keys of item i are keys[key_offsets[i]] ... keys[key_offsets[i + 1] - 1], so items can have a different number of keys
+			//	If key_offsets is nullptr, every item has key_count keys
+			void Build(const wiECS::Entity* keys, const uint32_t* key_offsets, uint32_t count, uint32_t key_count = 0, bool single_group = false);
+
+			// Scratch memory of Build(), kept to avoid allocations when the groups are rebuilt every frame:
+			std::vector<uint32_t> parents; // union-find forest of item indices
+			std::vector<uint32_t> next;
+			wiECS::EntityLookup first_items; // key -> first item that depends on it
+			std::vector<wiECS::Entity> first_item_keys;
+		};
+		UpdateGroups spring_update_groups; // springs grouped by hierarchy root
+		UpdateGroups inverse_kinematics_update_groups; // IK grouped by the hierarchy roots of the chain and the target
+		UpdateGroups animation_update_groups; // animations grouped by the transforms and meshes that they write, rebuilt every frame
+		std::vector<wiECS::Entity> animation_group_keys; // written targets of every animation
+		std::vector<uint32_t> animation_group_key_offsets; // targets of animation i are [offsets[i], offsets[i + 1]) in animation_group_keys
+		float spring_time = 0;
+
+		// Transforms that changed in the current frame (they were dirty, or one of their ancestors changed), only these are recomputed by the hierarchy update
+		//	transforms_changed[i] is non-zero if transforms[i] changed, changed_transforms is the list of changed transform indices (see GatherChangedTransforms())
+		std::vector<uint8_t> transforms_changed;
+		std::vector<uint32_t> changed_transforms;
+		uint64_t transforms_changed_version = ~0ull; // if the transforms were reordered since the last frame, everything is treated as changed
+
+		// Results of the previous object update, to skip work for objects that didn't change:
+		struct ObjectUpdateCache
+		{
+			wiECS::Entity meshID = wiECS::INVALID_ENTITY;
+			AABB mesh_aabb;
+			uint32_t unchanged_frames = 0; // consecutive frames in which the object's transform and mesh bounds didn't change
+		};
+		std::vector<ObjectUpdateCache> object_update_cache;
+		uint64_t object_update_cache_version = ~0ull;
+
+		// aabb_objects, aabb_lights, aabb_probes and aabb_decals in structure of arrays layout, for SIMD frustum culling in wiRenderer::UpdateVisibility()
+		//	They are written by the update systems together with the component managers, so they are only valid after Update()
+		AABBSoA aabb_objects_soa;
+		AABBSoA aabb_lights_soa;
+		AABBSoA aabb_probes_soa;
+		AABBSoA aabb_decals_soa;
+
+		// CPU BVH over aabb_objects for the scene queries (Pick, SceneIntersectSphere, SceneIntersectCapsule) and frustum culling, the primitives are the object indices
+		//	It is refitted every frame with the objects whose bounds changed, and rebuilt when objects were added or removed, or refitting made it too loose
+		wiBVH object_bvh;
+		uint64_t object_bvh_version = ~0ull; // aabb_objects version at the last build
+		std::vector<uint32_t> object_bvh_changed; // object indices with changed bounds in the current frame
+		float object_bvh_rebuild_threshold = 2.0f; // rebuild when refitting increased the cost of the tree by this factor since the last build
+		// The object BVH can be used if the objects didn't change since its last update:
+		inline bool IsObjectBVHUpToDate() const
+		{
+			return object_bvh_version == aabb_objects.GetVersion() && object_bvh.GetPrimitiveCount() == aabb_objects.GetCount();
+		}
+
+		// Meshes whose triangle BVH was needed by the scene queries, they are built by the next Update()
+		//	The queries can run on multiple threads, so requesting is locked, but reading the built BVHs is not
+		mutable std::vector<wiECS::Entity> mesh_bvh_requests;
+		mutable wiSpinLock mesh_bvh_request_locker;
+		void RequestMeshBVH(wiECS::Entity meshID, const MeshComponent& mesh) const;
+
+		// Pipelined update: the simulation systems of the next frame (animation, transforms, hierarchy, springs, IK) can run while the current frame is rendered
+		//	In the meantime the renderer reads the transforms from render_transforms, which is a copy of them from the end of the last Update()
+		//	The overlapped systems are limited to transform work, they don't write anything else that the renderer reads (AABBs, objects, meshes, cameras, lights are updated by Update())
+		//	The morph weights computed by the animation system are kept in the animations, and written to the meshes by the next Update()
+		std::vector<TransformComponent> render_transforms;
+		wiJobSystem::context simulation_ctx;
+		bool simulation_started = false; // BeginSimulation() was called, the next Update() doesn't run the simulation systems
+		bool simulation_running = false; // BeginSimulation() was called, WaitSimulation() wasn't yet
+		// Starts the simulation systems of the next frame asynchronously, after the transforms were copied to render_transforms:
+		//	Only the renderer can read the scene until WaitSimulation(), and it must read transforms with GetRenderTransform()
+		void BeginSimulation(float dt);
+		// Waits until the simulation started by BeginSimulation() is finished:
+		void WaitSimulation();
+		// The transform as it was at the end of the last Update(), these are safe to read while the simulation is running:
+		inline const TransformComponent* GetRenderTransform(wiECS::Entity entity) const
+		{
+			const size_t index = transforms.GetIndex(entity);
+			if (index >= transforms.GetCount())
+			{
+				return nullptr;
+			}
+			return simulation_running ? &render_transforms[index] : &transforms[index];
+		}
 		WeatherComponent weather;
 		wiGraphics::RaytracingAccelerationStructure TLAS;
 		wiGraphics::GPUBuffer TLAS_instancesUpload[wiGraphics::GraphicsDevice::GetBufferCount()];
@@ -1347,12 +1572,29 @@ namespace wiScene
 		// Merge an other scene into this.
 		//	The contents of the other scene will be lost (and moved to this)!
 		void Merge(Scene& other);
-
-		// Removes a specific entity from the scene (if it exists):
-		void Entity_Remove(wiECS::Entity entity);
+		// Compresses the keyframe data of the translation, rotation and scale animation tracks that are sampled with LINEAR or STEP mode
+		//	tolerance: the largest error of a compressed track, tracks that can't be compressed within it are left as is (units of the track, quaternion components for rotations)
+		void CompressAnimations(float tolerance = 0.0001f);
+
+		// Removes the components of a specific entity from the scene (if it exists)
+		//	destroy_entity: also release the entity handle with wiECS::DestroyEntity(), so its index can be recycled.
+		//		Only use this if nothing else (an other scene, or a user component manager) refers to the entity any more
+		void Entity_Remove(wiECS::Entity entity, bool destroy_entity = false);
+		// Retrieve the mask of the component managers that contain the entity, the bit of a manager is manager.GetSignatureMask()
+		inline wiECS::EntitySignatures::Mask Entity_GetComponentMask(wiECS::Entity entity) const { return signatures.Get(entity); }
+		// Check if the entity has all of the components in the mask, for example: 
+		//	scene.Entity_HasComponents(entity, scene.transforms.GetSignatureMask() | scene.objects.GetSignatureMask())
+		inline bool Entity_HasComponents(wiECS::Entity entity, wiECS::EntitySignatures::Mask mask) const { return signatures.HasAll(entity, mask); }
 		// Finds the first entity by the name (if it exists, otherwise returns INVALID_ENTITY):
+		//	The names are looked up in the name index, so names written directly to NameComponent::name instead of NameComponent::SetName() are not found
 		wiECS::Entity Entity_FindByName(const std::string& name);
+		// Finds the first entity for each of the names, results[i] will be the entity for names_to_find[i] (or INVALID_ENTITY):
+		void Entity_FindByName(const std::string* names_to_find, size_t count, wiECS::Entity* results);
+		// Finds all the entities with the name, they are appended to the results:
+		void Entity_FindAllByName(const std::string& name, std::vector<wiECS::Entity>& results);
 		// Duplicates all of an entity's components and creates a new entity with them (recursively keeps hierarchy):
+		//	Components are copied directly, entity references inside the duplicated hierarchy are redirected to the duplicates
+		//	Meshes in the hierarchy and meshes skinned by a duplicated armature are duplicated, other meshes are shared by the duplicated objects
 		wiECS::Entity Entity_Duplicate(wiECS::Entity entity);
 		// Serializes entity and all of its components to archive:
 		//	Returns either the new entity that was read, or the original entity that was written
@@ -1409,7 +1651,17 @@ namespace wiScene
 
 		// Attaches an entity to a parent:
 		//	child_already_in_local_space	:	child won't be transformed from world space to local space
+		//	Parents are kept before their children in the hierarchy. This is usually constant time, but attaching an entity that already has children,
+		//	or to a parent that is after it, moves the nodes between the entity and its parent
 		void Component_Attach(wiECS::Entity entity, wiECS::Entity parent, bool child_already_in_local_space = false);
+		// Attaches multiple entities to their parents, in the given order. The hierarchy ordering is fixed up only once at the end, in linear time
+		//	entities[i] is attached to parents[i]
+		void Component_Attach(const wiECS::Entity* entities, const wiECS::Entity* parents, size_t count, bool child_already_in_local_space = false);
+		// Reorders the hierarchy so that parents are always before their children, while keeping the ordering intact otherwise
+		//	Only needed if the hierarchy component manager was modified directly (for example by Remove()), this is also done by the hierarchy update system
+		void SortHierarchy();
+		// Returns true if parents are known to be before their children in the hierarchy, then SortHierarchy() has nothing to do
+		bool IsHierarchySorted() const { return hierarchy_sorted && hierarchy_sorted_version == hierarchy.GetVersion(); }
 		// Detaches the entity from its parent (if it is attached):
 		void Component_Detach(wiECS::Entity entity);
 		// Detaches all children from an entity (if there are any):
@@ -1423,11 +1675,17 @@ namespace wiScene
 		void RunHierarchyUpdateSystem(wiJobSystem::context& ctx);
 		void RunSpringUpdateSystem(wiJobSystem::context& ctx);
 		void RunInverseKinematicsUpdateSystem(wiJobSystem::context& ctx);
+		// Fills changed_transforms, after the last system that modifies world matrices (IK)
+		void GatherChangedTransforms(wiJobSystem::context& ctx);
 		void RunArmatureUpdateSystem(wiJobSystem::context& ctx);
 		void RunMeshUpdateSystem(wiJobSystem::context& ctx);
 		void RunMaterialUpdateSystem(wiJobSystem::context& ctx);
 		void RunImpostorUpdateSystem(wiJobSystem::context& ctx);
 		void RunObjectUpdateSystem(wiJobSystem::context& ctx);
+		// Keeps object_bvh up to date with aabb_objects, after the object update system
+		void RunObjectBVHUpdateSystem(wiJobSystem::context& ctx);
+		// Builds the requested mesh BVHs and refits the ones with changed vertex positions, after the mesh and physics update systems
+		void RunMeshBVHUpdateSystem(wiJobSystem::context& ctx);
 		void RunCameraUpdateSystem(wiJobSystem::context& ctx);
 		void RunDecalUpdateSystem(wiJobSystem::context& ctx);
 		void RunProbeUpdateSystem(wiJobSystem::context& ctx);
@@ -1498,6 +1756,14 @@ namespace wiScene
 	//	layerMask		:	filter based on layer
 	//	scene			:	the scene that will be traced against the ray
 	PickResult Pick(const RAY& ray, uint32_t renderTypeMask = RENDERTYPE_OPAQUE, uint32_t layerMask = ~0, const Scene& scene = GetScene());
+	// Finds the closest intersections of many rays at once, results[i] is what Pick(rays[i]) would return
+	//	The rays are sorted by their direction and origin, then traced in packets of 4 with SIMD, and the packets are distributed on the job system
+	//	The layers are filtered with the current LayerComponent of the objects, like in Pick()
+	//	This waits until all the rays are traced
+	void PickBatch(const RAY* rays, size_t count, PickResult* results, uint32_t renderTypeMask = RENDERTYPE_OPAQUE, uint32_t layerMask = ~0, const Scene& scene = GetScene());
+	// Occlusion test of many rays at once, occluded[i] is true if rays[i] hits anything closer than maxDistances[i] (or at any distance if maxDistances is nullptr)
+	//	Rays stop at their first hit, and the results are not computed, so this is faster than PickBatch()
+	void PickBatchOcclusion(const RAY* rays, size_t count, bool* occluded, const float* maxDistances = nullptr, uint32_t renderTypeMask = RENDERTYPE_OPAQUE, uint32_t layerMask = ~0, const Scene& scene = GetScene());
 
 	struct SceneIntersectSphereResult
 	{
@@ -303,6 +303,8 @@ Luna<Scene_BindLua>::FunctionType Scene_BindLua::methods[] = {
 	lunamethod(Scene_BindLua, Clear),
 	lunamethod(Scene_BindLua, Merge),
 	lunamethod(Scene_BindLua, Entity_FindByName),
+	lunamethod(Scene_BindLua, Entity_FindByNames),
+	lunamethod(Scene_BindLua, Entity_FindAllByName),
 	lunamethod(Scene_BindLua, Entity_Remove),
 	lunamethod(Scene_BindLua, Entity_Duplicate),
 	lunamethod(Scene_BindLua, Component_CreateName),
@@ -418,6 +420,68 @@ int Scene_BindLua::Entity_FindByName(lua_State* L)
 	}
 	return 0;
 }
+int Scene_BindLua::Entity_FindByNames(lua_State* L)
+{
+	int argc = wiLua::SGetArgCount(L);
+	if (argc > 0 && lua_istable(L, 1))
+	{
+		// All names are looked up with a single call into the scene:
+		const size_t count = (size_t)lua_rawlen(L, 1);
+		std::vector<std::string> names(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			lua_rawgeti(L, 1, lua_Integer(i + 1));
+			const char* str = lua_tostring(L, -1);
+			if (str != nullptr)
+			{
+				names[i] = str;
+			}
+			lua_pop(L, 1);
+		}
+
+		std::vector<Entity> entities(count);
+		scene->Entity_FindByName(names.data(), count, entities.data());
+
+		lua_createtable(L, (int)count, 0);
+		int newTable = lua_gettop(L);
+		for (size_t i = 0; i < count; ++i)
+		{
+			wiLua::SSetLongLong(L, entities[i]);
+			lua_rawseti(L, newTable, lua_Integer(i + 1));
+		}
+		return 1;
+	}
+	else
+	{
+		wiLua::SError(L, "Scene::Entity_FindByNames(table names) not enough arguments!");
+	}
+	return 0;
+}
+int Scene_BindLua::Entity_FindAllByName(lua_State* L)
+{
+	int argc = wiLua::SGetArgCount(L);
+	if (argc > 0)
+	{
+		std::string name = wiLua::SGetString(L, 1);
+
+		std::vector<Entity> entities;
+		scene->Entity_FindAllByName(name, entities);
+
+		lua_createtable(L, (int)entities.size(), 0);
+		int newTable = lua_gettop(L);
+		for (size_t i = 0; i < entities.size(); ++i)
+		{
+			wiLua::SSetLongLong(L, entities[i]);
+			lua_rawseti(L, newTable, lua_Integer(i + 1));
+		}
+		return 1;
+	}
+	else
+	{
+		wiLua::SError(L, "Scene::Entity_FindAllByName(string name) not enough arguments!");
+	}
+	return 0;
+}
 int Scene_BindLua::Entity_Remove(lua_State* L)
 {
 	int argc = wiLua::SGetArgCount(L);
@@ -1145,7 +1209,7 @@ int NameComponent_BindLua::SetName(lua_State* L)
 	if (argc > 0)
 	{
 		std::string name = wiLua::SGetString(L, 1);
-		*component = name;
+		component->SetName(name);
 	}
 	else
 	{
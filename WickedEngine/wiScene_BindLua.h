@@ -29,6 +29,8 @@ namespace wiScene_BindLua
 		int Merge(lua_State* L);
 
 		int Entity_FindByName(lua_State* L);
+		int Entity_FindByNames(lua_State* L);
+		int Entity_FindAllByName(lua_State* L);
 		int Entity_Remove(lua_State* L);
 		int Entity_Duplicate(lua_State* L);
 
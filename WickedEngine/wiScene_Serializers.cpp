@@ -405,8 +405,14 @@ namespace wiScene
 			    }
 			}
 
+			if (archive.GetVersion() >= 74)
+			{
+				bvh.Serialize(archive);
+			}
+
 			wiJobSystem::Execute(seri.ctx, [&](wiJobArgs args) {
 				CreateRenderData();
+				dirty_bvh = false; // the loaded bvh was built for these triangles, it doesn't need to wait for a refit
 			});
 		}
 		else
@@ -465,6 +471,11 @@ namespace wiScene
 			    }
 			}
 
+			if (archive.GetVersion() >= 74)
+			{
+				bvh.Serialize(archive);
+			}
+
 		}
 	}
 	void ImpostorComponent::Serialize(wiArchive& archive, EntitySerializer& seri)
@@ -929,12 +940,34 @@ namespace wiScene
 			archive >> _flags;
 			archive >> keyframe_times;
 			archive >> keyframe_data;
+
+			if (archive.GetVersion() >= 73 && IsCompressed())
+			{
+				archive >> time_start;
+				archive >> time_step;
+				archive >> keyframe_frames;
+				archive >> compressed_components;
+				archive >> compressed_min;
+				archive >> compressed_range;
+				archive >> compressed_data;
+			}
 		}
 		else
 		{
 			archive << _flags;
 			archive << keyframe_times;
 			archive << keyframe_data;
+
+			if (archive.GetVersion() >= 73 && IsCompressed())
+			{
+				archive << time_start;
+				archive << time_step;
+				archive << keyframe_frames;
+				archive << compressed_components;
+				archive << compressed_min;
+				archive << compressed_range;
+				archive << compressed_data;
+			}
 		}
 	}
 	void WeatherComponent::Serialize(wiArchive& archive, EntitySerializer& seri)